@@ -0,0 +1,58 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Delta Files
+//
+// a delta file is a sparse copy file in the sandbox which holds only the
+// blocks that were modified inside the sandbox.  the allocated ranges of
+// the sparse file form the extent map:  a block that is allocated holds
+// valid data, a block that is not allocated is read from the true file.
+// the header below is stored in an alternate data stream of the copy file.
+// it also identifies the true file, as the holes are only valid for as
+// long as the true file is the same, unmodified file
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_DELTA_FILE_H
+#define _MY_DELTA_FILE_H
+
+
+#define FILE_DELTA_STREAM_NAME      L":SbieDelta"
+#define FILE_DELTA_FLAG_FILE_NAME   L"DeltaFiles.dat"
+
+#define FILE_DELTA_MAGIC            0x544C4544  // 'DELT'
+#define FILE_DELTA_VERSION          2
+
+#define FILE_DELTA_MIN_BLOCK_SIZE   (64 * 1024)
+
+
+typedef struct _FILE_DELTA_HEADER {
+
+    ULONG magic;
+    ULONG version;
+    ULONG block_size;
+    ULONG true_path_len;        // in characters, without terminating NULL
+    ULONGLONG true_size;        // size of the true file at migration
+    ULONGLONG true_write_time;  // last write time of the true file, likewise
+    ULONGLONG true_file_id;     // file id of the true file, likewise
+    WCHAR true_path[1];         // NT path of the true file
+
+} FILE_DELTA_HEADER;
+
+
+#endif /* _MY_DELTA_FILE_H */
@@ -440,6 +440,515 @@ BOOLEAN NetFw_BlockTraffic(LIST* list, IP_ADDRESS* Ip, USHORT Port, int Protocol
 	return FALSE;
 }
 
+// Compiled rule index
+//
+// The rule list is compiled into elementary intervals over the port space
+// and the IPv6-mapped address space, each interval holds the rules which
+// match every value within it, along with the match level, sorted by the
+// rule's position in the list. A lookup is then two binary searches and a
+// merge of the candidate lists, the final choice among the candidates is
+// done with NetFw_IsBetterMatch in list order, so the result is exactly
+// the same as the one of NetFw_BlockTraffic.
+//
+// Every interval holds a copy of each rule overlapping it, so heavily
+// overlapping rules make the index grow with intervals times rules, above
+// NETFW_INDEX_MAX_ENTRIES no index is built and the rule list is scanned.
+
+#ifndef NETFW_INDEX_MAX_ENTRIES
+#define NETFW_INDEX_MAX_ENTRIES		0x40000		// 1 MB of interval entries
+#endif
+
+typedef struct _NETFW_INDEX_RULE
+{
+	UCHAR proc_match_level;
+	BOOLEAN action_block;
+	BOOLEAN has_ports;
+	BOOLEAN has_ips;
+	int protocol;
+} NETFW_INDEX_RULE;
+
+struct _NETFW_INDEX
+{
+	POOL* pool;
+	ULONG size;
+
+	ULONG rule_count;
+	NETFW_INDEX_RULE* rules;
+
+	ULONG global_count;
+	ULONG* global_rules;		// rules without ports and without IPs
+
+	ULONG port_count;			// number of elementary port intervals
+	ULONG* port_bounds;			// first port of each interval, ascending
+	ULONG* port_offsets;		// port_count + 1 offsets into port_entries
+	ULONG* port_entries;
+
+	ULONG ip_count;				// number of elementary IP intervals
+	IP_ADDRESS* ip_bounds;		// first address of each interval, ascending
+	ULONG* ip_offsets;			// ip_count + 1 offsets into ip_entries
+	ULONG* ip_entries;
+};
+
+#define NETFW_ENTRY(rule, level)	(((rule) << 3) | (level))
+#define NETFW_ENTRY_RULE(entry)		((entry) >> 3)
+#define NETFW_ENTRY_LEVEL(entry)	((entry) & 7)
+
+typedef struct _NETFW_PORT_RANGE
+{
+	ULONG Begin;
+	ULONG End;
+	ULONG Entry;
+} NETFW_PORT_RANGE;
+
+typedef struct _NETFW_IP_RANGE
+{
+	IP_ADDRESS Begin;
+	IP_ADDRESS End;
+	ULONG Entry;
+} NETFW_IP_RANGE;
+
+static void* NetFw_AllocMem(POOL* pool, ULONG size)
+{
+#ifdef KERNEL_MODE
+#pragma warning(suppress: 4996) // suppress deprecation warning
+	return ExAllocatePoolWithTag(NonPagedPool, size, tzuk);
+#else
+	return Pool_Alloc(pool, size);
+#endif
+}
+
+static void NetFw_FreeMem(void* ptr, ULONG size)
+{
+#ifdef KERNEL_MODE
+	ExFreePoolWithTag(ptr, tzuk);
+#else
+	Pool_Free(ptr, size);
+#endif
+}
+
+static BOOLEAN NetFw_IpNext(IP_ADDRESS* ip)
+{
+	for (int i = 15; i >= 0; i--) {
+		if (++ip->Data[i] != 0)
+			return TRUE;
+	}
+	return FALSE; // wrapped around
+}
+
+static void NetFw_IpPrev(IP_ADDRESS* ip)
+{
+	for (int i = 15; i >= 0; i--) {
+		if (ip->Data[i]-- != 0)
+			break;
+	}
+}
+
+static ULONG NetFw_GetPortRanges(rbtree_t* port_map, ULONG rule, NETFW_PORT_RANGE* out)
+{
+	//
+	// NetFw_MatchPort only considers the closest range starting at or below the tested port,
+	// hence the range which effectively applies ends at the latest right before the next range begins
+	//
+
+	ULONG count = 0;
+	for (NETFW_PORTS* node = (NETFW_PORTS*)rbtree_first(port_map); ((rbnode_t*)node) != RBTREE_NULL; ) {
+
+		NETFW_PORTS* next = (NETFW_PORTS*)rbtree_next((rbnode_t*)node);
+
+		ULONG begin = node->RangeBegin;
+		ULONG end = node->RangeEnd;
+		if (((rbnode_t*)next) != RBTREE_NULL && end >= next->RangeBegin)
+			end = next->RangeBegin - 1;
+
+		if (begin <= end) {
+			if (out) {
+				out[count].Begin = begin;
+				out[count].End = end;
+				out[count].Entry = NETFW_ENTRY(rule, node->RangeBegin == node->RangeEnd ? NETFW_MATCH_EXACT : NETFW_MATCH_RANGE);
+			}
+			count++;
+		}
+
+		node = next;
+	}
+	return count;
+}
+
+static ULONG NetFw_GetIpRanges(rbtree_t* ip_map, ULONG rule, NETFW_IP_RANGE* out)
+{
+	//
+	// see comment in NetFw_GetPortRanges
+	//
+
+	ULONG count = 0;
+	for (NETFW_IPS* node = (NETFW_IPS*)rbtree_first(ip_map); ((rbnode_t*)node) != RBTREE_NULL; ) {
+
+		NETFW_IPS* next = (NETFW_IPS*)rbtree_next((rbnode_t*)node);
+
+		IP_ADDRESS end = node->RangeEnd;
+		if (((rbnode_t*)next) != RBTREE_NULL && NetFw_IpCmp(&end, &next->RangeBegin) >= 0) {
+			end = next->RangeBegin;
+			NetFw_IpPrev(&end);
+		}
+
+		if (NetFw_IpCmp(&node->RangeBegin, &end) <= 0) {
+			if (out) {
+				out[count].Begin = node->RangeBegin;
+				out[count].End = end;
+				out[count].Entry = NETFW_ENTRY(rule, NetFw_IpCmp(&node->RangeBegin, &node->RangeEnd) == 0 ? NETFW_MATCH_EXACT : NETFW_MATCH_RANGE);
+			}
+			count++;
+		}
+
+		node = next;
+	}
+	return count;
+}
+
+static void NetFw_SortIps(IP_ADDRESS* ips, ULONG count)
+{
+	// heap sort, we can't rely on qsort being available in kernel mode
+
+	IP_ADDRESS tmp;
+	for (ULONG start = count / 2; count > 1; ) {
+
+		ULONG root;
+		if (start > 0)
+			root = --start;
+		else {
+			count--;
+			tmp = ips[0]; ips[0] = ips[count]; ips[count] = tmp;
+			root = 0;
+		}
+
+		for (ULONG child; (child = root * 2 + 1) < count; root = child) {
+			if (child + 1 < count && NetFw_IpCmp(&ips[child], &ips[child + 1]) < 0)
+				child++;
+			if (NetFw_IpCmp(&ips[root], &ips[child]) >= 0)
+				break;
+			tmp = ips[root]; ips[root] = ips[child]; ips[child] = tmp;
+		}
+	}
+}
+
+static ULONG NetFw_FindPort(NETFW_INDEX* index, ULONG port)
+{
+	// returns the interval containing the port or -1
+
+	ULONG lo = 0, hi = index->port_count;
+	while (lo < hi) {
+		ULONG mid = (lo + hi) / 2;
+		if (index->port_bounds[mid] <= port)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+static ULONG NetFw_FindIp(NETFW_INDEX* index, IP_ADDRESS* ip)
+{
+	// returns the interval containing the address or -1
+
+	ULONG lo = 0, hi = index->ip_count;
+	while (lo < hi) {
+		ULONG mid = (lo + hi) / 2;
+		if (NetFw_IpCmp(&index->ip_bounds[mid], ip) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+NETFW_INDEX* NetFw_BuildIndex(LIST* list, POOL* pool)
+{
+	NETFW_INDEX* index = NULL;
+	ULONG rule_count = List_Count(list);
+	ULONG global_count = 0;
+	ULONG port_range_count = 0, port_bound_count = 0, port_entry_count = 0;
+	ULONG ip_range_count = 0, ip_bound_count = 0, ip_entry_count = 0;
+	ULONG port_bitmap_size = (0x10000 / 8) + sizeof(ULONG);
+	UCHAR* port_bitmap = NULL;
+	NETFW_PORT_RANGE* port_ranges = NULL;
+	NETFW_IP_RANGE* ip_ranges = NULL;
+	IP_ADDRESS* ip_bounds = NULL;
+	ULONG* port_counts = NULL;
+	ULONG* ip_counts = NULL;
+	ULONG port_count = 0, ip_count = 0;
+	NETFW_RULE* rule;
+	ULONG i, j;
+
+	//
+	// collect the effective ranges of all rules
+	//
+
+	for (rule = List_Head(list); rule; rule = List_Next(rule)) {
+		port_range_count += NetFw_GetPortRanges(&rule->port_map, 0, NULL);
+		ip_range_count += NetFw_GetIpRanges(&rule->ip_map, 0, NULL);
+		if (rule->port_map.count == 0 && rule->ip_map.count == 0)
+			global_count++;
+	}
+
+	port_bitmap = NetFw_AllocMem(pool, port_bitmap_size);
+	if (port_range_count)
+		port_ranges = NetFw_AllocMem(pool, port_range_count * sizeof(NETFW_PORT_RANGE));
+	if (ip_range_count) {
+		ip_ranges = NetFw_AllocMem(pool, ip_range_count * sizeof(NETFW_IP_RANGE));
+		ip_bounds = NetFw_AllocMem(pool, ip_range_count * 2 * sizeof(IP_ADDRESS));
+	}
+	if (!port_bitmap || (port_range_count && !port_ranges) || (ip_range_count && (!ip_ranges || !ip_bounds)))
+		goto finish;
+
+	port_range_count = 0;
+	ip_range_count = 0;
+	for (rule = List_Head(list), i = 0; rule; rule = List_Next(rule), i++) {
+		port_range_count += NetFw_GetPortRanges(&rule->port_map, i, port_ranges + port_range_count);
+		ip_range_count += NetFw_GetIpRanges(&rule->ip_map, i, ip_ranges + ip_range_count);
+	}
+
+	//
+	// split the port space into elementary intervals,
+	// as there are only 64k ports we can use a bitmap for sorting
+	//
+
+	memzero(port_bitmap, port_bitmap_size);
+	for (i = 0; i < port_range_count; i++) {
+		port_bitmap[port_ranges[i].Begin / 8] |= 1 << (port_ranges[i].Begin % 8);
+		port_bitmap[(port_ranges[i].End + 1) / 8] |= 1 << ((port_ranges[i].End + 1) % 8);
+	}
+	for (i = 0; i < 0x10000; i++) {
+		if (port_bitmap[i / 8] & (1 << (i % 8)))
+			port_bound_count++;
+	}
+
+	//
+	// split the address space into elementary intervals
+	//
+
+	for (i = 0; i < ip_range_count; i++) {
+		ip_bounds[ip_bound_count++] = ip_ranges[i].Begin;
+		IP_ADDRESS next = ip_ranges[i].End;
+		if (NetFw_IpNext(&next))
+			ip_bounds[ip_bound_count++] = next;
+	}
+	NetFw_SortIps(ip_bounds, ip_bound_count);
+	for (i = 0, j = 0; i < ip_bound_count; i++) {
+		if (j == 0 || NetFw_IpCmp(&ip_bounds[j - 1], &ip_bounds[i]) != 0)
+			ip_bounds[j++] = ip_bounds[i];
+	}
+	ip_bound_count = j;
+
+	//
+	// allocate the index as one block
+	//
+
+	ULONG size = sizeof(NETFW_INDEX)
+		+ rule_count * sizeof(NETFW_INDEX_RULE)
+		+ global_count * sizeof(ULONG)
+		+ port_bound_count * sizeof(ULONG) + (port_bound_count + 1) * sizeof(ULONG)
+		+ ip_bound_count * sizeof(IP_ADDRESS) + (ip_bound_count + 1) * sizeof(ULONG);
+
+	index = NetFw_AllocMem(pool, size);
+	if (!index)
+		goto finish;
+	memzero(index, size);
+	index->pool = pool;
+	index->size = size;
+
+	UCHAR* ptr = (UCHAR*)(index + 1);
+	index->rules = (NETFW_INDEX_RULE*)ptr;			ptr += rule_count * sizeof(NETFW_INDEX_RULE);
+	index->ip_bounds = (IP_ADDRESS*)ptr;			ptr += ip_bound_count * sizeof(IP_ADDRESS);
+	index->global_rules = (ULONG*)ptr;				ptr += global_count * sizeof(ULONG);
+	index->port_bounds = (ULONG*)ptr;				ptr += port_bound_count * sizeof(ULONG);
+	index->port_offsets = (ULONG*)ptr;				ptr += (port_bound_count + 1) * sizeof(ULONG);
+	index->ip_offsets = (ULONG*)ptr;				ptr += (ip_bound_count + 1) * sizeof(ULONG);
+
+	for (rule = List_Head(list), i = 0; rule; rule = List_Next(rule), i++) {
+		index->rules[i].proc_match_level = (UCHAR)rule->proc_match_level;
+		index->rules[i].action_block = rule->action_block;
+		index->rules[i].has_ports = rule->port_map.count != 0;
+		index->rules[i].has_ips = rule->ip_map.count != 0;
+		index->rules[i].protocol = rule->protocol;
+		if (!index->rules[i].has_ports && !index->rules[i].has_ips)
+			index->global_rules[index->global_count++] = i;
+	}
+	index->rule_count = rule_count;
+
+	for (i = 0; i < 0x10000; i++) {
+		if (port_bitmap[i / 8] & (1 << (i % 8)))
+			index->port_bounds[index->port_count++] = i;
+	}
+
+	if (ip_bound_count)
+		memcpy(index->ip_bounds, ip_bounds, ip_bound_count * sizeof(IP_ADDRESS));
+	index->ip_count = ip_bound_count;
+
+	//
+	// count the rules falling into each interval, as the ranges were emitted
+	// in list order, filling them in sequentially keeps every interval sorted.
+	// give up if the entries would exceed the size limit
+	//
+
+	for (i = 0; i < port_range_count; i++) {
+		ULONG first = NetFw_FindPort(index, port_ranges[i].Begin);
+		ULONG last = NetFw_FindPort(index, port_ranges[i].End);
+		port_entry_count += last - first + 1;
+		if (port_entry_count > NETFW_INDEX_MAX_ENTRIES)
+			goto fail;
+		for (j = first; j <= last; j++)
+			index->port_offsets[j + 1]++;
+	}
+	for (i = 0; i < index->port_count; i++)
+		index->port_offsets[i + 1] += index->port_offsets[i];
+	port_entry_count = index->port_offsets[index->port_count];
+
+	for (i = 0; i < ip_range_count; i++) {
+		ULONG first = NetFw_FindIp(index, &ip_ranges[i].Begin);
+		ULONG last = NetFw_FindIp(index, &ip_ranges[i].End);
+		ip_entry_count += last - first + 1;
+		if (port_entry_count + ip_entry_count > NETFW_INDEX_MAX_ENTRIES)
+			goto fail;
+		for (j = first; j <= last; j++)
+			index->ip_offsets[j + 1]++;
+	}
+	for (i = 0; i < index->ip_count; i++)
+		index->ip_offsets[i + 1] += index->ip_offsets[i];
+	ip_entry_count = index->ip_offsets[index->ip_count];
+
+	port_count = index->port_count;
+	ip_count = index->ip_count;
+
+	if (port_entry_count) {
+		index->port_entries = NetFw_AllocMem(pool, port_entry_count * sizeof(ULONG));
+		port_counts = NetFw_AllocMem(pool, port_count * sizeof(ULONG));
+	}
+	if (ip_entry_count) {
+		index->ip_entries = NetFw_AllocMem(pool, ip_entry_count * sizeof(ULONG));
+		ip_counts = NetFw_AllocMem(pool, ip_count * sizeof(ULONG));
+	}
+	if ((port_entry_count && (!index->port_entries || !port_counts)) || (ip_entry_count && (!index->ip_entries || !ip_counts)))
+		goto fail;
+
+	if (port_entry_count) {
+		memzero(port_counts, port_count * sizeof(ULONG));
+		for (i = 0; i < port_range_count; i++) {
+			ULONG last = NetFw_FindPort(index, port_ranges[i].End);
+			for (j = NetFw_FindPort(index, port_ranges[i].Begin); j <= last; j++)
+				index->port_entries[index->port_offsets[j] + port_counts[j]++] = port_ranges[i].Entry;
+		}
+	}
+
+	if (ip_entry_count) {
+		memzero(ip_counts, ip_count * sizeof(ULONG));
+		for (i = 0; i < ip_range_count; i++) {
+			ULONG last = NetFw_FindIp(index, &ip_ranges[i].End);
+			for (j = NetFw_FindIp(index, &ip_ranges[i].Begin); j <= last; j++)
+				index->ip_entries[index->ip_offsets[j] + ip_counts[j]++] = ip_ranges[i].Entry;
+		}
+	}
+
+	goto finish;
+
+fail:
+	NetFw_FreeIndex(index);
+	index = NULL;
+
+finish:
+	if (port_counts)
+		NetFw_FreeMem(port_counts, port_count * sizeof(ULONG));
+	if (ip_counts)
+		NetFw_FreeMem(ip_counts, ip_count * sizeof(ULONG));
+	if (ip_bounds)
+		NetFw_FreeMem(ip_bounds, ip_range_count * 2 * sizeof(IP_ADDRESS));
+	if (ip_ranges)
+		NetFw_FreeMem(ip_ranges, ip_range_count * sizeof(NETFW_IP_RANGE));
+	if (port_ranges)
+		NetFw_FreeMem(port_ranges, port_range_count * sizeof(NETFW_PORT_RANGE));
+	if (port_bitmap)
+		NetFw_FreeMem(port_bitmap, port_bitmap_size);
+	return index;
+}
+
+void NetFw_FreeIndex(NETFW_INDEX* index)
+{
+	if (index->port_entries)
+		NetFw_FreeMem(index->port_entries, index->port_offsets[index->port_count] * sizeof(ULONG));
+	if (index->ip_entries)
+		NetFw_FreeMem(index->ip_entries, index->ip_offsets[index->ip_count] * sizeof(ULONG));
+	NetFw_FreeMem(index, index->size);
+}
+
+BOOLEAN NetFw_BlockTrafficIndex(NETFW_INDEX* index, IP_ADDRESS* Ip, USHORT Port, int Protocol)
+{
+	const ULONG *port_ptr = NULL, *port_end = NULL;
+	const ULONG *ip_ptr = NULL, *ip_end = NULL;
+	const ULONG *global_ptr = index->global_rules, *global_end = index->global_rules + index->global_count;
+	NETFW_INDEX_RULE* best_rule = NULL;
+	RULE_MATCH best_match = { 0 };
+
+	ULONG seg = NetFw_FindPort(index, Port);
+	if (seg != (ULONG)-1 && index->port_entries) {
+		port_ptr = index->port_entries + index->port_offsets[seg];
+		port_end = index->port_entries + index->port_offsets[seg + 1];
+	}
+
+	seg = NetFw_FindIp(index, Ip);
+	if (seg != (ULONG)-1 && index->ip_entries) {
+		ip_ptr = index->ip_entries + index->ip_offsets[seg];
+		ip_end = index->ip_entries + index->ip_offsets[seg + 1];
+	}
+
+	//
+	// merge the candidate lists in list order
+	//
+
+	while (1) 
+	{
+		ULONG port_rule = port_ptr < port_end ? NETFW_ENTRY_RULE(*port_ptr) : MAXULONG;
+		ULONG ip_rule = ip_ptr < ip_end ? NETFW_ENTRY_RULE(*ip_ptr) : MAXULONG;
+		ULONG global_rule = global_ptr < global_end ? *global_ptr : MAXULONG;
+
+		ULONG cur = port_rule < ip_rule ? port_rule : ip_rule;
+		if (global_rule < cur)
+			cur = global_rule;
+		if (cur == MAXULONG)
+			break;
+
+		RULE_MATCH match = { 0 };
+		match.ByPort = NETFW_MATCH_GLOBAL;
+		match.ByAddress = NETFW_MATCH_GLOBAL;
+		if (cur == port_rule)
+			match.ByPort = NETFW_ENTRY_LEVEL(*port_ptr++);
+		if (cur == ip_rule)
+			match.ByAddress = NETFW_ENTRY_LEVEL(*ip_ptr++);
+		if (cur == global_rule)
+			global_ptr++;
+
+		NETFW_INDEX_RULE* rule = &index->rules[cur];
+		if (rule->has_ports && match.ByPort == NETFW_MATCH_GLOBAL)
+			continue; // port not in any of the rule's ranges
+		if (rule->has_ips && match.ByAddress == NETFW_MATCH_GLOBAL)
+			continue; // address not in any of the rule's ranges
+		if (!(match.ByProtocol = NetFw_MatchProtocol(rule->protocol, Protocol)))
+			continue;
+
+		match.ByProg = rule->proc_match_level;
+		if (match.ByAddress > NETFW_MATCH_GLOBAL && match.ByPort > NETFW_MATCH_GLOBAL)
+			match.ByEndPoint = match.ByAddress > match.ByPort ? match.ByAddress : match.ByPort; // max
+		match.BlockAction = rule->action_block;
+
+		if (!best_rule || NetFw_IsBetterMatch(&match, &best_match)) {
+			best_rule = rule;
+			best_match = match;
+		}
+	}
+
+	if (best_rule && best_rule->action_block)
+		return TRUE;
+	return FALSE;
+}
+
 // text helpers
 
 const WCHAR* wcsnchr(const WCHAR* str, size_t max, WCHAR ch)
@@ -470,7 +979,9 @@ int _inet_xton(const WCHAR* src, ULONG src_len, IP_ADDRESS *dst, USHORT *type)
 int _wntoi(const WCHAR* str, ULONG max) 
 {
 	WCHAR tmp[12];
+	if (max > ARRAYSIZE(tmp) - 1) max = ARRAYSIZE(tmp) - 1;
 	wmemcpy(tmp, str, max);
+	tmp[max] = L'\0';
     return _wtoi(tmp);
 }
 
@@ -5,6 +5,7 @@
 #include "common/pool.h"
 
 typedef struct _NETFW_RULE NETFW_RULE;
+typedef struct _NETFW_INDEX NETFW_INDEX;
 
 
 typedef struct _IP_ADDRESS
@@ -27,6 +28,12 @@ BOOLEAN NetFw_ParseRule(NETFW_RULE* rule, const WCHAR* RuleStr);
 
 void NetFw_FreeRule(NETFW_RULE* rule);
 
+NETFW_INDEX* NetFw_BuildIndex(LIST* list, POOL* pool);
+
+void NetFw_FreeIndex(NETFW_INDEX* index);
+
+BOOLEAN NetFw_BlockTrafficIndex(NETFW_INDEX* index, IP_ADDRESS* Ip, USHORT Port, int Protocol);
+
 
 int _wntoi(const WCHAR* str, ULONG max);
 int _inet_pton(int af, const wchar_t* src, void* dst);
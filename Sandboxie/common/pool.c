@@ -90,6 +90,22 @@ static const ULONG Pool_Tag = 'loop';
 #endif
 
 
+// user mode pools can keep small blocks in per thread caches, this has
+// to be enabled for each pool with Pool_EnableThreadCache
+#ifndef POOL_THREAD_CACHE
+#if defined(KERNEL_MODE) || defined(POOL_USE_CUSTOM_LOCK)
+#define POOL_THREAD_CACHE 0
+#else
+#define POOL_THREAD_CACHE 1
+#endif
+#endif
+
+#define POOL_CACHE_CLASSES      8       // cached block sizes, 1 to 8 cells
+#define POOL_CACHE_SIZE         16      // blocks per size in a thread cache
+#define POOL_DEPOT_LIMIT        256     // blocks per size in the pool depot
+#define POOL_SLAB_CELLS         32      // cells taken at once to refill a cache
+
+
 //---------------------------------------------------------------------------
 // Defines
 //---------------------------------------------------------------------------
@@ -129,6 +145,8 @@ static const ULONG Pool_Tag = 'loop';
 
 typedef struct PAGE PAGE;
 typedef struct LARGE_CHUNK LARGE_CHUNK;
+typedef struct POOL_DEPOT POOL_DEPOT;
+typedef struct POOL_THREAD_CACHE_DATA POOL_THREAD_CACHE_DATA;
 
 
 #pragma pack(push)
@@ -169,6 +187,8 @@ struct POOL {
     LIST full_pages;                    // full pages that are not searched
     LIST large_chunks;
 
+    POOL_DEPOT *depot;                  // NULL unless thread cache enabled
+
     UCHAR initial_bitmap[PAGE_BITMAP_SIZE];
 };
 
@@ -187,6 +207,33 @@ struct LARGE_CHUNK {
 #pragma pack(pop)
 
 
+#if POOL_THREAD_CACHE
+
+
+// blocks of a thread cache or of the depot remain marked as allocated
+// in their page bitmap.  a thread puts freed blocks into its own cache,
+// no matter which thread allocated them, when the cache is full they go
+// to the depot, which is a lock free list shared by all threads, and
+// only when the depot is full as well the page bitmap is updated
+
+struct POOL_DEPOT {
+
+    SLIST_HEADER free_list[POOL_CACHE_CLASSES];
+    volatile LONG free_count[POOL_CACHE_CLASSES];
+    ULONG tls_index;
+};
+
+
+struct POOL_THREAD_CACHE_DATA {
+
+    ULONG count[POOL_CACHE_CLASSES];
+    void *blocks[POOL_CACHE_CLASSES][POOL_CACHE_SIZE];
+};
+
+
+#endif
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -205,6 +252,11 @@ static void Pool_Free_Cells(void *ptr, ULONG size);
 static void *Pool_Get_Large_Chunk(POOL *pool, ULONG size);
 static void Pool_Free_Large_Chunk(void *ptr, ULONG size);
 
+#if POOL_THREAD_CACHE
+static void *Pool_Get_Cached_Cells(POOL *pool, ULONG size);
+static BOOLEAN Pool_Free_Cached_Cells(void *ptr, ULONG size);
+#endif
+
 
 //---------------------------------------------------------------------------
 // ABEND
@@ -239,59 +291,219 @@ enum {
 #if POOL_TIMING
 
 
-static __int64 Pool_Alloc_Time = 0;
-static __int64 Pool_Alloc_Mem_Time = 0;
-static __int64 Pool_Alloc_Page_Time = 0;
-static __int64 Pool_Find_Cells_Time = 0;
-static __int64 Pool_Get_Cells_Time = 0;
-static __int64 Pool_Get_Cells_1_Time = 0;
-static __int64 Pool_Get_Cells_2_Time = 0;
+// the nested timers are kept per thread in user mode, in kernel mode
+// the accumulated times are only meaningful for a single thread
 
-static __int64 Pool_Free_Time = 0;
-static __int64 Pool_Free_Mem_Time = 0;
-static __int64 Pool_Free_Cells_Time = 0;
+#ifdef KERNEL_MODE
+#define POOL_TIMING_THREAD
+#else
+#define POOL_TIMING_THREAD      __declspec(thread)
+#endif
+
+
+// latencies of single Pool_Alloc and Pool_Free calls are counted in
+// buckets, four for each power of two of performance counter ticks
+
+#define POOL_HISTOGRAM_SUB      4
+#define POOL_HISTOGRAM_SIZE     (64 * POOL_HISTOGRAM_SUB)
+
+
+typedef struct POOL_HISTOGRAM {
+
+    volatile LONG count[POOL_HISTOGRAM_SIZE];
+    volatile LONG total;
+    volatile LONG max;
+
+} POOL_HISTOGRAM;
+
+
+static volatile __int64 Pool_Alloc_Time = 0;
+static volatile __int64 Pool_Alloc_Mem_Time = 0;
+static volatile __int64 Pool_Alloc_Page_Time = 0;
+static volatile __int64 Pool_Find_Cells_Time = 0;
+static volatile __int64 Pool_Get_Cells_Time = 0;
+static volatile __int64 Pool_Get_Cells_1_Time = 0;
+static volatile __int64 Pool_Get_Cells_2_Time = 0;
+
+static volatile __int64 Pool_Free_Time = 0;
+static volatile __int64 Pool_Free_Mem_Time = 0;
+static volatile __int64 Pool_Free_Cells_Time = 0;
 
+static volatile LONG Pool_Cache_Hits = 0;
+static volatile LONG Pool_Depot_Hits = 0;
+static volatile LONG Pool_Cache_Misses = 0;
+static volatile LONG Pool_Slab_Refills = 0;
 
-ALIGNED void Pool_Timing(__int64 *timer)
+static POOL_HISTOGRAM Pool_Alloc_Histogram;
+static POOL_HISTOGRAM Pool_Free_Histogram;
+
+static __int64 Pool_Timing_Frequency = 0;
+
+
+ALIGNED __int64 Pool_Timing_Now(void)
 {
-    static __int64 TimerQueue[16];
-    static int TimerLevel = 0;
-    FILETIME ftNow;
     LARGE_INTEGER liNow;
-    __int64 now;
+#ifdef KERNEL_MODE
+    LARGE_INTEGER liFrequency;
+    liNow = KeQueryPerformanceCounter(&liFrequency);
+    Pool_Timing_Frequency = liFrequency.QuadPart;
+#else
+    QueryPerformanceCounter(&liNow);
+#endif
+    return liNow.QuadPart;
+}
+
 
-    GetSystemTimeAsFileTime(&ftNow);
-    liNow.LowPart = ftNow.dwLowDateTime;
-    liNow.HighPart = ftNow.dwHighDateTime;
-    now = liNow.QuadPart;
+ALIGNED void Pool_Timing(volatile __int64 *timer)
+{
+    static POOL_TIMING_THREAD __int64 TimerQueue[16];
+    static POOL_TIMING_THREAD int TimerLevel = 0;
+    __int64 now = Pool_Timing_Now();
 
     if (! timer) {
         TimerQueue[TimerLevel] = now;
         ++TimerLevel;
     } else {
         --TimerLevel;
-        (*timer) += now - TimerQueue[TimerLevel];
+        InterlockedExchangeAdd64(timer, now - TimerQueue[TimerLevel]);
     }
 }
 
 
+ALIGNED void Pool_Record_Latency(POOL_HISTOGRAM *histogram, __int64 start)
+{
+    __int64 ticks = Pool_Timing_Now() - start;
+    ULONG index, bit;
+    LONG max;
+
+    if (ticks < 0)
+        ticks = 0;
+    if (ticks > 0x7FFFFFFF)
+        ticks = 0x7FFFFFFF;
+
+    if (ticks < POOL_HISTOGRAM_SUB)
+        index = (ULONG)ticks;
+    else {
+        for (bit = 2; (ticks >> (bit + 1)) != 0; ++bit)
+            ;
+        index = (bit - 1) * POOL_HISTOGRAM_SUB
+              + (ULONG)((ticks >> (bit - 2)) & (POOL_HISTOGRAM_SUB - 1));
+    }
+
+    InterlockedIncrement(&histogram->count[index]);
+    InterlockedIncrement(&histogram->total);
+
+    max = histogram->max;
+    while ((LONG)ticks > max) {
+        LONG old = InterlockedCompareExchange(&histogram->max, (LONG)ticks, max);
+        if (old == max)
+            break;
+        max = old;
+    }
+}
+
+
+ALIGNED double Pool_Ticks_To_Ns(__int64 ticks)
+{
+    return Pool_Timing_Frequency
+        ? (double)ticks * 1000000000.0 / Pool_Timing_Frequency : 0.0;
+}
+
+
+ALIGNED double Pool_Percentile(POOL_HISTOGRAM *histogram, ULONG permille)
+{
+    __int64 rank = ((__int64)histogram->total * permille + 999) / 1000;
+    __int64 seen = 0;
+    ULONG index;
+
+    // returns the upper end of the bucket holding the percentile
+
+    for (index = 0; index < POOL_HISTOGRAM_SIZE; ++index) {
+
+        seen += histogram->count[index];
+        if (seen >= rank && seen) {
+
+            __int64 upper;
+            if (index + 1 < POOL_HISTOGRAM_SUB)
+                upper = index + 1;
+            else {
+                ULONG next = index + 1;
+                ULONG bit = next / POOL_HISTOGRAM_SUB + 1;
+                upper = (__int64)(POOL_HISTOGRAM_SUB + next % POOL_HISTOGRAM_SUB)
+                      << (bit - 2);
+            }
+            if (upper > histogram->max)
+                upper = histogram->max;
+            return Pool_Ticks_To_Ns(upper);
+        }
+    }
+
+    return Pool_Ticks_To_Ns(histogram->max);
+}
+
+
+ALIGNED void Pool_Print_Histogram(const char *name, POOL_HISTOGRAM *histogram)
+{
+    printf("%s: %d calls, p50 %.0f ns, p90 %.0f ns, p99 %.0f ns, "
+           "p99.9 %.0f ns, max %.0f ns\n",
+           name, histogram->total,
+           Pool_Percentile(histogram, 500), Pool_Percentile(histogram, 900),
+           Pool_Percentile(histogram, 990), Pool_Percentile(histogram, 999),
+           Pool_Ticks_To_Ns(histogram->max));
+}
+
+
 ALIGNED void Pool_Print_Timing(void)
 {
-    printf("Pool_Alloc_Time = %f\n", Pool_Alloc_Time / 1000.0);
-    printf("Pool_Alloc_Mem_Time = %f\n", Pool_Alloc_Mem_Time / 1000.0);
-    printf("Pool_Alloc_Page_Time = %f\n", Pool_Alloc_Page_Time / 1000.0);
-    printf("Pool_Find_Cells_Time = %f\n", Pool_Find_Cells_Time / 1000.0);
-    printf("Pool_Get_Cells_Time = %f\n", Pool_Get_Cells_Time / 1000.0);
-    printf("Pool_Get_Cells_1_Time = %f\n", Pool_Get_Cells_1_Time / 1000.0);
-    printf("Pool_Get_Cells_2_Time = %f\n", Pool_Get_Cells_2_Time / 1000.0);
+#ifndef KERNEL_MODE
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    Pool_Timing_Frequency = liFrequency.QuadPart;
+#endif
+
+    printf("Pool_Alloc_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Alloc_Time) / 1000000.0);
+    printf("Pool_Alloc_Mem_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Alloc_Mem_Time) / 1000000.0);
+    printf("Pool_Alloc_Page_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Alloc_Page_Time) / 1000000.0);
+    printf("Pool_Find_Cells_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Find_Cells_Time) / 1000000.0);
+    printf("Pool_Get_Cells_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Get_Cells_Time) / 1000000.0);
+    printf("Pool_Get_Cells_1_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Get_Cells_1_Time) / 1000000.0);
+    printf("Pool_Get_Cells_2_Time = %f ms\n", Pool_Ticks_To_Ns(Pool_Get_Cells_2_Time) / 1000000.0);
+    printf("Pool_Cache_Hits = %d\n", Pool_Cache_Hits);
+    printf("Pool_Depot_Hits = %d\n", Pool_Depot_Hits);
+    printf("Pool_Cache_Misses = %d\n", Pool_Cache_Misses);
+    printf("Pool_Slab_Refills = %d\n", Pool_Slab_Refills);
+
+    Pool_Print_Histogram("Pool_Alloc", &Pool_Alloc_Histogram);
+    Pool_Print_Histogram("Pool_Free", &Pool_Free_Histogram);
+
+    // start over for the next pool
+
+    Pool_Alloc_Time = Pool_Alloc_Mem_Time = Pool_Alloc_Page_Time = 0;
+    Pool_Find_Cells_Time = Pool_Get_Cells_Time = 0;
+    Pool_Get_Cells_1_Time = Pool_Get_Cells_2_Time = 0;
+    Pool_Cache_Hits = Pool_Depot_Hits = Pool_Cache_Misses = 0;
+    Pool_Slab_Refills = 0;
+    memzero((void *)&Pool_Alloc_Histogram, sizeof(POOL_HISTOGRAM));
+    memzero((void *)&Pool_Free_Histogram, sizeof(POOL_HISTOGRAM));
 }
 
 
+#define Pool_Count(counter) InterlockedIncrement(&counter)
+
+#define Pool_Latency_Start(start) __int64 start = Pool_Timing_Now()
+#define Pool_Latency_Record(histogram, start) \
+    Pool_Record_Latency(&histogram, start)
+
+
 #else POOL_TIMING
 
 
 #define Pool_Timing(timer)
 #define Pool_Print_Timing()
+#define Pool_Count(counter)
+
+#define Pool_Latency_Start(start)
+#define Pool_Latency_Record(histogram, start)
 
 
 #endif
@@ -570,6 +782,8 @@ ALIGNED POOL *Pool_CreateTagged(ULONG tag)
     List_Init(&pool->full_pages);
     List_Init(&pool->large_chunks);
 
+    pool->depot = NULL;
+
     // mark in the bitmap, the cells allocated to the pool structure
 
     i = 0;
@@ -626,6 +840,11 @@ ALIGNED ULONG Pool_Delete(POOL *pool)
         page = next_page;
     }
 
+#if POOL_THREAD_CACHE
+    if (pool->depot)
+        TlsFree(pool->depot->tls_index);
+#endif
+
 #ifdef POOL_USE_CUSTOM_LOCK
 #elif defined(KERNEL_MODE)
     ExDeleteResourceLite(pool->lock);
@@ -653,6 +872,8 @@ ALIGNED void *Pool_Alloc(POOL *pool, ULONG size)
     if (size >= LARGE_CHUNK_MAXIMUM)
         return NULL;
 
+    Pool_Latency_Start(start);
+
     void *ptr = NULL;
     if (size) {
 
@@ -663,6 +884,10 @@ ALIGNED void *Pool_Alloc(POOL *pool, ULONG size)
 
         if (size > LARGE_CHUNK_MINIMUM)
             ptr = Pool_Get_Large_Chunk(pool, size);
+#if POOL_THREAD_CACHE
+        else if (pool->depot && NUM_CELLS(size) <= POOL_CACHE_CLASSES)
+            ptr = Pool_Get_Cached_Cells(pool, NUM_CELLS(size));
+#endif
         else
             ptr = Pool_Get_Cells(pool, NUM_CELLS(size));
 
@@ -680,6 +905,8 @@ ALIGNED void *Pool_Alloc(POOL *pool, ULONG size)
 #endif
 #endif
 
+    Pool_Latency_Record(Pool_Alloc_Histogram, start);
+
     return ptr;
 }
 
@@ -691,6 +918,8 @@ ALIGNED void *Pool_Alloc(POOL *pool, ULONG size)
 
 ALIGNED void Pool_Free(void *ptr, ULONG size)
 {
+    Pool_Latency_Start(start);
+
     if (ptr && size) {
 
 #if POOL_DEBUG
@@ -705,6 +934,11 @@ ALIGNED void Pool_Free(void *ptr, ULONG size)
         // if the pointer is page-aligned, this must be a LARGE_CHUNK
         if (((ULONG_PTR)ptr & (POOL_PAGE_SIZE - 1)) == 0)
             Pool_Free_Large_Chunk(ptr, size);
+#if POOL_THREAD_CACHE
+        else if (NUM_CELLS(size) <= POOL_CACHE_CLASSES &&
+                    Pool_Free_Cached_Cells(ptr, NUM_CELLS(size)))
+            ;
+#endif
         else
             Pool_Free_Cells(ptr, NUM_CELLS(size));
 
@@ -716,6 +950,8 @@ ALIGNED void Pool_Free(void *ptr, ULONG size)
 
     } else
         ABEND(POOL_FREE_NULL_PTR_OR_ZERO_SIZE);
+
+    Pool_Latency_Record(Pool_Free_Histogram, start);
 }
 
 
@@ -884,6 +1120,7 @@ ALIGNED void *Pool_Get_Cells(POOL *pool, ULONG size)
 
         page = Pool_Alloc_Page(pool, pool->eyecatcher);
         if (! page) {
+            Pool_Timing(&Pool_Get_Cells_Time);
             POOL_UNLOCK(pages_lock);
             return NULL;
         }
@@ -1083,3 +1320,198 @@ ALIGNED void Pool_Free_Large_Chunk(void *ptr, ULONG size)
 
     Pool_Free_Mem(ptr, large_chunk->eyecatcher);
 }
+
+
+#if POOL_THREAD_CACHE
+
+
+//---------------------------------------------------------------------------
+// Pool_GetThreadCache
+//---------------------------------------------------------------------------
+
+
+ALIGNED POOL_THREAD_CACHE_DATA *Pool_GetThreadCache(POOL_DEPOT *depot)
+{
+    // TlsGetValue resets the last error, which callers of hooked
+    // functions may still need
+    ULONG LastError = GetLastError();
+    POOL_THREAD_CACHE_DATA *cache =
+        (POOL_THREAD_CACHE_DATA *)TlsGetValue(depot->tls_index);
+    SetLastError(LastError);
+    return cache;
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_EnableThreadCache
+//---------------------------------------------------------------------------
+
+
+ALIGNED BOOLEAN Pool_EnableThreadCache(POOL *pool)
+{
+    POOL_DEPOT *depot;
+    ULONG i;
+
+    if (pool->depot)
+        return TRUE;
+
+    depot = (POOL_DEPOT *)Pool_Get_Cells(pool, NUM_CELLS(sizeof(POOL_DEPOT)));
+    if (! depot)
+        return FALSE;
+
+    depot->tls_index = TlsAlloc();
+    if (depot->tls_index == TLS_OUT_OF_INDEXES) {
+        Pool_Free_Cells(depot, NUM_CELLS(sizeof(POOL_DEPOT)));
+        return FALSE;
+    }
+
+    for (i = 0; i < POOL_CACHE_CLASSES; ++i) {
+        InitializeSListHead(&depot->free_list[i]);
+        depot->free_count[i] = 0;
+    }
+
+    pool->depot = depot;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_FlushThreadCache
+//---------------------------------------------------------------------------
+
+
+ALIGNED void Pool_FlushThreadCache(POOL *pool)
+{
+    POOL_DEPOT *depot = pool->depot;
+    POOL_THREAD_CACHE_DATA *cache;
+    ULONG i, j;
+
+    if (! depot)
+        return;
+
+    cache = Pool_GetThreadCache(depot);
+    if (! cache)
+        return;
+
+    TlsSetValue(depot->tls_index, NULL);
+
+    for (i = 0; i < POOL_CACHE_CLASSES; ++i) {
+        for (j = 0; j < cache->count[i]; ++j)
+            Pool_Free_Cells(cache->blocks[i][j], i + 1);
+    }
+
+    Pool_Free_Cells(cache, NUM_CELLS(sizeof(POOL_THREAD_CACHE_DATA)));
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_Get_Cached_Cells
+//---------------------------------------------------------------------------
+
+
+ALIGNED void *Pool_Get_Cached_Cells(POOL *pool, ULONG size)
+{
+    POOL_DEPOT *depot = pool->depot;
+    POOL_THREAD_CACHE_DATA *cache;
+    ULONG index = size - 1;
+    void *ptr;
+
+    cache = Pool_GetThreadCache(depot);
+    if (cache && cache->count[index]) {
+
+        Pool_Count(Pool_Cache_Hits);
+        return cache->blocks[index][--cache->count[index]];
+    }
+
+    ptr = InterlockedPopEntrySList(&depot->free_list[index]);
+    if (ptr) {
+
+        Pool_Count(Pool_Depot_Hits);
+        InterlockedDecrement(&depot->free_count[index]);
+        return ptr;
+    }
+
+    Pool_Count(Pool_Cache_Misses);
+
+    // the cache of this thread is created on the first miss
+
+    if (! cache) {
+
+        cache = (POOL_THREAD_CACHE_DATA *)Pool_Get_Cells(
+                    pool, NUM_CELLS(sizeof(POOL_THREAD_CACHE_DATA)));
+        if (cache) {
+            memzero(cache, sizeof(POOL_THREAD_CACHE_DATA));
+            TlsSetValue(depot->tls_index, cache);
+        }
+    }
+
+    // refill the empty cache from a slab, a run of cells which is taken
+    // with a single pass of the pool lock and the bitmap search, and then
+    // split into blocks of this size.  each block is freed on its own,
+    // the bitmap does not know that they were allocated together
+
+    if (cache) {
+
+        ULONG count = POOL_SLAB_CELLS / size;
+        if (count > POOL_CACHE_SIZE / 2)
+            count = POOL_CACHE_SIZE / 2;
+
+        ptr = Pool_Get_Cells(pool, size * count);
+        if (ptr) {
+
+            Pool_Count(Pool_Slab_Refills);
+            while (--count)
+                cache->blocks[index][cache->count[index]++] =
+                    (UCHAR *)ptr + count * size * POOL_CELL_SIZE;
+            return ptr;
+        }
+    }
+
+    return Pool_Get_Cells(pool, size);
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_Free_Cached_Cells
+//---------------------------------------------------------------------------
+
+
+ALIGNED BOOLEAN Pool_Free_Cached_Cells(void *ptr, ULONG size)
+{
+    PAGE *page = (PAGE *)((ULONG_PTR)ptr & POOL_MASK_LEFT);
+    POOL *pool = page->pool;
+    POOL_DEPOT *depot = pool->depot;
+    POOL_THREAD_CACHE_DATA *cache;
+    ULONG index = size - 1;
+
+    if (! depot)
+        return FALSE;
+
+    if (page->eyecatcher != pool->eyecatcher)
+        ABEND(POOL_FREE_CELLS_EYECATCHER_MISMATCH);
+
+    cache = Pool_GetThreadCache(depot);
+    if (cache && cache->count[index] < POOL_CACHE_SIZE) {
+
+        cache->blocks[index][cache->count[index]++] = ptr;
+        return TRUE;
+    }
+
+    // cells are aligned to POOL_CELL_SIZE, which satisfies the alignment
+    // required for an SLIST_ENTRY.  the limit is not exact, as the count
+    // is not updated together with the list, but it only has to bound
+    // the memory held by the depot
+
+    if (depot->free_count[index] < POOL_DEPOT_LIMIT) {
+
+        InterlockedIncrement(&depot->free_count[index]);
+        InterlockedPushEntrySList(&depot->free_list[index], (PSLIST_ENTRY)ptr);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+#endif
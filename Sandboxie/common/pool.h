@@ -49,6 +49,11 @@ ULONG Pool_Delete(POOL *pool);
 void *Pool_Alloc(POOL *pool, ULONG size);
 void Pool_Free(void *ptr, ULONG size);
 
+#ifndef KERNEL_MODE
+BOOLEAN Pool_EnableThreadCache(POOL *pool);
+void Pool_FlushThreadCache(POOL *pool);
+#endif
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Snapshot Index
+//
+// when a snapshot is taken, the list of all files and folders it contains
+// is stored in the snapshot folder, as a sorted array of path hashes.
+// the contents of a snapshot folder never change while processes are
+// running in the box, so a path whose hash is not in the array is known
+// not to exist in that snapshot.  a hash that is found may be a collision
+// and the caller still has to check the file system.
+//
+// paths are relative to the snapshot folder, e.g. \drive\C\Windows,
+// only ASCII characters are case folded, so paths with any other
+// characters can't be looked up and must always be checked on disk
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_SNAPSHOT_INDEX_H
+#define _MY_SNAPSHOT_INDEX_H
+
+
+#define SNAPSHOT_INDEX_FILE_NAME    L"SnapshotIndex.dat"
+
+#define SNAPSHOT_INDEX_MAGIC        0x58444E49  // 'INDX'
+#define SNAPSHOT_INDEX_VERSION      1
+
+
+typedef struct _SNAPSHOT_INDEX_HEADER {
+
+    ULONG magic;
+    ULONG version;
+    ULONG count;
+    ULONG reserved;
+    // followed by count ULONGLONG hashes in ascending order
+
+} SNAPSHOT_INDEX_HEADER;
+
+
+//---------------------------------------------------------------------------
+// SnapshotIndex_Hash
+//---------------------------------------------------------------------------
+
+
+static __inline BOOLEAN SnapshotIndex_Hash(
+    const WCHAR *path, ULONG len, ULONGLONG *hash)
+{
+    ULONGLONG h = 0xCBF29CE484222325ULL; // FNV-1a
+    ULONG i;
+
+    //
+    // a trailing backslash does not change the path
+    //
+
+    while (len && path[len - 1] == L'\\')
+        --len;
+
+    for (i = 0; i < len; i++) {
+
+        WCHAR c = path[i];
+
+        //
+        // non ASCII names need full case folding, short names and
+        // stream names refer to paths under a different name
+        //
+
+        if (c >= 0x80 || c == L'~' || c == L':')
+            return FALSE;
+
+        if (c >= L'A' && c <= L'Z')
+            c += L'a' - L'A';
+
+        h ^= (UCHAR)c;
+        h *= 0x100000001B3ULL;
+    }
+
+    *hash = h;
+    return TRUE;
+}
+
+
+#endif /* _MY_SNAPSHOT_INDEX_H */
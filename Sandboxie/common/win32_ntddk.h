@@ -901,6 +901,29 @@ NtWriteFile(
     IN PULONG                       Key  OPTIONAL
 );
 
+__declspec(dllimport) NTSTATUS __stdcall
+NtLockFile(
+    IN HANDLE                       FileHandle,
+    IN HANDLE                       Event  OPTIONAL,
+    IN PIO_APC_ROUTINE              ApcRoutine  OPTIONAL,
+    IN PVOID                        ApcContext  OPTIONAL,
+    OUT PIO_STATUS_BLOCK            IoStatusBlock,
+    IN PLARGE_INTEGER               ByteOffset,
+    IN PLARGE_INTEGER               Length,
+    IN ULONG                        Key,
+    IN BOOLEAN                      FailImmediately,
+    IN BOOLEAN                      ExclusiveLock
+);
+
+__declspec(dllimport) NTSTATUS __stdcall
+NtUnlockFile(
+    IN HANDLE                       FileHandle,
+    OUT PIO_STATUS_BLOCK            IoStatusBlock,
+    IN PLARGE_INTEGER               ByteOffset,
+    IN PLARGE_INTEGER               Length,
+    IN ULONG                        Key
+);
+
 __declspec(dllimport) NTSTATUS __stdcall
 NtDeviceIoControlFile(
     IN HANDLE                       FileHandle,
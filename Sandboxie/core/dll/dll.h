@@ -53,6 +53,13 @@ extern __declspec(dllexport) int __CRTDECL Sbie_snprintf(char *_Buffer, size_t C
 #define NAME_BUFFER_COUNT       12
 #define NAME_BUFFER_DEPTH       16
 
+//
+// checked name buffers:  detect overruns, writes after
+// Dll_PopTlsNameBuffer and pushes which are never popped
+//
+
+//#define NAME_BUFFER_CHECKS
+
 
 #ifdef _WIN64
 #define Dll_IsWin64 1
@@ -158,7 +165,10 @@ typedef struct _MY_LDR_WORKER_QUEUE_STUFF {
 typedef struct _THREAD_DATA {
 
     //
-    // name buffers:  first index is for true name, second for copy name
+    // name buffers:  first index is for true name, second for copy name.
+    // the buffers point into a per thread arena.  the space of a popped
+    // depth stays valid until the next Dll_PushTlsNameBuffer, which
+    // rewinds the arena, see Dll_PopTlsNameBuffer in dllmem.c
     //
 
     WCHAR *name_buffer[NAME_BUFFER_COUNT][NAME_BUFFER_DEPTH];
@@ -166,6 +176,22 @@ typedef struct _THREAD_DATA {
     int name_buffer_count[NAME_BUFFER_DEPTH];
     int name_buffer_depth;
 
+    struct _NAME_BUFFER_CHUNK *name_chunks;     // first chunk of the arena
+    struct _NAME_BUFFER_CHUNK *name_chunk;      // chunk at the top, or NULL
+    ULONG name_chunk_used;                      // bytes used in name_chunk
+    struct _NAME_BUFFER_CHUNK *name_mark_chunk[NAME_BUFFER_DEPTH];
+    ULONG name_mark_used[NAME_BUFFER_DEPTH];
+    struct _NAME_BUFFER_CHUNK *name_popped_chunk;   // popped space, which
+    ULONG name_popped_used;                         // the next push rewinds
+    struct _NAME_BUFFER_CHUNK *name_popped_top;     // top when popped
+    ULONG name_popped_top_used;
+    BOOLEAN name_popped;
+    ULONG name_buffer_max_depth;                // high water marks
+    ULONG name_buffer_max_bytes;
+#ifdef NAME_BUFFER_CHECKS
+    void *name_push_site[NAME_BUFFER_DEPTH];
+#endif
+
     //
     // locks
     //
@@ -475,6 +501,8 @@ void Handle_SetupDuplicate(HANDLE OldFileHandle, HANDLE NewFileHandle);
 
 void File_DoAutoRecover(BOOLEAN force);
 
+void File_NameCache_Report(void);
+
 NTSTATUS File_CreateBoxedPath(const WCHAR *PathToCreate);
 
 HANDLE File_GetTrueHandle(HANDLE FileHandle, BOOLEAN *pIsOpenPath);
@@ -506,6 +534,11 @@ void File_GetSetDeviceMap(WCHAR *DeviceMap96);
 
 void File_NotifyRecover(HANDLE FileHandle, void* CloseParams);
 
+void File_MaterializeDelta(HANDLE FileHandle);
+
+void File_DuplicateDelta(
+    HANDLE OldFileHandle, HANDLE NewFileHandle, BOOLEAN CloseOld);
+
 //---------------------------------------------------------------------------
 // Functions (key)
 //---------------------------------------------------------------------------
@@ -205,6 +205,7 @@ _FX BOOL WINAPI DllMain(
         if (Dll_InitComplete && Dll_BoxName) {
 
             File_DoAutoRecover(TRUE);
+            File_NameCache_Report();
             Gui_ResetClipCursor();
         }
 
@@ -35,6 +35,34 @@
 #undef  DEBUG_MEMORY
 
 
+#define NAME_BUFFER_CHUNK_SIZE  16384   // arena grows in chunks of this size
+#define NAME_BUFFER_ALIGN       512     // name buffer sizes are rounded to this
+#define NAME_BUFFER_PAD         64      // extra bytes at the end of each buffer
+
+#define NAME_BUFFER_GUARD       0xCC    // fills the pad with NAME_BUFFER_CHECKS
+#define NAME_BUFFER_POISON      0xDD    // fills unused arena space, likewise
+
+
+#ifdef NAME_BUFFER_CHECKS
+#include <intrin.h>
+#endif // NAME_BUFFER_CHECKS
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _NAME_BUFFER_CHUNK {
+
+    struct _NAME_BUFFER_CHUNK *next;
+    ULONG size;                 // bytes in data
+    ULONG base;                 // bytes in the chunks before this one
+    UCHAR data[1];
+
+} NAME_BUFFER_CHUNK;
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -42,6 +70,24 @@
 
 static void *Dll_AllocFromPool(POOL *pool, ULONG size);
 
+static UCHAR *Dll_NameArena_Alloc(THREAD_DATA *data, ULONG size);
+
+static void Dll_NameArena_Grow(
+    THREAD_DATA *data, WCHAR **name_buffer, ULONG *name_buffer_len, ULONG size);
+
+static void Dll_NameArena_Rewind(
+    THREAD_DATA *data, NAME_BUFFER_CHUNK *chunk, ULONG used);
+
+#ifdef NAME_BUFFER_CHECKS
+
+static void Dll_NameBuffer_Report(const WCHAR *format, void *ptr);
+
+static BOOLEAN Dll_NameBuffer_CheckFill(const UCHAR *ptr, ULONG len, UCHAR fill);
+
+static void Dll_NameBuffer_CheckGuard(const WCHAR *buf, ULONG len);
+
+#endif // NAME_BUFFER_CHECKS
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -79,6 +125,15 @@ _FX BOOLEAN Dll_InitMem(void)
             return FALSE;
     }
 
+    //
+    // let each thread keep a few small blocks of the main pools, so that
+    // threads don't contend on the pool lock for every allocation.
+    // the code pool is rarely used and doesn't need this
+    //
+
+    Pool_EnableThreadCache(Dll_Pool);
+    Pool_EnableThreadCache(Dll_PoolTemp);
+
     if (! Dll_PoolCode) {
         Dll_PoolCode = Pool_CreateTagged(tzuk | 0xFF);
         if (! Dll_PoolCode)
@@ -283,29 +338,255 @@ _FX THREAD_DATA *Dll_GetTlsData(ULONG *pLastError)
 _FX void Dll_FreeTlsData(void)
 {
     THREAD_DATA *data;
-    ULONG depth, count;
 
     if (Dll_TlsIndex == TLS_OUT_OF_INDEXES)
         data = NULL;
     else
         data = TlsGetValue(Dll_TlsIndex);
-    if (! data)
-        return;
+    if (data) {
+
+        NAME_BUFFER_CHUNK *chunk;
+
+        TlsSetValue(Dll_TlsIndex, NULL);
 
-    TlsSetValue(Dll_TlsIndex, NULL);
+#ifdef NAME_BUFFER_CHECKS
+        {
+        int depth;
 
-    for (depth = 0; depth < NAME_BUFFER_DEPTH; ++depth) {
+        for (depth = data->name_buffer_depth; depth > 0; --depth)
+            Dll_NameBuffer_Report(L"leaked push from %p", data->name_push_site[depth]);
 
-        for (count = 0; count < NAME_BUFFER_COUNT; ++count) {
+        DbgTrace("Name buffers, max depth %d, max arena bytes %d\r\n",
+            data->name_buffer_max_depth, data->name_buffer_max_bytes);
+        }
+#endif // NAME_BUFFER_CHECKS
+
+        //
+        // the name buffers point into the arena chunks
+        //
 
-            WCHAR* buf = data->name_buffer[count][depth];
-            if (buf)
-                Dll_Free(buf);
-            data->name_buffer[count][depth] = NULL;
+        while (data->name_chunks) {
+            chunk = data->name_chunks;
+            data->name_chunks = chunk->next;
+            Dll_Free(chunk);
         }
+
+        Dll_Free(data);
+    }
+
+    //
+    // return the blocks cached by this thread to the pools
+    //
+
+    if (Dll_Pool)
+        Pool_FlushThreadCache(Dll_Pool);
+    if (Dll_PoolTemp)
+        Pool_FlushThreadCache(Dll_PoolTemp);
+}
+
+
+#ifdef NAME_BUFFER_CHECKS
+//---------------------------------------------------------------------------
+// Dll_NameBuffer_Report
+//---------------------------------------------------------------------------
+
+
+_FX void Dll_NameBuffer_Report(const WCHAR *format, void *ptr)
+{
+    WCHAR txt[96];
+
+    Sbie_snwprintf(txt, 96, format, ptr);
+    DbgTrace("Name buffer check: %S\r\n", txt);
+    SbieApi_Log(2310, L"%s", txt);
+}
+
+
+//---------------------------------------------------------------------------
+// Dll_NameBuffer_CheckFill
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Dll_NameBuffer_CheckFill(const UCHAR *ptr, ULONG len, UCHAR fill)
+{
+    ULONG i;
+
+    for (i = 0; i < len; ++i) {
+        if (ptr[i] != fill)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Dll_NameBuffer_CheckGuard
+//---------------------------------------------------------------------------
+
+
+_FX void Dll_NameBuffer_CheckGuard(const WCHAR *buf, ULONG len)
+{
+    //
+    // the last NAME_BUFFER_PAD bytes of each buffer are filled with
+    // NAME_BUFFER_GUARD when it is handed out, see Dll_GetTlsNameBuffer
+    //
+
+    if (buf && ! Dll_NameBuffer_CheckFill(
+            (UCHAR *)buf + len - NAME_BUFFER_PAD, NAME_BUFFER_PAD, NAME_BUFFER_GUARD))
+        Dll_NameBuffer_Report(L"overrun of buffer %p", (void *)buf);
+}
+#endif // NAME_BUFFER_CHECKS
+
+
+//---------------------------------------------------------------------------
+// Dll_NameArena_Alloc
+//---------------------------------------------------------------------------
+
+
+_FX UCHAR *Dll_NameArena_Alloc(THREAD_DATA *data, ULONG size)
+{
+    NAME_BUFFER_CHUNK *chunk, *next;
+    ULONG bytes;
+    UCHAR *ptr;
+
+    chunk = data->name_chunk;
+
+    if ((! chunk) || data->name_chunk_used + size > chunk->size) {
+
+        //
+        // move on to the next chunk.  chunks are kept when the arena is
+        // rewound, so a chunk which follows is normally reused, a new
+        // chunk is inserted only if there is none or it is too small
+        //
+
+        next = chunk ? chunk->next : data->name_chunks;
+
+        if ((! next) || next->size < size) {
+
+            ULONG chunk_size = NAME_BUFFER_CHUNK_SIZE;
+            if (chunk_size < size)
+                chunk_size = size;
+
+            next = Dll_Alloc(FIELD_OFFSET(NAME_BUFFER_CHUNK, data) + chunk_size);
+            next->size = chunk_size;
+            next->next = chunk ? chunk->next : data->name_chunks;
+            if (chunk)
+                chunk->next = next;
+            else
+                data->name_chunks = next;
+
+#ifdef NAME_BUFFER_CHECKS
+            memset(next->data, NAME_BUFFER_POISON, chunk_size);
+#endif // NAME_BUFFER_CHECKS
+        }
+
+        next->base = chunk ? chunk->base + chunk->size : 0;
+
+        data->name_chunk = chunk = next;
+        data->name_chunk_used = 0;
+    }
+
+    ptr = chunk->data + data->name_chunk_used;
+    data->name_chunk_used += size;
+
+    bytes = chunk->base + data->name_chunk_used;
+    if (bytes > data->name_buffer_max_bytes)
+        data->name_buffer_max_bytes = bytes;
+
+#ifdef NAME_BUFFER_CHECKS
+    if (! Dll_NameBuffer_CheckFill(ptr, size, NAME_BUFFER_POISON))
+        Dll_NameBuffer_Report(L"write after pop near %p", ptr);
+#endif // NAME_BUFFER_CHECKS
+
+    return ptr;
+}
+
+
+//---------------------------------------------------------------------------
+// Dll_NameArena_Rewind
+//---------------------------------------------------------------------------
+
+
+_FX void Dll_NameArena_Rewind(
+    THREAD_DATA *data, NAME_BUFFER_CHUNK *chunk, ULONG used)
+{
+#ifdef NAME_BUFFER_CHECKS
+    {
+    //
+    // poison the released part of the arena, so a name which is used
+    // after it was released shows up as garbage, and Dll_NameArena_Alloc
+    // can tell when something was written to it
+    //
+
+    NAME_BUFFER_CHUNK *cur = chunk;
+    ULONG from = used;
+
+    if (! cur) {
+        cur = data->name_chunks;
+        from = 0;
+    }
+
+    while (cur) {
+
+        ULONG end = (cur == data->name_chunk) ? data->name_chunk_used : cur->size;
+        memset(cur->data + from, NAME_BUFFER_POISON, end - from);
+
+        if (cur == data->name_chunk)
+            break;
+        cur = cur->next;
+        from = 0;
     }
+    }
+#endif // NAME_BUFFER_CHECKS
 
-    Dll_Free(data);
+    data->name_chunk      = chunk;
+    data->name_chunk_used = used;
+}
+
+
+//---------------------------------------------------------------------------
+// Dll_NameArena_Grow
+//---------------------------------------------------------------------------
+
+
+_FX void Dll_NameArena_Grow(
+    THREAD_DATA *data, WCHAR **name_buffer, ULONG *name_buffer_len, ULONG size)
+{
+    NAME_BUFFER_CHUNK *chunk = data->name_chunk;
+    UCHAR *old_buf = (UCHAR *)*name_buffer;
+    ULONG old_len = *name_buffer_len;
+    UCHAR *new_buf;
+
+    //
+    // a buffer which was the last one taken from the arena
+    // can be extended in place, if its chunk has enough room
+    //
+
+    if (old_buf && chunk && old_buf >= chunk->data
+            && old_buf + old_len == chunk->data + data->name_chunk_used
+            && (ULONG)(old_buf - chunk->data) + size <= chunk->size) {
+
+        Dll_NameArena_Alloc(data, size - old_len);
+
+        *name_buffer_len = size;
+        return;
+    }
+
+    //
+    // otherwise take a new buffer from the top of the arena and move the
+    // contents over to it.  the old space is only reclaimed when the
+    // arena is rewound, so grow by at least a factor of two
+    //
+
+    if (size < old_len * 2)
+        size = old_len * 2;
+
+    new_buf = Dll_NameArena_Alloc(data, size);
+
+    if (old_buf)
+        memcpy(new_buf, old_buf, old_len);
+
+    *name_buffer = (WCHAR *)new_buf;
+    *name_buffer_len = size;
 }
 
 
@@ -320,8 +601,6 @@ ALIGNED WCHAR *Dll_GetTlsNameBuffer_(THREAD_DATA *data, ULONG which, ULONG size,
 ALIGNED WCHAR *Dll_GetTlsNameBuffer(THREAD_DATA *data, ULONG which, ULONG size)
 #endif
 {
-    WCHAR *old_name_buffer;
-    ULONG old_name_buffer_len;
     WCHAR **name_buffer;
     ULONG *name_buffer_len;
 
@@ -349,43 +628,28 @@ ALIGNED WCHAR *Dll_GetTlsNameBuffer(THREAD_DATA *data, ULONG which, ULONG size)
 
     //
     // round up the requested size (+ extra padding of some bytes)
-    // to a multiple of PAGE_SIZE.
+    // to a multiple of NAME_BUFFER_ALIGN.
+    //
+    // the buffers of each depth are taken from a per thread arena,
+    // which is rewound after the depth is popped, so in the common
+    // case this neither allocates memory nor copies anything
     //
 
-    size = (size + 64 + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    size = (size + NAME_BUFFER_PAD + NAME_BUFFER_ALIGN - 1) & ~(NAME_BUFFER_ALIGN - 1);
     if (size > *name_buffer_len) {
 
-        //
-        // requested size is larger than current name buffer, so we
-        // allocate a larger buffer, and move the contents over to it
-        //
-
-        old_name_buffer     = *name_buffer;
-        old_name_buffer_len = *name_buffer_len;
+#ifdef NAME_BUFFER_CHECKS
+        Dll_NameBuffer_CheckGuard(*name_buffer, *name_buffer_len);
+#endif // NAME_BUFFER_CHECKS
 
-        *name_buffer_len = size;
-        *name_buffer = Dll_Alloc(*name_buffer_len);
+        Dll_NameArena_Grow(data, name_buffer, name_buffer_len, size);
 
-        if (old_name_buffer) {
-            memcpy(*name_buffer, old_name_buffer, old_name_buffer_len);
-            Dll_Free(old_name_buffer);
-        }
-    }
-
-    //
-    // debug checks:  the name buffer is allocated at least 64 bytes
-    // more than needed.  fill these with 0xCC, and check that later
-    //
-
-#ifdef DEBUG_MEMORY
-
-    {
-    UCHAR *debug_area = ((UCHAR *)(*name_buffer)) + *name_buffer_len - 64;
-    memset(debug_area, 0xCC, 64);
+#ifdef NAME_BUFFER_CHECKS
+        memset((UCHAR *)*name_buffer + *name_buffer_len - NAME_BUFFER_PAD,
+               NAME_BUFFER_GUARD, NAME_BUFFER_PAD);
+#endif // NAME_BUFFER_CHECKS
     }
 
-#endif // DEBUG_MEMORY
-
     return *name_buffer;
 }
 
@@ -412,6 +676,39 @@ ALIGNED void Dll_PushTlsNameBuffer(THREAD_DATA *data)
     if (data->name_buffer_depth >= NAME_BUFFER_DEPTH) {
         ExitProcess(-1);
     }
+
+    if ((ULONG)data->name_buffer_depth > data->name_buffer_max_depth)
+        data->name_buffer_max_depth = data->name_buffer_depth;
+
+    //
+    // the space released by the last pop is reclaimed now, unless the
+    // outer depth took more buffers from the arena in the meantime.
+    // then it is only reclaimed when the outer depth is popped
+    //
+
+    if (data->name_popped) {
+
+        if (data->name_chunk      == data->name_popped_top &&
+            data->name_chunk_used == data->name_popped_top_used) {
+
+            Dll_NameArena_Rewind(
+                data, data->name_popped_chunk, data->name_popped_used);
+        }
+
+        data->name_popped = FALSE;
+    }
+
+    //
+    // remember the top of the arena, the space above it belongs to this
+    // depth and is released by Dll_PopTlsNameBuffer
+    //
+
+    data->name_mark_chunk[data->name_buffer_depth] = data->name_chunk;
+    data->name_mark_used [data->name_buffer_depth] = data->name_chunk_used;
+
+#ifdef NAME_BUFFER_CHECKS
+    data->name_push_site[data->name_buffer_depth] = _ReturnAddress();
+#endif // NAME_BUFFER_CHECKS
 }
 
 
@@ -426,53 +723,45 @@ _FX void Dll_PopTlsNameBuffer_(THREAD_DATA *data, char* func)
 _FX void Dll_PopTlsNameBuffer(THREAD_DATA *data)
 #endif
 {
+    int depth = data->name_buffer_depth;
+    ULONG which;
+
 #ifdef NAME_BUFFER_DEBUG
     DbgTrace("Dll_PopTlsNameBuffer, %s, %d\r\n", func, data->name_buffer_depth-1);
 #endif
 
-    //
-    // debug checks:  the name buffer is allocated at least 64 bytes
-    // more than needed.  fill these with 0xCC, and check that later
-    //
+    if (depth > 0) {
 
-#ifdef DEBUG_MEMORY
+        //
+        // the buffers of this depth are released.  callers rely on the
+        // contents of popped buffers to stay valid until the next push,
+        // so the arena is not rewound here but in Dll_PushTlsNameBuffer.
+        // buffers taken by the outer depth before that come from above
+        // the popped space and do not overlap it
+        //
 
-    {
+        for (which = 0; which < NAME_BUFFER_COUNT; ++which) {
 
-    WCHAR **name_buffer;
-    ULONG *name_buffer_len;
-    UCHAR *debug_area;
-    ULONG i;
-    ULONG which;
-    WCHAR txt[128];
-
-    which = TRUE_NAME_BUFFER;
-    name_buffer     = &data->name_buffer    [which][data->depth];
-    name_buffer_len = &data->name_buffer_len[which][data->depth];
-    debug_area      = ((UCHAR *)(*name_buffer)) + *name_buffer_len - 64;
-    for (i = 0; i < 64 && (*name_buffer); ++i)
-        if (debug_area[i] != 0xCC) {
-            Sbie_snwprintf(txt, 128, L"Buffer %d corrupted.  Buffer=%08X Length=%d Corrupt=%08X\n",
-                which, *name_buffer, *name_buffer_len, &debug_area[i]);
-            OutputDebugString(txt);
-            __debugbreak();
-        }
+#ifdef NAME_BUFFER_CHECKS
+            Dll_NameBuffer_CheckGuard(
+                data->name_buffer[which][depth], data->name_buffer_len[which][depth]);
+#endif // NAME_BUFFER_CHECKS
 
-    which = COPY_NAME_BUFFER;
-    name_buffer     = &data->name_buffer    [which][data->depth];
-    name_buffer_len = &data->name_buffer_len[which][data->depth];
-    debug_area      = ((UCHAR *)(*name_buffer)) + *name_buffer_len - 64;
-    for (i = 0; i < 64 && (*name_buffer); ++i)
-        if (debug_area[i] != 0xCC) {
-            Sbie_snwprintf(txt, 128, L"Buffer %d corrupted.  Buffer=%08X Length=%d Corrupt=%08X\n",
-                which, *name_buffer, *name_buffer_len, &debug_area[i]);
-            OutputDebugString(txt);
-            __debugbreak();
+            data->name_buffer    [which][depth] = NULL;
+            data->name_buffer_len[which][depth] = 0;
         }
 
-    }
+        //
+        // everything above the mark of this depth was taken at this depth
+        // or deeper, so it includes the space of any earlier pop
+        //
 
-#endif // DEBUG_MEMORY
+        data->name_popped_chunk    = data->name_mark_chunk[depth];
+        data->name_popped_used     = data->name_mark_used [depth];
+        data->name_popped_top      = data->name_chunk;
+        data->name_popped_top_used = data->name_chunk_used;
+        data->name_popped          = TRUE;
+    }
 
     --data->name_buffer_depth;
     if (data->name_buffer_depth < 0) {
@@ -91,32 +91,371 @@ typedef struct _WSA_LOOKUP {
     GUID* ServiceClassId;    // Request Class ID
     DWORD Namespace;         // Request Namespace
     BOOLEAN Filtered;        // Filter flag
+    GUID ServiceClassIdBuf;
+    // followed by the domain name
 } WSA_LOOKUP;
 
 static HASH_MAP   WSA_LookupMap;
 
 static BOOLEAN    WSA_DnsTraceFlag = FALSE;
 
+static CRITICAL_SECTION WSA_DnsFilter_CritSec;
+
+//
+// the filter patterns are compiled into a trie over the reversed domain labels,
+// exact names and *.domain wildcards are resolved in O(labels), any other pattern
+// is kept in WSA_FilterOther and evaluated with Pattern_MatchX
+//
+
+typedef struct _DNS_TRIE_NODE {
+    HASH_MAP children;       // label -> DNS_TRIE_NODE*
+    ULONG* exact;            // patterns matching this name
+    ULONG exact_count;
+    ULONG* wild;             // patterns matching any sub domain of this name
+    ULONG wild_count;
+} DNS_TRIE_NODE;
+
+#define DNS_MAX_LABEL       64
+#define DNS_MAX_CANDIDATES  64
+
+static PATTERN**      WSA_FilterArray = NULL;   // all patterns in list order
+static DNS_TRIE_NODE* WSA_FilterTrie = NULL;
+static ULONG*         WSA_FilterOther = NULL;
+static ULONG          WSA_FilterOtherCount = 0;
+
+//
+// filter decisions only depend on the name, we cache them
+// for a while to save the matching on repeated lookups
+//
+
+typedef struct _DNS_CACHE_ENTRY {
+    PATTERN* found;          // NULL when the name is not filtered
+    ULONG expire;
+} DNS_CACHE_ENTRY;
+
+#define DNS_CACHE_TTL       (5 * 60 * 1000)
+#define DNS_CACHE_MAX       1024
+
+static HASH_MAP   WSA_DnsCache;
+
 
 //---------------------------------------------------------------------------
 // WSA_GetLookup
 //---------------------------------------------------------------------------
 
 
-_FX WSA_LOOKUP* WSA_GetLookup(HANDLE h, BOOLEAN bCanAdd)
+_FX WSA_LOOKUP* WSA_GetLookup(HANDLE h)
 {
+    EnterCriticalSection(&WSA_DnsFilter_CritSec);
     WSA_LOOKUP* pLookup = (WSA_LOOKUP*)map_get(&WSA_LookupMap, h);
-    if (pLookup == NULL && bCanAdd) {
-        pLookup = (WSA_LOOKUP*)map_insert(&WSA_LookupMap, h, NULL, sizeof(WSA_LOOKUP));
-        if (pLookup) {
-            pLookup->pEntries = NULL;
-            pLookup->NoMore = FALSE;
-            pLookup->DomainName = NULL;
-            pLookup->ServiceClassId = NULL;
-            pLookup->Filtered = FALSE;
+    LeaveCriticalSection(&WSA_DnsFilter_CritSec);
+    return pLookup;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_FormatClsId
+//---------------------------------------------------------------------------
+
+
+_FX void WSA_FormatClsId(LPGUID lpServiceClassId, WCHAR* ClsId)
+{
+    ClsId[0] = L'\0';
+    if (lpServiceClassId) {
+        Sbie_snwprintf(ClsId, 64, L" (ClsId: %08lX-%04hX-%04hX-%02hhX%02hhX-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX)",
+            lpServiceClassId->Data1, lpServiceClassId->Data2, lpServiceClassId->Data3,
+            lpServiceClassId->Data4[0], lpServiceClassId->Data4[1], lpServiceClassId->Data4[2], lpServiceClassId->Data4[3],
+            lpServiceClassId->Data4[4], lpServiceClassId->Data4[5], lpServiceClassId->Data4[6], lpServiceClassId->Data4[7]);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_DnsTrieGetChild
+//---------------------------------------------------------------------------
+
+
+_FX DNS_TRIE_NODE* WSA_DnsTrieGetChild(DNS_TRIE_NODE* node, const WCHAR* label, ULONG label_len, BOOLEAN create)
+{
+    WCHAR key[DNS_MAX_LABEL + 1];
+    if (label_len > DNS_MAX_LABEL)
+        return NULL;
+    wmemcpy(key, label, label_len);
+    key[label_len] = L'\0';
+
+    DNS_TRIE_NODE* child = (DNS_TRIE_NODE*)map_get(&node->children, key);
+    if (!child && create) {
+
+        child = (DNS_TRIE_NODE*)Dll_Alloc(sizeof(DNS_TRIE_NODE));
+        memzero(child, sizeof(DNS_TRIE_NODE));
+        map_init(&child->children, Dll_Pool);
+        child->children.func_key_size = map_wcssize;
+
+        map_insert(&node->children, key, child, 0);
+    }
+    return child;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_DnsTrieAppend
+//---------------------------------------------------------------------------
+
+
+_FX void WSA_DnsTrieAppend(ULONG** array, ULONG* count, ULONG index)
+{
+    // this is only done once during initialization so we keep it simple
+
+    ULONG* new_array = (ULONG*)Dll_Alloc((*count + 1) * sizeof(ULONG));
+    if (*array) {
+        memcpy(new_array, *array, *count * sizeof(ULONG));
+        Dll_Free(*array);
+    }
+    new_array[(*count)++] = index;
+    *array = new_array;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_DnsTrieAdd
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN WSA_DnsTrieAdd(PATTERN* pat, ULONG index)
+{
+    const WCHAR* source = Pattern_Source(pat);
+    BOOLEAN wild = FALSE;
+
+    //
+    // only "name" and "*.name" patterns without any further wildcards go into the trie,
+    // for these Pattern_MatchX returns the name length, respectively name length + 1
+    //
+
+    if (source[0] == L'*' && source[1] == L'.') {
+        wild = TRUE;
+        source += 1; // keep the dot, *.name matches any name ending with .name
+    }
+
+    ULONG len = wcslen(source);
+    if (len == 0 || wcspbrk(source, L"*?") || wcsstr(source, L"__hex"))
+        return FALSE;
+
+    WCHAR* name = (WCHAR*)Dll_AllocTemp((len + 1) * sizeof(WCHAR));
+    wmemcpy(name, source, len + 1);
+    _wcslwr(name);
+
+    //
+    // walk the labels right to left, for *.name the leading dot yields
+    // a final empty label, hence we stop before it and mark the node as wild
+    //
+
+    DNS_TRIE_NODE* node = WSA_FilterTrie;
+    ULONG end = len;
+    ULONG stop = wild ? 1 : 0;
+    while (node) {
+        ULONG start = end;
+        while (start > stop && name[start - 1] != L'.')
+            start--;
+        node = WSA_DnsTrieGetChild(node, name + start, end - start, TRUE);
+        if (start == stop)
+            break;
+        end = start - 1;
+    }
+
+    Dll_Free(name);
+
+    if (!node)
+        return FALSE;
+
+    if (wild)
+        WSA_DnsTrieAppend(&node->wild, &node->wild_count, index);
+    else
+        WSA_DnsTrieAppend(&node->exact, &node->exact_count, index);
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_DnsTrieMatch
+//---------------------------------------------------------------------------
+
+
+_FX ULONG WSA_DnsTrieMatch(const WCHAR* name, ULONG len, ULONG* cand)
+{
+    //
+    // collects the patterns which match the name as (index << 1) | wild
+    // sorted by index, returns -1 if there are more than DNS_MAX_CANDIDATES
+    //
+
+    ULONG count = 0;
+    ULONG i, j;
+
+    DNS_TRIE_NODE* node = WSA_FilterTrie;
+    ULONG end = len;
+    while (1) {
+        ULONG start = end;
+        while (start > 0 && name[start - 1] != L'.')
+            start--;
+
+        node = WSA_DnsTrieGetChild(node, name + start, end - start, FALSE);
+        if (!node)
+            break;
+
+        ULONG* list = start > 0 ? node->wild : node->exact;
+        ULONG list_count = start > 0 ? node->wild_count : node->exact_count;
+        if (count + list_count > DNS_MAX_CANDIDATES)
+            return -1;
+        for (i = 0; i < list_count; i++)
+            cand[count++] = (list[i] << 1) | (start > 0 ? 1 : 0);
+
+        if (start == 0)
+            break;
+        end = start - 1;
+    }
+
+    for (i = 1; i < count; i++) {
+        ULONG tmp = cand[i];
+        for (j = i; j > 0 && cand[j - 1] > tmp; j--)
+            cand[j] = cand[j - 1];
+        cand[j] = tmp;
+    }
+
+    return count;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_MatchDnsFilter
+//---------------------------------------------------------------------------
+
+
+_FX int WSA_MatchDnsFilter(WCHAR* path_lwr, ULONG path_len, PATTERN** found)
+{
+    ULONG cand[DNS_MAX_CANDIDATES];
+    ULONG cand_count = WSA_DnsTrieMatch(path_lwr, path_len, cand);
+    if (cand_count == -1)
+        return Pattern_MatchPathList(path_lwr, path_len, &WSA_FilterList, NULL, NULL, NULL, found);
+
+    //
+    // this mirrors Pattern_MatchPathList, but only visits the patterns from the trie
+    // which are known to match, merged with the remaining patterns in list order,
+    // a trie pattern can't match the name with a backslash appended so we skip that step for them
+    //
+
+    int match_len = 0;
+    ULONG level = -1;
+    ULONG flags = 0;
+    ULONG i = 0, j = 0;
+
+    while (i < cand_count || j < WSA_FilterOtherCount) {
+
+        ULONG cand_index = i < cand_count ? (cand[i] >> 1) : -1;
+        ULONG other_index = j < WSA_FilterOtherCount ? WSA_FilterOther[j] : -1;
+        BOOLEAN from_trie = cand_index < other_index;
+        PATTERN* pat;
+        int cur_len;
+
+        if (from_trie) {
+            pat = WSA_FilterArray[cand_index];
+            cur_len = path_len + (cand[i] & 1);
+            i++;
+        }
+        else {
+            pat = WSA_FilterArray[other_index];
+            cur_len = -1;
+            j++;
+        }
+
+        ULONG cur_level = Pattern_Level(pat);
+        if (cur_level > level)
+            continue;
+
+        BOOLEAN cur_exact = Pattern_Exact(pat);
+        if (!cur_exact && (flags & MATCH_FLAG_EXACT))
+            continue;
+
+        if (cur_len == -1)
+            cur_len = Pattern_MatchX(pat, path_lwr, path_len);
+        if (cur_len > match_len) {
+            match_len = cur_len;
+            level = cur_level;
+            flags = cur_exact ? MATCH_FLAG_EXACT : 0;
+            *found = pat;
+            if (cur_exact)
+                break;
+        }
+        else if (!from_trie && path_lwr[path_len - 1] != L'\\') {
+            path_lwr[path_len] = L'\\';
+            cur_len = Pattern_MatchX(pat, path_lwr, path_len + 1);
+            path_lwr[path_len] = L'\0';
+            if (cur_len > match_len) {
+                match_len = cur_len;
+                level = cur_level;
+                flags = MATCH_FLAG_AUX | (cur_exact ? MATCH_FLAG_EXACT : 0);
+                *found = pat;
+            }
         }
     }
-    return pLookup;
+
+    return match_len;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_FindDnsFilter
+//---------------------------------------------------------------------------
+
+
+_FX PATTERN* WSA_FindDnsFilter(const WCHAR* name)
+{
+    WCHAR path_buf[256 + 4];
+    ULONG path_len = wcslen(name);
+    WCHAR* path_lwr = path_len < 256 ? path_buf : (WCHAR*)Dll_AllocTemp((path_len + 4) * sizeof(WCHAR));
+    wmemcpy(path_lwr, name, path_len);
+    path_lwr[path_len] = L'\0';
+    _wcslwr(path_lwr);
+
+    PATTERN* found = NULL;
+    ULONG now = GetTickCount();
+    BOOLEAN cached = FALSE;
+
+    EnterCriticalSection(&WSA_DnsFilter_CritSec);
+
+    DNS_CACHE_ENTRY* entry = (DNS_CACHE_ENTRY*)map_get(&WSA_DnsCache, path_lwr);
+    if (entry) {
+        if ((LONG)(entry->expire - now) > 0) {
+            found = entry->found;
+            cached = TRUE;
+        }
+        else
+            map_remove(&WSA_DnsCache, path_lwr);
+    }
+
+    LeaveCriticalSection(&WSA_DnsFilter_CritSec);
+
+    if (!cached && path_len > 0) {
+
+        if (WSA_MatchDnsFilter(path_lwr, path_len, &found) <= 0)
+            found = NULL;
+
+        DNS_CACHE_ENTRY new_entry;
+        new_entry.found = found;
+        new_entry.expire = now + DNS_CACHE_TTL;
+
+        EnterCriticalSection(&WSA_DnsFilter_CritSec);
+
+        if (WSA_DnsCache.nnodes >= DNS_CACHE_MAX)
+            map_clear(&WSA_DnsCache);
+        if (!map_get(&WSA_DnsCache, path_lwr))
+            map_insert(&WSA_DnsCache, path_lwr, &new_entry, sizeof(new_entry));
+
+        LeaveCriticalSection(&WSA_DnsFilter_CritSec);
+    }
+
+    if (path_lwr != path_buf)
+        Dll_Free(path_lwr);
+
+    return found;
 }
 
 //---------------------------------------------------------------------------
@@ -372,8 +711,32 @@ _FX BOOLEAN WSA_InitNetDnsFilter(HMODULE module)
 
         WSA_FilterEnabled = TRUE;
 
+        InitializeCriticalSectionAndSpinCount(&WSA_DnsFilter_CritSec, 1000);
+
         map_init(&WSA_LookupMap, Dll_Pool);
 
+        map_init(&WSA_DnsCache, Dll_Pool);
+        WSA_DnsCache.func_key_size = map_wcssize;
+
+        //
+        // compile the filter trie
+        //
+
+        WSA_FilterArray = (PATTERN**)Dll_Alloc(WSA_FilterList.count * sizeof(PATTERN*));
+        WSA_FilterOther = (ULONG*)Dll_Alloc(WSA_FilterList.count * sizeof(ULONG));
+
+        WSA_FilterTrie = (DNS_TRIE_NODE*)Dll_Alloc(sizeof(DNS_TRIE_NODE));
+        memzero(WSA_FilterTrie, sizeof(DNS_TRIE_NODE));
+        map_init(&WSA_FilterTrie->children, Dll_Pool);
+        WSA_FilterTrie->children.func_key_size = map_wcssize;
+
+        ULONG index = 0;
+        for (PATTERN* pat = (PATTERN*)List_Head(&WSA_FilterList); pat; pat = (PATTERN*)List_Next(pat), index++) {
+            WSA_FilterArray[index] = pat;
+            if (!WSA_DnsTrieAdd(pat, index))
+                WSA_FilterOther[WSA_FilterOtherCount++] = index;
+        }
+
         SCertInfo CertInfo = { 0 };
         if (!NT_SUCCESS(SbieApi_QueryDrvInfo(-1, &CertInfo, sizeof(CertInfo))) || !(CertInfo.active && CertInfo.opt_net)) {
 
@@ -423,56 +786,51 @@ _FX int WSA_WSALookupServiceBeginW(
     LPHANDLE        lphLookup)
 {
     if (WSA_FilterEnabled && lpqsRestrictions && lpqsRestrictions->lpszServiceInstanceName) {
-        ULONG path_len = wcslen(lpqsRestrictions->lpszServiceInstanceName);
-        WCHAR* path_lwr = (WCHAR*)Dll_AllocTemp((path_len + 4) * sizeof(WCHAR));
-        wmemcpy(path_lwr, lpqsRestrictions->lpszServiceInstanceName, path_len);
-        path_lwr[path_len] = L'\0';
-        _wcslwr(path_lwr);
-
-        PATTERN* found;
-        if (Pattern_MatchPathList(path_lwr, path_len, &WSA_FilterList, NULL, NULL, NULL, &found) > 0) {
-            HANDLE fakeHandle = (HANDLE)Dll_Alloc(sizeof(ULONG_PTR));
-            if (!fakeHandle) {
-                Dll_Free(path_lwr);
+
+        PATTERN* found = WSA_FindDnsFilter(lpqsRestrictions->lpszServiceInstanceName);
+        if (found) {
+
+            //
+            // the lookup object itself serves as the fake handle
+            //
+
+            ULONG name_len = wcslen(lpqsRestrictions->lpszServiceInstanceName);
+            WSA_LOOKUP* pLookup = (WSA_LOOKUP*)Dll_Alloc(sizeof(WSA_LOOKUP) + (name_len + 1) * sizeof(WCHAR));
+            if (!pLookup) {
                 SetLastError(ERROR_NOT_ENOUGH_MEMORY);
                 return SOCKET_ERROR;
             }
+            memzero(pLookup, sizeof(WSA_LOOKUP));
 
-            *lphLookup = fakeHandle;
+            pLookup->Filtered = TRUE;
 
-            WSA_LOOKUP* pLookup = WSA_GetLookup(fakeHandle, TRUE);
-            if (pLookup) {
-                pLookup->Filtered = TRUE;
+            pLookup->DomainName = (WCHAR*)(pLookup + 1);
+            wmemcpy(pLookup->DomainName, lpqsRestrictions->lpszServiceInstanceName, name_len + 1);
 
-                pLookup->DomainName = Dll_Alloc((path_len + 1) * sizeof(WCHAR));
-                if (pLookup->DomainName) {
-                    wcscpy(pLookup->DomainName, lpqsRestrictions->lpszServiceInstanceName);
-                }
+            pLookup->Namespace = lpqsRestrictions->dwNameSpace;
 
-                pLookup->Namespace = lpqsRestrictions->dwNameSpace;
+            if (lpqsRestrictions->lpServiceClassId) {
+                memcpy(&pLookup->ServiceClassIdBuf, lpqsRestrictions->lpServiceClassId, sizeof(GUID));
+                pLookup->ServiceClassId = &pLookup->ServiceClassIdBuf;
+            }
 
-                if (lpqsRestrictions->lpServiceClassId) {
-                    pLookup->ServiceClassId = Dll_Alloc(sizeof(GUID));
-                    if (pLookup->ServiceClassId) {
-                        memcpy(pLookup->ServiceClassId, lpqsRestrictions->lpServiceClassId, sizeof(GUID));
-                    }
-                }
+            PVOID* aux = Pattern_Aux(found);
+            if (*aux)
+                pLookup->pEntries = (LIST*)*aux;
+            else
+                pLookup->NoMore = TRUE;
 
-                PVOID* aux = Pattern_Aux(found);
-                if (*aux)
-                    pLookup->pEntries = (LIST*)*aux;
-                else
-                    pLookup->NoMore = TRUE;
-            }
+            HANDLE fakeHandle = (HANDLE)pLookup;
+
+            EnterCriticalSection(&WSA_DnsFilter_CritSec);
+            map_insert(&WSA_LookupMap, fakeHandle, pLookup, 0);
+            LeaveCriticalSection(&WSA_DnsFilter_CritSec);
+
+            *lphLookup = fakeHandle;
 
             if (WSA_DnsTraceFlag) {
-                WCHAR ClsId[64] = { 0 };
-                if (lpqsRestrictions->lpServiceClassId) {
-                    Sbie_snwprintf(ClsId, 64, L" (ClsId: %08lX-%04hX-%04hX-%02hhX%02hhX-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX)",
-                        lpqsRestrictions->lpServiceClassId->Data1, lpqsRestrictions->lpServiceClassId->Data2, lpqsRestrictions->lpServiceClassId->Data3,
-                        lpqsRestrictions->lpServiceClassId->Data4[0], lpqsRestrictions->lpServiceClassId->Data4[1], lpqsRestrictions->lpServiceClassId->Data4[2], lpqsRestrictions->lpServiceClassId->Data4[3],
-                        lpqsRestrictions->lpServiceClassId->Data4[4], lpqsRestrictions->lpServiceClassId->Data4[5], lpqsRestrictions->lpServiceClassId->Data4[6], lpqsRestrictions->lpServiceClassId->Data4[7]);
-                }
+                WCHAR ClsId[64];
+                WSA_FormatClsId(lpqsRestrictions->lpServiceClassId, ClsId);
 
                 WCHAR msg[512];
                 Sbie_snwprintf(msg, 512, L"DNS Request Intercepted: %s%s (NS: %d, Type: %s, Hdl: 0x%x) - Using filtered response",
@@ -481,23 +839,15 @@ _FX int WSA_WSALookupServiceBeginW(
                 SbieApi_MonitorPutMsg(MONITOR_DNS | MONITOR_DENY, msg);
             }
 
-            Dll_Free(path_lwr);
             return NO_ERROR;
         }
-
-        Dll_Free(path_lwr);
     }
 
     int ret = __sys_WSALookupServiceBeginW(lpqsRestrictions, dwControlFlags, lphLookup);
 
     if (WSA_DnsTraceFlag && lpqsRestrictions) {
-        WCHAR ClsId[64] = { 0 };
-        if (lpqsRestrictions->lpServiceClassId) {
-            Sbie_snwprintf(ClsId, 64, L" (ClsId: %08lX-%04hX-%04hX-%02hhX%02hhX-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX)",
-                lpqsRestrictions->lpServiceClassId->Data1, lpqsRestrictions->lpServiceClassId->Data2, lpqsRestrictions->lpServiceClassId->Data3,
-                lpqsRestrictions->lpServiceClassId->Data4[0], lpqsRestrictions->lpServiceClassId->Data4[1], lpqsRestrictions->lpServiceClassId->Data4[2], lpqsRestrictions->lpServiceClassId->Data4[3],
-                lpqsRestrictions->lpServiceClassId->Data4[4], lpqsRestrictions->lpServiceClassId->Data4[5], lpqsRestrictions->lpServiceClassId->Data4[6], lpqsRestrictions->lpServiceClassId->Data4[7]);
-        }
+        WCHAR ClsId[64];
+        WSA_FormatClsId(lpqsRestrictions->lpServiceClassId, ClsId);
 
         WCHAR msg[512];
         BOOLEAN isIPv6 = WSA_IsIPv6Query(lpqsRestrictions->lpServiceClassId);
@@ -526,7 +876,7 @@ _FX int WSA_WSALookupServiceNextW(
     WSA_LOOKUP* pLookup = NULL;
 
     if (WSA_FilterEnabled) {
-        pLookup = WSA_GetLookup(hLookup, FALSE);
+        pLookup = WSA_GetLookup(hLookup);
 
         if (pLookup && pLookup->Filtered) {
             if (pLookup->NoMore || !pLookup->pEntries) {
@@ -675,18 +1025,15 @@ _FX int WSA_WSALookupServiceNextW(
 _FX int WSA_WSALookupServiceEnd(HANDLE hLookup)
 {
     if (WSA_FilterEnabled) {
-        WSA_LOOKUP* pLookup = WSA_GetLookup(hLookup, FALSE);
+        WSA_LOOKUP* pLookup = WSA_GetLookup(hLookup);
 
         if (pLookup && pLookup->Filtered) {
-            if (pLookup->DomainName)
-                Dll_Free(pLookup->DomainName);
-
-            if (pLookup->ServiceClassId)
-                Dll_Free(pLookup->ServiceClassId);
 
+            EnterCriticalSection(&WSA_DnsFilter_CritSec);
             map_remove(&WSA_LookupMap, hLookup);
+            LeaveCriticalSection(&WSA_DnsFilter_CritSec);
 
-            Dll_Free(hLookup);
+            Dll_Free(pLookup);
 
             if (WSA_DnsTraceFlag) {
                 WCHAR msg[256];
@@ -697,7 +1044,11 @@ _FX int WSA_WSALookupServiceEnd(HANDLE hLookup)
             return NO_ERROR;
         }
 
-        map_remove(&WSA_LookupMap, hLookup);
+        if (pLookup) {
+            EnterCriticalSection(&WSA_DnsFilter_CritSec);
+            map_remove(&WSA_LookupMap, hLookup);
+            LeaveCriticalSection(&WSA_DnsFilter_CritSec);
+        }
     }
 
     if (WSA_DnsTraceFlag) {
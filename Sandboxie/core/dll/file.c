@@ -243,10 +243,58 @@ static NTSTATUS File_MigrateFile(
     const WCHAR *TruePath, const WCHAR *CopyPath,
     BOOLEAN IsWritePath, BOOLEAN WithContents);
 
+static BOOLEAN File_InitDelta(void);
+
+static NTSTATUS File_Delta_Create(
+    HANDLE CopyHandle, HANDLE TrueHandle,
+    const WCHAR *TruePath, const WCHAR *CopyPath, ULONGLONG file_size);
+
+static NTSTATUS File_Delta_CheckOpen(
+    const WCHAR *CopyPath, ACCESS_MASK DesiredAccess,
+    ULONG CreateDisposition, ULONG CreateOptions);
+
+static NTSTATUS File_Delta_Attach(
+    HANDLE FileHandle, const WCHAR *CopyPath, ACCESS_MASK DesiredAccess,
+    ULONG CreateDisposition, ULONG CreateOptions);
+
+static void File_Delta_SetEndOfFile(HANDLE FileHandle, ULONGLONG NewSize);
+
+static BOOLEAN File_Delta_ReadFile(
+    HANDLE FileHandle, HANDLE Event, PIO_APC_ROUTINE ApcRoutine,
+    PVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock, PVOID Buffer,
+    ULONG Length, PLARGE_INTEGER ByteOffset, PULONG Key, NTSTATUS *pStatus);
+
+static NTSTATUS File_Delta_WriteFile(
+    HANDLE FileHandle, PLARGE_INTEGER ByteOffset, ULONG Length);
+
+static void File_Delta_FsControl(
+    HANDLE FileHandle, ULONG IoControlCode,
+    void *InputBuffer, ULONG InputBufferLength);
+
 static NTSTATUS File_MigrateJunction(
     const WCHAR *TruePath, const WCHAR *CopyPath,
     BOOLEAN IsWritePath);
 
+static void File_InitNameCache(void);
+
+static void File_FlushNameCache(void);
+
+static WCHAR *File_NameCache_GetLink(
+    THREAD_DATA *TlsData, const WCHAR *objname_buf, ULONG objname_len);
+
+static void File_NameCache_AddLink(
+    const WCHAR *link, ULONG link_len, const WCHAR *name, ULONG suffix_len);
+
+static BOOLEAN File_NameCache_GetShortName(
+    const WCHAR *Path, ULONG index, PFILE_BOTH_DIRECTORY_INFORMATION info,
+    const ULONG info_size, ULONG *generation);
+
+static void File_NameCache_AddShortName(
+    const WCHAR *Path, ULONG index, PFILE_BOTH_DIRECTORY_INFORMATION info,
+    ULONG generation);
+
+static void File_NameCache_InvalidateShortNames(void);
+
 static NTSTATUS File_CopyShortName(
     const WCHAR *TruePath, const WCHAR *CopyPath);
 
@@ -451,6 +499,8 @@ static ULONG File_AltBoxPathLen = 0;
 #include "file_recovery.c"
 #include "file_misc.c"
 #include "file_copy.c"
+#include "file_delta.c"
+#include "file_cache.c"
 #include "file_init.c"
 
 
@@ -1554,6 +1604,16 @@ _FX WCHAR *File_GetName_TranslateSymlinks(
         goto not_link;
     }
 
+    //
+    // a link which was already translated doesn't need to be looked up
+    //
+
+    name = File_NameCache_GetLink(TlsData, objname_buf, objname_len);
+    if (name) {
+        *translated = TRUE;
+        return name;
+    }
+
     InitializeObjectAttributes(
         &objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
 
@@ -1691,6 +1751,8 @@ copy_suffix:
     else {
 
         WCHAR *name2 = name + path_len / sizeof(WCHAR);
+        WCHAR *link;
+        ULONG link_len;
 
         memcpy(name2, suffix, suffix_len);
         name2 += suffix_len / sizeof(WCHAR);
@@ -1703,6 +1765,15 @@ copy_suffix:
         // put the result in the true name buffer, and return
         //
 
+        // the recursive invocation may reallocate the copy name buffer,
+        // which holds objname_buf if we are a recursive invocation too,
+        // so keep a copy of the link name for File_NameCache_AddLink
+
+        link_len = (objname_len - suffix_len) / sizeof(WCHAR);
+        link = Dll_AllocTemp((link_len + 1) * sizeof(WCHAR));
+        wmemcpy(link, objname_buf, link_len);
+        link[link_len] = L'\0';
+
         name2 = Dll_GetTlsNameBuffer(
                     TlsData, COPY_NAME_BUFFER,
                     path_len + suffix_len + sizeof(WCHAR));
@@ -1711,8 +1782,13 @@ copy_suffix:
 
         name = File_GetName_TranslateSymlinks(
                     TlsData, name2, path_len + suffix_len, translated);
-        if (name)
+        if (name) {
             *translated = TRUE;
+            File_NameCache_AddLink(
+                link, link_len, name, suffix_len / sizeof(WCHAR));
+        }
+
+        Dll_Free(link);
     }
 
     return name;
@@ -1874,9 +1950,17 @@ _FX WCHAR *File_GetName_ExpandShortNames(
         if (dot_count > 1 || (index - backslash_index - 1) > 12)
             continue;
 
-        // otherwise open the directory containing the short name component
+        // otherwise open the directory containing the short name component,
+        // unless the long name for this path is already known
 
-		status = File_GetName_ExpandShortNames2(Path, index, backslash_index, info, info_size, NULL);
+		ULONG generation = 0;
+		if (File_NameCache_GetShortName(Path, index, info, info_size, &generation))
+			status = STATUS_SUCCESS;
+		else {
+			status = File_GetName_ExpandShortNames2(Path, index, backslash_index, info, info_size, NULL);
+			if (NT_SUCCESS(status))
+				File_NameCache_AddShortName(Path, index, info, generation);
+		}
 
 		if (!NT_SUCCESS(status) && File_Snapshot != NULL)
 		{
@@ -3145,6 +3229,17 @@ ReparseLoop:
 
         if (NT_SUCCESS(status)) TrueOpened = TRUE;
 
+        //
+        // a new or deleted entry outside the sandbox may change what a
+        // short name refers to, see File_NameCache_InvalidateShortNames
+        //
+
+        if (NT_SUCCESS(status) && (
+                IoStatusBlock->Information == FILE_CREATED ||
+                IoStatusBlock->Information == FILE_SUPERSEDED ||
+                (CreateOptions & FILE_DELETE_ON_CLOSE)))
+            File_NameCache_InvalidateShortNames();
+
         //
         // if we got STATUS_OBJECT_PATH_NOT_FOUND on an open path, meaning
         // that parent directories are missing outside the sandbox, then
@@ -3937,6 +4032,21 @@ ReparseLoop:
         DesiredAccess |= DELETE;
     }
 
+    //
+    // a delta file which can't be served lazily through the new handle
+    // must receive its full contents before the handle is opened
+    //
+
+    if (File_DeltaEnabled && (! DeleteOnClose) && (! CopyPathColon) &&
+            (! (CreateOptions & FILE_DIRECTORY_FILE))) {
+
+        status = File_Delta_CheckOpen(
+            CopyPath, DesiredAccess, CreateDisposition, CreateOptions);
+
+        if (! NT_SUCCESS(status))
+            __leave;
+    }
+
     //status = __sys_NtCreateFile(
     status = File_NtCreateCopyFile(
         FileHandle, DesiredAccess | FILE_READ_ATTRIBUTES,
@@ -4064,6 +4174,23 @@ ReparseLoop:
             }
             IoStatusBlock->Information = 0;
         }
+
+        //
+        // track handles to delta files, see file_delta.c
+        //
+
+        else if (File_DeltaEnabled && (! DeleteOnClose) && (! CopyPathColon) &&
+                (! (CreateOptions & FILE_DIRECTORY_FILE))) {
+
+            status = File_Delta_Attach(*FileHandle, CopyPath,
+                DesiredAccess, CreateDisposition, CreateOptions);
+
+            if (! NT_SUCCESS(status)) {
+                NtClose(*FileHandle);
+                *FileHandle = NULL;
+                IoStatusBlock->Information = 0;
+            }
+        }
     }
 
     //
@@ -6831,6 +6958,9 @@ _FX NTSTATUS File_NtSetInformationFile(
             status = File_SetDisposition(
                 FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass);
 
+        if (NT_SUCCESS(status))
+            File_NameCache_InvalidateShortNames();
+
     //
     // rename request
     //
@@ -6840,6 +6970,9 @@ _FX NTSTATUS File_NtSetInformationFile(
 
         status = File_RenameFile(FileHandle, FileInformation, FALSE);
 
+        if (NT_SUCCESS(status))
+            File_NameCache_InvalidateShortNames();
+
     //
     // pipe state request on a proxy pipe
     //
@@ -6899,6 +7032,24 @@ _FX NTSTATUS File_NtSetInformationFile(
 
         FillIoStatusBlock = FALSE;
 
+        //
+        // truncating a delta file cuts it loose from the true file
+        //
+
+        if ((FileInformationClass == FileEndOfFileInformation ||
+             FileInformationClass == FileAllocationInformation) &&
+                Length >= sizeof(LARGE_INTEGER)) {
+
+            ULONGLONG NewSize = -1;
+
+            __try {
+                NewSize = ((FILE_END_OF_FILE_INFORMATION *)FileInformation)->EndOfFile.QuadPart;
+            } __except (EXCEPTION_EXECUTE_HANDLER) {
+            }
+
+            File_Delta_SetEndOfFile(FileHandle, NewSize);
+        }
+
         status = __sys_NtSetInformationFile(
             FileHandle, IoStatusBlock,
             FileInformation, Length, FileInformationClass);
@@ -0,0 +1,416 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// File (Name Cache)
+//
+// caches the results of symbolic link translation and short name expansion
+// done by File_GetName.  a symbolic link is only cached when its expansion
+// ends on a volume or on the Mup device, then everything below the link is
+// a file system path, which can't contain any further object manager links.
+// short names are cached only for the true path, outside of snapshots.
+// both caches are flushed whenever File_InitDrives reloads the drives.
+// a short name entry is dropped when it is older than 10 seconds, like
+// the temporary links in file_link.c, or when this process created,
+// renamed or deleted an entry outside the sandbox since it was looked up
+//---------------------------------------------------------------------------
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define FILE_NAME_CACHE_MAX_ENTRIES     4096
+
+#define FILE_NAME_CACHE_SHORT_NAME_TTL  (10 * 1000)
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _FILE_NAME_CACHE_ENTRY {
+
+    ULONG ticks;                // when the result was looked up
+    ULONG generation;           // File_NameCacheShortNameGeneration then
+    ULONG len;                  // in characters, without terminating NULL
+    WCHAR name[1];
+
+} FILE_NAME_CACHE_ENTRY;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN File_NameCacheEnabled = FALSE;
+static BOOLEAN File_NameCacheTrace = FALSE;
+
+static CRITICAL_SECTION File_NameCacheCritSec;
+
+static HASH_MAP File_NameCacheLinks;        // link prefix -> expansion
+static HASH_MAP File_NameCacheShortNames;   // path with short name -> long name
+
+static volatile LONG File_NameCacheLinkHits = 0;
+static volatile LONG File_NameCacheLinkMisses = 0;
+static volatile LONG File_NameCacheShortNameHits = 0;
+static volatile LONG File_NameCacheShortNameMisses = 0;
+
+static volatile LONG File_NameCacheShortNameGeneration = 0;
+
+
+//---------------------------------------------------------------------------
+// File_InitNameCache
+//---------------------------------------------------------------------------
+
+
+_FX void File_InitNameCache(void)
+{
+    if (! SbieApi_QueryConfBool(NULL, L"UseFileNameCache", TRUE))
+        return;
+
+    InitializeCriticalSectionAndSpinCount(&File_NameCacheCritSec, 1000);
+
+    //
+    // keys are lower case strings, they are compared by value with memcmp
+    //
+
+    map_init(&File_NameCacheLinks, Dll_Pool);
+    File_NameCacheLinks.func_key_size = &map_wcssize;
+
+    map_init(&File_NameCacheShortNames, Dll_Pool);
+    File_NameCacheShortNames.func_key_size = &map_wcssize;
+
+    File_NameCacheTrace = SbieApi_QueryConfBool(NULL, L"FileNameCacheTrace", FALSE);
+
+    File_NameCacheEnabled = TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_FlushNameCache
+//---------------------------------------------------------------------------
+
+
+_FX void File_FlushNameCache(void)
+{
+    if (! File_NameCacheEnabled)
+        return;
+
+    EnterCriticalSection(&File_NameCacheCritSec);
+
+    map_clear(&File_NameCacheLinks);
+    map_clear(&File_NameCacheShortNames);
+
+    LeaveCriticalSection(&File_NameCacheCritSec);
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_MakeKey
+//---------------------------------------------------------------------------
+
+
+_FX WCHAR *File_NameCache_MakeKey(const WCHAR *name, ULONG len)
+{
+    WCHAR *key = Dll_AllocTemp((len + 1) * sizeof(WCHAR));
+    wmemcpy(key, name, len);
+    key[len] = L'\0';
+    _wcslwr(key);
+    return key;
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_Insert
+//---------------------------------------------------------------------------
+
+
+_FX void File_NameCache_Insert(
+    HASH_MAP *map, const WCHAR *key, const WCHAR *name, ULONG len,
+    ULONG ticks, ULONG generation)
+{
+    FILE_NAME_CACHE_ENTRY *entry;
+
+    EnterCriticalSection(&File_NameCacheCritSec);
+
+    if (! map_get(map, key)) {
+
+        if (map->nnodes >= FILE_NAME_CACHE_MAX_ENTRIES)
+            map_clear(map);
+
+        entry = map_insert(map, key, NULL,
+                    sizeof(FILE_NAME_CACHE_ENTRY) + len * sizeof(WCHAR));
+        if (entry) {
+            entry->ticks = ticks;
+            entry->generation = generation;
+            entry->len = len;
+            wmemcpy(entry->name, name, len);
+            entry->name[len] = L'\0';
+        }
+    }
+
+    LeaveCriticalSection(&File_NameCacheCritSec);
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_GetLink
+//---------------------------------------------------------------------------
+
+
+_FX WCHAR *File_NameCache_GetLink(
+    THREAD_DATA *TlsData, const WCHAR *objname_buf, ULONG objname_len)
+{
+    ULONG len = objname_len / sizeof(WCHAR);
+    WCHAR *key, *name = NULL;
+    ULONG i;
+
+    if (! File_NameCacheEnabled)
+        return NULL;
+
+    key = File_NameCache_MakeKey(objname_buf, len);
+
+    EnterCriticalSection(&File_NameCacheCritSec);
+
+    //
+    // check every prefix which ends on a path component, at most one of
+    // them can be in the cache, as nothing below a cached link is a link
+    //
+
+    for (i = 1; i <= len; ++i) {
+
+        FILE_NAME_CACHE_ENTRY *entry;
+        WCHAR save_char;
+
+        if (i < len && key[i] != L'\\')
+            continue;
+
+        save_char = key[i];
+        key[i] = L'\0';
+        entry = map_get(&File_NameCacheLinks, key);
+        key[i] = save_char;
+
+        if (entry) {
+
+            ULONG suffix_len = len - i;
+
+            name = Dll_GetTlsNameBuffer(
+                        TlsData, TRUE_NAME_BUFFER,
+                        (entry->len + suffix_len + 1) * sizeof(WCHAR));
+
+            wmemcpy(name, entry->name, entry->len);
+            wmemcpy(name + entry->len, objname_buf + i, suffix_len);
+            name[entry->len + suffix_len] = L'\0';
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&File_NameCacheCritSec);
+
+    Dll_Free(key);
+
+    if (name)
+        InterlockedIncrement(&File_NameCacheLinkHits);
+    else
+        InterlockedIncrement(&File_NameCacheLinkMisses);
+
+    return name;
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_AddLink
+//---------------------------------------------------------------------------
+
+
+_FX void File_NameCache_AddLink(
+    const WCHAR *link, ULONG link_len, const WCHAR *name, ULONG suffix_len)
+{
+    ULONG name_len = wcslen(name);
+    ULONG target_len;
+    const FILE_DRIVE *drive;
+    BOOLEAN terminal;
+    WCHAR *key;
+
+    if (! File_NameCacheEnabled)
+        return;
+
+    //
+    // the translated name ends with the unchanged suffix which followed
+    // the link, what remains in front of it is the expansion of the link
+    //
+
+    if (name_len < suffix_len)
+        return;
+    target_len = name_len - suffix_len;
+
+    //
+    // only cache links which lead into a file system, see the top of
+    // this file.  the suffix starts with a backslash or is empty, so
+    // File_GetDriveForPath can look past the end of the target
+    //
+
+    terminal = FALSE;
+
+    drive = File_GetDriveForPath(name, target_len);
+    if (drive) {
+        LeaveCriticalSection(File_DrivesAndLinks_CritSec);
+        terminal = TRUE;
+
+    } else if (target_len >= File_MupLen - 1 &&
+                _wcsnicmp(name, File_Mup, File_MupLen - 1) == 0 &&
+                (name[File_MupLen - 1] == L'\\' || name[File_MupLen - 1] == L'\0')) {
+
+        terminal = TRUE;
+    }
+
+    if (! terminal)
+        return;
+
+    key = File_NameCache_MakeKey(link, link_len);
+    File_NameCache_Insert(&File_NameCacheLinks, key, name, target_len, 0, 0);
+    Dll_Free(key);
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_GetShortName
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_NameCache_GetShortName(
+    const WCHAR *Path, ULONG index, PFILE_BOTH_DIRECTORY_INFORMATION info,
+    const ULONG info_size, ULONG *generation)
+{
+    FILE_NAME_CACHE_ENTRY *entry;
+    BOOLEAN found = FALSE;
+    WCHAR *key;
+
+    if (! File_NameCacheEnabled)
+        return FALSE;
+
+    //
+    // the generation is taken before the directory is queried, so a
+    // change which happens while the query is in progress also makes
+    // the result stale, see File_NameCache_AddShortName
+    //
+
+    *generation = File_NameCacheShortNameGeneration;
+
+    key = File_NameCache_MakeKey(Path, index);
+
+    EnterCriticalSection(&File_NameCacheCritSec);
+
+    entry = map_get(&File_NameCacheShortNames, key);
+    if (entry && (entry->generation != *generation ||
+            GetTickCount() - entry->ticks > FILE_NAME_CACHE_SHORT_NAME_TTL)) {
+
+        map_remove(&File_NameCacheShortNames, key);
+        entry = NULL;
+    }
+
+    if (entry && FIELD_OFFSET(FILE_BOTH_DIRECTORY_INFORMATION, FileName)
+                        + entry->len * sizeof(WCHAR) <= info_size) {
+
+        info->FileNameLength = entry->len * sizeof(WCHAR);
+        wmemcpy(info->FileName, entry->name, entry->len);
+        found = TRUE;
+    }
+
+    LeaveCriticalSection(&File_NameCacheCritSec);
+
+    Dll_Free(key);
+
+    if (found)
+        InterlockedIncrement(&File_NameCacheShortNameHits);
+    else
+        InterlockedIncrement(&File_NameCacheShortNameMisses);
+
+    return found;
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_AddShortName
+//---------------------------------------------------------------------------
+
+
+_FX void File_NameCache_AddShortName(
+    const WCHAR *Path, ULONG index, PFILE_BOTH_DIRECTORY_INFORMATION info,
+    ULONG generation)
+{
+    WCHAR *key;
+
+    if (! File_NameCacheEnabled)
+        return;
+
+    if (generation != (ULONG)File_NameCacheShortNameGeneration)
+        return;
+
+    key = File_NameCache_MakeKey(Path, index);
+    File_NameCache_Insert(&File_NameCacheShortNames, key,
+                    info->FileName, info->FileNameLength / sizeof(WCHAR),
+                    GetTickCount(), generation);
+    Dll_Free(key);
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_InvalidateShortNames
+//---------------------------------------------------------------------------
+
+
+_FX void File_NameCache_InvalidateShortNames(void)
+{
+    //
+    // called when this process creates, renames or deletes an entry,
+    // which may give a short name to a different long name.  we don't
+    // know which directory the short names in the cache were looked up
+    // in, as the keys may still contain other short names, so all
+    // entries become stale and are dropped on their next lookup
+    //
+
+    if (File_NameCacheEnabled)
+        InterlockedIncrement(&File_NameCacheShortNameGeneration);
+}
+
+
+//---------------------------------------------------------------------------
+// File_NameCache_Report
+//---------------------------------------------------------------------------
+
+
+_FX void File_NameCache_Report(void)
+{
+    WCHAR msg[256];
+
+    if ((! File_NameCacheEnabled) || (! File_NameCacheTrace))
+        return;
+
+    Sbie_snwprintf(msg, 256,
+        L"FileNameCache: %s links %d hits %d misses, short names %d hits %d misses",
+        Dll_ImageName,
+        File_NameCacheLinkHits, File_NameCacheLinkMisses,
+        File_NameCacheShortNameHits, File_NameCacheShortNameMisses);
+
+    SbieApi_MonitorPutMsg(MONITOR_OTHER | MONITOR_TRACE, msg);
+}
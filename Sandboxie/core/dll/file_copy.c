@@ -23,6 +23,87 @@
 
 #include "common\pattern.h"
 
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#ifndef FSCTL_DUPLICATE_EXTENTS_TO_FILE
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_DATA)
+#endif
+
+#ifndef FILE_SUPPORTS_BLOCK_REFCOUNTING
+#define FILE_SUPPORTS_BLOCK_REFCOUNTING     0x08000000
+#endif
+
+#define FILE_COPY_BUFFER_MIN    (256 * 1024)
+#define FILE_COPY_BUFFER_MID    (1024 * 1024)
+#define FILE_COPY_BUFFER_MAX    (4 * 1024 * 1024)
+
+#define FILE_COPY_CLONE_CHUNK   (1024 * 1024 * 1024)   // 1 GB per FSCTL
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _FILE_COPY_DUPLICATE_EXTENTS {
+
+    HANDLE FileHandle;
+    LARGE_INTEGER SourceFileOffset;
+    LARGE_INTEGER TargetFileOffset;
+    LARGE_INTEGER ByteCount;
+
+} FILE_COPY_DUPLICATE_EXTENTS;
+
+
+typedef struct _FILE_COPY_FS_ATTRIBUTE_INFORMATION {
+
+    ULONG FileSystemAttributes;
+    LONG MaximumComponentNameLength;
+    ULONG FileSystemNameLength;
+    WCHAR FileSystemName[1];
+
+} FILE_COPY_FS_ATTRIBUTE_INFORMATION;
+
+
+typedef struct _FILE_COPY_FS_SIZE_INFORMATION {
+
+    LARGE_INTEGER TotalAllocationUnits;
+    LARGE_INTEGER AvailableAllocationUnits;
+    ULONG SectorsPerAllocationUnit;
+    ULONG BytesPerSector;
+
+} FILE_COPY_FS_SIZE_INFORMATION;
+
+
+typedef struct _FILE_COPY_CONTEXT {
+
+    HANDLE TrueHandle;
+    HANDLE CopyHandle;
+    const WCHAR *TruePath;
+
+    HANDLE ReadEvent;
+    HANDLE WriteEvent;
+
+    UCHAR *Buffers[2];
+    ULONG BufferSize;
+    ULONG BufferIndex;
+
+    IO_STATUS_BLOCK WriteIosb;
+    LARGE_INTEGER WriteOffset;
+    BOOLEAN WritePending;
+
+    ULONGLONG FileSize;
+    ULONGLONG BytesCopied;
+    ULONG NextStatus;
+
+} FILE_COPY_CONTEXT;
+
+
  //---------------------------------------------------------------------------
  // Functions
  //---------------------------------------------------------------------------
@@ -31,6 +112,10 @@ static void File_InitCopyLimit(void);
 
 static BOOLEAN File_InitFileMigration(void);
 
+static NTSTATUS File_MigrateFile_CopyData(
+    HANDLE TrueHandle, HANDLE CopyHandle, const WCHAR *TruePath,
+    ULONGLONG file_size, ULONG FileAttributes);
+
 //---------------------------------------------------------------------------
 // Variables
 //---------------------------------------------------------------------------
@@ -41,6 +126,7 @@ extern POOL* Dll_PoolTemp;
 typedef enum { // Note: thisorder defines the config priority
     FILE_DONT_COPY,
     FILE_COPY_CONTENT,
+    FILE_COPY_DELTA,
     FILE_COPY_EMPTY,
     NUM_COPY_MODES
 } ENUM_COPY_MODES;
@@ -53,6 +139,9 @@ static ULONGLONG File_CopyLimitKb = (80 * 1024);        // 80 MB
 static BOOLEAN File_CopyLimitSilent = FALSE;
 static BOOLEAN File_NotifyNoCopy = FALSE;
 
+static BOOLEAN File_CopyLimitDelta = FALSE;
+static BOOLEAN File_DeltaEnabled = FALSE;
+
 //---------------------------------------------------------------------------
 // File_InitFileMigration
 //---------------------------------------------------------------------------
@@ -65,6 +154,7 @@ _FX BOOLEAN File_InitFileMigration(void)
 
     Config_InitPatternList(NULL, L"CopyEmpty", &File_MigrationOptions[FILE_COPY_EMPTY], FALSE);
     Config_InitPatternList(NULL, L"CopyAlways", &File_MigrationOptions[FILE_COPY_CONTENT], FALSE);
+    Config_InitPatternList(NULL, L"CopyDelta", &File_MigrationOptions[FILE_COPY_DELTA], FALSE);
     Config_InitPatternList(NULL, L"DontCopy", &File_MigrationOptions[FILE_DONT_COPY], FALSE);
 
     File_MigrationDenyWrite = Config_GetSettingsForImageName_bool(L"CopyBlockDenyWrite", FALSE);
@@ -73,7 +163,12 @@ _FX BOOLEAN File_InitFileMigration(void)
 
     File_NotifyNoCopy = SbieApi_QueryConfBool(NULL, L"NotifyNoCopy", FALSE);
 
-    return TRUE;
+    File_CopyLimitDelta = SbieApi_QueryConfBool(NULL, L"CopyLimitDelta", FALSE);
+
+    File_DeltaEnabled = File_CopyLimitDelta ||
+        List_Head(&File_MigrationOptions[FILE_COPY_DELTA]) != NULL;
+
+    return File_InitDelta();
 }
 
 
@@ -166,6 +261,13 @@ found_match:
     if (File_CopyLimitKb == -1 || file_size < ((ULONGLONG)File_CopyLimitKb * 1024))
         return FILE_COPY_CONTENT;
 
+    //
+    // large files can be migrated as delta files, without asking the user
+    //
+
+    if (File_CopyLimitDelta)
+        return FILE_COPY_DELTA;
+
     //
     // ask the user to decide if the large file should be coped into the sandbox
     //
@@ -244,6 +346,498 @@ _FX void File_InitCopyLimit(void)
 }
 
 
+//---------------------------------------------------------------------------
+// File_MigrateFile_Wait
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_Wait(
+    NTSTATUS status, HANDLE Event, IO_STATUS_BLOCK *IoStatusBlock)
+{
+    if (status == STATUS_PENDING) {
+
+        NtWaitForSingleObject(Event, FALSE, NULL);
+        status = IoStatusBlock->Status;
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_SetEndOfFile
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_SetEndOfFile(
+    HANDLE CopyHandle, ULONGLONG file_size)
+{
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_END_OF_FILE_INFORMATION eof_info;
+
+    eof_info.EndOfFile.QuadPart = file_size;
+
+    return __sys_NtSetInformationFile(
+        CopyHandle, &IoStatusBlock, &eof_info,
+        sizeof(FILE_END_OF_FILE_INFORMATION), FileEndOfFileInformation);
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_CanClone
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_MigrateFile_CanClone(
+    HANDLE TrueHandle, HANDLE CopyHandle, ULONG *ClusterSize)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    union {
+        FILE_FS_VOLUME_INFORMATION info;
+        WCHAR space[64];
+    } true_vol, copy_vol;
+    union {
+        FILE_COPY_FS_ATTRIBUTE_INFORMATION info;
+        WCHAR space[64];
+    } attr;
+    FILE_COPY_FS_SIZE_INFORMATION size_info;
+
+    //
+    // block cloning is only possible when both files reside on the
+    // same volume, and that volume supports block reference counting
+    // (ReFS, including Dev Drive volumes)
+    //
+
+    status = __sys_NtQueryVolumeInformationFile(
+        CopyHandle, &IoStatusBlock, &attr, sizeof(attr),
+        FileFsAttributeInformation);
+
+    if ((! NT_SUCCESS(status)) && status != STATUS_BUFFER_OVERFLOW)
+        return FALSE;
+    if (! (attr.info.FileSystemAttributes & FILE_SUPPORTS_BLOCK_REFCOUNTING))
+        return FALSE;
+
+    status = __sys_NtQueryVolumeInformationFile(
+        TrueHandle, &IoStatusBlock, &true_vol, sizeof(true_vol),
+        FileFsVolumeInformation);
+
+    if ((! NT_SUCCESS(status)) && status != STATUS_BUFFER_OVERFLOW)
+        return FALSE;
+
+    status = __sys_NtQueryVolumeInformationFile(
+        CopyHandle, &IoStatusBlock, &copy_vol, sizeof(copy_vol),
+        FileFsVolumeInformation);
+
+    if ((! NT_SUCCESS(status)) && status != STATUS_BUFFER_OVERFLOW)
+        return FALSE;
+    if (true_vol.info.VolumeSerialNumber != copy_vol.info.VolumeSerialNumber)
+        return FALSE;
+
+    //
+    // the cloned byte count must be a multiple of the cluster size
+    //
+
+    status = __sys_NtQueryVolumeInformationFile(
+        CopyHandle, &IoStatusBlock, &size_info, sizeof(size_info),
+        FileFsSizeInformation);
+
+    if (! NT_SUCCESS(status))
+        return FALSE;
+
+    *ClusterSize =
+        size_info.SectorsPerAllocationUnit * size_info.BytesPerSector;
+
+    if ((! *ClusterSize) || (*ClusterSize & (*ClusterSize - 1)))
+        return FALSE;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_Clone
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_Clone(
+    FILE_COPY_CONTEXT *ctx, ULONG ClusterSize)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_COPY_DUPLICATE_EXTENTS dup;
+    ULONGLONG offset, chunk;
+
+    //
+    // the target must already be extended to its final size.  the last
+    // chunk is rounded up to the cluster size, which the file system
+    // accepts as long as the range ends at the end of the source file
+    //
+
+    for (offset = 0; offset < ctx->FileSize; offset += chunk) {
+
+        chunk = ctx->FileSize - offset;
+        if (chunk > FILE_COPY_CLONE_CHUNK)
+            chunk = FILE_COPY_CLONE_CHUNK;
+
+        dup.FileHandle = ctx->TrueHandle;
+        dup.SourceFileOffset.QuadPart = offset;
+        dup.TargetFileOffset.QuadPart = offset;
+        dup.ByteCount.QuadPart =
+            (chunk + ClusterSize - 1) & ~((ULONGLONG)ClusterSize - 1);
+
+        status = __sys_NtFsControlFile(
+            ctx->CopyHandle, ctx->WriteEvent, NULL, NULL, &IoStatusBlock,
+            FSCTL_DUPLICATE_EXTENTS_TO_FILE, &dup, sizeof(dup), NULL, 0);
+
+        status = File_MigrateFile_Wait(
+            status, ctx->WriteEvent, &IoStatusBlock);
+
+        if (! NT_SUCCESS(status))
+            break;
+
+        ctx->BytesCopied += chunk;
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_FlushWrite
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_FlushWrite(FILE_COPY_CONTEXT *ctx)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (ctx->WritePending) {
+
+        ctx->WritePending = FALSE;
+
+        status = File_MigrateFile_Wait(
+            STATUS_PENDING, ctx->WriteEvent, &ctx->WriteIosb);
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_CopyRange
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_CopyRange(
+    FILE_COPY_CONTEXT *ctx, ULONGLONG offset, ULONGLONG length)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER ReadOffset;
+
+    //
+    // the data is double buffered:  the write of one buffer into the
+    // CopyPath file is still in flight while the next buffer is being
+    // read from the TruePath file.  a buffer is reused only after the
+    // write issued from it has completed
+    //
+
+    while (length > 0) {
+
+        UCHAR *buffer = ctx->Buffers[ctx->BufferIndex];
+        ULONG buffer_size = (length > ctx->BufferSize)
+                          ? ctx->BufferSize : (ULONG)length;
+
+        ReadOffset.QuadPart = offset;
+
+        status = NtReadFile(
+            ctx->TrueHandle, ctx->ReadEvent, NULL, NULL, &IoStatusBlock,
+            buffer, buffer_size, &ReadOffset, NULL);
+
+        status = File_MigrateFile_Wait(
+            status, ctx->ReadEvent, &IoStatusBlock);
+
+        if (status == STATUS_END_OF_FILE) {
+            status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (! NT_SUCCESS(status))
+            break;
+
+        buffer_size = (ULONG)IoStatusBlock.Information;
+        if (! buffer_size)
+            break;
+
+        status = File_MigrateFile_FlushWrite(ctx);
+        if (! NT_SUCCESS(status))
+            break;
+
+        ctx->WriteOffset.QuadPart = offset;
+
+        status = NtWriteFile(
+            ctx->CopyHandle, ctx->WriteEvent, NULL, NULL, &ctx->WriteIosb,
+            buffer, buffer_size, &ctx->WriteOffset, NULL);
+
+        if (status == STATUS_PENDING) {
+            ctx->WritePending = TRUE;
+            status = STATUS_SUCCESS;
+        }
+
+        if (! NT_SUCCESS(status))
+            break;
+
+        ctx->BufferIndex ^= 1;
+        ctx->BytesCopied += buffer_size;
+        offset += buffer_size;
+        length -= buffer_size;
+
+        ULONG Cur_Ticks = GetTickCount();
+        if (ctx->NextStatus < Cur_Ticks) {
+            ctx->NextStatus = Cur_Ticks + 1000; // update progress every second
+
+            WCHAR size_str[32];
+            Sbie_snwprintf(size_str, 32, L"%I64u", ctx->FileSize - offset);
+            const WCHAR* strings[] = { Dll_BoxName, ctx->TruePath, size_str, NULL };
+            SbieApi_LogMsgExt(-1, 2198, strings);
+        }
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_CopySparse
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_CopySparse(FILE_COPY_CONTEXT *ctx)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    FILE_ALLOCATED_RANGE_BUFFER ranges[64];
+    ULONG count, i;
+    BOOLEAN more;
+
+    //
+    // copy only the allocated ranges of a sparse file, the holes
+    // in between stay unallocated in the sparse CopyPath file
+    //
+
+    query.FileOffset.QuadPart = 0;
+    query.Length.QuadPart = ctx->FileSize;
+
+    do {
+
+        status = __sys_NtFsControlFile(
+            ctx->TrueHandle, ctx->ReadEvent, NULL, NULL, &IoStatusBlock,
+            FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+            ranges, sizeof(ranges));
+
+        status = File_MigrateFile_Wait(
+            status, ctx->ReadEvent, &IoStatusBlock);
+
+        more = (status == STATUS_BUFFER_OVERFLOW);
+        if ((! NT_SUCCESS(status)) && (! more))
+            break;
+
+        count = (ULONG)(IoStatusBlock.Information
+                            / sizeof(FILE_ALLOCATED_RANGE_BUFFER));
+        if (! count) {
+            status = more ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+            break;
+        }
+
+        for (i = 0; i < count; ++i) {
+
+            ULONGLONG offset = ranges[i].FileOffset.QuadPart;
+            ULONGLONG length = ranges[i].Length.QuadPart;
+
+            if (offset >= ctx->FileSize)
+                break;
+            if (length > ctx->FileSize - offset)
+                length = ctx->FileSize - offset;
+
+            status = File_MigrateFile_CopyRange(ctx, offset, length);
+            if (! NT_SUCCESS(status))
+                return status;
+        }
+
+        query.FileOffset.QuadPart = ranges[count - 1].FileOffset.QuadPart
+                                  + ranges[count - 1].Length.QuadPart;
+
+        if ((ULONGLONG)query.FileOffset.QuadPart >= ctx->FileSize)
+            break;
+
+        query.Length.QuadPart = ctx->FileSize - query.FileOffset.QuadPart;
+
+    } while (more);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MigrateFile_CopyData
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MigrateFile_CopyData(
+    HANDLE TrueHandle, HANDLE CopyHandle, const WCHAR *TruePath,
+    ULONGLONG file_size, ULONG FileAttributes)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_COPY_CONTEXT ctx;
+    const WCHAR *method = L"copy";
+    BOOLEAN sparse = FALSE;
+    BOOLEAN done = FALSE;
+    ULONG ClusterSize = 0;
+    ULONG start_ticks = GetTickCount();
+
+    memzero(&ctx, sizeof(ctx));
+    ctx.TrueHandle = TrueHandle;
+    ctx.CopyHandle = CopyHandle;
+    ctx.TruePath = TruePath;
+    ctx.FileSize = file_size;
+    ctx.NextStatus = start_ticks + 3000; // wait 3 seconds
+
+    ctx.ReadEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    ctx.WriteEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if ((! ctx.ReadEvent) || (! ctx.WriteEvent)) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto finish;
+    }
+
+    //
+    // keep sparse files sparse.  if the CopyPath volume does not
+    // support sparse files, we fall back to a full copy
+    //
+
+    if (FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) {
+
+        status = __sys_NtFsControlFile(
+            CopyHandle, ctx.WriteEvent, NULL, NULL, &IoStatusBlock,
+            FSCTL_SET_SPARSE, NULL, 0, NULL, 0);
+
+        status = File_MigrateFile_Wait(
+            status, ctx.WriteEvent, &IoStatusBlock);
+
+        sparse = NT_SUCCESS(status);
+    }
+
+    //
+    // if both files are on the same ReFS volume, clone the extents
+    // instead of copying the data.  on failure, fall through to a
+    // regular copy which overwrites whatever was cloned so far
+    //
+
+    if (File_MigrateFile_CanClone(TrueHandle, CopyHandle, &ClusterSize)) {
+
+        status = File_MigrateFile_SetEndOfFile(CopyHandle, file_size);
+
+        if (NT_SUCCESS(status))
+            status = File_MigrateFile_Clone(&ctx, ClusterSize);
+
+        if (NT_SUCCESS(status)) {
+            method = L"clone";
+            done = TRUE;
+        }
+        else
+            ctx.BytesCopied = 0;
+    }
+
+    if (! done) {
+
+        //
+        // pick the buffer size based on the file size, small files
+        // are copied with a single buffer sized to fit the data
+        //
+
+        if (file_size >= 64 * 1024 * 1024)
+            ctx.BufferSize = FILE_COPY_BUFFER_MAX;
+        else if (file_size >= 4 * 1024 * 1024)
+            ctx.BufferSize = FILE_COPY_BUFFER_MID;
+        else if (file_size >= FILE_COPY_BUFFER_MIN)
+            ctx.BufferSize = FILE_COPY_BUFFER_MIN;
+        else
+            ctx.BufferSize =
+                ((ULONG)file_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+        ctx.Buffers[0] = VirtualAlloc(NULL, ctx.BufferSize * 2,
+                                      MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (! ctx.Buffers[0]) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto finish;
+        }
+        ctx.Buffers[1] = ctx.Buffers[0] + ctx.BufferSize;
+
+        status = STATUS_UNSUCCESSFUL;
+
+        if (sparse) {
+
+            status = File_MigrateFile_SetEndOfFile(CopyHandle, file_size);
+
+            if (NT_SUCCESS(status))
+                status = File_MigrateFile_CopySparse(&ctx);
+
+            if (NT_SUCCESS(status))
+                method = L"sparse";
+        }
+
+        if (! NT_SUCCESS(status)) {
+
+            //
+            // not sparse, or copying the allocated ranges failed:
+            // drain the write left over from that attempt, if any,
+            // and copy the whole file
+            //
+
+            File_MigrateFile_FlushWrite(&ctx);
+
+            ctx.BytesCopied = 0;
+            status = File_MigrateFile_CopyRange(&ctx, 0, file_size);
+        }
+
+        {
+            NTSTATUS flush_status = File_MigrateFile_FlushWrite(&ctx);
+            if (NT_SUCCESS(status))
+                status = flush_status;
+        }
+
+        VirtualFree(ctx.Buffers[0], 0, MEM_RELEASE);
+    }
+
+    //
+    // report the copy throughput in the trace log
+    //
+
+    if (NT_SUCCESS(status)) {
+
+        ULONG elapsed = GetTickCount() - start_ticks;
+        ULONGLONG rate_kb = (ctx.BytesCopied / 1024) * 1000 / (elapsed ? elapsed : 1);
+
+        WCHAR msg[1024];
+        Sbie_snwprintf(msg, 1024, L"File Migrate (%s): %s, %I64u bytes in %u ms (%I64u KB/s)",
+            method, TruePath, ctx.BytesCopied, elapsed, rate_kb);
+        SbieApi_MonitorPutMsg(MONITOR_FILE | MONITOR_TRACE, msg);
+    }
+
+finish:
+
+    if (ctx.ReadEvent)
+        CloseHandle(ctx.ReadEvent);
+    if (ctx.WriteEvent)
+        CloseHandle(ctx.WriteEvent);
+
+    return status;
+}
+
+
 //---------------------------------------------------------------------------
 // File_MigrateFile
 //---------------------------------------------------------------------------
@@ -262,6 +856,7 @@ _FX NTSTATUS File_MigrateFile(
     ULONGLONG file_size;
     ACCESS_MASK DesiredAccess;
     ULONG CreateOptions;
+    BOOLEAN IsDelta = FALSE;
     PSECURITY_DESCRIPTOR pSecurityDescriptor = NULL;
 
     InitializeObjectAttributes(
@@ -323,6 +918,8 @@ _FX NTSTATUS File_MigrateFile(
 
         if (mode == FILE_COPY_EMPTY)
             file_size = 0;
+        else if (mode == FILE_COPY_DELTA)
+            IsDelta = (file_size != 0);
         else if (mode == FILE_DONT_COPY)
         {
             NtClose(TrueHandle);
@@ -380,10 +977,19 @@ _FX NTSTATUS File_MigrateFile(
         CreateOptions = FILE_NON_DIRECTORY_FILE;
     }
 
+    //
+    // when there is data to copy, the CopyPath handle is opened for
+    // asynchronous i/o, so File_MigrateFile_CopyData can overlap writes
+    // into the box with reads from the TruePath file
+    //
+
+    if ((! file_size) || IsDelta || (open_info.FileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        CreateOptions |= FILE_SYNCHRONOUS_IO_NONALERT;
+
     status = __sys_NtCreateFile(
         &CopyHandle, DesiredAccess, &objattrs, &IoStatusBlock,
         NULL, FILE_ATTRIBUTE_NORMAL, FILE_SHARE_VALID_FLAGS,
-        FILE_CREATE, FILE_SYNCHRONOUS_IO_NONALERT | CreateOptions,
+        FILE_CREATE, CreateOptions,
         NULL, 0);
 
     if (!NT_SUCCESS(status)) {
@@ -394,54 +1000,25 @@ _FX NTSTATUS File_MigrateFile(
     }
 
     //
-    // copy the file, if so desired
+    // a delta file starts out empty and receives its data on demand,
+    // if it can't be set up, fall back to copying the whole file
     //
 
-    if (file_size) {
-
-        ULONG Next_Status = GetTickCount() + 3000; // wait 3 seconds
+    if (IsDelta && (! (open_info.FileAttributes & FILE_ATTRIBUTE_DIRECTORY))) {
 
-        void* buffer = Dll_AllocTemp(PAGE_SIZE);
-        if (!buffer) {
-            status = STATUS_INSUFFICIENT_RESOURCES;
+        if (NT_SUCCESS(File_Delta_Create(CopyHandle, TrueHandle, TruePath, CopyPath, file_size)))
             file_size = 0;
-        }
-
-        while (file_size > 0) {
-
-            ULONG buffer_size =
-                (file_size > PAGE_SIZE) ? PAGE_SIZE : (ULONG)file_size;
-
-            status = NtReadFile(
-                TrueHandle, NULL, NULL, NULL, &IoStatusBlock,
-                buffer, buffer_size, NULL, NULL);
-
-            if (NT_SUCCESS(status)) {
-
-                buffer_size = (ULONG)IoStatusBlock.Information;
-                file_size -= (ULONGLONG)buffer_size;
-
-                status = NtWriteFile(
-                    CopyHandle, NULL, NULL, NULL, &IoStatusBlock,
-                    buffer, buffer_size, NULL, NULL);
-            }
-
-            if (!NT_SUCCESS(status))
-                break;
+    }
 
-            ULONG Cur_Ticks = GetTickCount();
-            if (Next_Status < Cur_Ticks) {
-                Next_Status = Cur_Ticks + 1000; // update progress every second
+    //
+    // copy the file, if so desired
+    //
 
-                WCHAR size_str[32];
-                Sbie_snwprintf(size_str, 32, L"%I64u", file_size);
-                const WCHAR* strings[] = { Dll_BoxName, TruePath, size_str, NULL };
-                SbieApi_LogMsgExt(-1, 2198, strings);
-            }
-        }
+    if (file_size) {
 
-        if (buffer)
-            Dll_Free(buffer);
+        status = File_MigrateFile_CopyData(
+            TrueHandle, CopyHandle, TruePath,
+            file_size, open_info.FileAttributes);
     }
 
     //
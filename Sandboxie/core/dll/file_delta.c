@@ -0,0 +1,1654 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// File (Delta)
+//
+// large files can be migrated as delta files (see common\delta_file.h).
+// the copy file is created sparse and empty, reads are stitched together
+// from the copy file and the true file, and the first partial write into
+// a block pulls the rest of the block from the true file.  handles which
+// can not be served this way (asynchronous read-only handles, sections)
+// materialize the full file first
+//---------------------------------------------------------------------------
+
+
+#include "common\delta_file.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#ifndef FILE_NO_INTERMEDIATE_BUFFERING
+#define FILE_NO_INTERMEDIATE_BUFFERING      0x00000008
+#endif
+
+#ifndef FILE_WRITE_TO_END_OF_FILE
+#define FILE_WRITE_TO_END_OF_FILE           0xFFFFFFFF
+#endif
+
+#ifndef FILE_USE_FILE_POINTER_POSITION
+#define FILE_USE_FILE_POINTER_POSITION      0xFFFFFFFE
+#endif
+
+
+// byte range lock used to serialize block fills between processes,
+// far beyond the end of any real file
+#define FILE_DELTA_LOCK_OFFSET      0x7FFFFFFF00000000ULL
+
+#define FILE_DELTA_BUFFER_SIZE      (1024 * 1024)
+
+#define FILE_DELTA_SECTOR_SIZE      4096
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _FILE_DELTA {
+
+    LIST_ELEM list_elem;
+
+    ULONG RefCount;
+    BOOLEAN Materialized;
+
+    CRITICAL_SECTION CritSec;
+
+    HANDLE TrueHandle;
+    ULONG BlockSize;
+    ULONGLONG TrueSize;
+    ULONGLONG TrueWriteTime;
+
+    // blocks known to be allocated in the copy file.  bits are only
+    // ever set, as a block once written stays valid
+    ULONG *ValidMap;
+
+    WCHAR CopyPath[1];
+
+} FILE_DELTA;
+
+
+typedef struct _FILE_DELTA_HANDLE {
+
+    FILE_DELTA *Delta;
+    HANDLE Event;               // for asynchronous handles only
+    BOOLEAN Synchronous;
+    BOOLEAN Unbuffered;
+    BOOLEAN CanWrite;
+
+} FILE_DELTA_HANDLE;
+
+
+typedef struct _FILE_DELTA_PATCH {
+
+    UCHAR *Buffer;
+    ULONGLONG Offset;
+
+} FILE_DELTA_PATCH;
+
+
+typedef struct _FILE_DELTA_HOLES {
+
+    ULONG Count;
+    ULONG Max;
+    ULONGLONG *Ranges;          // start and end of each hole
+
+} FILE_DELTA_HOLES;
+
+
+typedef NTSTATUS (*P_File_Delta_HoleFunc)(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    ULONGLONG start, ULONGLONG end, void *param);
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static void File_Delta_CloseHandler(HANDLE FileHandle, void *param);
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static volatile LONG File_DeltaHandleCount = 0;
+
+static HASH_MAP File_DeltaHandles;
+static LIST File_DeltaFiles;
+static CRITICAL_SECTION File_DeltaCritSec;
+
+
+//---------------------------------------------------------------------------
+// File_InitDelta
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_InitDelta(void)
+{
+    InitializeCriticalSection(&File_DeltaCritSec);
+    map_init(&File_DeltaHandles, Dll_Pool);
+    List_Init(&File_DeltaFiles);
+
+    //
+    // delta files created earlier must still be served when the options
+    // which created them are no longer set, the flag file in the box
+    // root indicates that this box may contain delta files
+    //
+
+    if (! File_DeltaEnabled) {
+
+        File_DeltaEnabled = File_GetAttributes_internal(
+                                FILE_DELTA_FLAG_FILE_NAME, NULL, NULL, NULL);
+    }
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_StreamPath
+//---------------------------------------------------------------------------
+
+
+_FX WCHAR *File_Delta_StreamPath(const WCHAR *CopyPath)
+{
+    ULONG len = wcslen(CopyPath) + wcslen(FILE_DELTA_STREAM_NAME) + 1;
+    WCHAR *StreamPath = Dll_AllocTemp(len * sizeof(WCHAR));
+    wcscpy(StreamPath, CopyPath);
+    wcscat(StreamPath, FILE_DELTA_STREAM_NAME);
+    return StreamPath;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_QueryTrue
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_QueryTrue(
+    HANDLE TrueHandle, ULONGLONG *WriteTime, ULONGLONG *FileId)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_BASIC_INFORMATION basic_info;
+    FILE_INTERNAL_INFORMATION internal_info;
+
+    status = __sys_NtQueryInformationFile(
+        TrueHandle, &IoStatusBlock, &basic_info,
+        sizeof(FILE_BASIC_INFORMATION), FileBasicInformation);
+
+    if (NT_SUCCESS(status) && FileId) {
+
+        status = __sys_NtQueryInformationFile(
+            TrueHandle, &IoStatusBlock, &internal_info,
+            sizeof(FILE_INTERNAL_INFORMATION), FileInternalInformation);
+
+        if (NT_SUCCESS(status))
+            *FileId = internal_info.IndexNumber.QuadPart;
+    }
+
+    if (NT_SUCCESS(status))
+        *WriteTime = basic_info.LastWriteTime.QuadPart;
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_CheckTrue
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_CheckTrue(FILE_DELTA *delta)
+{
+    NTSTATUS status;
+    ULONGLONG WriteTime;
+
+    //
+    // the true file may be modified outside the sandbox while the delta
+    // is open, its holes must then no longer be served from the true file.
+    // the file id can't change for an open handle, see File_Delta_Open
+    //
+
+    status = File_Delta_QueryTrue(delta->TrueHandle, &WriteTime, NULL);
+
+    if (NT_SUCCESS(status) && WriteTime != delta->TrueWriteTime)
+        status = STATUS_FILE_INVALID;
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_Create
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_Create(
+    HANDLE CopyHandle, HANDLE TrueHandle,
+    const WCHAR *TruePath, const WCHAR *CopyPath, ULONGLONG file_size)
+{
+    NTSTATUS status;
+    HANDLE StreamHandle;
+    OBJECT_ATTRIBUTES objattrs;
+    UNICODE_STRING objname;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_COPY_FS_SIZE_INFORMATION size_info;
+    FILE_DELTA_HEADER *header;
+    ULONG header_len, path_len, block_size;
+    ULONGLONG true_write_time, true_file_id;
+    WCHAR *StreamPath;
+
+    //
+    // the delta is only valid for this very version of the true file
+    //
+
+    status = File_Delta_QueryTrue(TrueHandle, &true_write_time, &true_file_id);
+    if (! NT_SUCCESS(status))
+        return status;
+
+    //
+    // the copy file is sparse, so unmodified blocks take no space
+    //
+
+    status = __sys_NtFsControlFile(
+        CopyHandle, NULL, NULL, NULL, &IoStatusBlock,
+        FSCTL_SET_SPARSE, NULL, 0, NULL, 0);
+
+    if (! NT_SUCCESS(status))
+        return status;
+
+    //
+    // a block must never share an allocation unit with another block,
+    // on NTFS sparse files are allocated in units of 16 clusters
+    //
+
+    block_size = FILE_DELTA_MIN_BLOCK_SIZE;
+
+    status = __sys_NtQueryVolumeInformationFile(
+        CopyHandle, &IoStatusBlock, &size_info, sizeof(size_info),
+        FileFsSizeInformation);
+
+    if (NT_SUCCESS(status)) {
+
+        ULONG unit = size_info.SectorsPerAllocationUnit
+                   * size_info.BytesPerSector * 16;
+        if (unit > block_size && (unit & (unit - 1)) == 0)
+            block_size = unit;
+    }
+
+    status = File_MigrateFile_SetEndOfFile(CopyHandle, file_size);
+    if (! NT_SUCCESS(status))
+        return status;
+
+    //
+    // write the delta header into the alternate data stream
+    //
+
+    path_len = wcslen(TruePath);
+    header_len = FIELD_OFFSET(FILE_DELTA_HEADER, true_path)
+               + (path_len + 1) * sizeof(WCHAR);
+    header = Dll_AllocTemp(header_len);
+
+    header->magic = FILE_DELTA_MAGIC;
+    header->version = FILE_DELTA_VERSION;
+    header->block_size = block_size;
+    header->true_path_len = path_len;
+    header->true_size = file_size;
+    header->true_write_time = true_write_time;
+    header->true_file_id = true_file_id;
+    wmemcpy(header->true_path, TruePath, path_len + 1);
+
+    StreamPath = File_Delta_StreamPath(CopyPath);
+
+    RtlInitUnicodeString(&objname, StreamPath);
+    InitializeObjectAttributes(
+        &objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, Secure_NormalSD);
+
+    status = __sys_NtCreateFile(
+        &StreamHandle, FILE_GENERIC_WRITE, &objattrs, &IoStatusBlock,
+        NULL, 0, FILE_SHARE_VALID_FLAGS, FILE_OVERWRITE_IF,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+
+    if (NT_SUCCESS(status)) {
+
+        status = __sys_NtWriteFile(
+            StreamHandle, NULL, NULL, NULL, &IoStatusBlock,
+            header, header_len, NULL, NULL);
+
+        NtClose(StreamHandle);
+    }
+
+    Dll_Free(StreamPath);
+    Dll_Free(header);
+
+    if (! NT_SUCCESS(status))
+        return status;
+
+    //
+    // mark the box as containing delta files
+    //
+
+    if (! File_GetAttributes_internal(
+                FILE_DELTA_FLAG_FILE_NAME, NULL, NULL, NULL)) {
+
+        HANDLE hFlagFile;
+        if (File_OpenDataFile(FILE_DELTA_FLAG_FILE_NAME, &hFlagFile, TRUE))
+            NtClose(hFlagFile);
+    }
+
+    File_DeltaEnabled = TRUE;
+
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_ReadHeader
+//---------------------------------------------------------------------------
+
+
+_FX FILE_DELTA_HEADER *File_Delta_ReadHeader(const WCHAR *CopyPath)
+{
+    NTSTATUS status;
+    HANDLE StreamHandle;
+    OBJECT_ATTRIBUTES objattrs;
+    UNICODE_STRING objname;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_DELTA_HEADER *header;
+    ULONG header_max;
+    WCHAR *StreamPath;
+
+    StreamPath = File_Delta_StreamPath(CopyPath);
+
+    RtlInitUnicodeString(&objname, StreamPath);
+    InitializeObjectAttributes(
+        &objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    status = __sys_NtCreateFile(
+        &StreamHandle, FILE_GENERIC_READ, &objattrs, &IoStatusBlock,
+        NULL, 0, FILE_SHARE_VALID_FLAGS, FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+
+    Dll_Free(StreamPath);
+
+    if (! NT_SUCCESS(status))
+        return NULL;
+
+    //
+    // one extra character is allocated to terminate the path
+    //
+
+    header_max = FIELD_OFFSET(FILE_DELTA_HEADER, true_path)
+               + (0x7FFF + 1) * sizeof(WCHAR);
+    header = Dll_AllocTemp(header_max + sizeof(WCHAR));
+
+    status = __sys_NtReadFile(
+        StreamHandle, NULL, NULL, NULL, &IoStatusBlock,
+        header, header_max, NULL, NULL);
+
+    NtClose(StreamHandle);
+
+    if (NT_SUCCESS(status) &&
+            IoStatusBlock.Information >= FIELD_OFFSET(FILE_DELTA_HEADER, true_path) &&
+            header->magic == FILE_DELTA_MAGIC &&
+            header->version == FILE_DELTA_VERSION &&
+            header->block_size >= FILE_DELTA_MIN_BLOCK_SIZE &&
+            (header->block_size & (header->block_size - 1)) == 0 &&
+            header->true_path_len &&
+            header->true_path_len <= 0x7FFF &&
+            FIELD_OFFSET(FILE_DELTA_HEADER, true_path)
+                + header->true_path_len * sizeof(WCHAR)
+                    <= IoStatusBlock.Information) {
+
+        header->true_path[header->true_path_len] = L'\0';
+        return header;
+    }
+
+    Dll_Free(header);
+    return NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_RemoveHeader
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_RemoveHeader(const WCHAR *CopyPath)
+{
+    NTSTATUS status;
+    OBJECT_ATTRIBUTES objattrs;
+    UNICODE_STRING objname;
+    WCHAR *StreamPath;
+
+    StreamPath = File_Delta_StreamPath(CopyPath);
+
+    RtlInitUnicodeString(&objname, StreamPath);
+    InitializeObjectAttributes(
+        &objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    status = __sys_NtDeleteFile(&objattrs);
+
+    Dll_Free(StreamPath);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_Open
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_Open(
+    const WCHAR *CopyPath, const FILE_DELTA_HEADER *header,
+    FILE_DELTA **pdelta)
+{
+    NTSTATUS status;
+    FILE_DELTA *delta;
+    HANDLE TrueHandle;
+    OBJECT_ATTRIBUTES objattrs;
+    UNICODE_STRING objname;
+    IO_STATUS_BLOCK IoStatusBlock;
+    ULONGLONG num_blocks;
+    ULONGLONG true_write_time, true_file_id;
+    ULONG map_len;
+
+    //
+    // all handles to the same copy file share one delta object
+    //
+
+    EnterCriticalSection(&File_DeltaCritSec);
+
+    delta = List_Head(&File_DeltaFiles);
+    while (delta) {
+        if ((! delta->Materialized) && _wcsicmp(delta->CopyPath, CopyPath) == 0) {
+            ++delta->RefCount;
+            break;
+        }
+        delta = List_Next(delta);
+    }
+
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    if (delta) {
+
+        status = File_Delta_CheckTrue(delta);
+        if (NT_SUCCESS(status))
+            *pdelta = delta;
+        else
+            File_Delta_Release(delta);
+        return status;
+    }
+
+    //
+    // open the true file, which provides all unmodified blocks
+    //
+
+    RtlInitUnicodeString(&objname, header->true_path);
+    InitializeObjectAttributes(
+        &objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    status = __sys_NtCreateFile(
+        &TrueHandle, FILE_GENERIC_READ, &objattrs, &IoStatusBlock,
+        NULL, 0, FILE_SHARE_VALID_FLAGS, FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+
+    if (status == STATUS_SHARING_VIOLATION || status == STATUS_ACCESS_DENIED)
+        status = SbieApi_OpenFile(&TrueHandle, header->true_path);
+
+    //
+    // the true file must still be the file which was migrated, and must
+    // not have been modified since.  otherwise the copy file can't be
+    // served, neither lazily nor by materializing it
+    //
+
+    if (NT_SUCCESS(status)) {
+
+        status = File_Delta_QueryTrue(TrueHandle, &true_write_time, &true_file_id);
+
+        if (NT_SUCCESS(status) && (true_write_time != header->true_write_time ||
+                                   true_file_id != header->true_file_id))
+            status = STATUS_FILE_INVALID;
+
+        if (! NT_SUCCESS(status))
+            NtClose(TrueHandle);
+    }
+
+    if (! NT_SUCCESS(status)) {
+
+        WCHAR msg[1024];
+        Sbie_snwprintf(msg, 1024, L"File Delta: can't open %s (%08X)",
+            header->true_path, status);
+        SbieApi_MonitorPutMsg(MONITOR_FILE | MONITOR_TRACE, msg);
+
+        return status;
+    }
+
+    num_blocks = (header->true_size + header->block_size - 1) / header->block_size;
+    map_len = (ULONG)((num_blocks + 31) / 32) * sizeof(ULONG);
+
+    delta = Dll_Alloc(sizeof(FILE_DELTA) + wcslen(CopyPath) * sizeof(WCHAR));
+    memzero(delta, sizeof(FILE_DELTA));
+
+    delta->RefCount = 1;
+    InitializeCriticalSectionAndSpinCount(&delta->CritSec, 1000);
+    delta->TrueHandle = TrueHandle;
+    delta->BlockSize = header->block_size;
+    delta->TrueSize = header->true_size;
+    delta->TrueWriteTime = true_write_time;
+    wcscpy(delta->CopyPath, CopyPath);
+
+    if (map_len) {
+        delta->ValidMap = Dll_Alloc(map_len);
+        memzero(delta->ValidMap, map_len);
+    }
+
+    EnterCriticalSection(&File_DeltaCritSec);
+    List_Insert_After(&File_DeltaFiles, NULL, delta);
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    *pdelta = delta;
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_Release
+//---------------------------------------------------------------------------
+
+
+_FX void File_Delta_Release(FILE_DELTA *delta)
+{
+    BOOLEAN last;
+
+    EnterCriticalSection(&File_DeltaCritSec);
+
+    last = (--delta->RefCount == 0);
+    if (last)
+        List_Remove(&File_DeltaFiles, delta);
+
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    if (last) {
+
+        NtClose(delta->TrueHandle);
+        DeleteCriticalSection(&delta->CritSec);
+        if (delta->ValidMap)
+            Dll_Free(delta->ValidMap);
+        Dll_Free(delta);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_IsValid
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_Delta_IsValid(
+    FILE_DELTA *delta, ULONGLONG start, ULONGLONG end)
+{
+    ULONGLONG first = start / delta->BlockSize;
+    ULONGLONG last = (end - 1) / delta->BlockSize;
+
+    for (; first <= last; ++first) {
+        if (! (delta->ValidMap[first / 32] & (1 << (first % 32))))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_SetValid
+//---------------------------------------------------------------------------
+
+
+_FX void File_Delta_SetValid(
+    FILE_DELTA *delta, ULONGLONG start, ULONGLONG end)
+{
+    ULONGLONG first, last;
+
+    //
+    // only blocks which are covered entirely, the last block of the
+    // true file counts as covered when the range reaches its end
+    //
+
+    first = (start + delta->BlockSize - 1) / delta->BlockSize;
+
+    if (end >= delta->TrueSize)
+        last = (delta->TrueSize + delta->BlockSize - 1) / delta->BlockSize;
+    else
+        last = end / delta->BlockSize;
+
+    for (; first < last; ++first) {
+        InterlockedOr((LONG *)&delta->ValidMap[first / 32], 1 << (first % 32));
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_EnumHoles
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_EnumHoles(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    ULONGLONG start, ULONGLONG end,
+    P_File_Delta_HoleFunc HoleFunc, void *param)
+{
+    FILE_DELTA *delta = dh->Delta;
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    FILE_ALLOCATED_RANGE_BUFFER ranges[32];
+    ULONGLONG pos;
+    ULONG count, i;
+    BOOLEAN more;
+
+    //
+    // only the part of the file which existed at migration time
+    // can have holes which are backed by the true file
+    //
+
+    if (end > delta->TrueSize)
+        end = delta->TrueSize;
+    if (start >= end)
+        return STATUS_SUCCESS;
+
+    if (File_Delta_IsValid(delta, start, end))
+        return STATUS_SUCCESS;
+
+    pos = start;
+    query.FileOffset.QuadPart = start;
+    query.Length.QuadPart = end - start;
+
+    do {
+
+        status = __sys_NtFsControlFile(
+            FileHandle, dh->Event, NULL, NULL, &IoStatusBlock,
+            FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+            ranges, sizeof(ranges));
+
+        status = File_MigrateFile_Wait(status, dh->Event, &IoStatusBlock);
+
+        more = (status == STATUS_BUFFER_OVERFLOW);
+        if ((! NT_SUCCESS(status)) && (! more))
+            return status;
+
+        count = (ULONG)(IoStatusBlock.Information
+                            / sizeof(FILE_ALLOCATED_RANGE_BUFFER));
+
+        for (i = 0; i < count; ++i) {
+
+            ULONGLONG r_start = ranges[i].FileOffset.QuadPart;
+            ULONGLONG r_end = r_start + ranges[i].Length.QuadPart;
+
+            if (r_start < pos)
+                r_start = pos;
+            if (r_end > end)
+                r_end = end;
+            if (r_start >= r_end)
+                continue;
+
+            if (r_start > pos) {
+
+                status = HoleFunc(dh, FileHandle, pos, r_start, param);
+                if (! NT_SUCCESS(status))
+                    return status;
+            }
+
+            File_Delta_SetValid(delta, r_start, r_end);
+
+            pos = r_end;
+        }
+
+        if (! count)
+            break;
+
+        query.FileOffset.QuadPart = pos;
+        query.Length.QuadPart = end - pos;
+
+    } while (more && pos < end);
+
+    if (pos < end)
+        status = HoleFunc(dh, FileHandle, pos, end, param);
+    else
+        status = STATUS_SUCCESS;
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_ReadTrue
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_ReadTrue(
+    FILE_DELTA *delta, UCHAR *Buffer, ULONGLONG offset, ULONG length)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER ReadOffset;
+    ULONG got = 0;
+
+    status = File_Delta_CheckTrue(delta);
+    if (! NT_SUCCESS(status))
+        return status;
+
+    ReadOffset.QuadPart = offset;
+
+    status = __sys_NtReadFile(
+        delta->TrueHandle, NULL, NULL, NULL, &IoStatusBlock,
+        Buffer, length, &ReadOffset, NULL);
+
+    if (NT_SUCCESS(status))
+        got = (ULONG)IoStatusBlock.Information;
+    else if (status == STATUS_END_OF_FILE)
+        status = STATUS_SUCCESS;
+
+    //
+    // the true file may have shrunk since migration
+    //
+
+    if (NT_SUCCESS(status) && got < length)
+        memzero(Buffer + got, length - got);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_PatchHole
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_PatchHole(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    ULONGLONG start, ULONGLONG end, void *param)
+{
+    FILE_DELTA_PATCH *patch = (FILE_DELTA_PATCH *)param;
+    NTSTATUS status;
+
+    __try {
+
+        status = File_Delta_ReadTrue(dh->Delta,
+            patch->Buffer + (start - patch->Offset), start, (ULONG)(end - start));
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_AddHole
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_AddHole(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    ULONGLONG start, ULONGLONG end, void *param)
+{
+    FILE_DELTA_HOLES *holes = (FILE_DELTA_HOLES *)param;
+
+    if (holes->Count >= holes->Max)
+        return STATUS_INTERNAL_ERROR;
+
+    holes->Ranges[holes->Count * 2]     = start;
+    holes->Ranges[holes->Count * 2 + 1] = end;
+    ++holes->Count;
+
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_FillHole
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_FillHole(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    ULONGLONG start, ULONGLONG end, void *param)
+{
+    FILE_DELTA *delta = dh->Delta;
+    NTSTATUS status = STATUS_SUCCESS;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_STANDARD_INFORMATION std_info;
+    LARGE_INTEGER WriteOffset;
+    ULONG buffer_size, length, write_length;
+    BOOLEAN restore_eof = FALSE;
+    UCHAR *buffer;
+
+    buffer_size = FILE_DELTA_BUFFER_SIZE;
+    if (end - start < buffer_size)
+        buffer_size = (ULONG)(end - start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    //
+    // page aligned, so the buffer is also good for unbuffered handles
+    //
+
+    buffer = VirtualAlloc(NULL, buffer_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (! buffer)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    while (start < end) {
+
+        length = (end - start > buffer_size) ? buffer_size : (ULONG)(end - start);
+
+        status = File_Delta_ReadTrue(delta, buffer, start, length);
+        if (! NT_SUCCESS(status))
+            break;
+
+        //
+        // an unbuffered handle can only write whole sectors, the tail
+        // of the true file is rounded up and the end of file restored
+        //
+
+        write_length = length;
+
+        if (dh->Unbuffered && (length & (FILE_DELTA_SECTOR_SIZE - 1))) {
+
+            write_length = (length + FILE_DELTA_SECTOR_SIZE - 1)
+                         & ~(FILE_DELTA_SECTOR_SIZE - 1);
+            memzero(buffer + length, write_length - length);
+
+            status = __sys_NtQueryInformationFile(
+                FileHandle, &IoStatusBlock, &std_info,
+                sizeof(FILE_STANDARD_INFORMATION), FileStandardInformation);
+            if (! NT_SUCCESS(status))
+                break;
+
+            restore_eof = TRUE;
+        }
+
+        WriteOffset.QuadPart = start;
+
+        status = __sys_NtWriteFile(
+            FileHandle, dh->Event, NULL, NULL, &IoStatusBlock,
+            buffer, write_length, &WriteOffset, NULL);
+
+        status = File_MigrateFile_Wait(status, dh->Event, &IoStatusBlock);
+
+        if (restore_eof && NT_SUCCESS(status)) {
+
+            status = File_MigrateFile_SetEndOfFile(
+                        FileHandle, std_info.EndOfFile.QuadPart);
+        }
+
+        if (! NT_SUCCESS(status))
+            break;
+
+        File_Delta_SetValid(delta, start, start + length);
+
+        start += length;
+    }
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_Lock
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_Delta_Lock(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle, BOOLEAN Lock)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER LockOffset, LockLength;
+    ULONG retry;
+
+    LockOffset.QuadPart = FILE_DELTA_LOCK_OFFSET;
+    LockLength.QuadPart = 1;
+
+    if (! Lock) {
+
+        NtUnlockFile(FileHandle, &IoStatusBlock, &LockOffset, &LockLength, 0);
+        return TRUE;
+    }
+
+    //
+    // the lock is not waited on indefinitely, if the caller holds a lock
+    // over the entire file on this same handle, ours will never be granted
+    //
+
+    for (retry = 0; retry < 10; ++retry) {
+
+        status = NtLockFile(
+            FileHandle, dh->Event, NULL, NULL, &IoStatusBlock,
+            &LockOffset, &LockLength, 0, TRUE, TRUE);
+
+        status = File_MigrateFile_Wait(status, dh->Event, &IoStatusBlock);
+
+        if (NT_SUCCESS(status))
+            return TRUE;
+        if (status != STATUS_LOCK_NOT_GRANTED)
+            break;
+
+        Sleep(10);
+    }
+
+    return FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_FillRange
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_FillRange(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    ULONGLONG start, ULONGLONG end)
+{
+    FILE_DELTA *delta = dh->Delta;
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_POSITION_INFORMATION pos_info;
+    BOOLEAN locked, restore_pos = FALSE;
+
+    start -= start % delta->BlockSize;
+    end = (end + delta->BlockSize - 1) & ~((ULONGLONG)delta->BlockSize - 1);
+    if (end > delta->TrueSize)
+        end = delta->TrueSize;
+
+    if (start >= end || File_Delta_IsValid(delta, start, end))
+        return STATUS_SUCCESS;
+
+    //
+    // fills are serialized within the process by the critical section,
+    // and between processes by a byte range lock on the copy file
+    //
+
+    EnterCriticalSection(&delta->CritSec);
+
+    locked = File_Delta_Lock(dh, FileHandle, TRUE);
+
+    //
+    // writing with an explicit offset moves the file pointer
+    // of a synchronous handle, so it must be restored afterwards
+    //
+
+    if (dh->Synchronous) {
+
+        status = __sys_NtQueryInformationFile(
+            FileHandle, &IoStatusBlock, &pos_info,
+            sizeof(FILE_POSITION_INFORMATION), FilePositionInformation);
+
+        restore_pos = NT_SUCCESS(status);
+    }
+
+    status = File_Delta_EnumHoles(
+        dh, FileHandle, start, end, File_Delta_FillHole, NULL);
+
+    if (restore_pos) {
+
+        __sys_NtSetInformationFile(
+            FileHandle, &IoStatusBlock, &pos_info,
+            sizeof(FILE_POSITION_INFORMATION), FilePositionInformation);
+    }
+
+    if (locked)
+        File_Delta_Lock(dh, FileHandle, FALSE);
+
+    LeaveCriticalSection(&delta->CritSec);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_Materialize
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_Materialize(
+    FILE_DELTA *delta, HANDLE FileHandle, FILE_DELTA_HANDLE *dh,
+    ULONGLONG limit)
+{
+    NTSTATUS status;
+    HANDLE CopyHandle = NULL;
+    OBJECT_ATTRIBUTES objattrs;
+    UNICODE_STRING objname;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_DELTA_HANDLE tmp;
+
+    if (limit > delta->TrueSize)
+        limit = delta->TrueSize;
+
+    //
+    // fill all holes through the caller's handle if it can write,
+    // otherwise through a handle of our own
+    //
+
+    if ((! dh) || (! dh->CanWrite)) {
+
+        RtlInitUnicodeString(&objname, delta->CopyPath);
+        InitializeObjectAttributes(
+            &objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+        status = __sys_NtCreateFile(
+            &CopyHandle, FILE_GENERIC_READ | FILE_GENERIC_WRITE,
+            &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_VALID_FLAGS,
+            FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE,
+            NULL, 0);
+
+        if (NT_SUCCESS(status)) {
+
+            memzero(&tmp, sizeof(tmp));
+            tmp.Delta = delta;
+            tmp.Synchronous = TRUE;
+            tmp.CanWrite = TRUE;
+
+            dh = &tmp;
+            FileHandle = CopyHandle;
+        }
+
+    } else
+        status = STATUS_SUCCESS;
+
+    if (NT_SUCCESS(status))
+        status = File_Delta_FillRange(dh, FileHandle, 0, limit);
+
+    if (CopyHandle)
+        NtClose(CopyHandle);
+
+    if (NT_SUCCESS(status)) {
+
+        File_Delta_RemoveHeader(delta->CopyPath);
+
+        EnterCriticalSection(&File_DeltaCritSec);
+        delta->Materialized = TRUE;
+        LeaveCriticalSection(&File_DeltaCritSec);
+    }
+
+    {
+        WCHAR msg[1024];
+        Sbie_snwprintf(msg, 1024, L"File Delta: materialize %s (%08X)",
+            delta->CopyPath, status);
+        SbieApi_MonitorPutMsg(MONITOR_FILE | MONITOR_TRACE, msg);
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_GetMode
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_Delta_GetMode(
+    ACCESS_MASK DesiredAccess, ULONG CreateOptions,
+    BOOLEAN *CanRead, BOOLEAN *CanWrite, BOOLEAN *Lazy)
+{
+    *CanRead = (DesiredAccess & (FILE_READ_DATA | GENERIC_READ |
+                    GENERIC_ALL | MAXIMUM_ALLOWED)) != 0;
+
+    *CanWrite = (DesiredAccess & (FILE_WRITE_DATA | FILE_APPEND_DATA |
+                    GENERIC_WRITE | GENERIC_ALL | MAXIMUM_ALLOWED)) != 0;
+
+    //
+    // a synchronous handle is patched after each read, an asynchronous
+    // handle must be able to write, to fill the holes before each read
+    //
+
+    *Lazy = *CanRead && (*CanWrite || (CreateOptions &
+                (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)));
+
+    return (*CanRead || *CanWrite);
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_CheckOpen
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_CheckOpen(
+    const WCHAR *CopyPath, ACCESS_MASK DesiredAccess,
+    ULONG CreateDisposition, ULONG CreateOptions)
+{
+    NTSTATUS status;
+    FILE_DELTA_HEADER *header;
+    FILE_DELTA *delta;
+    BOOLEAN CanRead, CanWrite, Lazy;
+
+    //
+    // a handle which can't be served lazily needs a full copy file,
+    // which is produced before the handle is opened, as the caller's
+    // share access may not allow us to write to the file afterwards.
+    // if the contents are replaced, see File_Delta_Attach
+    //
+
+    if (CreateDisposition == FILE_SUPERSEDE ||
+        CreateDisposition == FILE_OVERWRITE ||
+        CreateDisposition == FILE_OVERWRITE_IF)
+        return STATUS_SUCCESS;
+
+    if (! File_Delta_GetMode(DesiredAccess, CreateOptions, &CanRead, &CanWrite, &Lazy))
+        return STATUS_SUCCESS;
+    if (Lazy)
+        return STATUS_SUCCESS;
+
+    header = File_Delta_ReadHeader(CopyPath);
+    if (! header)
+        return STATUS_SUCCESS;
+
+    //
+    // the open fails if the holes can't be filled, rather than
+    // letting the caller read zeros in place of the true contents
+    //
+
+    status = File_Delta_Open(CopyPath, header, &delta);
+    Dll_Free(header);
+
+    if (NT_SUCCESS(status)) {
+
+        status = File_Delta_Materialize(delta, NULL, NULL, delta->TrueSize);
+        File_Delta_Release(delta);
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_Attach
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_Attach(
+    HANDLE FileHandle, const WCHAR *CopyPath, ACCESS_MASK DesiredAccess,
+    ULONG CreateDisposition, ULONG CreateOptions)
+{
+    NTSTATUS status;
+    FILE_DELTA_HEADER *header;
+    FILE_DELTA *delta;
+    FILE_DELTA_HANDLE *entry;
+    BOOLEAN CanRead, CanWrite, Lazy;
+
+    //
+    // when the contents are replaced, the true file no longer matters
+    //
+
+    if (CreateDisposition == FILE_SUPERSEDE ||
+        CreateDisposition == FILE_OVERWRITE ||
+        CreateDisposition == FILE_OVERWRITE_IF) {
+
+        File_Delta_RemoveHeader(CopyPath);
+
+        EnterCriticalSection(&File_DeltaCritSec);
+
+        delta = List_Head(&File_DeltaFiles);
+        while (delta) {
+            if (_wcsicmp(delta->CopyPath, CopyPath) == 0)
+                delta->Materialized = TRUE;
+            delta = List_Next(delta);
+        }
+
+        LeaveCriticalSection(&File_DeltaCritSec);
+
+        return STATUS_SUCCESS;
+    }
+
+    if (! File_Delta_GetMode(DesiredAccess, CreateOptions, &CanRead, &CanWrite, &Lazy))
+        return STATUS_SUCCESS;
+    if (! Lazy) // already handled in File_Delta_CheckOpen
+        return STATUS_SUCCESS;
+
+    header = File_Delta_ReadHeader(CopyPath);
+    if (! header)
+        return STATUS_SUCCESS;
+
+    //
+    // without the true file the holes would read as zeros,
+    // so the caller closes the handle and fails the open
+    //
+
+    status = File_Delta_Open(CopyPath, header, &delta);
+    Dll_Free(header);
+
+    if (! NT_SUCCESS(status))
+        return status;
+
+    EnterCriticalSection(&File_DeltaCritSec);
+
+    entry = map_get(&File_DeltaHandles, FileHandle);
+    if (entry) { // stale entry for a reused handle value
+        if (entry->Event)
+            CloseHandle(entry->Event);
+        File_Delta_Release(entry->Delta);
+    } else {
+        entry = map_insert(&File_DeltaHandles, FileHandle, NULL, sizeof(FILE_DELTA_HANDLE));
+        InterlockedIncrement(&File_DeltaHandleCount);
+    }
+
+    entry->Delta = delta;
+    entry->Synchronous = (CreateOptions &
+        (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)) != 0;
+    entry->Unbuffered = (CreateOptions & FILE_NO_INTERMEDIATE_BUFFERING) != 0;
+    entry->CanWrite = CanWrite;
+    entry->Event = entry->Synchronous ? NULL : CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    Handle_RegisterHandler(FileHandle, File_Delta_CloseHandler, NULL, FALSE);
+
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_GetHandle
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_Delta_GetHandle(HANDLE FileHandle, FILE_DELTA_HANDLE *dh)
+{
+    FILE_DELTA_HANDLE *entry;
+    BOOLEAN found = FALSE;
+
+    EnterCriticalSection(&File_DeltaCritSec);
+
+    entry = map_get(&File_DeltaHandles, FileHandle);
+    if (entry && (! entry->Delta->Materialized)) {
+        *dh = *entry;
+        found = TRUE;
+    }
+
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    return found;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_CloseHandler
+//---------------------------------------------------------------------------
+
+
+_FX void File_Delta_CloseHandler(HANDLE FileHandle, void *param)
+{
+    FILE_DELTA_HANDLE *entry;
+    FILE_DELTA_HANDLE dh;
+
+    EnterCriticalSection(&File_DeltaCritSec);
+
+    entry = map_get(&File_DeltaHandles, FileHandle);
+    if (entry) {
+        dh = *entry;
+        map_remove(&File_DeltaHandles, FileHandle);
+        InterlockedDecrement(&File_DeltaHandleCount);
+    }
+
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    if (entry) {
+
+        if (dh.Event)
+            CloseHandle(dh.Event);
+        File_Delta_Release(dh.Delta);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_GetOffset
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_Delta_GetOffset(
+    FILE_DELTA_HANDLE *dh, HANDLE FileHandle,
+    LARGE_INTEGER *ByteOffset, ULONGLONG *Offset)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_POSITION_INFORMATION pos_info;
+
+    __try {
+
+        if (ByteOffset && ByteOffset->HighPart == -1) {
+
+            //
+            // appending writes always start at or beyond the true size
+            //
+
+            if (ByteOffset->LowPart == FILE_WRITE_TO_END_OF_FILE)
+                return FALSE;
+            if (ByteOffset->LowPart == FILE_USE_FILE_POINTER_POSITION)
+                ByteOffset = NULL;
+        }
+
+        if (ByteOffset) {
+            *Offset = ByteOffset->QuadPart;
+            return TRUE;
+        }
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        return FALSE;
+    }
+
+    if (! dh->Synchronous)
+        return FALSE;
+
+    status = __sys_NtQueryInformationFile(
+        FileHandle, &IoStatusBlock, &pos_info,
+        sizeof(FILE_POSITION_INFORMATION), FilePositionInformation);
+
+    if (! NT_SUCCESS(status))
+        return FALSE;
+
+    *Offset = pos_info.CurrentByteOffset.QuadPart;
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_ReadFile
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_Delta_ReadFile(
+    HANDLE FileHandle,
+    HANDLE Event,
+    PIO_APC_ROUTINE ApcRoutine,
+    PVOID ApcContext,
+    PIO_STATUS_BLOCK IoStatusBlock,
+    PVOID Buffer,
+    ULONG Length,
+    PLARGE_INTEGER ByteOffset,
+    PULONG Key,
+    NTSTATUS *pStatus)
+{
+    FILE_DELTA_HANDLE dh_buf, *dh = &dh_buf;
+    FILE_DELTA_HOLES holes;
+    NTSTATUS status;
+    ULONGLONG offset;
+    BOOLEAN HaveOffset;
+    ULONG i;
+
+    if ((! File_DeltaHandleCount) || (! File_Delta_GetHandle(FileHandle, dh)))
+        return FALSE;
+
+    HaveOffset = File_Delta_GetOffset(dh, FileHandle, ByteOffset, &offset);
+
+    //
+    // the read may complete asynchronously, so the holes in the
+    // requested range are filled from the true file beforehand
+    //
+
+    if (! dh->Synchronous) {
+
+        if (HaveOffset && Length) {
+
+            status = File_Delta_FillRange(dh, FileHandle, offset, offset + Length);
+            if (! NT_SUCCESS(status)) {
+                *pStatus = status;
+                return TRUE;
+            }
+        }
+
+        *pStatus = __sys_NtReadFile(
+            FileHandle, Event, ApcRoutine, ApcContext,
+            IoStatusBlock, Buffer, Length, ByteOffset, Key);
+        return TRUE;
+    }
+
+    //
+    // a synchronous read has completed on return, so the holes in the
+    // data that was read can be replaced with the true file contents.
+    //
+    // the holes are collected before the read.  a hole which is filled
+    // or written while the read is in progress would otherwise no longer
+    // show up afterwards, although the read returned zeros for it.
+    // patching it with the true contents is correct either way, as the
+    // read then simply completed before the fill or write
+    //
+
+    holes.Count = 0;
+    holes.Ranges = NULL;
+
+    if (HaveOffset && Length) {
+
+        holes.Max = Length / dh->Delta->BlockSize + 2;
+        holes.Ranges = Dll_AllocTemp(holes.Max * 2 * sizeof(ULONGLONG));
+
+        status = File_Delta_EnumHoles(
+            dh, FileHandle, offset, offset + Length,
+            File_Delta_AddHole, &holes);
+
+        if (! NT_SUCCESS(status)) {
+            Dll_Free(holes.Ranges);
+            *pStatus = status;
+            return TRUE;
+        }
+    }
+
+    status = __sys_NtReadFile(
+        FileHandle, Event, ApcRoutine, ApcContext,
+        IoStatusBlock, Buffer, Length, ByteOffset, Key);
+
+    if (status == STATUS_SUCCESS && holes.Count) {
+
+        ULONGLONG got_end = offset + IoStatusBlock->Information;
+        FILE_DELTA_PATCH patch;
+        patch.Buffer = (UCHAR *)Buffer;
+        patch.Offset = offset;
+
+        for (i = 0; i < holes.Count && NT_SUCCESS(status); ++i) {
+
+            ULONGLONG start = holes.Ranges[i * 2];
+            ULONGLONG end   = holes.Ranges[i * 2 + 1];
+
+            if (end > got_end)
+                end = got_end;
+            if (start >= end) // the holes are in ascending order
+                break;
+
+            status = File_Delta_PatchHole(dh, FileHandle, start, end, &patch);
+        }
+
+        if (! NT_SUCCESS(status))
+            IoStatusBlock->Status = status;
+    }
+
+    if (holes.Ranges)
+        Dll_Free(holes.Ranges);
+
+    *pStatus = status;
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_WriteFile
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_Delta_WriteFile(
+    HANDLE FileHandle, PLARGE_INTEGER ByteOffset, ULONG Length)
+{
+    FILE_DELTA_HANDLE dh_buf, *dh = &dh_buf;
+    FILE_DELTA *delta;
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONGLONG offset, end;
+
+    if ((! File_DeltaHandleCount) || (! Length))
+        return STATUS_SUCCESS;
+
+    if (! File_Delta_GetHandle(FileHandle, dh))
+        return STATUS_SUCCESS;
+
+    if (! File_Delta_GetOffset(dh, FileHandle, ByteOffset, &offset))
+        return STATUS_SUCCESS;
+
+    delta = dh->Delta;
+
+    if (offset >= delta->TrueSize)
+        return STATUS_SUCCESS;
+
+    //
+    // only blocks which the write covers partially need the rest
+    // of their data from the true file
+    //
+
+    end = offset + Length;
+
+    if (offset % delta->BlockSize)
+        status = File_Delta_FillRange(dh, FileHandle, offset, offset + 1);
+
+    if (NT_SUCCESS(status) && (end % delta->BlockSize) && end < delta->TrueSize)
+        status = File_Delta_FillRange(dh, FileHandle, end - 1, end);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_SetEndOfFile
+//---------------------------------------------------------------------------
+
+
+_FX void File_Delta_SetEndOfFile(HANDLE FileHandle, ULONGLONG NewSize)
+{
+    FILE_DELTA_HANDLE dh;
+
+    //
+    // once truncated, a later extension must read as zeros rather
+    // than the true file, so the file is materialized up to the new size
+    //
+
+    if (File_DeltaHandleCount && File_Delta_GetHandle(FileHandle, &dh)) {
+
+        if (NewSize < dh.Delta->TrueSize)
+            File_Delta_Materialize(dh.Delta, FileHandle, &dh, NewSize);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// File_Delta_FsControl
+//---------------------------------------------------------------------------
+
+
+_FX void File_Delta_FsControl(
+    HANDLE FileHandle, ULONG IoControlCode,
+    void *InputBuffer, ULONG InputBufferLength)
+{
+    BOOLEAN materialize = FALSE;
+
+    if (! File_DeltaHandleCount)
+        return;
+
+    //
+    // zeroing a range or clearing the sparse attribute would make
+    // the holes read as zeros, rather than the true file contents
+    //
+
+    if (IoControlCode == FSCTL_SET_ZERO_DATA)
+        materialize = TRUE;
+
+    else if (IoControlCode == FSCTL_SET_SPARSE && InputBuffer
+                && InputBufferLength >= sizeof(BOOLEAN)) {
+
+        __try {
+            materialize = (*(BOOLEAN *)InputBuffer == FALSE);
+        } __except (EXCEPTION_EXECUTE_HANDLER) {
+        }
+    }
+
+    if (materialize)
+        File_MaterializeDelta(FileHandle);
+}
+
+
+//---------------------------------------------------------------------------
+// File_MaterializeDelta
+//---------------------------------------------------------------------------
+
+
+_FX void File_MaterializeDelta(HANDLE FileHandle)
+{
+    FILE_DELTA_HANDLE dh;
+
+    if (File_DeltaHandleCount && FileHandle && File_Delta_GetHandle(FileHandle, &dh))
+        File_Delta_Materialize(dh.Delta, FileHandle, &dh, dh.Delta->TrueSize);
+}
+
+
+//---------------------------------------------------------------------------
+// File_DuplicateDelta
+//---------------------------------------------------------------------------
+
+
+_FX void File_DuplicateDelta(
+    HANDLE OldFileHandle, HANDLE NewFileHandle, BOOLEAN CloseOld)
+{
+    FILE_DELTA_HANDLE *entry, *new_entry;
+    BOOLEAN registered = FALSE;
+
+    if (! File_DeltaHandleCount)
+        return;
+
+    EnterCriticalSection(&File_DeltaCritSec);
+
+    entry = map_get(&File_DeltaHandles, OldFileHandle);
+    if (entry && NewFileHandle && (! map_get(&File_DeltaHandles, NewFileHandle))) {
+
+        new_entry = map_insert(&File_DeltaHandles, NewFileHandle, entry, sizeof(FILE_DELTA_HANDLE));
+        if (new_entry) {
+
+            ++new_entry->Delta->RefCount;
+            if (! new_entry->Synchronous)
+                new_entry->Event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+            InterlockedIncrement(&File_DeltaHandleCount);
+            registered = TRUE;
+        }
+    }
+
+    LeaveCriticalSection(&File_DeltaCritSec);
+
+    if (registered)
+        Handle_RegisterHandler(NewFileHandle, File_Delta_CloseHandler, NULL, FALSE);
+
+    if (entry && CloseOld) {
+
+        Handle_UnRegisterHandler(OldFileHandle, File_Delta_CloseHandler, NULL);
+        File_Delta_CloseHandler(OldFileHandle, NULL);
+    }
+}
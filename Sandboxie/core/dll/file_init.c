@@ -141,12 +141,20 @@ _FX BOOLEAN File_Init(void)
     File_ProxyPipes = Dll_Alloc(sizeof(ULONG) * 256);
     memzero(File_ProxyPipes, sizeof(ULONG) * 256);
 
+    File_ProxyPipeEvents = Dll_Alloc(sizeof(HANDLE) * 256);
+    memzero(File_ProxyPipeEvents, sizeof(HANDLE) * 256);
+
+    File_ProxyPipeStats =
+        SbieApi_QueryConfBool(NULL, L"ProxyPipeStats", FALSE);
+
     SbieDll_MatchPath(L'f', (const WCHAR *)-1); //File_InitPathList();
 
     File_DriveAddSN = SbieApi_QueryConfBool(NULL, L"UseVolumeSerialNumbers", FALSE);
 
     File_UseVolumeGuid = SbieApi_QueryConfBool(NULL, L"UseVolumeGuidWhenNoLetter", FALSE);
 
+    File_InitNameCache();
+
     if (! File_InitDrives(0xFFFFFFFF))
         return FALSE;
 
@@ -725,6 +733,12 @@ _FX BOOLEAN File_InitDrives(ULONG DriveMask)
 
     LeaveCriticalSection(File_DrivesAndLinks_CritSec);
 
+    //
+    // links and short names may resolve differently now
+    //
+
+    File_FlushNameCache();
+
     return TRUE;
 }
 
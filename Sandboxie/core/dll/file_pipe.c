@@ -176,6 +176,10 @@ static NTSTATUS File_NtDeviceIoControlFile(
 
 static ULONG *File_ProxyPipes = NULL;
 
+static HANDLE *File_ProxyPipeEvents = NULL;
+
+static BOOLEAN File_ProxyPipeStats = FALSE;
+
 static const WCHAR *File_NamedPipe = L"\\device\\namedpipe\\";
 static const WCHAR *File_MailSlot  = L"\\device\\mailslot\\";
 
@@ -880,6 +884,23 @@ _FX NTSTATUS File_OpenProxyPipe(
 
                 status = File_AddProxyPipe(FileHandle, rpl->handle);
             }
+
+            //
+            // the ready event lets File_NtReadFile wait for data
+            // without holding a worker thread in SbieSvc
+            //
+
+            if (rpl->ready_event) {
+
+                HANDLE ReadyEvent = (HANDLE)(ULONG_PTR)rpl->ready_event;
+                UCHAR FileIndex;
+
+                if (NT_SUCCESS(status)
+                        && File_GetProxyPipe(*FileHandle, &FileIndex))
+                    File_ProxyPipeEvents[FileIndex] = ReadyEvent;
+                else
+                    NtClose(ReadyEvent);
+            }
         }
 
         Dll_Free(rpl);
@@ -915,9 +936,32 @@ _FX NTSTATUS File_CloseProxyPipe(HANDLE FileHandle)
 
         status = rpl->h.status;
 
-        if (NT_SUCCESS(status))
+        if (NT_SUCCESS(status)) {
+
+            HANDLE ReadyEvent = InterlockedExchangePointer(
+                                    &File_ProxyPipeEvents[FileIndex], NULL);
+            if (ReadyEvent)
+                NtClose(ReadyEvent);
+
             InterlockedExchange(&File_ProxyPipes[FileIndex], 0);
 
+            if (File_ProxyPipeStats
+                    && rpl->h.length >= sizeof(NAMED_PIPE_CLOSE_RPL)) {
+
+                WCHAR text[256];
+                Sbie_snwprintf(text, 256,
+                    L"Proxy pipe %p closed: %I64u reads (%I64u bytes, "
+                    L"%I64u parked, %I64u us wait), "
+                    L"%I64u writes (%I64u bytes, %I64u us wait)",
+                    FileHandle,
+                    rpl->stats.read_count, rpl->stats.read_bytes,
+                    rpl->stats.read_parked, rpl->stats.read_wait_us,
+                    rpl->stats.write_count, rpl->stats.write_bytes,
+                    rpl->stats.write_wait_us);
+                SbieApi_MonitorPutMsg(MONITOR_PIPE | MONITOR_TRACE, text);
+            }
+        }
+
         Dll_Free(rpl);
     }
 
@@ -1022,10 +1066,18 @@ _FX NTSTATUS File_NtReadFile(
     NAMED_PIPE_READ_RPL *rpl;
     NTSTATUS status;
     ULONG handle;
+    UCHAR FileIndex;
+    HANDLE ReadyEvent;
+    ULONG WaitStart, WaitTime;
 
-    handle = File_GetProxyPipe(FileHandle, NULL);
+    handle = File_GetProxyPipe(FileHandle, &FileIndex);
     if (! handle) {
 
+        if (File_Delta_ReadFile(
+                FileHandle, Event, ApcRoutine, ApcContext,
+                IoStatusBlock, Buffer, Length, ByteOffset, Key, &status))
+            return status;
+
         return __sys_NtReadFile(
                     FileHandle, Event, ApcRoutine, ApcContext,
                     IoStatusBlock, Buffer, Length, ByteOffset, Key);
@@ -1038,7 +1090,38 @@ _FX NTSTATUS File_NtReadFile(
 
     req.read_len = Length;
 
-    rpl = (NAMED_PIPE_READ_RPL *)SbieDll_CallServer(&req.h);
+    //
+    // when no data is available yet, SbieSvc parks the read and replies
+    // STATUS_PENDING.  we wait for the ready event and try again, giving
+    // up after ten seconds, like SbieSvc does for a synchronous read
+    //
+
+    ReadyEvent = File_ProxyPipeEvents[FileIndex];
+
+    req.flags = ReadyEvent ? NAMED_PIPE_READ_PARK : 0;
+
+    WaitStart = GetTickCount();
+
+    while (1) {
+
+        rpl = (NAMED_PIPE_READ_RPL *)SbieDll_CallServer(&req.h);
+        if (! rpl || rpl->h.status != STATUS_PENDING || ! ReadyEvent)
+            break;
+
+        Dll_Free(rpl);
+        rpl = NULL;
+
+        WaitTime = GetTickCount() - WaitStart;
+        if (WaitTime >= 10000 ||
+                WaitForSingleObject(ReadyEvent, 10000 - WaitTime)
+                                                    != WAIT_OBJECT_0) {
+
+            IoStatusBlock->Status = STATUS_CANCELLED;
+            IoStatusBlock->Information = 0;
+            return STATUS_CANCELLED;
+        }
+    }
+
     if (! rpl)
         status = STATUS_INSUFFICIENT_RESOURCES;
 
@@ -1049,7 +1132,8 @@ _FX NTSTATUS File_NtReadFile(
 
             IoStatusBlock->Status = (NTSTATUS)(ULONG_PTR)rpl->iosb.status;
             IoStatusBlock->Information = (ULONG_PTR)rpl->iosb.information;
-            memcpy(Buffer, rpl->data, rpl->data_len);
+            if (rpl->data_len <= Length)
+                memcpy(Buffer, rpl->data, rpl->data_len);
         }
 
         Dll_Free(rpl);
@@ -1087,6 +1171,10 @@ _FX NTSTATUS File_NtWriteFile(
     handle = File_GetProxyPipe(FileHandle, NULL);
     if (! handle) {
 
+        status = File_Delta_WriteFile(FileHandle, ByteOffset, Length);
+        if (! NT_SUCCESS(status))
+            return status;
+
         return __sys_NtWriteFile(
                     FileHandle, Event, ApcRoutine, ApcContext,
                     IoStatusBlock, Buffer, Length, ByteOffset, Key);
@@ -1172,8 +1260,13 @@ _FX NTSTATUS File_NtFsControlFile(
             else
                 status = STATUS_ACCESS_DENIED;
 
-        } else
+        } else {
+
+            File_Delta_FsControl(
+                FileHandle, IoControlCode, InputBuffer, InputBufferLength);
+
             status = STATUS_BAD_INITIAL_PC;
+        }
 
         if (status == STATUS_BAD_INITIAL_PC) {
 
@@ -19,6 +19,9 @@
 // File (Snapshot)
 //---------------------------------------------------------------------------
 
+
+#include "common\snapshot_index.h"
+
 //---------------------------------------------------------------------------
 // Defines
 //---------------------------------------------------------------------------
@@ -39,6 +42,7 @@ typedef struct _FILE_SNAPSHOT {
 	//WCHAR					Name[BOXNAME_COUNT];
 	struct _FILE_SNAPSHOT*	Parent;
 	LIST					PathRoot;
+	const SNAPSHOT_INDEX_HEADER* Index;
 } FILE_SNAPSHOT, *PFILE_SNAPSHOT;
 
 
@@ -64,6 +68,7 @@ static void File_ScrambleShortName(WCHAR* ShortName, CCHAR* ShortNameLength, ULO
 static void File_UnScrambleShortName(WCHAR* ShortName, ULONG ScramKey);
 
 static WCHAR* File_MakeSnapshotPath(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyPath);
+static BOOLEAN File_SnapshotMayContain(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyPath);
 static WCHAR* File_FindSnapshotPath(WCHAR* CopyPath);
 static WCHAR* File_ResolveTruePath(WCHAR* TruePath, WCHAR* CopyPath, ULONG* pFlags);
 static ULONG File_IsDeletedEx(const WCHAR* TruePath, const WCHAR* CopyPath, FILE_SNAPSHOT* snapshot);
@@ -210,6 +215,47 @@ _FX WCHAR* File_MakeSnapshotPath(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyP
 }
 
 
+//---------------------------------------------------------------------------
+// File_SnapshotMayContain
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_SnapshotMayContain(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyPath)
+{
+	//
+	// check the snapshot index, if there is one, see snapshot_index.h,
+	// returns FALSE only if the path is known not to be in the snapshot
+	//
+
+	const SNAPSHOT_INDEX_HEADER* Index = Cur_Snapshot->Index;
+	if (!Index)
+		return TRUE;
+
+	ULONG prefixLen = File_FindBoxPrefix(CopyPath);
+	if (prefixLen == 0)
+		return TRUE;
+
+	ULONGLONG hash;
+	if (!SnapshotIndex_Hash(CopyPath + prefixLen, wcslen(CopyPath + prefixLen), &hash))
+		return TRUE;
+
+	const ULONGLONG* hashes = (const ULONGLONG*)(Index + 1);
+	ULONG lo = 0, hi = Index->count;
+	while (lo < hi)
+	{
+		ULONG mid = lo + (hi - lo) / 2;
+		if (hashes[mid] < hash)
+			lo = mid + 1;
+		else if (hashes[mid] > hash)
+			hi = mid;
+		else
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
 //---------------------------------------------------------------------------
 // File_FindSnapshotPath
 //---------------------------------------------------------------------------
@@ -237,6 +283,9 @@ _FX WCHAR* File_FindSnapshotPath(WCHAR* CopyPath)
 
 	for (FILE_SNAPSHOT* Cur_Snapshot = File_Snapshot; Cur_Snapshot != NULL; Cur_Snapshot = Cur_Snapshot->Parent)
 	{
+		if (!File_SnapshotMayContain(Cur_Snapshot, CopyPath))
+			continue;
+
 		WCHAR* TmplName = File_MakeSnapshotPath(Cur_Snapshot, CopyPath);
 		if (!TmplName)
 			break;
@@ -344,7 +393,7 @@ _FX ULONG File_GetPathFlagsEx(const WCHAR *TruePath, const WCHAR *CopyPath, WCHA
 			}
 		}
 
-		if (CopyPath) 
+		if (CopyPath && File_SnapshotMayContain(Cur_Snapshot, CopyPath)) 
 		{
 			//
 			// check if the specified file is present in the current snapshot
@@ -523,6 +572,76 @@ _FX ULONG File_IsDeletedEx(const WCHAR* TruePath, const WCHAR* CopyPath, FILE_SN
 //}
 
 
+//---------------------------------------------------------------------------
+// File_LoadSnapshotIndex
+//---------------------------------------------------------------------------
+
+
+_FX const SNAPSHOT_INDEX_HEADER* File_LoadSnapshotIndex(FILE_SNAPSHOT* Cur_Snapshot)
+{
+	NTSTATUS status;
+	HANDLE hFile, hSection;
+	OBJECT_ATTRIBUTES objattrs;
+	UNICODE_STRING objname;
+	IO_STATUS_BLOCK IoStatusBlock;
+	FILE_STANDARD_INFORMATION info;
+	void* MappedBase = NULL;
+	SIZE_T ViewSize = 0;
+	LARGE_INTEGER offset;
+
+	WCHAR IndexFile[MAX_PATH];
+	wcscpy(IndexFile, Dll_BoxFilePath);
+	wcscat(IndexFile, L"\\");
+	wcscat(IndexFile, File_Snapshot_Prefix);
+	wcscat(IndexFile, Cur_Snapshot->ID);
+	wcscat(IndexFile, L"\\");
+	wcscat(IndexFile, SNAPSHOT_INDEX_FILE_NAME);
+
+	RtlInitUnicodeString(&objname, IndexFile);
+	InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+	status = NtCreateFile(&hFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+	if (!NT_SUCCESS(status))
+		return NULL; // snapshot taken without an index
+
+	status = NtQueryInformationFile(hFile, &IoStatusBlock, &info, sizeof(info), FileStandardInformation);
+	if (NT_SUCCESS(status) && info.EndOfFile.QuadPart < sizeof(SNAPSHOT_INDEX_HEADER))
+		status = STATUS_FILE_CORRUPT_ERROR;
+
+	if (NT_SUCCESS(status)) {
+
+		//
+		// map the index, it is shared by all processes in the box
+		//
+
+		status = NtCreateSection(&hSection, SECTION_MAP_READ | SECTION_QUERY, NULL, NULL, PAGE_READONLY, SEC_COMMIT, hFile);
+		if (NT_SUCCESS(status)) {
+
+			offset.QuadPart = 0;
+			const ULONG xViewShare = 1;
+			status = NtMapViewOfSection(hSection, NtCurrentProcess(), &MappedBase, 0, 0, &offset, &ViewSize, xViewShare, 0, PAGE_READONLY);
+
+			NtClose(hSection);
+		}
+	}
+
+	NtClose(hFile);
+
+	if (!NT_SUCCESS(status))
+		return NULL;
+
+	const SNAPSHOT_INDEX_HEADER* Index = (const SNAPSHOT_INDEX_HEADER*)MappedBase;
+	if (Index->magic != SNAPSHOT_INDEX_MAGIC || Index->version != SNAPSHOT_INDEX_VERSION ||
+			sizeof(SNAPSHOT_INDEX_HEADER) + (ULONGLONG)Index->count * sizeof(ULONGLONG) > (ULONGLONG)info.EndOfFile.QuadPart) {
+
+		NtUnmapViewOfSection(NtCurrentProcess(), MappedBase);
+		return NULL;
+	}
+
+	return Index;
+}
+
+
 //---------------------------------------------------------------------------
 // File_InitSnapshots
 //---------------------------------------------------------------------------
@@ -555,6 +674,8 @@ _FX void File_InitSnapshots(void)
 	{
 		Cur_Snapshot->ScramKey = CRC32(Cur_Snapshot->ID, Cur_Snapshot->IDlen * sizeof(WCHAR));
 
+		Cur_Snapshot->Index = File_LoadSnapshotIndex(Cur_Snapshot);
+
 		WCHAR SnapshotId[26] = L"Snapshot_";
 		wcscat(SnapshotId, Snapshot);
 		
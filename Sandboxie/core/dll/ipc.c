@@ -3888,6 +3888,14 @@ _FX NTSTATUS Ipc_NtCreateSection(
     WCHAR *CopyPath;
     ULONG mp_flags;
 
+    //
+    // a section maps the file directly, bypassing the read hooks which
+    // serve a delta file, so the file must have its full contents first
+    //
+
+    if (FileHandle)
+        File_MaterializeDelta(FileHandle);
+
     //
     // shortcut processing when object name is not specified
     //
@@ -4027,6 +4035,14 @@ _FX NTSTATUS Ipc_NtCreateSectionEx(
     WCHAR *CopyPath;
     ULONG mp_flags;
 
+    //
+    // a section maps the file directly, bypassing the read hooks which
+    // serve a delta file, so the file must have its full contents first
+    //
+
+    if (FileHandle)
+        File_MaterializeDelta(FileHandle);
+
     //
     // shortcut processing when object name is not specified
     //
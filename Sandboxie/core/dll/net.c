@@ -326,6 +326,7 @@ struct NETPROXY_RULE {
 extern POOL*            Dll_Pool;
 
 static LIST             WSA_FwList;
+static NETFW_INDEX*     WSA_FwIndex           = NULL;
 
 static BOOLEAN          WSA_WFPisEnabled      = FALSE;
 static BOOLEAN          WSA_WFPisBlocking     = FALSE;
@@ -915,7 +916,11 @@ _FX int WSA_IsBlockedTraffic(const short *addr, int addrlen, int protocol)
         if(!WSA_GetIP(addr, addrlen, &ip))
             return 1;  // lets block it
 
-        BOOLEAN block = NetFw_BlockTraffic(&WSA_FwList, &ip, port, protocol);
+        BOOLEAN block;
+        if (WSA_FwIndex)
+            block = NetFw_BlockTrafficIndex(WSA_FwIndex, &ip, port, protocol);
+        else
+            block = NetFw_BlockTraffic(&WSA_FwList, &ip, port, protocol);
 
         if (WSA_TraceFlag){
             WCHAR msg[256];
@@ -1582,6 +1587,14 @@ _FX void WSA_InitNetFwRules()
 
         NetFw_AddRule(&WSA_FwList, rule);
     }
+
+    //
+    // compile the rules into a lookup index, if that fails
+    // WSA_IsBlockedTraffic falls back to scanning the rule list
+    //
+
+    if (WSA_FwList.count > 0)
+        WSA_FwIndex = NetFw_BuildIndex(&WSA_FwList, Dll_Pool);
 }
 
 
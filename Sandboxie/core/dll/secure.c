@@ -780,8 +780,11 @@ _FX NTSTATUS Secure_NtDuplicateObject(
                 // SHFileOperation to recover correctly on Windows Vista
                 //
 
-                if(SourceHandle && *TargetHandle)
+                if(SourceHandle && *TargetHandle) {
                     Handle_SetupDuplicate(SourceHandle, *TargetHandle);
+                    File_DuplicateDelta(SourceHandle, *TargetHandle,
+                        (Options & DUPLICATE_CLOSE_SOURCE) != 0);
+                }
             }
 
             if (SourceHandle)
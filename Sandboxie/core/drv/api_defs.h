@@ -166,6 +166,8 @@ enum {
     API_MONITOR_PUT_EX,
     API_UPDATE_CONF,
     API_VERIFY,
+    API_GET_PROCESS_EVENTS,
+    API_QUERY_SYSCALL_PROFILE,
 
     API_LAST
 };
@@ -501,6 +503,84 @@ API_ARGS_FIELD(ULONG* ,param_size_out)
 API_ARGS_FIELD(BOOLEAN ,param_verify)
 API_ARGS_CLOSE(API_SECURE_PARAM_ARGS)
 
+
+typedef struct _API_PROCESS_EVENT {
+
+    ULONG type;                         // API_PROCESS_EVENT_*
+    ULONG process_id;
+    ULONG session_id;
+    ULONG reserved;
+    ULONG64 create_time;
+
+} API_PROCESS_EVENT;
+
+#define API_PROCESS_EVENT_START     1
+#define API_PROCESS_EVENT_EXIT      2
+
+API_ARGS_BEGIN(API_GET_PROCESS_EVENTS_ARGS)
+API_ARGS_FIELD(ULONG64 *,seq_num)       // in: last seen, out: last returned
+API_ARGS_FIELD(ULONG,session_id)        // -1 for all sessions
+API_ARGS_FIELD(API_PROCESS_EVENT *,events)
+API_ARGS_FIELD(ULONG *,count)           // in: capacity, out: returned
+API_ARGS_CLOSE(API_GET_PROCESS_EVENTS_ARGS)
+
+
+//
+// API_QUERY_SYSCALL_PROFILE returns the call counts and latencies of the
+// syscalls made by a process in a box with SyscallProfile=y, as a header
+// followed by one API_SYSCALL_PROFILE_ENTRY for each syscall that was used.
+// latency bucket 0 counts calls below one unit of (1 << unit_shift) ticks
+// of the performance counter, bucket i counts calls below (1 << i) units,
+// the last bucket counts all calls above that
+//
+
+#define API_SYSCALL_PROFILE_BUCKETS     16
+#define API_SYSCALL_PROFILE_RESET       1
+
+typedef struct _API_SYSCALL_PROFILE_HEADER {
+
+    ULONG64 frequency;                  // of the performance counter
+    ULONG unit_shift;
+    ULONG count;                        // of entries which follow
+
+} API_SYSCALL_PROFILE_HEADER;
+
+typedef struct _API_SYSCALL_PROFILE_ENTRY {
+
+    ULONG64 ticks;                      // total time spent in the syscall
+    ULONG count;
+    ULONG syscall_index;
+    ULONG hist[API_SYSCALL_PROFILE_BUCKETS];
+    UCHAR name[64];                     // without the Nt prefix
+
+} API_SYSCALL_PROFILE_ENTRY;
+
+API_ARGS_BEGIN(API_QUERY_SYSCALL_PROFILE_ARGS)
+API_ARGS_FIELD(HANDLE,process_id)
+API_ARGS_FIELD(ULONG,flags)             // API_SYSCALL_PROFILE_RESET
+API_ARGS_FIELD(void *,buffer)
+API_ARGS_FIELD(ULONG,buffer_len)
+API_ARGS_FIELD(ULONG *,result_len)      // out: required size
+API_ARGS_CLOSE(API_QUERY_SYSCALL_PROFILE_ARGS)
+
+
+//
+// API_QUERY_CONF with CONF_GET_SECTION in the index exports all settings
+// of a section into parms[6] as a sequence of CONF_RECORD entries, ended
+// by a zero length.  parms[7] points to the buffer size in bytes, which
+// receives the required size on STATUS_BUFFER_TOO_SMALL
+//
+
+typedef struct _CONF_RECORD {
+
+    ULONG length;                       // of the whole record, 8 aligned
+    ULONG flags;                        // CONF_GET_NO_TEMPLS/NO_GLOBAL
+    ULONG name_len;                     // in wchars, without the null
+    ULONG value_len;                    // in wchars, without the null
+    WCHAR data[1];                      // name, null, value, null
+
+} CONF_RECORD;
+
 #undef API_ARGS_BEGIN
 #undef API_ARGS_FIELD
 #undef API_ARGS_CLOSE
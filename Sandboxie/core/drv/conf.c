@@ -26,6 +26,7 @@
 #include "api.h"
 #include "api_flags.h"
 #include "obj.h"
+#include "ipc.h"
 #include "util.h"
 
 #define KERNEL_MODE
@@ -39,6 +40,11 @@
 //---------------------------------------------------------------------------
 
 
+#define CONF_RECORD_LENGTH(name_len, value_len)                     \
+    ((FIELD_OFFSET(CONF_RECORD, data)                               \
+        + ((name_len) + 1 + (value_len) + 1) * sizeof(WCHAR) + 7) & ~7)
+
+
 //---------------------------------------------------------------------------
 // Structures
 //---------------------------------------------------------------------------
@@ -86,6 +92,17 @@ typedef struct _CONF_SETTING {
 } CONF_SETTING;
 
 
+typedef struct _CONF_EXPORT {
+
+    const WCHAR *name;
+    const WCHAR *value;
+    ULONG flags;
+    ULONG name_len;
+    ULONG value_len;
+
+} CONF_EXPORT;
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -139,6 +156,19 @@ static const WCHAR *Conf_Get_Section_Name(ULONG index, BOOLEAN skip_tmpl);
 static const WCHAR *Conf_Get_Setting_Name(
     const WCHAR *section_name, ULONG index, BOOLEAN skip_tmpl);
 
+static CONF_SETTING *Conf_Get_First_Setting(
+    CONF_SECTION *section, const WCHAR *setting_name, BOOLEAN skip_tmpl);
+
+static ULONG Conf_Export_Values(
+    CONF_SECTION *section, const WCHAR *setting_name, BOOLEAN skip_tmpl,
+    ULONG flags, CONF_EXPORT *out);
+
+static CONF_EXPORT *Conf_Get_Section_Export(
+    const WCHAR *section_name, ULONG index, ULONG *out_count, ULONG *out_max);
+
+static NTSTATUS Conf_Api_Query_Section(
+    PROCESS *proc, const WCHAR *section_name, ULONG index, ULONG64 *parms);
+
 static NTSTATUS Conf_Drop_Section(CONF_DATA *data, CONF_SECTION *section);
 
 static NTSTATUS Conf_Update(CONF_DATA *data, 
@@ -1567,6 +1597,185 @@ _FX const WCHAR *Conf_GetEx(
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Get_First_Setting
+//---------------------------------------------------------------------------
+
+
+_FX CONF_SETTING *Conf_Get_First_Setting(
+    CONF_SECTION *section, const WCHAR *setting_name, BOOLEAN skip_tmpl)
+{
+    CONF_SETTING *setting = NULL;
+
+    if (section) {
+
+        map_iter_t iter2 = map_key_iter(&section->settings_map, setting_name);
+        if (map_next(&section->settings_map, &iter2)) {
+            setting = iter2.value;
+            if (skip_tmpl && setting->from_template)
+                setting = NULL;
+        }
+    }
+
+    return setting;
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Export_Values
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Conf_Export_Values(
+    CONF_SECTION *section, const WCHAR *setting_name, BOOLEAN skip_tmpl,
+    ULONG flags, CONF_EXPORT *out)
+{
+    CONF_SETTING *setting;
+    ULONG count = 0;
+
+    if (! section)
+        return 0;
+
+    map_iter_t iter2 = map_key_iter(&section->settings_map, setting_name);
+    while (map_next(&section->settings_map, &iter2)) {
+        setting = iter2.value;
+        if (skip_tmpl && setting->from_template) {
+            // we can break because template settings come after
+            // all non-template settings
+            break;
+        }
+        out[count].name = setting->name;
+        out[count].value = setting->value;
+        out[count].flags = flags;
+        if (setting->from_template)
+            out[count].flags |= CONF_GET_NO_TEMPLS;
+        ++count;
+    }
+
+    return count;
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Get_Section_Export
+//---------------------------------------------------------------------------
+
+
+_FX CONF_EXPORT *Conf_Get_Section_Export(
+    const WCHAR *section_name, ULONG index, ULONG *out_count, ULONG *out_max)
+{
+    //
+    // collect all values of all settings in a section in one pass, in
+    // the same order and with the same flags that a sequence of indexed
+    // Conf_GetEx calls would produce, i.e. for each setting the values
+    // from the section followed by the values from the global section.
+    // the returned pointers remain valid while the caller holds a
+    // Conf_AdjustUseCount reference
+    //
+
+    CONF_SECTION *section, *global;
+    CONF_SETTING *setting;
+    CONF_EXPORT *export = NULL;
+    BOOLEAN skip_tmpl;
+    BOOLEAN check_global;
+    ULONG count, max;
+    KIRQL irql;
+
+    skip_tmpl = ((index & CONF_GET_NO_TEMPLS) != 0);
+    check_global = ((index & CONF_GET_NO_GLOBAL) == 0);
+
+    *out_count = 0;
+    *out_max = 0;
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceSharedLite(Conf_Lock, TRUE);
+
+    section = Conf_Find_Sections(&Conf_Data, section_name);
+    if (skip_tmpl && section && section->from_template)
+        section = NULL;
+
+    global = NULL;
+    if (check_global && _wcsicmp(section_name, Conf_GlobalSettings) != 0) {
+        global = Conf_Find_Sections(&Conf_Data, Conf_GlobalSettings);
+        if (skip_tmpl && global && global->from_template)
+            global = NULL;
+    }
+
+    if ((! section) && (! global))
+        goto finish;
+
+    //
+    // every value is exported at most twice, once for its own section
+    // and once as a global value following the values of a box setting
+    //
+
+    max = 1;
+    if (section)
+        max += section->settings.count;
+    if (global)
+        max += global->settings.count * 2;
+
+    *out_max = max;
+
+    export = Mem_Alloc(Driver_Pool, max * sizeof(CONF_EXPORT));
+    if (! export)
+        goto finish;
+
+    count = 0;
+
+    if (section) {
+
+        setting = List_Head(&section->settings);
+        while (setting) {
+
+            if (skip_tmpl && setting->from_template)
+                break;
+
+            if (Conf_Get_First_Setting(
+                        section, setting->name, skip_tmpl) == setting) {
+
+                count += Conf_Export_Values(section, setting->name,
+                                skip_tmpl, 0, export + count);
+                count += Conf_Export_Values(global, setting->name,
+                                skip_tmpl, CONF_GET_NO_GLOBAL, export + count);
+            }
+
+            setting = List_Next(setting);
+        }
+    }
+
+    if (global) {
+
+        setting = List_Head(&global->settings);
+        while (setting) {
+
+            if (skip_tmpl && setting->from_template)
+                break;
+
+            if (Conf_Get_First_Setting(
+                        global, setting->name, skip_tmpl) == setting &&
+                (! Conf_Get_First_Setting(
+                        section, setting->name, skip_tmpl))) {
+
+                count += Conf_Export_Values(global, setting->name,
+                                skip_tmpl, CONF_GET_NO_GLOBAL, export + count);
+            }
+
+            setting = List_Next(setting);
+        }
+    }
+
+    *out_count = count;
+
+finish:
+
+    ExReleaseResourceLite(Conf_Lock);
+    KeLowerIrql(irql);
+
+    return export;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Get
 //---------------------------------------------------------------------------
@@ -1747,6 +1956,12 @@ _FX NTSTATUS Conf_Api_Reload(PROCESS *proc, ULONG64 *parms)
         status = STATUS_SUCCESS;
     }
 
+    //
+    // cached IPC access decisions may depend on the old configuration
+    //
+
+    Ipc_InvalidateObjectCaches();
+
     //
     // Check the reconfigure drier flag and if its set, load/unload the components accordingly
     //
@@ -1872,6 +2087,11 @@ _FX NTSTATUS Conf_Api_Query(PROCESS *proc, ULONG64 *parms)
     } else
         return STATUS_INVALID_PARAMETER;
 
+    // export a whole section in one call, see CONF_RECORD
+
+    if ((index & CONF_GET_SECTION) && (! setting_name[0]))
+        return Conf_Api_Query_Section(proc, section_name, index, parms);
+
     no_expand = (index & CONF_GET_NO_EXPAND) != 0;
 
     //
@@ -1968,6 +2188,168 @@ release_and_return:
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Api_Query_Section
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Conf_Api_Query_Section(
+    PROCESS *proc, const WCHAR *section_name, ULONG index, ULONG64 *parms)
+{
+    NTSTATUS status;
+    CONF_EXPORT *export;
+    CONF_EXPAND_ARGS *expand_args = NULL;
+    UNICODE_STRING SidString = { 0 };
+    ULONG SessionId;
+    ULONG count, max, expanded, i;
+    ULONG64 total_len;
+    BOOLEAN no_expand;
+
+    no_expand = (index & CONF_GET_NO_EXPAND) != 0;
+    expanded = 0;
+
+    //
+    // the caller must have specified a section
+    //
+
+    if (! section_name[0])
+        return STATUS_INVALID_PARAMETER;
+
+    Conf_AdjustUseCount(TRUE);
+
+    export = Conf_Get_Section_Export(section_name, index, &count, &max);
+    if (! export) {
+        status = max ? STATUS_INSUFFICIENT_RESOURCES
+                     : STATUS_RESOURCE_NAME_NOT_FOUND;
+        goto release_and_return;
+    }
+
+    //
+    // expand the values, see also Conf_Api_Query
+    //
+
+    if (! no_expand && ! proc) {
+
+        expand_args = Mem_Alloc(Driver_Pool, sizeof(CONF_EXPAND_ARGS));
+        if (! expand_args) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto release_and_return;
+        }
+
+        status = Process_GetSidStringAndSessionId(
+                        NtCurrentProcess(), NULL, &SidString, &SessionId);
+        if (! NT_SUCCESS(status)) {
+            status = STATUS_UNSUCCESSFUL;
+            goto release_and_return;
+        }
+
+        expand_args->pool = Driver_Pool;
+        expand_args->sandbox = (WCHAR *)section_name;
+        expand_args->sid = SidString.Buffer;
+        expand_args->session = &SessionId;
+    }
+
+    total_len = sizeof(ULONG);
+
+    for (i = 0; i < count; ++i) {
+
+        if (! no_expand) {
+
+            WCHAR *value2 = Conf_Expand(
+                proc ? proc->box->expand_args : expand_args,
+                export[i].value, export[i].name);
+            if (! value2) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                goto release_and_return;
+            }
+
+            export[i].value = value2;
+            ++expanded;
+        }
+
+        export[i].name_len = wcslen(export[i].name);
+        export[i].value_len = wcslen(export[i].value);
+
+        total_len += CONF_RECORD_LENGTH(
+                        export[i].name_len, export[i].value_len);
+    }
+
+    if (total_len > 0x7FFFFFFF) {
+        status = STATUS_BUFFER_OVERFLOW;
+        goto release_and_return;
+    }
+
+    //
+    // write the records into the user buffer at parms[6], and the
+    // required size into parms[7]
+    //
+
+    __try {
+
+        UCHAR *user_buf = (UCHAR *)parms[6];
+        ULONG *user_len = (ULONG *)parms[7];
+
+        ProbeForRead(user_len, sizeof(ULONG), sizeof(ULONG));
+        ProbeForWrite(user_len, sizeof(ULONG), sizeof(ULONG));
+
+        if ((ULONG)total_len > *user_len) {
+
+            *user_len = (ULONG)total_len;
+            status = STATUS_BUFFER_TOO_SMALL;
+
+        } else {
+
+            ProbeForWrite(user_buf, (ULONG)total_len, sizeof(ULONG));
+
+            for (i = 0; i < count; ++i) {
+
+                CONF_RECORD *rec = (CONF_RECORD *)user_buf;
+
+                rec->length = CONF_RECORD_LENGTH(
+                        export[i].name_len, export[i].value_len);
+                rec->flags = export[i].flags;
+                rec->name_len = export[i].name_len;
+                rec->value_len = export[i].value_len;
+                memcpy(rec->data, export[i].name,
+                       (export[i].name_len + 1) * sizeof(WCHAR));
+                memcpy(rec->data + export[i].name_len + 1, export[i].value,
+                       (export[i].value_len + 1) * sizeof(WCHAR));
+
+                user_buf += rec->length;
+            }
+
+            *(ULONG *)user_buf = 0;
+            *user_len = (ULONG)total_len;
+
+            status = STATUS_SUCCESS;
+        }
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+release_and_return:
+
+    if (export) {
+
+        for (i = 0; i < expanded; ++i)
+            Mem_FreeString((WCHAR *)export[i].value);
+
+        Mem_Free(export, max * sizeof(CONF_EXPORT));
+    }
+
+    if (SidString.Buffer)
+        RtlFreeUnicodeString(&SidString);
+
+    if (expand_args)
+        Mem_Free(expand_args, sizeof(CONF_EXPAND_ARGS));
+
+    Conf_AdjustUseCount(FALSE);
+
+    return status;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Drop_Section
 //---------------------------------------------------------------------------
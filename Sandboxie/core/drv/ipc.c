@@ -53,6 +53,26 @@ static NTSTATUS Ipc_CheckGenericObject(
     PROCESS *proc, void *Object, UNICODE_STRING *Name,
     ULONG Operation, ACCESS_MASK GrantedAccess);
 
+static UCHAR Ipc_ClassifyGenericObject(
+    PROCESS *proc, POBJECT_TYPE ObjectType, UNICODE_STRING *Name);
+
+static NTSTATUS Ipc_CheckGenericAccess(
+    PROCESS *proc, UCHAR ObjFlags, ULONG Operation, ACCESS_MASK GrantedAccess);
+
+static void Ipc_TraceGenericObject(
+    PROCESS *proc, POBJECT_TYPE ObjectType, UNICODE_STRING *Name,
+    UCHAR ObjFlags, NTSTATUS status, ACCESS_MASK GrantedAccess);
+
+static BOOLEAN Ipc_ObjectCache_Get(
+    PROCESS *proc, void *Object, POBJECT_TYPE ObjectType,
+    UNICODE_STRING *Name, UCHAR *ObjFlags);
+
+static void Ipc_ObjectCache_Insert(
+    PROCESS *proc, void *Object, POBJECT_TYPE ObjectType,
+    UNICODE_STRING *Name, UCHAR ObjFlags, ULONG seq);
+
+static void Ipc_ObjectCache_Clear(PROCESS *proc);
+
 static NTSTATUS Ipc_CheckPortObject(
     PROCESS *proc, void *Object, UNICODE_STRING *Name,
     ULONG Operation, ACCESS_MASK GrantedAccess);
@@ -110,6 +130,8 @@ static PERESOURCE Ipc_DirLock = NULL;
 
 static LIST Ipc_ObjDirs;
 
+static volatile LONG Ipc_ObjectCacheSeq = 0;
+
 //---------------------------------------------------------------------------
 // Structures and Types
 //---------------------------------------------------------------------------
@@ -121,6 +143,29 @@ typedef struct _DIR_OBJ_HANDLE {
 
 } DIR_OBJ_HANDLE;
 
+//
+// per process cache of the name based part of Ipc_CheckGenericObject,
+// the final decision still depends on the operation and granted access,
+// see Ipc_CheckGenericAccess.  only objects opened by name are cached
+//
+
+#define IPC_OBJECT_CACHE_MAX_ENTRIES    512
+
+#define IPC_OBJ_BOXED       0x01    // path leads inside the sandbox
+#define IPC_OBJ_OPEN        0x02    // matches an open path or dynamic port
+#define IPC_OBJ_KNOWN_DLL   0x04    // open path below \KnownDlls
+#define IPC_OBJ_SYMLINK     0x08    // copy path symbolic link
+#define IPC_OBJ_DIRECTORY   0x10    // copy path object directory
+
+typedef struct _IPC_OBJECT_CACHE_ENTRY {
+
+    POBJECT_TYPE type;
+    UCHAR flags;                // IPC_OBJ_*
+    USHORT name_len;            // in bytes, without terminating NULL
+    WCHAR name[1];
+
+} IPC_OBJECT_CACHE_ENTRY;
+
 //---------------------------------------------------------------------------
 // Ipc_Init
 //---------------------------------------------------------------------------
@@ -915,6 +960,9 @@ _FX BOOLEAN Ipc_InitProcess(PROCESS *proc)
 {
     BOOLEAN ok = Ipc_InitPaths(proc);
 
+    map_init(&proc->ipc_object_cache, proc->pool);
+    proc->ipc_object_cache_seq = Ipc_ObjectCacheSeq;
+
     //
     // finish
     //
@@ -957,6 +1005,158 @@ _FX BOOLEAN Ipc_IsRunRestricted(PROCESS *proc)
 }
 
 
+//---------------------------------------------------------------------------
+// Ipc_InvalidateObjectCaches
+//---------------------------------------------------------------------------
+
+
+_FX void Ipc_InvalidateObjectCaches(void)
+{
+    //
+    // called when the configuration or the dynamic ports change,
+    // each process discards its cache when it sees a new sequence number
+    //
+
+    InterlockedIncrement(&Ipc_ObjectCacheSeq);
+}
+
+
+//---------------------------------------------------------------------------
+// Ipc_FlushObjectCache
+//---------------------------------------------------------------------------
+
+
+_FX void Ipc_FlushObjectCache(PROCESS *proc)
+{
+    if (! proc->ipc_lock)
+        return;
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(proc->ipc_lock, TRUE);
+
+    Ipc_ObjectCache_Clear(proc);
+
+    ExReleaseResourceLite(proc->ipc_lock);
+    KeLeaveCriticalRegion();
+}
+
+
+//---------------------------------------------------------------------------
+// Ipc_ObjectCache_Clear
+//---------------------------------------------------------------------------
+
+
+_FX void Ipc_ObjectCache_Clear(PROCESS *proc)
+{
+    //
+    // caller must hold proc->ipc_lock exclusively
+    //
+
+    map_clear(&proc->ipc_object_cache);
+}
+
+
+//---------------------------------------------------------------------------
+// Ipc_ObjectCache_Get
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Ipc_ObjectCache_Get(
+    PROCESS *proc, void *Object, POBJECT_TYPE ObjectType,
+    UNICODE_STRING *Name, UCHAR *ObjFlags)
+{
+    IPC_OBJECT_CACHE_ENTRY *entry;
+    BOOLEAN found = FALSE;
+
+    if (! Name->Length)
+        return FALSE;
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceSharedLite(proc->ipc_lock, TRUE);
+
+    if (proc->ipc_object_cache_seq == (ULONG)Ipc_ObjectCacheSeq) {
+
+        entry = map_get(&proc->ipc_object_cache, Object);
+
+        //
+        // the same address may have been reused for a different object,
+        // so the entry must also match the type and name of the object
+        //
+
+        if (entry && entry->type == ObjectType
+                  && entry->name_len == Name->Length
+                  && memcmp(entry->name, Name->Buffer, Name->Length) == 0) {
+
+            *ObjFlags = entry->flags;
+            found = TRUE;
+        }
+    }
+
+    ExReleaseResourceLite(proc->ipc_lock);
+    KeLeaveCriticalRegion();
+
+    return found;
+}
+
+
+//---------------------------------------------------------------------------
+// Ipc_ObjectCache_Insert
+//---------------------------------------------------------------------------
+
+
+_FX void Ipc_ObjectCache_Insert(
+    PROCESS *proc, void *Object, POBJECT_TYPE ObjectType,
+    UNICODE_STRING *Name, UCHAR ObjFlags, ULONG seq)
+{
+    IPC_OBJECT_CACHE_ENTRY *entry;
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(proc->ipc_lock, TRUE);
+
+    //
+    // don't add a decision which was made before the last invalidation,
+    // or before Ipc_InitProcess has set up the cache
+    //
+
+    if (seq != (ULONG)Ipc_ObjectCacheSeq || ! proc->ipc_object_cache.mem_pool)
+        goto finish;
+
+    if (proc->ipc_object_cache_seq != seq) {
+
+        Ipc_ObjectCache_Clear(proc);
+        proc->ipc_object_cache_seq = seq;
+    }
+
+    //
+    // an existing entry is for an object which was at the same address
+    // before, replace it
+    //
+
+    if (map_get(&proc->ipc_object_cache, Object))
+        map_remove(&proc->ipc_object_cache, Object);
+
+    else if (proc->ipc_object_cache.nnodes >= IPC_OBJECT_CACHE_MAX_ENTRIES)
+        Ipc_ObjectCache_Clear(proc);
+
+    entry = map_insert(&proc->ipc_object_cache, Object, NULL,
+                FIELD_OFFSET(IPC_OBJECT_CACHE_ENTRY, name)
+                    + Name->Length + sizeof(WCHAR));
+    if (entry) {
+
+        entry->type = ObjectType;
+        entry->flags = ObjFlags;
+        entry->name_len = Name->Length;
+        memcpy(entry->name, Name->Buffer, Name->Length);
+        entry->name[Name->Length / sizeof(WCHAR)] = L'\0';
+    }
+
+finish:
+
+    ExReleaseResourceLite(proc->ipc_lock);
+    KeLeaveCriticalRegion();
+}
+
+
 //---------------------------------------------------------------------------
 // Ipc_CheckGenericObject
 //---------------------------------------------------------------------------
@@ -967,184 +1167,270 @@ _FX NTSTATUS Ipc_CheckGenericObject(
     ULONG Operation, ACCESS_MASK GrantedAccess)
 {
     NTSTATUS status;
-    BOOLEAN IsBoxedPath;
     POBJECT_TYPE ObjectType;
+    OBJECT_NAME_INFORMATION *ServerPortName = NULL;
+    ULONG NameLength = 0;
+    BOOLEAN Tracing;
+    UCHAR ObjFlags;
+    ULONG seq;
 
     ObjectType = pObGetObjectType(Object);
 
-    // If the client port object is unnamed, check the server port object. This happens with dynamic ports like the spooler and WPAD.
-    // (and possibly others)
+    Tracing = (proc->ipc_trace & (TRACE_ALLOW | TRACE_DENY))
+           || (Session_MonitorCount && !proc->disable_monitor);
 
-    if (!Name->Length)
-    {
-        OBJECT_NAME_INFORMATION *ServerPortName;
-        ULONG NameLength;
+    //
+    // COM and RPC clients open the same ports over and over, so the
+    // name based classification below is cached per process, see
+    // Ipc_ObjectCache_Get and Ipc_InvalidateObjectCaches
+    //
+
+    seq = (ULONG)Ipc_ObjectCacheSeq;
+
+    if (! Ipc_ObjectCache_Get(proc, Object, ObjectType, Name, &ObjFlags)) {
+
+        //
+        // an unnamed client port is classified by the name of its server
+        // port on every open.  an entry keyed by the address of the client
+        // port would need a reference to stay valid, and would keep the
+        // port alive until the cache is flushed
+        //
+
+        BOOLEAN Cache = (Name->Length != 0);
 
-        status = Obj_GetName(proc->pool, Object, &ServerPortName, &NameLength);
+        // If the client port object is unnamed, check the server port object. This happens with dynamic ports like the spooler and WPAD.
+        // (and possibly others)
 
-        if (ServerPortName && ServerPortName->Name.Buffer &&  ServerPortName->Name.Length)
+        if (!Name->Length)
         {
-            //DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Ipc_CheckGenericObject Server Name = %S\n", ServerPortName->Name.Buffer);
-            Name = &ServerPortName->Name;   // use the server name
+            status = Obj_GetName(proc->pool, Object, &ServerPortName, &NameLength);
+
+            if (ServerPortName && ServerPortName->Name.Buffer &&  ServerPortName->Name.Length)
+            {
+                //DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Ipc_CheckGenericObject Server Name = %S\n", ServerPortName->Name.Buffer);
+                Name = &ServerPortName->Name;   // use the server name
+            }
         }
+
+        //
+        // allow unconditional access to unnamed objects
+        //
+
+        if (! Name->Length)
+            return STATUS_SUCCESS;
+
+        ObjFlags = Ipc_ClassifyGenericObject(proc, ObjectType, Name);
+
+        if (Cache)
+            Ipc_ObjectCache_Insert(
+                proc, Object, ObjectType, Name, ObjFlags, seq);
     }
 
+    status = Ipc_CheckGenericAccess(proc, ObjFlags, Operation, GrantedAccess);
+
     //
-    // allow unconditional access to unnamed objects
+    // trace the request if so desired
     //
 
-    if (! Name->Length)
-        return STATUS_SUCCESS;
+    if (Tracing && Name->Length)
+        Ipc_TraceGenericObject(
+            proc, ObjectType, Name, ObjFlags, status, GrantedAccess);
 
-    ///
-    // check if the specified path leads inside the box
-    //
+    if (ServerPortName && ServerPortName != &Obj_Unnamed)
+        Mem_Free(ServerPortName, NameLength);
 
-    IsBoxedPath = FALSE;
+    // DbgPrint("Process <%06d> Status <%08X> Object <%S>\n", proc->pid, status, Name->Name.Buffer);
 
-    if (Box_IsBoxedPath(proc->box, ipc, Name))
-        IsBoxedPath = TRUE;
+    return status;
+}
 
-    //
-    // allow/deny rules:
-    // if path leads inside the sandbox, we allow access
-    //
 
-    status = STATUS_SUCCESS;
+//---------------------------------------------------------------------------
+// Ipc_ClassifyGenericObject
+//---------------------------------------------------------------------------
 
-    if (! IsBoxedPath) {
 
-        const WCHAR *pattern;
+_FX UCHAR Ipc_ClassifyGenericObject(
+    PROCESS *proc, POBJECT_TYPE ObjectType, UNICODE_STRING *Name)
+{
+    const WCHAR *pattern;
 #ifdef USE_MATCH_PATH_EX
-        ULONG mp_flags;
+    ULONG mp_flags;
 #else
-        BOOLEAN is_open, is_closed;
+    BOOLEAN is_open, is_closed;
 #endif
 
-        //
-        // deny access in two cases:
-        // - if unsandboxed path matches a closed path
-        // - if unsandboxed path does not match an open path
-        //
+    ///
+    // check if the specified path leads inside the box
+    //
+
+    if (Box_IsBoxedPath(proc->box, ipc, Name))
+        return IPC_OBJ_BOXED;
+
+    //
+    // deny access in two cases:
+    // - if unsandboxed path matches a closed path
+    // - if unsandboxed path does not match an open path
+    //
 
 #ifdef USE_MATCH_PATH_EX
-        mp_flags = Process_MatchPathEx(proc, 
-            Name->Buffer, Name->Length / sizeof(WCHAR), L'i',
-            &proc->normal_ipc_paths, &proc->open_ipc_paths, &proc->closed_ipc_paths,
-            NULL, NULL, &pattern);
+    mp_flags = Process_MatchPathEx(proc,
+        Name->Buffer, Name->Length / sizeof(WCHAR), L'i',
+        &proc->normal_ipc_paths, &proc->open_ipc_paths, &proc->closed_ipc_paths,
+        NULL, NULL, &pattern);
 #else
-        pattern = Process_MatchPath(
-            proc->pool,
-            Name->Buffer, Name->Length / sizeof(WCHAR),
-            &proc->open_ipc_paths, &proc->closed_ipc_paths,
-            &is_open, &is_closed);
+    pattern = Process_MatchPath(
+        proc->pool,
+        Name->Buffer, Name->Length / sizeof(WCHAR),
+        &proc->open_ipc_paths, &proc->closed_ipc_paths,
+        &is_open, &is_closed);
 #endif
 
-        //
-        // KnownDll objects:  prevent DELETE access
-        //
+    //
+    // KnownDll objects:  Ipc_CheckGenericAccess prevents DELETE access
+    //
 
 #ifdef USE_MATCH_PATH_EX
-        if (((mp_flags & TRUE_PATH_MASK) == TRUE_PATH_OPEN_FLAG) && pattern[0] == L'\\' && pattern[1] == L'K'
-                    && (wcsncmp(pattern, L"\\KnownDlls", 10) == 0)) { // L"\\KnownDlls\\*", L"\\KnownDlls32\\*",
+    if (((mp_flags & TRUE_PATH_MASK) == TRUE_PATH_OPEN_FLAG) && pattern[0] == L'\\' && pattern[1] == L'K'
+                && (wcsncmp(pattern, L"\\KnownDlls", 10) == 0)) { // L"\\KnownDlls\\*", L"\\KnownDlls32\\*",
 #else
-        if (is_open && pattern[0] == L'\\' && pattern[1] == L'K'
-                    && (wcsncmp(pattern, L"\\KnownDlls", 10) == 0)) { // L"\\KnownDlls\\*", L"\\KnownDlls32\\*",
+    if (is_open && pattern[0] == L'\\' && pattern[1] == L'K'
+                && (wcsncmp(pattern, L"\\KnownDlls", 10) == 0)) { // L"\\KnownDlls\\*", L"\\KnownDlls32\\*",
 #endif
 
-            if (GrantedAccess & (DELETE | SECTION_EXTEND_SIZE))
-                status = STATUS_ACCESS_DENIED;
-        }
+        return IPC_OBJ_KNOWN_DLL;
+    }
 
 #ifdef USE_MATCH_PATH_EX
-        else if (((mp_flags & TRUE_PATH_MASK) != TRUE_PATH_OPEN_FLAG) && ((mp_flags & COPY_PATH_MASK) == COPY_PATH_OPEN_FLAG))
+    else if (((mp_flags & TRUE_PATH_MASK) != TRUE_PATH_OPEN_FLAG) && ((mp_flags & COPY_PATH_MASK) == COPY_PATH_OPEN_FLAG))
 #else
-        else if (!is_open && !is_closed)
+    else if (!is_open && !is_closed)
 #endif
-        {
-            
-            #define IS_OBJECT_TYPE(l,t) (ObjectType && ObjectType->Name.Length == l * sizeof(WCHAR) \
-                                    && ObjectType->Name.Buffer && _wcsnicmp(ObjectType->Name.Buffer, t, l) == 0)
+    {
 
-            if (IS_OBJECT_TYPE(12, L"SymbolicLink")) {
+        #define IS_OBJECT_TYPE(l,t) (ObjectType && ObjectType->Name.Length == l * sizeof(WCHAR) \
+                                && ObjectType->Name.Buffer && _wcsnicmp(ObjectType->Name.Buffer, t, l) == 0)
 
-                //
-                // we enforce only CreateSymbolicLinkObject to use copy paths, 
-                // OpenSymbolicLinkObject can use true paths if the access is read only
-                //
+        if (IS_OBJECT_TYPE(12, L"SymbolicLink"))
+            return IPC_OBJ_SYMLINK;
 
-                ACCESS_MASK RestrictedAccess = DELETE | WRITE_OWNER | WRITE_DAC;
-                RestrictedAccess |= SYMBOLIC_LINK_SET;
-                if(Operation == OBJ_OP_OPEN && (GrantedAccess & RestrictedAccess) == 0)
-#ifdef USE_MATCH_PATH_EX
-                    mp_flags = TRUE_PATH_OPEN_FLAG;
-#else
-                    is_open = TRUE;
-#endif
-            }
+        else if (IS_OBJECT_TYPE(9, L"Directory"))
+            return IPC_OBJ_DIRECTORY;
 
-            else if (IS_OBJECT_TYPE(9, L"Directory")) {
+        else //if (IS_OBJECT_TYPE(9, L"ALPC Port"))
 
-                //
-                // we only enforce CreateDirectoryObject/CreateDirectoryObjectEx
-                //
-                // it seems that named object creation always does an additional access check
-                // regardless of what access is granted on the root handle
-                //
+        if (Ipc_Dynamic_Ports.pPortLock)
+        {
+            KeEnterCriticalRegion();
+            ExAcquireResourceSharedLite(Ipc_Dynamic_Ports.pPortLock, TRUE);
 
-                ACCESS_MASK RestrictedAccess = DELETE | WRITE_OWNER | WRITE_DAC;
-                //RestrictedAccess |= DIRECTORY_CREATE_OBJECT | DIRECTORY_CREATE_SUBDIRECTORY;
-                if (!proc->ipc_namespace_isoaltion || (Operation == OBJ_OP_OPEN && (GrantedAccess & RestrictedAccess) == 0))
+            IPC_DYNAMIC_PORT* port = List_Head(&Ipc_Dynamic_Ports.Ports);
+            while (port)
+            {
+                if (_wcsicmp(Name->Buffer, port->wstrPortName) == 0)
+                {
+                    // dynamic version of RPC ports, see also ipc_spl.c
+                    // and RpcBindingFromStringBindingW in core/dll/rpcrt.c
 #ifdef USE_MATCH_PATH_EX
                     mp_flags = TRUE_PATH_OPEN_FLAG;
 #else
                     is_open = TRUE;
 #endif
-            }
-            
-            else //if (IS_OBJECT_TYPE(9, L"ALPC Port"))
-               
-            if (Ipc_Dynamic_Ports.pPortLock)
-            {
-                KeEnterCriticalRegion();
-                ExAcquireResourceSharedLite(Ipc_Dynamic_Ports.pPortLock, TRUE);
-        
-                IPC_DYNAMIC_PORT* port = List_Head(&Ipc_Dynamic_Ports.Ports);
-                while (port) 
-                {    
-                    if (_wcsicmp(Name->Buffer, port->wstrPortName) == 0)
-                    {
-                        // dynamic version of RPC ports, see also ipc_spl.c
-                        // and RpcBindingFromStringBindingW in core/dll/rpcrt.c
-#ifdef USE_MATCH_PATH_EX
-                        mp_flags = TRUE_PATH_OPEN_FLAG;
-#else
-                        is_open = TRUE;
-#endif
-                        break;
-                    }
-
-                    port = List_Next(port);
+                    break;
                 }
-        
-                ExReleaseResourceLite(Ipc_Dynamic_Ports.pPortLock);
-                KeLeaveCriticalRegion();
+
+                port = List_Next(port);
             }
 
-            #undef IS_OBJECT_TYPE
+            ExReleaseResourceLite(Ipc_Dynamic_Ports.pPortLock);
+            KeLeaveCriticalRegion();
         }
 
+        #undef IS_OBJECT_TYPE
+    }
+
 #ifdef USE_MATCH_PATH_EX
-        if ((mp_flags & TRUE_PATH_MASK) == 0 || ((mp_flags & TRUE_PATH_MASK) != TRUE_PATH_OPEN_FLAG))
+    if ((mp_flags & TRUE_PATH_MASK) == 0 || ((mp_flags & TRUE_PATH_MASK) != TRUE_PATH_OPEN_FLAG))
 #else
-        if (is_closed || (! is_open))
+    if (is_closed || (! is_open))
 #endif
-            status = STATUS_ACCESS_DENIED;
-    }
+        return 0;
+
+    return IPC_OBJ_OPEN;
+}
+
+
+//---------------------------------------------------------------------------
+// Ipc_CheckGenericAccess
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Ipc_CheckGenericAccess(
+    PROCESS *proc, UCHAR ObjFlags, ULONG Operation, ACCESS_MASK GrantedAccess)
+{
+    ACCESS_MASK RestrictedAccess;
 
     //
-    // trace the request if so desired
+    // allow/deny rules:
+    // if path leads inside the sandbox, we allow access
+    //
+
+    if (ObjFlags & (IPC_OBJ_BOXED | IPC_OBJ_OPEN))
+        return STATUS_SUCCESS;
+
     //
+    // KnownDll objects:  prevent DELETE access
+    //
+
+    if (ObjFlags & IPC_OBJ_KNOWN_DLL) {
+
+        if (GrantedAccess & (DELETE | SECTION_EXTEND_SIZE))
+            return STATUS_ACCESS_DENIED;
+        return STATUS_SUCCESS;
+    }
+
+    if (ObjFlags & IPC_OBJ_SYMLINK) {
+
+        //
+        // we enforce only CreateSymbolicLinkObject to use copy paths,
+        // OpenSymbolicLinkObject can use true paths if the access is read only
+        //
+
+        RestrictedAccess = DELETE | WRITE_OWNER | WRITE_DAC;
+        RestrictedAccess |= SYMBOLIC_LINK_SET;
+        if(Operation == OBJ_OP_OPEN && (GrantedAccess & RestrictedAccess) == 0)
+            return STATUS_SUCCESS;
+    }
+
+    else if (ObjFlags & IPC_OBJ_DIRECTORY) {
+
+        //
+        // we only enforce CreateDirectoryObject/CreateDirectoryObjectEx
+        //
+        // it seems that named object creation always does an additional access check
+        // regardless of what access is granted on the root handle
+        //
+
+        RestrictedAccess = DELETE | WRITE_OWNER | WRITE_DAC;
+        //RestrictedAccess |= DIRECTORY_CREATE_OBJECT | DIRECTORY_CREATE_SUBDIRECTORY;
+        if (!proc->ipc_namespace_isoaltion || (Operation == OBJ_OP_OPEN && (GrantedAccess & RestrictedAccess) == 0))
+            return STATUS_SUCCESS;
+    }
+
+    return STATUS_ACCESS_DENIED;
+}
+
+
+//---------------------------------------------------------------------------
+// Ipc_TraceGenericObject
+//---------------------------------------------------------------------------
+
+
+_FX void Ipc_TraceGenericObject(
+    PROCESS *proc, POBJECT_TYPE ObjectType, UNICODE_STRING *Name,
+    UCHAR ObjFlags, NTSTATUS status, ACCESS_MASK GrantedAccess)
+{
+    BOOLEAN IsBoxedPath = (ObjFlags & IPC_OBJ_BOXED) != 0;
 
     if (proc->ipc_trace & (TRACE_ALLOW | TRACE_DENY)) {
 
@@ -1209,10 +1495,6 @@ _FX NTSTATUS Ipc_CheckGenericObject(
             mon_type |= MONITOR_DENY;
         Session_MonitorPut(mon_type, mon_name, proc->pid);
     }
-
-    // DbgPrint("Process <%06d> Status <%08X> Object <%S>\n", proc->pid, status, Name->Name.Buffer);
-
-    return status;
 }
 
 
@@ -79,6 +79,10 @@ BOOLEAN Ipc_InitProcess(PROCESS *proc);
 
 BOOLEAN Ipc_IsRunRestricted(PROCESS *proc);
 
+void Ipc_FlushObjectCache(PROCESS *proc);
+
+void Ipc_InvalidateObjectCaches(void);
+
 
 //---------------------------------------------------------------------------
 
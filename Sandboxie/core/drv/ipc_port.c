@@ -685,6 +685,8 @@ _FX NTSTATUS Ipc_Api_OpenDynamicPort(PROCESS* proc, ULONG64* parms)
 
         ExReleaseResourceLite(Ipc_Dynamic_Ports.pPortLock);
         KeLeaveCriticalRegion();
+
+        Ipc_InvalidateObjectCaches();
     }
 
     //
@@ -701,6 +703,8 @@ _FX NTSTATUS Ipc_Api_OpenDynamicPort(PROCESS* proc, ULONG64* parms)
             Process_AddPath(proc, &proc->open_ipc_paths, NULL, FALSE, portName, FALSE);
 
             ExReleaseResourceLite(proc->ipc_lock);
+
+            Ipc_InvalidateObjectCaches();
         }
         else
             status = STATUS_NOT_FOUND;
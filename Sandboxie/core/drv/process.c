@@ -37,6 +37,7 @@
 #include "token.h"
 #include "thread.h"
 #include "wfp.h"
+#include "syscall.h"
 #include "common/my_version.h"
 #define KERNEL_MODE
 #include "verify.h"
@@ -81,6 +82,12 @@ static void Process_NotifyImage(
 static NTSTATUS Process_CreateUserProcess(
     PROCESS *proc, SYSCALL_ENTRY *syscall_entry, ULONG_PTR *user_args);
 
+static void *Process_LookupTable_Update(void);
+
+static void Process_LookupTable_Free(void *old_table);
+
+static BOOLEAN Process_LookupTable_Find(HANDLE ProcessId, PROCESS **out_proc);
+
 //---------------------------------------------------------------------------
 
 
@@ -104,6 +111,46 @@ HASH_MAP Process_MapDfp;
 HASH_MAP Process_MapFcp;
 PERESOURCE Process_ListLock = NULL;
 
+//
+// read only copy of Process_Map for lock free lookups, rebuilt whenever
+// Process_Map changes, see Process_LookupTable_Update
+//
+
+typedef struct _PROCESS_LOOKUP_SLOT {
+
+    HANDLE pid;
+    PROCESS *proc;
+
+} PROCESS_LOOKUP_SLOT;
+
+typedef struct _PROCESS_LOOKUP_TABLE {
+
+    ULONG mask;
+    ULONG count;
+    PROCESS_LOOKUP_SLOT slots[1];
+
+} PROCESS_LOOKUP_TABLE;
+
+static void *volatile Process_LookupTable = NULL;  // PROCESS_LOOKUP_TABLE
+
+//
+// one counter per processor, odd while that processor is inside
+// Process_LookupTable_Find, padded so the processors do not share
+// a cache line
+//
+
+typedef struct _PROCESS_LOOKUP_READER {
+
+    volatile LONG seq;
+    UCHAR padding[64 - sizeof(LONG)];
+
+} PROCESS_LOOKUP_READER;
+
+static PROCESS_LOOKUP_READER *Process_LookupReaders = NULL;
+static ULONG Process_LookupReaderCount = 0;
+
+#define PROCESS_LOOKUP_HASH(pid)    ((ULONG)((ULONG_PTR)(pid) >> 2) * 2654435761U)
+
 static BOOLEAN Process_NotifyImageInstalled = FALSE;
 static BOOLEAN Process_NotifyProcessInstalled = FALSE;
 
@@ -139,9 +186,27 @@ _FX BOOLEAN Process_Init(void)
     if (! Mem_GetLockResource(&Process_ListLock, TRUE))
         return FALSE;
 
+    //
+    // without the reader counters no table is published, and
+    // Process_Find always uses Process_ListLock
+    //
+
+    Process_LookupReaderCount =
+        KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    Process_LookupReaders = ExAllocatePoolWithTag(NonPagedPool,
+        sizeof(PROCESS_LOOKUP_READER) * Process_LookupReaderCount, tzuk);
+    if (Process_LookupReaders) {
+        memzero(Process_LookupReaders,
+            sizeof(PROCESS_LOOKUP_READER) * Process_LookupReaderCount);
+        Process_LookupTable_Update();
+    } else
+        Process_LookupReaderCount = 0;
+
     if (! Process_Low_Init())
         return FALSE;
 
+    Process_InitEvents();
+
     //
     // install process notify routines
     //
@@ -210,6 +275,7 @@ _FX BOOLEAN Process_Init(void)
     Api_SetFunction(API_QUERY_PATH_LIST,      Process_Api_QueryPathList);
     Api_SetFunction(API_ENUM_PROCESSES,       Process_Api_Enum);
     Api_SetFunction(API_KILL_PROCESS,         Process_Api_Kill);
+    Api_SetFunction(API_GET_PROCESS_EVENTS,   Process_Api_GetEvents);
 
     return TRUE;
 }
@@ -260,8 +326,18 @@ _FX void Process_Unload(BOOLEAN FreeLock)
 
     Process_Low_Unload();
 
-    if (FreeLock)
+    if (FreeLock) {
+
+        Process_LookupTable_Free(
+            InterlockedExchangePointer(&Process_LookupTable, NULL));
+
+        if (Process_LookupReaders) {
+            ExFreePoolWithTag(Process_LookupReaders, tzuk);
+            Process_LookupReaders = NULL;
+        }
+
         Mem_FreeLockResource(&Process_ListLock);
+    }
 }
 
 
@@ -428,6 +504,160 @@ _FX NTSTATUS Process_HookProcessNotify(
 #endif
 
 
+//---------------------------------------------------------------------------
+// Process_LookupTable_Update
+//---------------------------------------------------------------------------
+
+
+_FX void *Process_LookupTable_Update(void)
+{
+    PROCESS_LOOKUP_TABLE *table;
+    map_iter_t iter;
+    ULONG mask, size, i;
+
+    //
+    // caller must hold Process_ListLock exclusively, or be Process_Init.
+    // the new table is filled completely before it is published, and the
+    // previous table is returned to the caller, which has to pass it to
+    // Process_LookupTable_Free after releasing Process_ListLock.
+    //
+    // the table is kept at most half full, so a lookup for a process
+    // which is not in the table stops at an empty slot quickly
+    //
+
+    if (! Process_LookupReaders)
+        return NULL;
+
+    for (mask = 63; mask < (ULONG)Process_Map.nnodes * 2; mask = (mask << 1) | 1)
+        ;
+
+    size = FIELD_OFFSET(PROCESS_LOOKUP_TABLE, slots)
+         + sizeof(PROCESS_LOOKUP_SLOT) * (mask + 1);
+
+    table = ExAllocatePoolWithTag(NonPagedPool, size, tzuk);
+    if (table) {
+
+        memzero(table, size);
+        table->mask = mask;
+
+        iter = map_iter();
+        while (map_next(&Process_Map, &iter)) {
+
+            HANDLE pid = *(HANDLE *)iter.key;   // keys are stored by value
+
+            i = PROCESS_LOOKUP_HASH(pid) & mask;
+            while (table->slots[i].pid)
+                i = (i + 1) & mask;
+
+            table->slots[i].pid = pid;
+            table->slots[i].proc = iter.value;
+            ++table->count;
+        }
+    }
+
+    //
+    // if the allocation failed, no table is published and
+    // Process_Find uses Process_ListLock until the next update
+    //
+
+    return InterlockedExchangePointer(&Process_LookupTable, table);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_LookupTable_Free
+//---------------------------------------------------------------------------
+
+
+_FX void Process_LookupTable_Free(void *old_table)
+{
+    ULONG i;
+
+    if (! old_table)
+        return;
+
+    //
+    // the table was replaced with an interlocked exchange, a processor
+    // which entered Process_LookupTable_Find after that sees the new
+    // table.  only a processor whose counter is odd now may still be
+    // looking at the old one, and it leaves within a few probes, as it
+    // runs at DISPATCH_LEVEL.  this replaces a hop of this thread
+    // across every processor, which was paid on every process create
+    // and delete
+    //
+
+    for (i = 0; i < Process_LookupReaderCount; ++i) {
+
+        LONG seq = Process_LookupReaders[i].seq;
+        if (seq & 1) {
+            while (Process_LookupReaders[i].seq == seq)
+                YieldProcessor();
+        }
+    }
+
+    ExFreePoolWithTag(old_table, tzuk);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_LookupTable_Find
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_LookupTable_Find(HANDLE ProcessId, PROCESS **out_proc)
+{
+    PROCESS_LOOKUP_READER *reader;
+    PROCESS_LOOKUP_TABLE *table;
+    PROCESS *proc = NULL;
+    BOOLEAN found = FALSE;
+    KIRQL irql;
+    ULONG i;
+
+    //
+    // returns FALSE if there is no table, in this case the caller
+    // has to look in Process_Map while holding Process_ListLock.
+    // the counter of this processor is odd while the table is read,
+    // the interlocked increment orders it before the table pointer
+    //
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+
+    i = KeGetCurrentProcessorNumberEx(NULL);
+    if (i >= Process_LookupReaderCount) {
+        KeLowerIrql(irql);
+        *out_proc = NULL;
+        return FALSE;
+    }
+
+    reader = &Process_LookupReaders[i];
+    InterlockedIncrement(&reader->seq);
+
+    table = (PROCESS_LOOKUP_TABLE *)Process_LookupTable;
+    if (table) {
+
+        i = PROCESS_LOOKUP_HASH(ProcessId) & table->mask;
+        while (table->slots[i].pid) {
+
+            if (table->slots[i].pid == ProcessId) {
+                proc = table->slots[i].proc;
+                break;
+            }
+
+            i = (i + 1) & table->mask;
+        }
+
+        found = TRUE;
+    }
+
+    InterlockedIncrement(&reader->seq);
+
+    KeLowerIrql(irql);
+
+    *out_proc = proc;
+    return found;
+}
+
+
 //---------------------------------------------------------------------------
 // Process_Find
 //---------------------------------------------------------------------------
@@ -438,6 +668,7 @@ _FX PROCESS *Process_Find(HANDLE ProcessId, KIRQL *out_irql)
     PROCESS *proc;
     KIRQL irql;
     BOOLEAN check_terminated;
+    BOOLEAN locked;
 
     //
     // if we're looking for the current process, then check execution mode
@@ -468,13 +699,21 @@ _FX PROCESS *Process_Find(HANDLE ProcessId, KIRQL *out_irql)
         check_terminated = FALSE;
 
     //
-    // find a PROCESS block that matches the current ProcessId
+    // find a PROCESS block that matches the current ProcessId.  a caller
+    // which does not keep the list locked can use the lock free table
     //
 
-    KeRaiseIrql(APC_LEVEL, &irql);
-    ExAcquireResourceSharedLite(Process_ListLock, TRUE);
+    if ((! out_irql) && Process_LookupTable_Find(ProcessId, &proc))
+        locked = FALSE;
+    else {
+
+        KeRaiseIrql(APC_LEVEL, &irql);
+        ExAcquireResourceSharedLite(Process_ListLock, TRUE);
+
+        proc = map_get(&Process_Map, ProcessId);
+        locked = TRUE;
+    }
 
-    proc = map_get(&Process_Map, ProcessId);
     if (proc) {
 
         if (check_terminated && proc->terminated) {
@@ -502,7 +741,7 @@ _FX PROCESS *Process_Find(HANDLE ProcessId, KIRQL *out_irql)
 
         *out_irql = irql;
 
-    } else {
+    } else if (locked) {
 
         ExReleaseResourceLite(Process_ListLock);
         KeLowerIrql(irql);
@@ -563,6 +802,7 @@ _FX void Process_CreateTerminated(HANDLE ProcessId, ULONG SessionId)
 {
     UNICODE_STRING pid_str;
     PROCESS *proc;
+    void *old_table;
     KIRQL irql;
 
     if (SessionId != -1) { // for StartRunAlertDenied, don't log in this case
@@ -593,8 +833,12 @@ _FX void Process_CreateTerminated(HANDLE ProcessId, ULONG SessionId)
 
         map_insert(&Process_Map, ProcessId, proc, 0);
 
+        old_table = Process_LookupTable_Update();
+
         ExReleaseResourceLite(Process_ListLock);
         KeLowerIrql(irql);
+
+        Process_LookupTable_Free(old_table);
     }
 }
 
@@ -898,6 +1142,8 @@ _FX PROCESS *Process_Create(
     proc->ipc_trace  = Process_GetTraceFlag(proc, L"IpcTrace");
     proc->gui_trace  = Process_GetTraceFlag(proc, L"GuiTrace");
 
+    Syscall_Profile_Create(proc);
+
     //
     // check if OpenWinClass=* is specified for the box
     //
@@ -905,7 +1151,9 @@ _FX PROCESS *Process_Create(
     Gui_Check_OpenWinClass(proc);
 
     //
-    // insert the new process into the list of sandboxed processes
+    // insert the new process into the list of sandboxed processes.
+    // the caller publishes it to lock free lookups once it has finished
+    // setting up the new process, see Process_NotifyProcess_Create
     //
 
     KeRaiseIrql(APC_LEVEL, &irql);
@@ -1137,6 +1385,7 @@ _FX BOOLEAN Process_NotifyProcess_Create(
     BOOLEAN add_process_to_job = FALSE;
 	BOOLEAN create_terminated = FALSE;
     BOOLEAN bHostInject = FALSE;
+    void *old_table;
     KIRQL irql;
 
     //
@@ -1422,8 +1671,12 @@ _FX BOOLEAN Process_NotifyProcess_Create(
             Process_SetTerminated(new_proc, 14);
             new_proc = NULL;
 
+            old_table = Process_LookupTable_Update();
+
             ExReleaseResourceLite(Process_ListLock);
             KeLowerIrql(irql);
+
+            Process_LookupTable_Free(old_table);
         }
         Box_Free(box);
 
@@ -1455,6 +1708,8 @@ _FX BOOLEAN Process_NotifyProcess_Create(
                 const WCHAR* strings[5] = { new_proc->image_path, new_proc->box->name, sParentId, Buffer, NULL };
                 Api_AddMessage(MSG_1399, strings, NULL, new_proc->box->session_id, (ULONG)ProcessId);
 
+                Process_AddEvent(API_PROCESS_EVENT_START, pid, session_id, create_time);
+
                 if (Buffer && Length)
                     Mem_Free(Buffer, Length);
 
@@ -1515,9 +1770,13 @@ _FX BOOLEAN Process_NotifyProcess_Create(
             // we should only use local variables and not touch new_proc
             //
 
+            old_table = Process_LookupTable_Update();
+
             ExReleaseResourceLite(Process_ListLock);
             KeLowerIrql(irql);
 
+            Process_LookupTable_Free(old_table);
+
             if (!Process_Low_Inject(
                 pid, session_id, create_time, nptr1, add_process_to_job, bHostInject)) {
 
@@ -1567,6 +1826,7 @@ _FX void Process_NotifyProcess_Delete(HANDLE ProcessId)
 _FX void Process_Delete(HANDLE ProcessId)
 {
     PROCESS *proc;
+    void *old_table;
     KIRQL irql;
 
     //
@@ -1578,7 +1838,9 @@ _FX void Process_Delete(HANDLE ProcessId)
     KeRaiseIrql(APC_LEVEL, &irql);
     ExAcquireResourceExclusiveLite(Process_ListLock, TRUE);
 
-    map_take(&Process_Map, ProcessId, &proc, 0);
+    old_table = NULL;
+    if (map_take(&Process_Map, ProcessId, &proc, 0))
+        old_table = Process_LookupTable_Update();
 
     Process_DfpDelete(ProcessId);
 
@@ -1587,6 +1849,8 @@ _FX void Process_Delete(HANDLE ProcessId)
     ExReleaseResourceLite(Process_ListLock);
     KeLowerIrql(irql);
 
+    Process_LookupTable_Free(old_table);
+
     if (proc) {
 
         if (proc->pool == Driver_Pool)
@@ -1599,8 +1863,17 @@ _FX void Process_Delete(HANDLE ProcessId)
             // from Process_List.  we have to do some process clean-up
             //
 
+            if (! proc->bHostInject) {
+                Process_AddEvent(API_PROCESS_EVENT_EXIT,
+                    proc->pid, proc->box->session_id, proc->create_time);
+            }
+
             WFP_DeleteProcess(proc);
 
+            Syscall_Profile_Delete(proc);
+
+            Ipc_FlushObjectCache(proc);
+
             Key_UnmountHive(proc);
 
             if (proc->file_lock)
@@ -143,6 +143,7 @@ struct _PROCESS {
     BOOLEAN confidential_box;
 
     ULONG call_trace;
+    struct _SYSCALL_PROFILE *syscall_profile;   // if SyscallProfile=y
 
     // file-related
 
@@ -197,6 +198,8 @@ struct _PROCESS {
     BOOLEAN ipc_open_sam_endpoint;
     BOOLEAN ipc_allowSpoolerPrintToFile;
     BOOLEAN ipc_openPrintSpooler;
+    HASH_MAP ipc_object_cache;          // object -> IPC_OBJECT_CACHE_ENTRY
+    ULONG ipc_object_cache_seq;
 
     // gui-related
 
@@ -491,6 +494,13 @@ BOOLEAN Process_IsInPcaJob(HANDLE ProcessId);
 
 void Process_SetTerminated(PROCESS *proc, ULONG reason);
 
+// Process start and exit events for user mode (process_api.c)
+
+void Process_InitEvents(void);
+
+void Process_AddEvent(
+    ULONG type, HANDLE ProcessId, ULONG SessionId, ULONG64 CreateTime);
+
 
 //
 // low level syscal interface (process_low.c)
@@ -527,6 +537,8 @@ NTSTATUS Process_Api_Enum(PROCESS *proc, ULONG64 *parms);
 
 NTSTATUS Process_Api_Kill(PROCESS *proc, ULONG64 *parms);
 
+NTSTATUS Process_Api_GetEvents(PROCESS *proc, ULONG64 *parms);
+
 
 //---------------------------------------------------------------------------
 // Variables
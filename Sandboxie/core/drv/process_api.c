@@ -1197,4 +1197,175 @@ _FX NTSTATUS Process_Api_Kill(PROCESS *proc, ULONG64 *parms)
     }
 
     return status;
-}
\ No newline at end of file
+}
+
+//---------------------------------------------------------------------------
+// Process Events
+//---------------------------------------------------------------------------
+
+
+//
+// the driver keeps a small ring of recent sandboxed process start and exit
+// events, so that user mode can update its process lists incrementally
+// instead of re enumerating all processes on every refresh
+//
+
+
+#define PROCESS_EVENT_COUNT     1024    // must be a power of two
+#define PROCESS_EVENT_CHUNK     32
+
+
+static API_PROCESS_EVENT Process_Events[PROCESS_EVENT_COUNT];
+static ULONG64 Process_EventSeq = 0;    // sequence number of the last event
+static KSPIN_LOCK Process_EventLock;
+
+
+//---------------------------------------------------------------------------
+// Process_InitEvents
+//---------------------------------------------------------------------------
+
+
+_FX void Process_InitEvents(void)
+{
+    KeInitializeSpinLock(&Process_EventLock);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_AddEvent
+//---------------------------------------------------------------------------
+
+
+_FX void Process_AddEvent(
+    ULONG type, HANDLE ProcessId, ULONG SessionId, ULONG64 CreateTime)
+{
+    API_PROCESS_EVENT *event;
+    KIRQL irql;
+
+    KeAcquireSpinLock(&Process_EventLock, &irql);
+
+    event = &Process_Events[Process_EventSeq & (PROCESS_EVENT_COUNT - 1)];
+    event->type = type;
+    event->process_id = (ULONG)(ULONG_PTR)ProcessId;
+    event->session_id = SessionId;
+    event->reserved = 0;
+    event->create_time = CreateTime;
+
+    ++Process_EventSeq;
+
+    KeReleaseSpinLock(&Process_EventLock, irql);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_Api_GetEvents
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Process_Api_GetEvents(PROCESS *proc, ULONG64 *parms)
+{
+    API_GET_PROCESS_EVENTS_ARGS *args = (API_GET_PROCESS_EVENTS_ARGS *)parms;
+    API_PROCESS_EVENT chunk[PROCESS_EVENT_CHUNK];
+    ULONG64 *user_seq_num;
+    ULONG *user_count;
+    API_PROCESS_EVENT *user_events;
+    ULONG64 seq_num;
+    ULONG session_id;
+    ULONG capacity;
+    ULONG count;
+    KIRQL irql;
+
+    if (proc) // sandboxed processes can't watch other processes
+        return STATUS_NOT_IMPLEMENTED;
+
+    user_seq_num = args->seq_num.val;
+    ProbeForRead(user_seq_num, sizeof(ULONG64), sizeof(ULONG64));
+    ProbeForWrite(user_seq_num, sizeof(ULONG64), sizeof(ULONG64));
+
+    user_count = args->count.val;
+    ProbeForRead(user_count, sizeof(ULONG), sizeof(ULONG));
+    ProbeForWrite(user_count, sizeof(ULONG), sizeof(ULONG));
+
+    seq_num = *user_seq_num;
+    capacity = *user_count;
+    session_id = args->session_id.val;
+
+    user_events = args->events.val;
+    if (capacity) {
+        if (! user_events)
+            return STATUS_INVALID_PARAMETER;
+        ProbeForWrite(user_events, sizeof(API_PROCESS_EVENT) * capacity, sizeof(ULONG64));
+    }
+
+    //
+    // a zero capacity request only returns the current sequence number,
+    // the caller uses it as a starting point before a full enumeration
+    //
+
+    if (capacity == 0) {
+
+        KeAcquireSpinLock(&Process_EventLock, &irql);
+        seq_num = Process_EventSeq;
+        KeReleaseSpinLock(&Process_EventLock, irql);
+
+        *user_seq_num = seq_num;
+        *user_count = 0;
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // copy the events in chunks, we can't touch user memory
+    // while holding the spin lock
+    //
+
+    count = 0;
+    while (count < capacity) {
+
+        ULONG num = 0;
+        ULONG i;
+
+        KeAcquireSpinLock(&Process_EventLock, &irql);
+
+        if (seq_num > Process_EventSeq ||
+                Process_EventSeq - seq_num > PROCESS_EVENT_COUNT) {
+
+            //
+            // events were overwritten before the caller could read them,
+            // report the current position so it can do a full enumeration
+            //
+
+            seq_num = Process_EventSeq;
+            KeReleaseSpinLock(&Process_EventLock, irql);
+
+            *user_seq_num = seq_num;
+            *user_count = 0;
+            return STATUS_REQUEST_OUT_OF_SEQUENCE;
+        }
+
+        while (num < PROCESS_EVENT_CHUNK && seq_num + num < Process_EventSeq) {
+            chunk[num] = Process_Events[(seq_num + num) & (PROCESS_EVENT_COUNT - 1)];
+            ++num;
+        }
+
+        KeReleaseSpinLock(&Process_EventLock, irql);
+
+        if (num == 0)
+            break;
+
+        for (i = 0; i < num && count < capacity; i++) {
+
+            ++seq_num;
+
+            if (session_id != -1 && chunk[i].session_id != session_id)
+                continue;
+
+            memcpy(&user_events[count], &chunk[i], sizeof(API_PROCESS_EVENT));
+            ++count;
+        }
+    }
+
+    *user_seq_num = seq_num;
+    *user_count = count;
+
+    return STATUS_SUCCESS;
+}
@@ -593,11 +593,22 @@ _FX void Session_MonitorPut(ULONG type, const WCHAR *name, HANDLE pid)
 
 
 _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths, HANDLE hpid, HANDLE htid)
+{
+    Session_MonitorPutForSession(-1, type, strings, lengths, hpid, htid);
+}
+
+
+//---------------------------------------------------------------------------
+// Session_MonitorPutForSession
+//---------------------------------------------------------------------------
+
+
+_FX void Session_MonitorPutForSession(ULONG SessionId, ULONG type, const WCHAR** strings, ULONG* lengths, HANDLE hpid, HANDLE htid)
 {
     SESSION *session;
     KIRQL irql;
 
-    session = Session_Get(FALSE, -1, &irql);
+    session = Session_Get(FALSE, SessionId, &irql);
     if (! session)
         return;
 
@@ -50,6 +50,8 @@ void Session_MonitorPut(ULONG type, const WCHAR *name, HANDLE pid);
 
 void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths, HANDLE pid, HANDLE tid);
 
+void Session_MonitorPutForSession(ULONG SessionId, ULONG type, const WCHAR** strings, ULONG* lengths, HANDLE pid, HANDLE tid);
+
 
 //---------------------------------------------------------------------------
 // Variables
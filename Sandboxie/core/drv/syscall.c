@@ -42,12 +42,18 @@
 
 static BOOLEAN Syscall_Init_List(void);
 
+static BOOLEAN Syscall_Init_NameIndex(void);
+
 static BOOLEAN Syscall_Init_Table(void);
 
 static BOOLEAN Syscall_Init_ServiceData(void);
 
 static void Syscall_ErrorForAsciiName(const UCHAR *name_a);
 
+static ULONG Syscall_HashName(const UCHAR *name, ULONG *name_len);
+
+static UCHAR Syscall_GetTraceKind(const UCHAR *name, ULONG name_len);
+
 void Syscall_Update_Config();
 
 
@@ -82,6 +88,13 @@ static NTSTATUS Syscall_Api_Query(PROCESS *proc, ULONG64 *parms);
 
 static NTSTATUS Syscall_Api_Invoke(PROCESS *proc, ULONG64 *parms);
 
+static void Syscall_Profile_Init(void);
+
+static void Syscall_Profile_Add(
+    PROCESS *proc, SYSCALL_ENTRY *entry, LONGLONG start);
+
+static NTSTATUS Syscall_Api_QueryProfile(PROCESS *proc, ULONG64 *parms);
+
 
 //---------------------------------------------------------------------------
 
@@ -98,6 +111,8 @@ static BOOLEAN Syscall_GetKernelAddr(
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, Syscall_Init)
 #pragma alloc_text (INIT, Syscall_Init_List)
+#pragma alloc_text (INIT, Syscall_Init_NameIndex)
+#pragma alloc_text (INIT, Syscall_GetTraceKind)
 #pragma alloc_text (INIT, Syscall_Init_Table)
 #pragma alloc_text (INIT, Syscall_Init_ServiceData)
 #pragma alloc_text (INIT, Syscall_Set1)
@@ -125,6 +140,9 @@ static LIST Syscall_List;
 
 static SYSCALL_ENTRY **Syscall_Table = NULL;
 
+static SYSCALL_ENTRY **Syscall_NameIndex = NULL;
+static ULONG Syscall_NameIndexMask = 0;
+
 static ULONG Syscall_MaxIndex = 0;
 
 static UCHAR *Syscall_NtdllSavedCode = NULL;
@@ -142,6 +160,9 @@ _FX BOOLEAN Syscall_Init(void)
     if (! Syscall_Init_List())
         return FALSE;
 
+    if (! Syscall_Init_NameIndex())
+        return FALSE;
+
     if (! Syscall_Init_Table())
         return FALSE;
 
@@ -185,6 +206,10 @@ _FX BOOLEAN Syscall_Init(void)
     Api_SetFunction(API_QUERY_SYSCALLS,     Syscall_Api_Query);
     Api_SetFunction(API_INVOKE_SYSCALL,     Syscall_Api_Invoke);
 
+    Syscall_Profile_Init();
+
+    Api_SetFunction(API_QUERY_SYSCALL_PROFILE, Syscall_Api_QueryProfile);
+
     //
     // finish
     //
@@ -350,9 +375,11 @@ _FX BOOLEAN Syscall_Init_List(void)
 #endif
         entry->disabled = (Syscall_HookMapMatch(name, name_len, &disabled_hooks) != 0);
         entry->approved = (Syscall_HookMapMatch(name, name_len, &approved_syscalls) != 0);
+        entry->trace_kind = Syscall_GetTraceKind(name, name_len);
         entry->name_len = (USHORT)name_len;
         memcpy(entry->name, name, name_len);
         entry->name[name_len] = '\0';
+        entry->name_hash = Syscall_HashName(entry->name, &name_len);
 
         List_Insert_After(&Syscall_List, NULL, entry);
 
@@ -397,6 +424,92 @@ finish:
 }
 
 
+//---------------------------------------------------------------------------
+// Syscall_Init_NameIndex
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Syscall_Init_NameIndex(void)
+{
+    SYSCALL_ENTRY *entry;
+    ULONG count, size, i;
+
+    //
+    // build an open addressing hash table of all entries, which is at
+    // most half full, so a lookup by name takes only a few probes
+    //
+
+    count = List_Count(&Syscall_List);
+    for (size = 64; size < count * 2; size <<= 1)
+        ;
+
+    Syscall_NameIndex = Mem_AllocEx(Driver_Pool, sizeof(SYSCALL_ENTRY *) * size, TRUE);
+    if (! Syscall_NameIndex)
+        return FALSE;
+    memzero(Syscall_NameIndex, sizeof(SYSCALL_ENTRY *) * size);
+
+    Syscall_NameIndexMask = size - 1;
+
+    entry = List_Head(&Syscall_List);
+    while (entry) {
+
+        i = entry->name_hash & Syscall_NameIndexMask;
+        while (Syscall_NameIndex[i])
+            i = (i + 1) & Syscall_NameIndexMask;
+        Syscall_NameIndex[i] = entry;
+
+        entry = List_Next(entry);
+    }
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Syscall_GetTraceKind
+//---------------------------------------------------------------------------
+
+
+_FX UCHAR Syscall_GetTraceKind(const UCHAR *name, ULONG name_len)
+{
+    static const struct {
+        const UCHAR *name;
+        UCHAR kind;
+    } TraceKinds[] = {
+        { "ConnectPort",                SYSCALL_TRACE_PORT_CONNECT },
+        { "AlpcConnectPort",            SYSCALL_TRACE_PORT_CONNECT },
+        { "AlpcCreatePort",             SYSCALL_TRACE_PORT_CREATE },
+        { "AlpcConnectPortEx",          SYSCALL_TRACE_PORT_CREATE },
+        { "ReplyWaitReceivePort",       SYSCALL_TRACE_PORT_HANDLE },
+        { "ReceiveMessagePort",         SYSCALL_TRACE_PORT_HANDLE },
+        { "AlpcSendReply",              SYSCALL_TRACE_PORT_HANDLE },
+        { "AlpcAcceptConnectPort",      SYSCALL_TRACE_PORT_HANDLE },
+        { "AlpcCreatePortSection",      SYSCALL_TRACE_PORT_HANDLE },
+        // these 2 APIs will generate a lot of output if we don't check status
+        { "AlpcSendWaitReceivePort",    SYSCALL_TRACE_PORT_HANDLE_FAIL },
+        { "RequestWaitReplyPort",       SYSCALL_TRACE_PORT_HANDLE_FAIL },
+        { "OpenDirectoryObject",        SYSCALL_TRACE_OPEN_DIRECTORY },
+        { "QueryFullAttributesFile",    SYSCALL_TRACE_FILE_ATTRIBUTES },
+        { "QueryInformationFile",       SYSCALL_TRACE_FILE_HANDLE },
+        { "FsControlFile",              SYSCALL_TRACE_FILE_HANDLE },
+        { "Close",                      SYSCALL_TRACE_FILE_HANDLE },
+        { "CreateFile",                 SYSCALL_TRACE_FILE_OPEN },
+        { "OpenFile",                   SYSCALL_TRACE_FILE_OPEN },
+        { "DeviceIoControlFile",        SYSCALL_TRACE_DEVICE_IO_CONTROL },
+        { NULL,                         SYSCALL_TRACE_NONE }
+    };
+    ULONG i;
+
+    for (i = 0; TraceKinds[i].name; ++i) {
+        if (strlen(TraceKinds[i].name) == name_len
+                && memcmp(TraceKinds[i].name, name, name_len) == 0)
+            return TraceKinds[i].kind;
+    }
+
+    return SYSCALL_TRACE_NONE;
+}
+
+
 //---------------------------------------------------------------------------
 // Syscall_Init_Table
 //---------------------------------------------------------------------------
@@ -499,18 +612,24 @@ _FX BOOLEAN Syscall_Init_ServiceData(void)
 
 _FX SYSCALL_ENTRY *Syscall_GetByName(const UCHAR *name)
 {
-    ULONG name_len = strlen(name);
+    ULONG name_len;
+    ULONG name_hash = Syscall_HashName(name, &name_len);
+    SYSCALL_ENTRY *entry;
+    ULONG i;
 
-    SYSCALL_ENTRY *entry = List_Head(&Syscall_List);
-    while (entry) {
+    if (Syscall_NameIndex) {
 
-        if (entry->name_len == name_len
+        i = name_hash & Syscall_NameIndexMask;
+        while ((entry = Syscall_NameIndex[i]) != NULL) {
+
+            if (entry->name_hash == name_hash && entry->name_len == name_len
                     && memcmp(entry->name, name, name_len) == 0) {
 
-            return entry;
-        }
+                return entry;
+            }
 
-        entry = List_Next(entry);
+            i = (i + 1) & Syscall_NameIndexMask;
+        }
     }
 
     Syscall_ErrorForAsciiName(name);
@@ -518,6 +637,26 @@ _FX SYSCALL_ENTRY *Syscall_GetByName(const UCHAR *name)
 }
 
 
+//---------------------------------------------------------------------------
+// Syscall_HashName
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Syscall_HashName(const UCHAR *name, ULONG *name_len)
+{
+    ULONG hash = 2166136261; // FNV-1a
+    ULONG len;
+
+    for (len = 0; name[len]; ++len) {
+        hash ^= name[len];
+        hash *= 16777619;
+    }
+
+    *name_len = len;
+    return hash;
+}
+
+
 //---------------------------------------------------------------------------
 // Syscall_Set1
 //---------------------------------------------------------------------------
@@ -745,6 +884,11 @@ _FX NTSTATUS Syscall_Api_Invoke(PROCESS *proc, ULONG64 *parms)
         //}
 
 
+        LARGE_INTEGER start = { 0 };
+
+        if (proc->syscall_profile)
+            start = KeQueryPerformanceCounter(NULL);
+
         if (entry->handler1_func && !proc->open_all_nt) {
 
             status = entry->handler1_func(proc, entry, user_args);
@@ -754,89 +898,75 @@ _FX NTSTATUS Syscall_Api_Invoke(PROCESS *proc, ULONG64 *parms)
             status = Syscall_Invoke(entry, user_args);
         }
 
+        if (proc->syscall_profile)
+            Syscall_Profile_Add(proc, entry, start.QuadPart);
+
         // Debug tip. Display all Alpc/Rpc here.
 
         HANDLE  hHandle = NULL;
         UNICODE_STRING* puStr = NULL;
 
-        if (proc->ipc_trace & (TRACE_ALLOW | TRACE_DENY))
-        {
-            if ((strcmp(entry->name, "ConnectPort") == 0) ||
-                (strcmp(entry->name, "AlpcConnectPort") == 0) )
-            {
-                hHandle = *(HANDLE*)user_args[0];
-                puStr = (UNICODE_STRING*)user_args[1];
-
-                //DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "SBIE [syscall] p=%06d t=%06d - %s, '%.*S', status = 0x%X, handle = %X\n",
-                //    PsGetCurrentProcessId(), PsGetCurrentThreadId(),
-                //    entry->name,
-                //    (puStr->Length / 2), puStr->Buffer,
-                //    status, hHandle);
-                //if (puStr && puStr->Buffer && wcsstr(puStr->Buffer, L"\\RPC Control\\LRPC-"))
-                //{
-                    //int i = 0;          // place breakpoint here if you want to debug a particular port
-                //}
-            }
-            else if ( (strcmp(entry->name, "AlpcCreatePort") == 0) ||
-                (strcmp(entry->name, "AlpcConnectPortEx") == 0) )
-            {
-                hHandle = *(HANDLE*)user_args[0];
-                POBJECT_ATTRIBUTES  pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[1];
-                if (pObjectAttributes)
-                    puStr = (UNICODE_STRING*)pObjectAttributes->ObjectName;
-
-                //DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "SBIE [syscall] p=%06d t=%06d - %s, '%.*S', status = 0x%X, handle = %X\n",
-                //    PsGetCurrentProcessId(), PsGetCurrentThreadId(),
-                //    entry->name,
-                //    (puStr->Length / 2), puStr->Buffer,
-                //    status, hHandle);
-            }
-            else if ((strcmp(entry->name, "ReplyWaitReceivePort") == 0) ||
-                (strcmp(entry->name, "ReceiveMessagePort") == 0) ||
-                (strcmp(entry->name, "AlpcSendReply") == 0) ||
-                (strcmp(entry->name, "AlpcAcceptConnectPort") == 0) ||
-                (strcmp(entry->name, "AlpcCreatePortSection") == 0) ||
-                // these 2 APIs will generate a lot of output if we don't check status
-                ((status != STATUS_SUCCESS) && ((strcmp(entry->name, "AlpcSendWaitReceivePort") == 0) || (strcmp(entry->name, "RequestWaitReplyPort") == 0))) )
-            {
-                hHandle = (HANDLE*)user_args[0];
+        //
+        // the trace kind of each syscall is set up by Syscall_Init_List
+        //
 
-                //DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "SBIE [syscall] p=%06d t=%06d - %s, status = 0x%X, handle = %X\n",
-                //    PsGetCurrentProcessId(), PsGetCurrentThreadId(),
-                //    entry->name,
-                //    status, hHandle);
-            }
-            else if (strcmp(entry->name, "OpenDirectoryObject") == 0)
-            {
-                POBJECT_ATTRIBUTES  pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[2];
-                if (pObjectAttributes)
-                    puStr = (UNICODE_STRING*)pObjectAttributes->ObjectName;
-            }
-        }
+        if (entry->trace_kind != SYSCALL_TRACE_NONE) {
 
-        if (proc->file_trace & (TRACE_ALLOW | TRACE_DENY))
-        {
-            if (strcmp(entry->name, "QueryFullAttributesFile") == 0)
-            {
-                POBJECT_ATTRIBUTES  pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[0];
-                if (pObjectAttributes)
-                    puStr = (UNICODE_STRING*)pObjectAttributes->ObjectName;
-            }
-            else if (strcmp(entry->name, "QueryInformationFile") == 0)
-            {
-                hHandle = (HANDLE*)user_args[0];
-            }
-            else if (strcmp(entry->name, "CreateFile") == 0 || strcmp(entry->name, "OpenFile") == 0)
+            POBJECT_ATTRIBUTES  pObjectAttributes = NULL;
+
+            if (proc->ipc_trace & (TRACE_ALLOW | TRACE_DENY))
             {
-                hHandle = *(HANDLE*)user_args[0];
-                POBJECT_ATTRIBUTES  pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[2];
-                if (pObjectAttributes)
-                    puStr = (UNICODE_STRING*)pObjectAttributes->ObjectName;
+                switch (entry->trace_kind) {
+
+                case SYSCALL_TRACE_PORT_CONNECT:
+                    hHandle = *(HANDLE*)user_args[0];
+                    puStr = (UNICODE_STRING*)user_args[1];
+                    //if (puStr && puStr->Buffer && wcsstr(puStr->Buffer, L"\\RPC Control\\LRPC-"))
+                    //{
+                        //int i = 0;          // place breakpoint here if you want to debug a particular port
+                    //}
+                    break;
+
+                case SYSCALL_TRACE_PORT_CREATE:
+                    hHandle = *(HANDLE*)user_args[0];
+                    pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[1];
+                    break;
+
+                case SYSCALL_TRACE_PORT_HANDLE_FAIL:
+                    // these APIs will generate a lot of output if we don't check status
+                    if (status == STATUS_SUCCESS)
+                        break;
+                case SYSCALL_TRACE_PORT_HANDLE:
+                    hHandle = (HANDLE*)user_args[0];
+                    break;
+
+                case SYSCALL_TRACE_OPEN_DIRECTORY:
+                    pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[2];
+                    break;
+                }
             }
-            else if (strcmp(entry->name, "FsControlFile") == 0 || strcmp(entry->name, "Close") == 0)
+
+            if (proc->file_trace & (TRACE_ALLOW | TRACE_DENY))
             {
-                hHandle = (HANDLE*)user_args[0];
+                switch (entry->trace_kind) {
+
+                case SYSCALL_TRACE_FILE_ATTRIBUTES:
+                    pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[0];
+                    break;
+
+                case SYSCALL_TRACE_FILE_OPEN:
+                    hHandle = *(HANDLE*)user_args[0];
+                    pObjectAttributes = (POBJECT_ATTRIBUTES)user_args[2];
+                    break;
+
+                case SYSCALL_TRACE_FILE_HANDLE:
+                    hHandle = (HANDLE*)user_args[0];
+                    break;
+                }
             }
+
+            if (pObjectAttributes)
+                puStr = (UNICODE_STRING*)pObjectAttributes->ObjectName;
         }
 
         if (puStr || hHandle)
@@ -844,11 +974,11 @@ _FX NTSTATUS Syscall_Api_Invoke(PROCESS *proc, ULONG64 *parms)
             WCHAR trace_str[128];
             if (hHandle) {
                 RtlStringCbPrintfW(trace_str, sizeof(trace_str), L"%.*S, status = 0x%X, handle = %X; ", //59 chars + entry->name
-                    max(strlen(entry->name), 64), entry->name, status, hHandle);
+                    max(entry->name_len, 64), entry->name, status, hHandle);
             }
             else {
                 RtlStringCbPrintfW(trace_str, sizeof(trace_str), L"%.*S, status = 0x%X; ", //59 chars + entry->name
-                    max(strlen(entry->name), 64), entry->name, status);
+                    max(entry->name_len, 64), entry->name, status);
             }
             const WCHAR* strings[4] = { trace_str, trace_str + (entry->name_len + 2), puStr ? puStr->Buffer : NULL, NULL };
             ULONG lengths[4] = {entry->name_len, wcslen(trace_str) - (entry->name_len + 4), puStr ? puStr->Length / 2 : 0, 0 };
@@ -861,11 +991,11 @@ _FX NTSTATUS Syscall_Api_Invoke(PROCESS *proc, ULONG64 *parms)
         if (!traced && ((proc->call_trace & TRACE_ALLOW) || ((status != STATUS_SUCCESS) && (proc->call_trace & TRACE_DENY))))
         {
             // Suppress Sbie's own calls to DeviceIoControlFile
-            if ((strcmp(entry->name, "DeviceIoControlFile") != 0) || user_args[5] != API_SBIEDRV_CTLCODE)
+            if (entry->trace_kind != SYSCALL_TRACE_DEVICE_IO_CONTROL || user_args[5] != API_SBIEDRV_CTLCODE)
             {
                 WCHAR trace_str[128];
                 RtlStringCbPrintfW(trace_str, sizeof(trace_str), L"%.*S, status = 0x%X", //59 chars + entry->name
-                    max(strlen(entry->name), 64), entry->name,
+                    max(entry->name_len, 64), entry->name,
                     status);
                 const WCHAR* strings[3] = { trace_str, trace_str + (entry->name_len + 2), NULL };
                 ULONG lengths[3] = { entry->name_len, wcslen(trace_str) - (entry->name_len + 2), 0 };
@@ -1109,3 +1239,4 @@ _FX BOOLEAN Syscall_QuerySystemInfo_SupportProcmonStack(
 #endif _WIN64
 
 #include "syscall_open.c"
+#include "syscall_profile.c"
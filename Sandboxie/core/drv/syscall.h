@@ -45,6 +45,23 @@ struct _SYSCALL_ENTRY;
 typedef struct _SYSCALL_ENTRY SYSCALL_ENTRY;
 
 
+//
+// what Syscall_Api_Invoke reports for a syscall when tracing is enabled,
+// this is determined once from the name when the entry is created
+//
+
+#define SYSCALL_TRACE_NONE              0
+#define SYSCALL_TRACE_PORT_CONNECT      1   // handle out in arg 0, name in arg 1
+#define SYSCALL_TRACE_PORT_CREATE       2   // handle out in arg 0, attributes in arg 1
+#define SYSCALL_TRACE_PORT_HANDLE       3   // port handle in arg 0
+#define SYSCALL_TRACE_PORT_HANDLE_FAIL  4   // port handle in arg 0, only on failure
+#define SYSCALL_TRACE_OPEN_DIRECTORY    5   // attributes in arg 2
+#define SYSCALL_TRACE_FILE_ATTRIBUTES   6   // attributes in arg 0
+#define SYSCALL_TRACE_FILE_HANDLE       7   // file handle in arg 0
+#define SYSCALL_TRACE_FILE_OPEN         8   // handle out in arg 0, attributes in arg 2
+#define SYSCALL_TRACE_DEVICE_IO_CONTROL 9   // may be our own API call
+
+
 typedef NTSTATUS (*P_Syscall_Handler1)(
     PROCESS *proc, SYSCALL_ENTRY *syscall_entry, ULONG_PTR *user_args);
 
@@ -74,6 +91,8 @@ struct _SYSCALL_ENTRY {
 #endif
     UCHAR disabled;
     UCHAR approved;
+    UCHAR trace_kind;
+    ULONG name_hash;
     USHORT name_len;
     UCHAR name[1];
 
@@ -107,6 +126,12 @@ NTSTATUS Syscall_Invoke(SYSCALL_ENTRY *entry, ULONG_PTR *stack);
 ULONG_PTR Syscall_GetKernelBase(void);
 #endif
 
+// Per syscall call counts and latencies (syscall_profile.c)
+
+void Syscall_Profile_Create(PROCESS *proc);
+
+void Syscall_Profile_Delete(PROCESS *proc);
+
 //---------------------------------------------------------------------------
 
 
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Syscall Profile
+//
+// optional per process call counts and latency histograms for the syscalls
+// which go through Syscall_Api_Invoke, enabled with SyscallProfile=y.
+// the counters live in non paged memory and are split into a few slots
+// selected by the current processor, so that threads of the same process
+// running on different processors rarely share a cache line
+//---------------------------------------------------------------------------
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define SYSCALL_PROFILE_MAX_SLOTS   4       // must be a power of two
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _SYSCALL_PROFILE_COUNTER {
+
+    LONG64 ticks;
+    LONG count;
+    LONG hist[API_SYSCALL_PROFILE_BUCKETS];
+    LONG reserved;
+
+} SYSCALL_PROFILE_COUNTER;
+
+
+typedef struct _SYSCALL_PROFILE {
+
+    ULONG size;
+    ULONG slot_mask;
+    ULONG entry_count;
+    ULONG reserved;
+    SYSCALL_PROFILE_COUNTER counters[1];    // slot * entry_count + index
+
+} SYSCALL_PROFILE;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static LARGE_INTEGER Syscall_ProfileFrequency = { 0 };
+
+static ULONG Syscall_ProfileShift = 0;
+
+
+//---------------------------------------------------------------------------
+// Syscall_Profile_Init
+//---------------------------------------------------------------------------
+
+
+_FX void Syscall_Profile_Init(void)
+{
+    ULONG64 ticks_per_us;
+
+    //
+    // the latency buckets are powers of two of a unit which is the
+    // largest power of two of performance counter ticks below 1 us
+    //
+
+    KeQueryPerformanceCounter(&Syscall_ProfileFrequency);
+
+    ticks_per_us = Syscall_ProfileFrequency.QuadPart / 1000000;
+
+    Syscall_ProfileShift = 0;
+    while ((2ULL << Syscall_ProfileShift) <= ticks_per_us)
+        ++Syscall_ProfileShift;
+}
+
+
+//---------------------------------------------------------------------------
+// Syscall_Profile_Create
+//---------------------------------------------------------------------------
+
+
+_FX void Syscall_Profile_Create(PROCESS *proc)
+{
+    SYSCALL_PROFILE *profile;
+    ULONG cpu_count, slot_count, entry_count, size;
+
+    proc->syscall_profile = NULL;
+
+    if (! Syscall_Table)
+        return;
+
+    if (! Conf_Get_Boolean(proc->box->name, L"SyscallProfile", 0, FALSE))
+        return;
+
+    cpu_count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    for (slot_count = 1; slot_count < SYSCALL_PROFILE_MAX_SLOTS
+                            && slot_count < cpu_count; slot_count <<= 1)
+        ;
+
+    entry_count = Syscall_MaxIndex + 1;
+
+    size = FIELD_OFFSET(SYSCALL_PROFILE, counters)
+         + sizeof(SYSCALL_PROFILE_COUNTER) * slot_count * entry_count;
+
+    profile = ExAllocatePoolWithTag(NonPagedPool, size, tzuk);
+    if (! profile)
+        return;
+
+    memzero(profile, size);
+    profile->size = size;
+    profile->slot_mask = slot_count - 1;
+    profile->entry_count = entry_count;
+
+    proc->syscall_profile = profile;
+}
+
+
+//---------------------------------------------------------------------------
+// Syscall_Profile_Delete
+//---------------------------------------------------------------------------
+
+
+_FX void Syscall_Profile_Delete(PROCESS *proc)
+{
+    if (proc->syscall_profile) {
+
+        ExFreePoolWithTag(proc->syscall_profile, tzuk);
+        proc->syscall_profile = NULL;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Syscall_Profile_Add
+//---------------------------------------------------------------------------
+
+
+_FX void Syscall_Profile_Add(
+    PROCESS *proc, SYSCALL_ENTRY *entry, LONGLONG start)
+{
+    SYSCALL_PROFILE *profile = proc->syscall_profile;
+    SYSCALL_PROFILE_COUNTER *counter;
+    LONGLONG ticks;
+    ULONG64 units;
+    ULONG slot, bucket;
+
+    ticks = KeQueryPerformanceCounter(NULL).QuadPart - start;
+
+    if (entry->syscall_index >= profile->entry_count)
+        return;
+
+    //
+    // the thread may be preempted and moved to another processor at any
+    // time, so the counters are still updated with interlocked operations,
+    // but these are cheap as long as the cache line stays on one processor
+    //
+
+    slot = KeGetCurrentProcessorNumberEx(NULL) & profile->slot_mask;
+    counter = &profile->counters[
+                    slot * profile->entry_count + entry->syscall_index];
+
+    bucket = 0;
+    for (units = (ULONG64)ticks >> Syscall_ProfileShift;
+            units && bucket < API_SYSCALL_PROFILE_BUCKETS - 1; units >>= 1)
+        ++bucket;
+
+    InterlockedIncrement(&counter->count);
+    InterlockedExchangeAdd64(&counter->ticks, ticks);
+    InterlockedIncrement(&counter->hist[bucket]);
+}
+
+
+//---------------------------------------------------------------------------
+// Syscall_Api_QueryProfile
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Syscall_Api_QueryProfile(PROCESS *proc, ULONG64 *parms)
+{
+    API_QUERY_SYSCALL_PROFILE_ARGS *args =
+                                (API_QUERY_SYSCALL_PROFILE_ARGS *)parms;
+    API_SYSCALL_PROFILE_HEADER *user_header;
+    API_SYSCALL_PROFILE_ENTRY *user_entries;
+    API_SYSCALL_PROFILE_ENTRY out;
+    SYSCALL_PROFILE *profile;
+    SYSCALL_ENTRY *entry;
+    ULONG *user_result_len;
+    ULONG buffer_len, result_len;
+    ULONG index, slot, count, i;
+    HANDLE ProcessId;
+    NTSTATUS status;
+    KIRQL irql;
+
+    //
+    // a sandboxed process can only query its own profile
+    //
+
+    ProcessId = args->process_id.val;
+    if (proc) {
+        if (ProcessId && ProcessId != proc->pid
+                      && ! IS_ARG_CURRENT_PROCESS(ProcessId))
+            return STATUS_ACCESS_DENIED;
+        ProcessId = 0;
+    } else {
+        if ((! ProcessId) || IS_ARG_CURRENT_PROCESS(ProcessId))
+            return STATUS_INVALID_CID;
+    }
+
+    user_header = args->buffer.val;
+    buffer_len = args->buffer_len.val;
+    user_result_len = args->result_len.val;
+
+    if (ProcessId) {
+
+        proc = Process_Find(ProcessId, &irql);
+        if (! proc || proc->terminated) {
+            ExReleaseResourceLite(Process_ListLock);
+            KeLowerIrql(irql);
+            return STATUS_INVALID_CID;
+        }
+    }
+
+    status = STATUS_SUCCESS;
+
+    __try {
+
+        ProbeForWrite(user_result_len, sizeof(ULONG), sizeof(ULONG));
+        if (buffer_len)
+            ProbeForWrite(user_header, buffer_len, sizeof(ULONG64));
+
+        profile = proc->syscall_profile;
+        if (! profile) {
+            status = STATUS_NOT_SUPPORTED;
+            __leave;
+        }
+
+        //
+        // count the syscalls which were used, the count can only
+        // grow while we copy, so we stop at the computed size
+        //
+
+        count = 0;
+        for (index = 0; index < profile->entry_count; ++index) {
+            for (slot = 0; slot <= profile->slot_mask; ++slot) {
+                if (profile->counters[
+                        slot * profile->entry_count + index].count) {
+                    ++count;
+                    break;
+                }
+            }
+        }
+
+        result_len = sizeof(API_SYSCALL_PROFILE_HEADER)
+                   + sizeof(API_SYSCALL_PROFILE_ENTRY) * count;
+        *user_result_len = result_len;
+
+        if (result_len > buffer_len) {
+            status = STATUS_BUFFER_TOO_SMALL;
+            __leave;
+        }
+
+        user_entries = (API_SYSCALL_PROFILE_ENTRY *)(user_header + 1);
+
+        i = 0;
+        for (index = 0; index < profile->entry_count && i < count; ++index) {
+
+            entry = Syscall_Table[index];
+            if (! entry)
+                continue;
+
+            memzero(&out, sizeof(out));
+            for (slot = 0; slot <= profile->slot_mask; ++slot) {
+
+                SYSCALL_PROFILE_COUNTER *counter =
+                    &profile->counters[slot * profile->entry_count + index];
+                ULONG bucket;
+
+                out.count += counter->count;
+                out.ticks += counter->ticks;
+                for (bucket = 0; bucket < API_SYSCALL_PROFILE_BUCKETS; ++bucket)
+                    out.hist[bucket] += counter->hist[bucket];
+            }
+
+            if (! out.count)
+                continue;
+
+            out.syscall_index = index;
+            memcpy(out.name, entry->name,
+                min(entry->name_len, sizeof(out.name) - 1));
+
+            memcpy(&user_entries[i], &out, sizeof(out));
+            ++i;
+        }
+
+        user_header->frequency = Syscall_ProfileFrequency.QuadPart;
+        user_header->unit_shift = Syscall_ProfileShift;
+        user_header->count = i;
+
+        if (args->flags.val & API_SYSCALL_PROFILE_RESET) {
+
+            memzero(profile->counters,
+                profile->size - FIELD_OFFSET(SYSCALL_PROFILE, counters));
+        }
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+    if (ProcessId) {
+        ExReleaseResourceLite(Process_ListLock);
+        KeLowerIrql(irql);
+    }
+
+    return status;
+}
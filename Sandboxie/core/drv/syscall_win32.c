@@ -426,6 +426,7 @@ _FX BOOLEAN Syscall_Init_List32(void)
         entry->handler3_func_support_procmon = NULL;
 #endif
         entry->approved = (Syscall_HookMapMatch(name, name_len, &approved_syscalls) != 0);
+        entry->trace_kind = SYSCALL_TRACE_NONE;
         entry->name_len = (USHORT)name_len;
         memcpy(entry->name, name, name_len);
         entry->name[name_len] = '\0';
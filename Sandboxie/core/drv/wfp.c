@@ -25,7 +25,6 @@
 #include "conf.h"
 #include "session.h"
 #include "api_flags.h"
-#include "common/map.h"
 #include "common/netfw.h"
 #include "common/my_version.h"
 #define NO_IP_DEFS
@@ -34,6 +33,7 @@
 
 
 extern DEVICE_OBJECT *Api_DeviceObject;
+extern BOOLEAN Driver_FullUnload;
 
 #ifdef _M_ARM64
 #define NDIS630 1 // windows 8.1
@@ -92,16 +92,56 @@ DEFINE_GUID(WPF_RECV_CALLOUT_GUID_V6,	// 0bf56435-71e4-4de7-bd0b-1af0b4cbb9f9
 //---------------------------------------------------------------------------
 
 
-typedef struct _WFP_PROCESS {
+typedef struct _WFP_RULES {
 
-	HANDLE ProcessId;
 	BOOLEAN LogTraffic;
 	BOOLEAN BlockInternet;
 	LIST NetFwRules;
+	NETFW_INDEX* NetFwIndex;
+
+} WFP_RULES;
+
+
+typedef struct _WFP_PROCESS {
+
+	struct _WFP_PROCESS* volatile Next;
+	HANDLE ProcessId;
+	ULONG SessionId;
+
+	// the rule set is never modified once published, on update
+	// a new one is swapped in and the old one freed after WFP_Synchronize
+	WFP_RULES* volatile Rules;
 
 } WFP_PROCESS;
 
 
+typedef struct _WFP_READER {
+
+	volatile LONG Sequence;		// odd while a reader is active on this processor
+	UCHAR Padding[64 - sizeof(LONG)];
+
+} WFP_READER;
+
+
+typedef struct _WFP_LOG_ENTRY {
+
+	volatile LONG Sequence;
+	HANDLE ProcessId;
+	ULONG SessionId;
+	BOOLEAN Block;
+	BOOLEAN Send;
+	BOOLEAN IPv6;
+	USHORT Port;
+	int Protocol;
+	IP_ADDRESS Ip;
+
+} WFP_LOG_ENTRY;
+
+
+#define WFP_BUCKET_COUNT	256		// must be a power of two
+#define WFP_LOG_SIZE		1024	// must be a power of two
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -118,7 +158,11 @@ const WCHAR* Process_MatchImageAndGetValue(BOX* box, const WCHAR* value, const W
 
 ULONG Process_GetTraceFlag(PROCESS *proc, const WCHAR *setting);
 
-void WFP_FreeRules(LIST* NetFwRules);
+void WFP_FreeRules(WFP_RULES* rules);
+
+void WFP_Synchronize(void);
+
+void WFP_LogWorker(DEVICE_OBJECT* DeviceObject, void* Context);
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, WFP_Init)
@@ -197,8 +241,19 @@ static UINT64 WFP_recv_filter_id_v4 = 0;
 static UINT64 WFP_recv_filter_id_v6 = 0;
 
 static BOOLEAN WPF_MapInitialized = FALSE;
-static map_base_t WFP_Processes;
-static KSPIN_LOCK WFP_MapLock;
+static WFP_PROCESS* volatile WFP_Processes[WFP_BUCKET_COUNT];
+static KSPIN_LOCK WFP_MapLock;		// serializes writers only
+
+static WFP_READER* WFP_Readers = NULL;
+static ULONG WFP_ReaderCount = 0;
+
+static WFP_LOG_ENTRY* WFP_LogRing = NULL;
+static volatile LONG WFP_LogHead = 0;
+static volatile LONG WFP_LogTail = 0;
+static volatile LONG WFP_LogDropped = 0;
+static volatile LONG WFP_LogQueued = 0;
+static volatile LONG WFP_LogRunning = 0;	// workers queued or still running
+static PIO_WORKITEM WFP_LogWorkItem = NULL;
 
 
 //---------------------------------------------------------------------------
@@ -230,14 +285,27 @@ _FX VOID WFP_Free(void* pool, void* ptr)
 
 _FX BOOLEAN WFP_Init(void)
 {
-	map_init(&WFP_Processes, NULL);
-	WFP_Processes.func_malloc = &WFP_Alloc;
-	WFP_Processes.func_free = &WFP_Free;
+	memzero((void*)WFP_Processes, sizeof(WFP_Processes));
 
 	MyInitializeSpinLock(&WFP_MapLock);
 
 	WPF_MapInitialized = TRUE;
 
+	//
+	// allocate the per processor reader slots once, WFP_Unload runs on a
+	// config reload while WFP_UpdateProcess or WFP_DeleteProcess may still
+	// scan them in WFP_Synchronize, so they are only released on driver unload.
+	// they are accessed at dispatch level so they must be non paged
+	//
+
+	WFP_ReaderCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	WFP_Readers = WFP_Alloc(NULL, WFP_ReaderCount * sizeof(WFP_READER));
+	if (!WFP_Readers) {
+		WFP_ReaderCount = 0;
+		return FALSE;
+	}
+	memzero(WFP_Readers, WFP_ReaderCount * sizeof(WFP_READER));
+
 	if (!Conf_Get_Boolean(NULL, L"NetworkEnableWFP", 0, FALSE))
 		return TRUE;
 
@@ -255,9 +323,30 @@ _FX BOOLEAN WFP_Load(void)
 	if (WFP_Enabled)
 		return TRUE;
 
-	WFP_Enabled = TRUE;
+	//
+	// allocate the traffic log ring, it is accessed at dispatch level
+	// so it must be non paged
+	//
+
+	if (!WFP_LogRing) {
+
+		WFP_LogRing = WFP_Alloc(NULL, WFP_LOG_SIZE * sizeof(WFP_LOG_ENTRY));
+		if (!WFP_LogRing)
+			return FALSE;
+		memzero(WFP_LogRing, WFP_LOG_SIZE * sizeof(WFP_LOG_ENTRY));
+		for (LONG i = 0; i < WFP_LOG_SIZE; i++)
+			WFP_LogRing[i].Sequence = i;
+		WFP_LogHead = WFP_LogTail = 0;
+	}
 
-	map_resize(&WFP_Processes, 128); // prepare some buckets for better performance
+	if (!WFP_LogWorkItem) {
+
+		WFP_LogWorkItem = IoAllocateWorkItem(Api_DeviceObject);
+		if (!WFP_LogWorkItem)
+			return FALSE;
+	}
+
+	WFP_Enabled = TRUE;
 
 	DbgPrint("Sbie WFP enabled\r\n");
 
@@ -325,6 +414,7 @@ _FX void WFP_Unload(void)
 	if (WPF_MapInitialized) {
 
 		KIRQL irql; 
+		WFP_PROCESS* list = NULL;
 
 #ifdef _WIN64
 		irql = KeAcquireSpinLockRaiseToDpc(&WFP_MapLock);
@@ -332,21 +422,137 @@ _FX void WFP_Unload(void)
 		KeAcquireSpinLock(&WFP_MapLock, &irql);
 #endif
 
-		map_iter_t iter = map_iter();
-		while (map_next(&WFP_Processes, &iter)) {
-			WFP_PROCESS* wfp_proc = iter.value;
-			
-			WFP_FreeRules(&wfp_proc->NetFwRules);
-			WFP_Free(NULL, wfp_proc);
-		}
+		for (ULONG i = 0; i < WFP_BUCKET_COUNT; i++) {
 
-		map_clear(&WFP_Processes);
+			WFP_PROCESS* wfp_proc = InterlockedExchangePointer((void**)&WFP_Processes[i], NULL);
+			while (wfp_proc) {
+				WFP_PROCESS* next = wfp_proc->Next;
+				wfp_proc->Next = list;
+				list = wfp_proc;
+				wfp_proc = next;
+			}
+		}
 
 		KeReleaseSpinLock(&WFP_MapLock, irql);
+
+		if (list)
+			WFP_Synchronize();
+
+		while (list) {
+			WFP_PROCESS* next = list->Next;
+			if (list->Rules)
+				WFP_FreeRules(list->Rules);
+			WFP_Free(NULL, list);
+			list = next;
+		}
+	}
+
+	//
+	// wait for a pending log worker to return before releasing its resources,
+	// WFP_LogQueued is cleared while the worker may still read the ring
+	//
+
+	if (WFP_LogWorkItem) {
+
+		LARGE_INTEGER time;
+		time.QuadPart = -SECONDS(1) / 100;
+		while (WFP_LogRunning != 0)
+			KeDelayExecutionThread(KernelMode, FALSE, &time);
+
+		IoFreeWorkItem(WFP_LogWorkItem);
+		WFP_LogWorkItem = NULL;
+	}
+
+	if (WFP_LogRing) {
+		WFP_Free(NULL, WFP_LogRing);
+		WFP_LogRing = NULL;
+	}
+
+	if (WFP_Readers && Driver_FullUnload) {
+		WFP_Free(NULL, WFP_Readers);
+		WFP_Readers = NULL;
+		WFP_ReaderCount = 0;
+	}
+}
+
+
+//---------------------------------------------------------------------------
+// WFP_ReaderEnter
+//---------------------------------------------------------------------------
+
+
+_FX KIRQL WFP_ReaderEnter(ULONG* cpu)
+{
+	//
+	// readers run at dispatch level so they can't be preempted on their
+	// processor, and flag their presence in a per processor slot,
+	// this way the hot path never writes to a shared cache line
+	//
+
+	KIRQL irql;
+	KeRaiseIrql(DISPATCH_LEVEL, &irql);
+	*cpu = KeGetCurrentProcessorNumberEx(NULL);
+	InterlockedIncrement(&WFP_Readers[*cpu].Sequence);
+	return irql;
+}
+
+
+//---------------------------------------------------------------------------
+// WFP_ReaderLeave
+//---------------------------------------------------------------------------
+
+
+_FX void WFP_ReaderLeave(ULONG cpu, KIRQL irql)
+{
+	InterlockedIncrement(&WFP_Readers[cpu].Sequence);
+	KeLowerIrql(irql);
+}
+
+
+//---------------------------------------------------------------------------
+// WFP_Synchronize
+//---------------------------------------------------------------------------
+
+
+_FX void WFP_Synchronize(void)
+{
+	//
+	// wait until every reader that may still see an unlinked object has left,
+	// readers entering after this point can only see the new state
+	//
+
+	KeMemoryBarrier();
+
+	for (ULONG i = 0; i < WFP_ReaderCount; i++) {
+
+		LONG seq = WFP_Readers[i].Sequence;
+		if ((seq & 1) == 0)
+			continue;
+
+		while (WFP_Readers[i].Sequence == seq)
+			YieldProcessor();
 	}
 }
 
 
+//---------------------------------------------------------------------------
+// WFP_FindProcess
+//---------------------------------------------------------------------------
+
+
+_FX WFP_PROCESS* WFP_FindProcess(HANDLE ProcessId)
+{
+	//
+	// must be called in a reader section or with WFP_MapLock held
+	//
+
+	WFP_PROCESS* wfp_proc = WFP_Processes[((ULONG_PTR)ProcessId >> 2) & (WFP_BUCKET_COUNT - 1)];
+	while (wfp_proc && wfp_proc->ProcessId != ProcessId)
+		wfp_proc = wfp_proc->Next;
+	return wfp_proc;
+}
+
+
 //---------------------------------------------------------------------------
 // WFP_state_changed
 //---------------------------------------------------------------------------
@@ -576,16 +782,21 @@ Exit:
 //---------------------------------------------------------------------------
 
 
-void WFP_FreeRules(LIST* NetFwRules)
+void WFP_FreeRules(WFP_RULES* rules)
 {
+	if (rules->NetFwIndex)
+		NetFw_FreeIndex(rules->NetFwIndex);
+
 	// clear Firewall Rules
 	while (1) {
-		NETFW_RULE* rule = List_Head(NetFwRules);
+		NETFW_RULE* rule = List_Head(&rules->NetFwRules);
 		if (!rule)
 			break;
-		List_Remove(NetFwRules, rule);
+		List_Remove(&rules->NetFwRules, rule);
 		NetFw_FreeRule(rule);
 	}
+
+	WFP_Free(NULL, rules);
 }
 
 
@@ -648,8 +859,7 @@ BOOLEAN WFP_InitProcess(PROCESS* proc)
 	memzero(wfp_proc, sizeof(WFP_PROCESS));
 
 	wfp_proc->ProcessId = proc->pid;
-
-	List_Init(&wfp_proc->NetFwRules);
+	wfp_proc->SessionId = proc->box->session_id;
 
 #ifdef _WIN64
 	irql = KeAcquireSpinLockRaiseToDpc(&WFP_MapLock);
@@ -657,10 +867,19 @@ BOOLEAN WFP_InitProcess(PROCESS* proc)
 	KeAcquireSpinLock(&WFP_MapLock, &irql);
 #endif
 
-	if(map_get(&WFP_Processes, wfp_proc->ProcessId) != NULL)
+	if (WFP_FindProcess(wfp_proc->ProcessId) != NULL)
 		ok = FALSE; // that would be a duplicate, should not happen, but in case
-	else if (!map_insert(&WFP_Processes, wfp_proc->ProcessId, wfp_proc, 0))
-		ok = FALSE;
+	else {
+
+		//
+		// the entry is fully initialized before it gets published,
+		// so a concurrent reader sees either the old or the new list head
+		//
+
+		WFP_PROCESS* volatile* bucket = &WFP_Processes[((ULONG_PTR)wfp_proc->ProcessId >> 2) & (WFP_BUCKET_COUNT - 1)];
+		wfp_proc->Next = *bucket;
+		InterlockedExchangePointer((void**)bucket, wfp_proc);
+	}
     
 	KeReleaseSpinLock(&WFP_MapLock, irql);
 
@@ -685,29 +904,37 @@ BOOLEAN WFP_UpdateProcess(PROCESS* proc)
 	KIRQL irql;
 	WFP_PROCESS* wfp_proc;
 	HANDLE processId = proc->pid;
-	BOOLEAN LogTraffic = FALSE;
-	BOOLEAN BlockInternet = FALSE;
-	LIST NewNetFwRules, OldNetFwRules;
-	
-	List_Init(&NewNetFwRules);
-	List_Init(&OldNetFwRules);
+	WFP_RULES* NewRules;
+	WFP_RULES* OldRules = NULL;
+
+	NewRules = WFP_Alloc(NULL, sizeof(WFP_RULES));
+	if (!NewRules)
+		return FALSE;
+	memzero(NewRules, sizeof(WFP_RULES));
+	List_Init(&NewRules->NetFwRules);
 
-	LogTraffic = Process_GetTraceFlag(proc, L"NetFwTrace") != 0;
+	NewRules->LogTraffic = Process_GetTraceFlag(proc, L"NetFwTrace") != 0;
 
 	if (!proc->AllowInternetAccess) { // if the process isn't exempted check the config
 
-		BlockInternet = !Process_GetConf_bool(proc, L"AllowNetworkAccess", TRUE);
+		NewRules->BlockInternet = !Process_GetConf_bool(proc, L"AllowNetworkAccess", TRUE);
 	}
 
-	if (!BlockInternet) {
+	if (!NewRules->BlockInternet) {
 
-		ok = WFP_LoadRules(&NewNetFwRules, proc);
-
-		if (!ok) {
-			memcpy(&OldNetFwRules, &NewNetFwRules, sizeof(LIST));
-			BlockInternet = TRUE; // on roule failure we lust block everything
+		if (!WFP_LoadRules(&NewRules->NetFwRules, proc)) {
+			NewRules->BlockInternet = TRUE; // on roule failure we lust block everything
 			// todo: log error
 		}
+		else if (NewRules->NetFwRules.count > 0) {
+
+			//
+			// compile the rules here at passive level, WFP_classify runs at dispatch level,
+			// if this fails WFP_classify falls back to scanning the rule list
+			//
+
+			NewRules->NetFwIndex = NetFw_BuildIndex(&NewRules->NetFwRules, NULL);
+		}
 	}
 
 #ifdef _WIN64
@@ -716,28 +943,24 @@ BOOLEAN WFP_UpdateProcess(PROCESS* proc)
 	KeAcquireSpinLock(&WFP_MapLock, &irql);
 #endif
 
-	wfp_proc = map_get(&WFP_Processes, processId);
+	wfp_proc = WFP_FindProcess(processId);
 	if (wfp_proc) {
 
-		wfp_proc->LogTraffic = LogTraffic;
-		wfp_proc->BlockInternet = BlockInternet;
-
-		if (ok) {
-			memcpy(&OldNetFwRules, &wfp_proc->NetFwRules, sizeof(LIST));
-			memcpy(&wfp_proc->NetFwRules, &NewNetFwRules, sizeof(LIST));
-		}
+		OldRules = InterlockedExchangePointer((void**)&wfp_proc->Rules, NewRules);
 		ok = TRUE;
 	}
-	else {
-		if (ok) {
-			memcpy(&OldNetFwRules, &NewNetFwRules, sizeof(LIST));
-		}
-		ok = FALSE;
-	}
+	else
+		OldRules = NewRules;
     
 	KeReleaseSpinLock(&WFP_MapLock, irql);
 
-	WFP_FreeRules(&OldNetFwRules);
+	if (OldRules) {
+
+		if (OldRules != NewRules)
+			WFP_Synchronize();
+
+		WFP_FreeRules(OldRules);
+	}
 
 	return ok;
 }
@@ -763,17 +986,171 @@ void WFP_DeleteProcess(PROCESS* proc)
 	KeAcquireSpinLock(&WFP_MapLock, &irql);
 #endif
 
-	map_take(&WFP_Processes, processId, &wfp_proc, 0);
+	WFP_PROCESS* volatile* link = &WFP_Processes[((ULONG_PTR)processId >> 2) & (WFP_BUCKET_COUNT - 1)];
+	while (*link && (*link)->ProcessId != processId)
+		link = &(*link)->Next;
+
+	if (*link) {
+
+		//
+		// unlink the entry, readers which already hold a pointer to it
+		// can still walk on through its Next pointer, which we leave intact
+		//
+
+		wfp_proc = *link;
+		InterlockedExchangePointer((void**)link, wfp_proc->Next);
+	}
     
 	KeReleaseSpinLock(&WFP_MapLock, irql);
 
 	if (wfp_proc)
 	{
-		WFP_FreeRules(&wfp_proc->NetFwRules);
+		WFP_Synchronize();
+
+		if (wfp_proc->Rules)
+			WFP_FreeRules(wfp_proc->Rules);
 		WFP_Free(NULL, wfp_proc);
 	}
 }
 
+
+//---------------------------------------------------------------------------
+// WFP_LogPush
+//---------------------------------------------------------------------------
+
+
+_FX void WFP_LogPush(WFP_PROCESS* wfp_proc, BOOLEAN block, BOOLEAN send, BOOLEAN v6, USHORT port, int protocol, IP_ADDRESS* ip)
+{
+	//
+	// bounded multi producer / single consumer ring, every slot carries a sequence number,
+	// a slot is free for position pos when its sequence equals pos, and filled when it equals pos + 1
+	//
+
+	WFP_LOG_ENTRY* entry;
+	LONG pos = WFP_LogTail;
+	for (;;) {
+
+		entry = &WFP_LogRing[pos & (WFP_LOG_SIZE - 1)];
+		LONG diff = entry->Sequence - pos;
+		if (diff == 0) {
+			LONG prev = InterlockedCompareExchange(&WFP_LogTail, pos + 1, pos);
+			if (prev == pos)
+				break;
+			pos = prev;
+		}
+		else if (diff < 0) {
+			InterlockedIncrement(&WFP_LogDropped); // ring is full
+			return;
+		}
+		else
+			pos = WFP_LogTail;
+	}
+
+	entry->ProcessId = wfp_proc->ProcessId;
+	entry->SessionId = wfp_proc->SessionId;
+	entry->Block = block;
+	entry->Send = send;
+	entry->IPv6 = v6;
+	entry->Port = port;
+	entry->Protocol = protocol;
+	entry->Ip = *ip;
+
+	KeMemoryBarrier();
+	entry->Sequence = pos + 1;
+
+	//
+	// the worker drains the ring at passive level, queue it unless it already is
+	//
+
+	InterlockedIncrement(&WFP_LogRunning);
+	if (InterlockedCompareExchange(&WFP_LogQueued, 1, 0) == 0)
+		IoQueueWorkItem(WFP_LogWorkItem, WFP_LogWorker, DelayedWorkQueue, NULL);
+	else
+		InterlockedDecrement(&WFP_LogRunning);
+}
+
+
+//---------------------------------------------------------------------------
+// WFP_LogPop
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN WFP_LogPop(WFP_LOG_ENTRY* out)
+{
+	//
+	// only ever called from the single log worker
+	//
+
+	LONG pos = WFP_LogHead;
+	WFP_LOG_ENTRY* entry = &WFP_LogRing[pos & (WFP_LOG_SIZE - 1)];
+	if (entry->Sequence != pos + 1)
+		return FALSE;
+
+	KeMemoryBarrier();
+	*out = *entry;
+
+	KeMemoryBarrier();
+	entry->Sequence = pos + WFP_LOG_SIZE;
+	WFP_LogHead = pos + 1;
+	return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// WFP_LogWorker
+//---------------------------------------------------------------------------
+
+
+_FX void WFP_LogWorker(DEVICE_OBJECT* DeviceObject, void* Context)
+{
+	UNREFERENCED_PARAMETER(DeviceObject);
+	UNREFERENCED_PARAMETER(Context);
+
+	WFP_LOG_ENTRY entry;
+	WCHAR trace_str[256];
+
+	do {
+
+		while (WFP_LogPop(&entry)) {
+
+			if (entry.IPv6) {
+				RtlStringCbPrintfW(trace_str, sizeof(trace_str), L"%s Network Traffic; Port: %u; Prot: %u; IPv6: %02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x", 
+					entry.Send ? L"Outgoing" : L"Incoming", entry.Port, entry.Protocol,
+					entry.Ip.Data[0], entry.Ip.Data[1], entry.Ip.Data[2], entry.Ip.Data[3], entry.Ip.Data[4], entry.Ip.Data[5], entry.Ip.Data[6], entry.Ip.Data[7],
+					entry.Ip.Data[8], entry.Ip.Data[9], entry.Ip.Data[10], entry.Ip.Data[11], entry.Ip.Data[12], entry.Ip.Data[13], entry.Ip.Data[14], entry.Ip.Data[15]);
+			}
+			else {
+				RtlStringCbPrintfW(trace_str, sizeof(trace_str), L"%s Network Traffic; Port: %u; Prot: %u; IPv4: %d.%d.%d.%d", 
+					entry.Send ? L"Outgoing" : L"Incoming", entry.Port, entry.Protocol,
+					entry.Ip.Data[12], entry.Ip.Data[13], entry.Ip.Data[14], entry.Ip.Data[15]);
+			}
+
+			const WCHAR* strings[2] = { trace_str, NULL };
+			Session_MonitorPutForSession(entry.SessionId, MONITOR_NETFW | (entry.Block ? MONITOR_DENY : MONITOR_OPEN), strings, NULL, entry.ProcessId, NULL);
+		}
+
+		LONG dropped = InterlockedExchange(&WFP_LogDropped, 0);
+		if (dropped)
+			DbgPrint("Sbie WFP traffic log overflow, %d records dropped\r\n", dropped);
+
+		InterlockedExchange(&WFP_LogQueued, 0);
+
+		//
+		// a record may have been pushed after the ring was drained but before the flag was cleared,
+		// in that case its producer did not queue us, so we continue unless someone else got queued
+		//
+
+	} while (WFP_LogRing[WFP_LogHead & (WFP_LOG_SIZE - 1)].Sequence == WFP_LogHead + 1 
+		&& InterlockedCompareExchange(&WFP_LogQueued, 1, 0) == 0);
+
+	//
+	// the ring is no longer accessed, WFP_Unload may release it now
+	//
+
+	InterlockedDecrement(&WFP_LogRunning);
+}
+
+
 //---------------------------------------------------------------------------
 // WFP_classify
 //---------------------------------------------------------------------------
@@ -838,80 +1215,50 @@ void WFP_classify(
 		UINT16 remote_port = inFixedValues->incomingValue[remotePortIndex].value.uint16;
 
 
-		BOOLEAN log = FALSE;
 		BOOLEAN block = FALSE;
 
 
 		KIRQL irql; 
+		ULONG cpu;
 		WFP_PROCESS* wfp_proc;
+		WFP_RULES* rules;
 		HANDLE processId = (HANDLE)inMetaValues->processId;
 
-#ifdef _WIN64
-		irql = KeAcquireSpinLockRaiseToDpc(&WFP_MapLock);
-#else
-		KeAcquireSpinLock(&WFP_MapLock, &irql);
-#endif
+		//
+		// lock free lookup, the process entry and its rule set stay valid
+		// until we leave the reader section, see WFP_Synchronize
+		//
 
-		wfp_proc = map_get(&WFP_Processes, processId);
-		if (wfp_proc) {
+		irql = WFP_ReaderEnter(&cpu);
 
-			log = wfp_proc->LogTraffic;
-			block = wfp_proc->BlockInternet;
+		wfp_proc = WFP_FindProcess(processId);
+		if (wfp_proc && (rules = wfp_proc->Rules) != NULL) {
+
+			block = rules->BlockInternet;
 
 			if (!block) {
 
-				block = NetFw_BlockTraffic(&wfp_proc->NetFwRules, &remote_ip, remote_port, protocol);
+				if (rules->NetFwIndex)
+					block = NetFw_BlockTrafficIndex(rules->NetFwIndex, &remote_ip, remote_port, protocol);
+				else
+					block = NetFw_BlockTraffic(&rules->NetFwRules, &remote_ip, remote_port, protocol);
 			}
-		}
-    
-		KeReleaseSpinLock(&WFP_MapLock, irql);
-
-		// TODO: Fix-Me, no ETW logging for now, we are here at DISPATCH_LEVEL but Session_MonitorPut is using pagable memory,
-		// we need either to create a logging proxy using non-paged pool, or change the tracking mechanism to use non-paged pool itself.
-        /*if (log){
-
-			BOOLEAN send = (filter->filterId == WFP_send_filter_id_v4) || (filter->filterId == WFP_send_filter_id_v6);
-			BOOLEAN v6 = (filter->filterId == WFP_send_filter_id_v6) || (filter->filterId == WFP_recv_filter_id_v6);
-
-			
-			//RtlStringCbPrintfW at DISPATCH_LEVEL or higher can cause a BSOD, 
-			//the issue is with accessing unicode tables, which may be paged out.
 
-			//The documentation for KdPrint() states it this way:
+			//
+			// Session_MonitorPut needs paged memory, so we only record the traffic
+			// in a non paged ring here and let a worker put it into the monitor log
+			//
 
-			//<wdk>
-			//Format
-			//Specifies a pointer to the format string to print. The Format string
-			//supports all the printf-style formatting codes. However, the Unicode format
-			//codes (%C, %S, %lc, %ls, %wc, %ws, and %wZ) can only be used with IRQL =
-			//PASSIVE_LEVEL.
-			//</wdk>
+			if (rules->LogTraffic) {
 
-			//RtlStringCbPrintfA is technically also not permitted so a better solution needs to be found
-			
+				BOOLEAN send = (filter->filterId == WFP_send_filter_id_v4) || (filter->filterId == WFP_send_filter_id_v6);
+				BOOLEAN v6 = (filter->filterId == WFP_send_filter_id_v6) || (filter->filterId == WFP_recv_filter_id_v6);
 
-			char trace_strA[256];
-			if (v6) {
-				RtlStringCbPrintfA(trace_strA, sizeof(trace_strA), "%s Network Traffic; Port: %u; Prot: %u; IPv6: %02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x", 
-					send ? "Outgoing " : "Incoming ", remote_port, protocol,
-					remote_ip.Data[0], remote_ip.Data[1], remote_ip.Data[2], remote_ip.Data[3], remote_ip.Data[4], remote_ip.Data[5], remote_ip.Data[6], remote_ip.Data[7],
-					remote_ip.Data[8], remote_ip.Data[9], remote_ip.Data[10], remote_ip.Data[11], remote_ip.Data[12], remote_ip.Data[13], remote_ip.Data[14], remote_ip.Data[15]);
+				WFP_LogPush(wfp_proc, block, send, v6, remote_port, protocol, &remote_ip);
 			}
-			else {
-				RtlStringCbPrintfA(trace_strA, sizeof(trace_strA), "%s Network Traffic; Port: %u; Prot: %u; IPv4: %d.%d.%d.%d", 
-					send ? "Outgoing " : "Incoming ", remote_port, protocol,
-					remote_ip.Data[12], remote_ip.Data[13], remote_ip.Data[14], remote_ip.Data[15]);
-			}
-
-			WCHAR trace_str[256];
-			char* cptr = trace_strA;
-			WCHAR* wptr = trace_str;
-			while (*cptr != '\0')
-				*wptr++ = *cptr++;
-			*wptr = L'\0';
-
-            Session_MonitorPut(MONITOR_NETFW | (block ? MONITOR_DENY : MONITOR_OPEN), trace_str, PsGetCurrentProcessId());
-        }*/
+		}
+    
+		WFP_ReaderLeave(cpu, irql);
 
 		if (block) {
 
@@ -323,6 +323,8 @@ void DriverAssist::MsgWorkerThread(void *MyMsg)
         if(data_len < sizeof(ULONG) || *(ULONG*)data_ptr != GetCurrentProcessId())
             SbieIniServer::NotifyConfigReloaded();
 
+        GuiServer::GetInstance()->NotifyConfigReloaded();
+
         SbieDll_InjectLow_InitSyscalls(TRUE);
 
         RestartHostInjectedSvcs();
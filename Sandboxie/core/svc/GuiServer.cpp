@@ -48,6 +48,10 @@ extern "C" {
 
 #define MAX_RPL_BUF_SIZE    32768
 
+#define GUI_POLICY_CACHE_MAX    256
+#define GUI_WINDOW_CACHE_MAX    1024
+#define GUI_WINDOW_CACHE_TTL    2000        // milliseconds
+
 
 //---------------------------------------------------------------------------
 // Structures and Types
@@ -65,6 +69,26 @@ typedef struct _GUI_SLAVE {
 } GUI_SLAVE;
 
 
+typedef struct _GUI_CACHED_WINDOW {
+
+    ULONG pid;
+    ULONGLONG expire;
+    WCHAR clsnm[256];
+
+} GUI_CACHED_WINDOW;
+
+
+typedef struct _GUI_CACHED_PROCESS {
+
+    ULONGLONG expire;
+    ULONG64 create_time;        // to detect a reused process id
+    ULONG integrity;
+    WCHAR boxname[BOXNAME_COUNT];
+    WCHAR image[256];
+
+} GUI_CACHED_PROCESS;
+
+
 typedef struct _WND_HOOK {
 
     LIST_ELEM list_elem;
@@ -114,6 +138,17 @@ GuiServer::GuiServer()
 
     List_Init(&m_WndHooks);
 
+    //
+    // the cache maps allocate their nodes from m_CachePool, without it
+    // map_insert fails and every lookup takes the uncached path
+    //
+
+    InitializeCriticalSection(&m_CacheLock);
+    m_CachePool = Pool_Create();
+    map_init(&m_PolicyMap, m_CachePool);
+    map_init(&m_WindowMap, m_CachePool);
+    map_init(&m_OwnerMap, m_CachePool);
+
     OSVERSIONINFOW osvi = { 0 };
     osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFOW);
 	/*NTSTATUS(WINAPI *RtlGetVersion)(LPOSVERSIONINFOW);
@@ -135,6 +170,9 @@ GuiServer::~GuiServer()
 {
 	// cleanup CS
 	DeleteCriticalSection(&m_SlavesLock);
+	DeleteCriticalSection(&m_CacheLock);
+    if (m_CachePool)
+        Pool_Delete(m_CachePool);
 }
 
 
@@ -355,6 +393,34 @@ ULONG GuiServer::SendMessageToSlave(ULONG session_id, void* data, ULONG data_len
 }
 
 
+//---------------------------------------------------------------------------
+// NotifyConfigReloaded
+//---------------------------------------------------------------------------
+
+
+void GuiServer::NotifyConfigReloaded()
+{
+    //
+    // tell every running slave to drop its window access check caches
+    //
+
+    GUI_RELOAD_CONF_REQ data;
+    data.msgid = GUI_RELOAD_CONF;
+
+    EnterCriticalSection(&m_SlavesLock);
+
+    GUI_SLAVE *slave = (GUI_SLAVE *)List_Head(&m_SlavesList);
+    while (slave) {
+
+        SendMessageToSlave(slave->session_id, &data, sizeof(data));
+
+        slave = (GUI_SLAVE *)List_Next(slave);
+    }
+
+    LeaveCriticalSection(&m_SlavesLock);
+}
+
+
 //---------------------------------------------------------------------------
 // StartSlave
 //---------------------------------------------------------------------------
@@ -798,6 +864,7 @@ bool GuiServer::CreateQueueSlave(const WCHAR *cmdline)
     m_SlaveFuncs[GUI_WND_HOOK_NOTIFY]       = &GuiServer::WndHookNotifySlave;
     m_SlaveFuncs[GUI_WND_HOOK_REGISTER]     = &GuiServer::WndHookRegisterSlave;
     m_SlaveFuncs[GUI_KILL_JOB]              = &GuiServer::KillJob;
+    m_SlaveFuncs[GUI_RELOAD_CONF]           = &GuiServer::ReloadConfSlave;
 
 
     //
@@ -879,12 +946,20 @@ bool GuiServer::QueueCallbackSlave2(void)
             // make sure the request is coming from the same session
             // (with the exception of the GUI_INIT_PROCESS message)
             //
+            // the box name and creation time of the caller are kept
+            // in args, to look up its cached window access policy
+            //
 
-            if (msgid != GUI_INIT_PROCESS && msgid != GUI_KILL_JOB) {
+            args.boxname[0] = L'\0';
+            args.create_time = 0;
+
+            if (msgid != GUI_INIT_PROCESS && msgid != GUI_KILL_JOB
+                                          && msgid != GUI_RELOAD_CONF) {
 
                 ULONG session_id;
-                status = SbieApi_QueryProcess((HANDLE)(ULONG_PTR)args.pid,
-                                              NULL, NULL, NULL, &session_id);
+                status = SbieApi_QueryProcessEx2(
+                            (HANDLE)(ULONG_PTR)args.pid, 0, args.boxname,
+                            NULL, NULL, &session_id, &args.create_time);
 
                 if (status != 0)
                     issue_request = false;
@@ -2141,7 +2216,7 @@ ULONG GuiServer::EnumWindowsSlave(SlaveArgs *args)
         return STATUS_DISK_FULL;
     rpl->error = GetLastError();
 
-    ULONG status = EnumWindowsFilterSlave(args->pid, rpl);
+    ULONG status = EnumWindowsFilterSlave(args, rpl);
     if (status != STATUS_SUCCESS)
         return status;
 
@@ -2179,21 +2254,14 @@ BOOL GuiServer::EnumWindowsSlaveEnumProc(HWND hwnd, LPARAM lParam)
 //---------------------------------------------------------------------------
 
 
-ULONG GuiServer::EnumWindowsFilterSlave(ULONG pid, void *rpl_buf)
+ULONG GuiServer::EnumWindowsFilterSlave(SlaveArgs *args, void *rpl_buf)
 {
     GUI_ENUM_WINDOWS_RPL *rpl = (GUI_ENUM_WINDOWS_RPL *)rpl_buf;
     if (! rpl->num_hwnds)
         return 0;
 
-    WCHAR boxname[BOXNAME_COUNT];
-    ULONG status = SbieApi_QueryProcess((HANDLE)(ULONG_PTR)pid,
-                                        boxname, NULL, NULL, NULL);
-    if (status != 0)
-        return status;
-
-    POOL *pool;
-    LIST *list;
-    status = GetProcessPathList(pid, (void **)&pool, &list);
+    GUI_PROCESS_POLICY *policy;
+    ULONG status = GetProcessPolicy(args, &policy);
     if (status != 0)
         return status;
 
@@ -2205,14 +2273,16 @@ ULONG GuiServer::EnumWindowsFilterSlave(ULONG pid, void *rpl_buf)
     ULONG n = 0;
     for (ULONG i = 0; i < rpl->num_hwnds; ++i) {
         HWND hwnd = (HWND)(LONG_PTR)rpl->hwnds[i];
-        if (CheckWindowAccessible(pid, boxname, list, hwnd)) {
+        GUI_WINDOW_OWNER owner;
+        if (GetWindowOwner(hwnd, &owner)
+                && CheckWindowAccessible(policy, &owner)) {
             rpl->hwnds[n] = (ULONG)(ULONG_PTR)hwnd;
             ++n;
         }
     }
     rpl->num_hwnds = n;
 
-    Pool_Delete(pool);
+    ReleaseProcessPolicy(policy);
 
     return 0;
 }
@@ -2369,13 +2439,13 @@ ULONG GuiServer::SetWindowPosSlave(SlaveArgs *args)
     // check access according to OpenWinClass rules
     //
 
-    POOL *pool;
-    LIST *list;
-    ULONG status = GetProcessPathList(args->pid, (void **)&pool, &list);
+    GUI_PROCESS_POLICY *policy;
+    ULONG status = GetProcessPolicy(args, &policy);
     if (status != 0)
         return status;
-    bool access = CheckWindowAccessible(args->pid, NULL, list, hwnd);
-    Pool_Delete(pool);
+    GUI_WINDOW_OWNER owner;
+    bool access = GetWindowOwner(hwnd, &owner)
+               && CheckWindowAccessible(policy, &owner);
 
     if (access) {
 
@@ -2383,10 +2453,12 @@ ULONG GuiServer::SetWindowPosSlave(SlaveArgs *args)
         // check access according to integrity level
         //
 
-        if (! CompareIntegrityLevels(args->pid, hwnd))
+        if (! CompareIntegrityLevels(policy, &owner))
             access = false;
     }
 
+    ReleaseProcessPolicy(policy);
+
     if (! access) {
 
         rpl->error = ERROR_INVALID_WINDOW_HANDLE;
@@ -2874,13 +2946,13 @@ ULONG GuiServer::SendPostMessageSlave(SlaveArgs *args)
     // check access according to OpenWinClass rules
     //
 
-    POOL *pool;
-    LIST *list;
-    ULONG status = GetProcessPathList(args->pid, (void **)&pool, &list);
+    GUI_PROCESS_POLICY *policy;
+    ULONG status = GetProcessPolicy(args, &policy);
     if (status != 0)
         return status;
-    bool access = CheckWindowAccessible(args->pid, NULL, list, hwnd);
-    Pool_Delete(pool);
+    GUI_WINDOW_OWNER owner;
+    bool access = GetWindowOwner(hwnd, &owner)
+               && CheckWindowAccessible(policy, &owner);
 
     if (access) {
 
@@ -2888,8 +2960,8 @@ ULONG GuiServer::SendPostMessageSlave(SlaveArgs *args)
         // check access according to integrity level
         //
 
-        if ((! CompareIntegrityLevels(args->pid, hwnd))
-                    && (! ShouldIgnoreIntegrityLevels(args->pid, hwnd)))
+        if ((! CompareIntegrityLevels(policy, &owner))
+                    && (! ShouldIgnoreIntegrityLevels(policy, &owner)))
             access = false;
 
         else {
@@ -2903,6 +2975,8 @@ ULONG GuiServer::SendPostMessageSlave(SlaveArgs *args)
         }
     }
 
+    ReleaseProcessPolicy(policy);
+
     rpl->lresult2 = 0;
 
     if (! access) {
@@ -2991,13 +3065,13 @@ ULONG GuiServer::SendCopyDataSlave(SlaveArgs *args)
     // check access according to OpenWinClass rules
     //
 
-    POOL *pool;
-    LIST *list;
-    ULONG status = GetProcessPathList(args->pid, (void **)&pool, &list);
+    GUI_PROCESS_POLICY *policy;
+    ULONG status = GetProcessPolicy(args, &policy);
     if (status != 0)
         return status;
-    bool access = CheckWindowAccessible(args->pid, NULL, list, hwnd);
-    Pool_Delete(pool);
+    GUI_WINDOW_OWNER owner;
+    bool access = GetWindowOwner(hwnd, &owner)
+               && CheckWindowAccessible(policy, &owner);
 
     if (access) {
 
@@ -3006,8 +3080,8 @@ ULONG GuiServer::SendCopyDataSlave(SlaveArgs *args)
         // but always allow copying data to the taskbar
         //
 
-        if ((! CompareIntegrityLevels(args->pid, hwnd))
-            && (! ShouldIgnoreIntegrityLevels(args->pid, hwnd))) {
+        if ((! CompareIntegrityLevels(policy, &owner))
+            && (! ShouldIgnoreIntegrityLevels(policy, &owner))) {
 
             HWND hShellTrayWnd = FindWindow(L"Shell_TrayWnd", NULL);
             if (hwnd != hShellTrayWnd) {
@@ -3017,6 +3091,8 @@ ULONG GuiServer::SendCopyDataSlave(SlaveArgs *args)
         }
     }
 
+    ReleaseProcessPolicy(policy);
+
     rpl->lresult2 = 0;
 
     if (! access) {
@@ -3783,122 +3859,385 @@ bool GuiServer::CheckProcessPathList(LIST *list, const WCHAR *str)
 
 
 //---------------------------------------------------------------------------
-// CheckSameProcessBoxes
+// GetProcessPolicy
 //---------------------------------------------------------------------------
 
 
-bool GuiServer::CheckSameProcessBoxes(
-    ULONG in_pid, WCHAR *boxname, HWND hwnd, ULONG *out_pid)
+ULONG GuiServer::GetProcessPolicy(
+    SlaveArgs *args, GUI_PROCESS_POLICY **out_policy)
 {
-    *out_pid = 0;
-    ULONG idThread = GetWindowThreadProcessId(hwnd, out_pid);
-    if (! (*out_pid))
-        return false;
+    //
+    // the OpenWinClass list of a sandboxed process is fixed for its
+    // lifetime, so compile it once and keep it keyed by process id.
+    // the creation time tells us if the process id has been reused
+    //
 
-    if (*out_pid == in_pid)
-        return true;
+    void *key = (void *)(ULONG_PTR)args->pid;
+    GUI_PROCESS_POLICY *policy;
 
-    WCHAR boxname2[BOXNAME_COUNT];
-    ULONG status = SbieApi_QueryProcess((HANDLE)(ULONG_PTR)*out_pid,
-                                        boxname2, NULL, NULL, NULL);
-    if (! NT_SUCCESS(status))
-        return false;
+    EnterCriticalSection(&m_CacheLock);
 
-    if (! boxname) {
-        WCHAR boxname1[BOXNAME_COUNT];
-        status = SbieApi_QueryProcess((HANDLE)(ULONG_PTR)in_pid,
-                                      boxname1, NULL, NULL, NULL);
-        if (! NT_SUCCESS(status))
-            return false;
-        boxname = boxname1;
+    policy = (GUI_PROCESS_POLICY *)map_get(&m_PolicyMap, key);
+    if (policy && policy->create_time != args->create_time) {
+        map_remove(&m_PolicyMap, key);
+        ReleaseProcessPolicy(policy);
+        policy = NULL;
     }
+    if (policy)
+        InterlockedIncrement(&policy->refs);
 
-    if (_wcsicmp(boxname, boxname2) != 0) {
-        *out_pid = -1;      // both processes in box, but not same box
-        return false;
+    LeaveCriticalSection(&m_CacheLock);
+
+    if (policy) {
+        *out_policy = policy;
+        return STATUS_SUCCESS;
     }
 
-    return true;
+    //
+    // build a new policy outside the lock
+    //
+
+    policy = (GUI_PROCESS_POLICY *)HeapAlloc(
+                GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(GUI_PROCESS_POLICY));
+    if (! policy)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ULONG status = GetProcessPathList(
+                        args->pid, (void **)&policy->pool, &policy->list);
+    if (status != STATUS_SUCCESS) {
+        HeapFree(GetProcessHeap(), 0, policy);
+        return status;
+    }
+
+    policy->pid = args->pid;
+    policy->create_time = args->create_time;
+    policy->integrity = (ULONG)(ULONG_PTR)SbieApi_QueryProcessInfo(
+                                    (HANDLE)(ULONG_PTR)args->pid, 'pril');
+    wcscpy(policy->boxname, args->boxname);
+    policy->refs = 2;           // one for the map, one for the caller
+
+    EnterCriticalSection(&m_CacheLock);
+
+    if (m_PolicyMap.nnodes >= GUI_POLICY_CACHE_MAX)
+        PurgeProcessPolicies();
+
+    GUI_PROCESS_POLICY *other =
+                    (GUI_PROCESS_POLICY *)map_get(&m_PolicyMap, key);
+    if (other) {
+        map_remove(&m_PolicyMap, key);
+        ReleaseProcessPolicy(other);
+    }
+
+    if (! map_insert(&m_PolicyMap, key, policy, 0))
+        --policy->refs;
+
+    LeaveCriticalSection(&m_CacheLock);
+
+    *out_policy = policy;
+    return STATUS_SUCCESS;
 }
 
 
 //---------------------------------------------------------------------------
-// CheckWindowAccessible
+// ReleaseProcessPolicy
 //---------------------------------------------------------------------------
 
 
-bool GuiServer::CheckWindowAccessible(
-    ULONG pid, WCHAR *boxname, LIST *list, HWND hwnd)
+void GuiServer::ReleaseProcessPolicy(GUI_PROCESS_POLICY *policy)
+{
+    if (InterlockedDecrement(&policy->refs) == 0) {
+        Pool_Delete(policy->pool);
+        HeapFree(GetProcessHeap(), 0, policy);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// PurgeProcessPolicies
+//---------------------------------------------------------------------------
+
+
+void GuiServer::PurgeProcessPolicies(void)
 {
     //
-    // allow if target window is part of a process in the same sandbox
+    // caller must hold m_CacheLock.  drop the policies of processes
+    // which have terminated, or whose process id has been reused
     //
 
-    ULONG pid2;
-    if (CheckSameProcessBoxes(pid, boxname, hwnd, &pid2))
-        return true;
+    map_iter_t iter = map_iter();
+    BOOLEAN more = map_next(&m_PolicyMap, &iter);
+    while (more) {
 
-    if (pid2 == -1)     // both processes in box, but not same box
-        return false;
+        GUI_PROCESS_POLICY *policy = (GUI_PROCESS_POLICY *)iter.value;
+
+        ULONG64 create_time = 0;
+        ULONG status = SbieApi_QueryProcessEx2(
+                            (HANDLE)(ULONG_PTR)policy->pid, 0,
+                            NULL, NULL, NULL, NULL, &create_time);
+
+        if (status != STATUS_SUCCESS || create_time != policy->create_time) {
+            more = map_erase(&m_PolicyMap, &iter);
+            ReleaseProcessPolicy(policy);
+        } else
+            more = map_next(&m_PolicyMap, &iter);
+    }
+}
 
+
+//---------------------------------------------------------------------------
+// FlushCaches
+//---------------------------------------------------------------------------
+
+
+void GuiServer::FlushCaches(void)
+{
+    EnterCriticalSection(&m_CacheLock);
+
+    map_iter_t iter = map_iter();
+    while (map_next(&m_PolicyMap, &iter))
+        ReleaseProcessPolicy((GUI_PROCESS_POLICY *)iter.value);
+    map_clear(&m_PolicyMap);
+
+    map_clear(&m_WindowMap);
+    map_clear(&m_OwnerMap);
+
+    LeaveCriticalSection(&m_CacheLock);
+}
+
+
+//---------------------------------------------------------------------------
+// GetWindowOwner
+//---------------------------------------------------------------------------
+
+
+bool GuiServer::GetWindowOwner(HWND hwnd, GUI_WINDOW_OWNER *owner)
+{
     //
-    // allow if class name of target window matches OpenWinClass
+    // collect the class name, box name, image name and integrity level
+    // which the access checks need for a target window.  class names are
+    // cached per window handle and the rest per owner process, both for
+    // a short time only.  a window entry is only reused as long as the
+    // window still belongs to the same process, and a process entry only
+    // as long as the process id was not reused by another process
     //
 
-    WCHAR clsnm[256];
-    if (GetClassName(hwnd, clsnm, 255)) {
+    ULONG pid = 0;
+    GetWindowThreadProcessId(hwnd, &pid);
+    if (! pid)
+        return false;
 
-        clsnm[255] = L'\0';
-        _wcslwr(clsnm);
+    ULONGLONG now = GetTickCount64();
+    void *pid_key = (void *)(ULONG_PTR)pid;
+    bool have_window = false;
+    bool have_process = false;
 
-        if (CheckProcessPathList(list, clsnm))
-            return true;
-    }
+    owner->pid = pid;
 
     //
-    // allow if process name of target window matches $:OpenWinClass
+    // the process handle also serves to query the image name and the
+    // integrity level below.  without a creation time nothing is cached
     //
 
-    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pid2);
+    ULONG64 create_time = 0;
+
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pid);
     if (hProcess) {
 
-        ULONG x;
-        NTSTATUS status = NtQueryInformationProcess(
-                    hProcess, ProcessImageFileName,
-                    clsnm, sizeof(clsnm) - 8, &x);
-        x = 0;
+        FILETIME times[4];
+        if (GetProcessTimes(hProcess, &times[0], &times[1], &times[2], &times[3]))
+            create_time = ((ULONG64)times[0].dwHighDateTime << 32) | times[0].dwLowDateTime;
+    }
 
-        if (NT_SUCCESS(status)) {
+    EnterCriticalSection(&m_CacheLock);
 
-            WCHAR *name;
-            UNICODE_STRING *uni = (UNICODE_STRING *)clsnm;
+    GUI_CACHED_WINDOW *window =
+                    (GUI_CACHED_WINDOW *)map_get(&m_WindowMap, hwnd);
+    if (window && window->pid == pid && window->expire > now) {
+        wcscpy(owner->clsnm, window->clsnm);
+        have_window = true;
+    }
+
+    GUI_CACHED_PROCESS *process =
+                    (GUI_CACHED_PROCESS *)map_get(&m_OwnerMap, pid_key);
+    if (process && process->expire > now && create_time
+                && process->create_time == create_time) {
+        owner->integrity = process->integrity;
+        wcscpy(owner->boxname, process->boxname);
+        wcscpy(owner->image, process->image);
+        have_process = true;
+    }
+
+    LeaveCriticalSection(&m_CacheLock);
+
+    if (have_window && have_process) {
+        CloseHandle(hProcess);
+        return true;
+    }
 
-            if (uni->Buffer) {      // Curt 26-Aug-2013
+    GUI_CACHED_WINDOW new_window;
+    GUI_CACHED_PROCESS new_process;
 
-                uni->Buffer[uni->Length / sizeof(WCHAR)] = L'\0';
-                name = wcsrchr(uni->Buffer, L'\\');
+    if (! have_window) {
+
+        new_window.pid = pid;
+        new_window.expire = now + GUI_WINDOW_CACHE_TTL;
+
+        if (GetClassName(hwnd, new_window.clsnm, 255)) {
+            new_window.clsnm[255] = L'\0';
+            _wcslwr(new_window.clsnm);
+        } else
+            new_window.clsnm[0] = L'\0';
+
+        wcscpy(owner->clsnm, new_window.clsnm);
+    }
+
+    if (! have_process) {
+
+        new_process.expire = now + GUI_WINDOW_CACHE_TTL;
+        new_process.create_time = create_time;
+        new_process.integrity = -1;
+        new_process.image[0] = L'\0';
+
+        //
+        // box name is left empty if the owner process is not sandboxed
+        //
+
+        if (! NT_SUCCESS(SbieApi_QueryProcess(pid_key,
+                            new_process.boxname, NULL, NULL, NULL)))
+            new_process.boxname[0] = L'\0';
+
+        //
+        // image name and integrity level with a single process handle
+        //
+
+        if (hProcess) {
+
+            union {
+                UNICODE_STRING uni;
+                WCHAR space[512];
+            } image;
+            ULONG len;
+
+            NTSTATUS status = NtQueryInformationProcess(
+                        hProcess, ProcessImageFileName,
+                        &image, sizeof(image) - 8, &len);
+
+            if (NT_SUCCESS(status) && image.uni.Buffer) {
+
+                image.uni.Buffer[image.uni.Length / sizeof(WCHAR)] = L'\0';
+                WCHAR *name = wcsrchr(image.uni.Buffer, L'\\');
                 if (name)
                     ++name;
                 else
-                    name = uni->Buffer;
+                    name = image.uni.Buffer;
+
+                if (wcslen(name) < 250) {
+                    wcscpy(new_process.image, L"$:");
+                    wcscat(new_process.image, name);
+                    _wcslwr(new_process.image);
+                }
+            }
+
+            HANDLE hToken;
+            if (OpenProcessToken(hProcess, TOKEN_QUERY, &hToken)) {
+
+                union {
+                    SID_AND_ATTRIBUTES label;       // TOKEN_MANDATORY_LABEL
+                    UCHAR info_space[64];
+                } info;
 
-                _wcslwr(name);
-                --name;
-                *name = L':';
-                --name;
-                *name = L'$';
+                if (GetTokenInformation(
+                        hToken, (TOKEN_INFORMATION_CLASS)TokenIntegrityLevel,
+                        &info, sizeof(info), &len))
+                    new_process.integrity = ((ULONG *)info.label.Sid)[2];
 
-                if (CheckProcessPathList(list, name))
-                    x = 1;
+                CloseHandle(hToken);
             }
         }
 
+        owner->integrity = new_process.integrity;
+        wcscpy(owner->boxname, new_process.boxname);
+        wcscpy(owner->image, new_process.image);
+    }
+
+    if (hProcess)
         CloseHandle(hProcess);
 
-        if (x == 1)
+    //
+    // store the new entries
+    //
+
+    EnterCriticalSection(&m_CacheLock);
+
+    if (! have_window) {
+
+        window = (GUI_CACHED_WINDOW *)map_get(&m_WindowMap, hwnd);
+        if (window)
+            memcpy(window, &new_window, sizeof(GUI_CACHED_WINDOW));
+        else {
+            if (m_WindowMap.nnodes >= GUI_WINDOW_CACHE_MAX)
+                map_clear(&m_WindowMap);
+            map_insert(&m_WindowMap, hwnd,
+                       &new_window, sizeof(GUI_CACHED_WINDOW));
+        }
+    }
+
+    if ((! have_process) && create_time) {
+
+        process = (GUI_CACHED_PROCESS *)map_get(&m_OwnerMap, pid_key);
+        if (process)
+            memcpy(process, &new_process, sizeof(GUI_CACHED_PROCESS));
+        else {
+            if (m_OwnerMap.nnodes >= GUI_POLICY_CACHE_MAX)
+                map_clear(&m_OwnerMap);
+            map_insert(&m_OwnerMap, pid_key,
+                       &new_process, sizeof(GUI_CACHED_PROCESS));
+        }
+    }
+
+    LeaveCriticalSection(&m_CacheLock);
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// CheckWindowAccessible
+//---------------------------------------------------------------------------
+
+
+bool GuiServer::CheckWindowAccessible(
+    GUI_PROCESS_POLICY *policy, GUI_WINDOW_OWNER *owner)
+{
+    //
+    // allow if target window is part of a process in the same sandbox
+    //
+
+    if (owner->pid == policy->pid)
+        return true;
+
+    if (owner->boxname[0]) {
+
+        if (_wcsicmp(policy->boxname, owner->boxname) == 0)
             return true;
+
+        return false;       // both processes in box, but not same box
     }
 
+    //
+    // allow if class name of target window matches OpenWinClass
+    //
+
+    if (owner->clsnm[0] && CheckProcessPathList(policy->list, owner->clsnm))
+        return true;
+
+    //
+    // allow if process name of target window matches $:OpenWinClass
+    //
+
+    if (owner->image[0] && CheckProcessPathList(policy->list, owner->image))
+        return true;
+
     return false;
 }
 
@@ -3908,42 +4247,17 @@ bool GuiServer::CheckWindowAccessible(
 //---------------------------------------------------------------------------
 
 
-_FX bool GuiServer::CompareIntegrityLevels(ULONG src_pid, HWND dst_hwnd)
+_FX bool GuiServer::CompareIntegrityLevels(
+    GUI_PROCESS_POLICY *policy, GUI_WINDOW_OWNER *owner)
 {
-    ULONG src_il = (ULONG)(ULONG_PTR)SbieApi_QueryProcessInfo(
-                                        (HANDLE)(ULONG_PTR)src_pid, 'pril');
+    ULONG src_il = policy->integrity;
     if (src_il == tzuk) // Windows XP
         return true;
 
-    ULONG dst_pid = 0;
-    ULONG dst_tid = GetWindowThreadProcessId(dst_hwnd, &dst_pid);
-    if ((! dst_tid) || (! dst_pid))
-        return false;
-
-    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, dst_pid);
-    if (! hProcess)
-        return false;
-
-    HANDLE hToken;
-    BOOL ok = OpenProcessToken(hProcess, TOKEN_QUERY, &hToken);
-    CloseHandle(hProcess);
-    if (! ok)
+    if (owner->integrity == -1)
         return false;
 
-    union {
-        SID_AND_ATTRIBUTES label;       // TOKEN_MANDATORY_LABEL
-        UCHAR info_space[64];
-    } info;
-    ULONG len;
-    ok = GetTokenInformation(
-                hToken, (TOKEN_INFORMATION_CLASS)TokenIntegrityLevel,
-                &info, sizeof(info), &len);
-    CloseHandle(hToken);
-    if (! ok)
-        return false;
-
-    ULONG dst_il = ((ULONG *)info.label.Sid)[2];
-    return (src_il >= dst_il) ? true : false;
+    return (src_il >= owner->integrity) ? true : false;
 }
 
 
@@ -3952,7 +4266,8 @@ _FX bool GuiServer::CompareIntegrityLevels(ULONG src_pid, HWND dst_hwnd)
 //---------------------------------------------------------------------------
 
 
-bool GuiServer::ShouldIgnoreIntegrityLevels(ULONG pid, HWND hwnd)
+bool GuiServer::ShouldIgnoreIntegrityLevels(
+    GUI_PROCESS_POLICY *policy, GUI_WINDOW_OWNER *owner)
 {
     //
     // we can't tell if the target window used ChangeWindowMessageFilter*Ex
@@ -3962,82 +4277,34 @@ bool GuiServer::ShouldIgnoreIntegrityLevels(ULONG pid, HWND hwnd)
 
     static const WCHAR *_IgnoreUIPI = L"/ignoreuipi";
 
-    POOL *pool;
-    LIST *list;
-    ULONG status = GetProcessPathList(pid, (void **)&pool, &list);
-    if (status != 0)
-        return false;
+    WCHAR str[256+32];
 
     //
     // check if we have an OpenWinClass=<clsnm>/IgnoreUIPI
     //
 
-    WCHAR clsnm[256+32];
-    if (GetClassName(hwnd, clsnm, 255)) {
+    if (owner->clsnm[0]) {
 
-        clsnm[255] = L'\0';
-        _wcslwr(clsnm);
-        wcscat(clsnm, _IgnoreUIPI);
+        wcscpy(str, owner->clsnm);
+        wcscat(str, _IgnoreUIPI);
 
-        if (CheckProcessPathList(list, clsnm)) {
-            Pool_Delete(pool);
+        if (CheckProcessPathList(policy->list, str))
             return true;
-        }
     }
 
     //
     // allow if process name of target window matches $:OpenWinClass
     //
 
-    ULONG idProcess = 0;
-    ULONG idThread = GetWindowThreadProcessId(hwnd, &idProcess);
-    if (! idProcess) {
-        Pool_Delete(pool);
-        return false;
-    }
-
-    HANDLE hProcess =
-                OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, idProcess);
-    if (hProcess) {
-
-        ULONG x;
-        NTSTATUS status = NtQueryInformationProcess(
-                    hProcess, ProcessImageFileName,
-                    clsnm, sizeof(clsnm) - 8, &x);
-        x = 0;
-
-        if (NT_SUCCESS(status)) {
-
-            WCHAR *name;
-            UNICODE_STRING *uni = (UNICODE_STRING *)clsnm;
-            uni->Buffer[uni->Length / sizeof(WCHAR)] = L'\0';
-            name = wcsrchr(uni->Buffer, L'\\');
-            if (name)
-                ++name;
-            else
-                name = uni->Buffer;
-
-            _wcslwr(name);
-            if (wcslen(name) < 250) {
-
-                wcscpy(clsnm, L"$:");
-                wcscat(clsnm, name);
-                wcscat(clsnm, _IgnoreUIPI);
-
-                if (CheckProcessPathList(list, clsnm))
-                    x = 1;
-            }
-        }
+    if (owner->image[0]) {
 
-        CloseHandle(hProcess);
+        wcscpy(str, owner->image);
+        wcscat(str, _IgnoreUIPI);
 
-        if (x == 1) {
-            Pool_Delete(pool);
+        if (CheckProcessPathList(policy->list, str))
             return true;
-        }
     }
 
-    Pool_Delete(pool);
     return false;
 }
 
@@ -4681,6 +4948,35 @@ ULONG GuiServer::KillJob(SlaveArgs* args)
 }
 
 
+//---------------------------------------------------------------------------
+// ReloadConfSlave
+//---------------------------------------------------------------------------
+
+
+ULONG GuiServer::ReloadConfSlave(SlaveArgs *args)
+{
+    //
+    // validate the request
+    //
+
+    if (args->pid != m_ParentPid)
+        return STATUS_ACCESS_DENIED;
+
+    if (args->req_len != sizeof(GUI_RELOAD_CONF_REQ))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    //
+    // the OpenWinClass lists of running processes are fixed when they
+    // start, but drop everything anyway so no stale state survives a
+    // configuration reload
+    //
+
+    FlushCaches();
+
+    return STATUS_SUCCESS;
+}
+
+
 //---------------------------------------------------------------------------
 // StartAsync
 //---------------------------------------------------------------------------
@@ -24,7 +24,40 @@
 #define _MY_GUISERVER_H
 
 
+#include "common/defines.h"
 #include "common/list.h"
+#include "common/map.h"
+
+
+//---------------------------------------------------------------------------
+// Window Access Check Cache
+//---------------------------------------------------------------------------
+
+
+typedef struct _GUI_PROCESS_POLICY {
+
+    ULONG pid;
+    ULONG64 create_time;
+    volatile LONG refs;
+
+    struct POOL *pool;
+    LIST *list;                     // compiled OpenWinClass patterns
+    ULONG integrity;
+    WCHAR boxname[BOXNAME_COUNT];
+
+} GUI_PROCESS_POLICY;
+
+
+typedef struct _GUI_WINDOW_OWNER {
+
+    ULONG pid;
+    ULONG integrity;                // -1 if not known
+
+    WCHAR boxname[BOXNAME_COUNT];   // empty if not sandboxed
+    WCHAR clsnm[256];               // lower case class name
+    WCHAR image[256];               // lower case $:image name
+
+} GUI_WINDOW_OWNER;
 
 
 class GuiServer
@@ -47,6 +80,8 @@ public:
 
     ULONG SendMessageToSlave(ULONG session_id, void* data, ULONG data_len);
 
+    void NotifyConfigReloaded();
+
 protected:
 
     GuiServer();
@@ -92,6 +127,8 @@ protected:
         ULONG rpl_len;
         void *req_buf;
         void *rpl_buf;
+        ULONG64 create_time;
+        WCHAR boxname[BOXNAME_COUNT];
     };
     typedef ULONG (GuiServer::*SlaveFunc)(SlaveArgs *args);
     SlaveFunc *m_SlaveFuncs;
@@ -122,7 +159,7 @@ protected:
 
     ULONG EnumWindowsSlave(SlaveArgs *args);
 
-    ULONG EnumWindowsFilterSlave(ULONG pid, void *rpl_buf);
+    ULONG EnumWindowsFilterSlave(SlaveArgs *args, void *rpl_buf);
 
     static BOOL EnumWindowsSlaveEnumProc(HWND hwnd, LPARAM lParam);
 
@@ -172,6 +209,8 @@ protected:
 
     ULONG KillJob(SlaveArgs *args);
 
+    ULONG ReloadConfSlave(SlaveArgs *args);
+
     //
     // window access check utilities
     //
@@ -181,15 +220,25 @@ protected:
 
     bool CheckProcessPathList(LIST *list, const WCHAR *str);
 
-    bool CheckSameProcessBoxes(
-        ULONG in_pid, WCHAR *boxname, HWND hwnd, ULONG *out_pid);
+    ULONG GetProcessPolicy(
+        SlaveArgs *args, GUI_PROCESS_POLICY **out_policy);
+
+    void ReleaseProcessPolicy(GUI_PROCESS_POLICY *policy);
+
+    void PurgeProcessPolicies(void);
+
+    void FlushCaches(void);
+
+    bool GetWindowOwner(HWND hwnd, GUI_WINDOW_OWNER *owner);
 
     bool CheckWindowAccessible(
-        ULONG pid, WCHAR *boxname, LIST *list, HWND hwnd);
+        GUI_PROCESS_POLICY *policy, GUI_WINDOW_OWNER *owner);
 
-    bool CompareIntegrityLevels(ULONG src_pid, HWND dst_hwnd);
+    bool CompareIntegrityLevels(
+        GUI_PROCESS_POLICY *policy, GUI_WINDOW_OWNER *owner);
 
-    bool ShouldIgnoreIntegrityLevels(ULONG pid, HWND hwnd);
+    bool ShouldIgnoreIntegrityLevels(
+        GUI_PROCESS_POLICY *policy, GUI_WINDOW_OWNER *owner);
 
     bool AllowSendPostMessage(
         ULONG pid, ULONG msg, bool IsSendMsg, HWND hwnd);
@@ -213,6 +262,12 @@ protected:
     ULONG m_nOSVersion;
 
     LIST m_WndHooks;
+
+    CRITICAL_SECTION m_CacheLock;
+    struct POOL *m_CachePool;
+    HASH_MAP m_PolicyMap;
+    HASH_MAP m_WindowMap;
+    HASH_MAP m_OwnerMap;
 };
 
 
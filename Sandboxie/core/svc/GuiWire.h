@@ -63,6 +63,7 @@ enum {
     GUI_WND_HOOK_NOTIFY,
     GUI_WND_HOOK_REGISTER,
     GUI_KILL_JOB,
+    GUI_RELOAD_CONF,
     GUI_MAX_REQUEST_CODE
 };
 
@@ -770,6 +771,19 @@ struct tagGUI_KILL_JOB_REQ
 
 typedef struct tagGUI_KILL_JOB_REQ GUI_KILL_JOB_REQ;
 
+
+//---------------------------------------------------------------------------
+// Reload Configuration
+//---------------------------------------------------------------------------
+
+
+struct tagGUI_RELOAD_CONF_REQ
+{
+    ULONG msgid;
+};
+
+typedef struct tagGUI_RELOAD_CONF_REQ GUI_RELOAD_CONF_REQ;
+
 //---------------------------------------------------------------------------
 
 
@@ -42,6 +42,9 @@
 #define SECONDS(n64)            (((LONGLONG)n64) * 10000000L)
 #define MINUTES(n64)            (SECONDS(n64) * 60)
 
+#define KILL_ALL_PASSES         10
+#define KILL_ALL_TIMEOUT        5000    // milliseconds
+
 extern "C"
 {
 
@@ -307,9 +310,21 @@ MSG_HEADER *ProcessServer::KillAllHandler(MSG_HEADER *msg)
     // kill target processes
     //
 
-    status = KillAllHelper(TargetBoxName, TargetSessionId, TerminateJob);
+    ULONG ProcessCount, ElapsedMs;
 
-    return SHORT_REPLY(status);
+    status = KillAllHelper(TargetBoxName, TargetSessionId, TerminateJob,
+                           &ProcessCount, &ElapsedMs);
+
+    PROCESS_KILL_ALL_RPL *rpl =
+        (PROCESS_KILL_ALL_RPL *)LONG_REPLY(sizeof(PROCESS_KILL_ALL_RPL));
+    if (! rpl)
+        return SHORT_REPLY(status);
+
+    rpl->h.status = status;
+    rpl->process_count = ProcessCount;
+    rpl->elapsed_ms = ElapsedMs;
+
+    return (MSG_HEADER *)rpl;
 }
 
 
@@ -318,13 +333,18 @@ MSG_HEADER *ProcessServer::KillAllHandler(MSG_HEADER *msg)
 //---------------------------------------------------------------------------
 
 
-NTSTATUS ProcessServer::KillAllHelper(const WCHAR *BoxName, ULONG SessionId, BOOLEAN TerminateJob)
+NTSTATUS ProcessServer::KillAllHelper(const WCHAR *BoxName, ULONG SessionId, BOOLEAN TerminateJob,
+                                      ULONG *ProcessCount, ULONG *ElapsedMs)
 {
     NTSTATUS status;
-    ULONG retries, i;
-    const ULONG pids_len = 512;
-    ULONG pids[pids_len];
-    ULONG count;
+    POOL *pool;
+    HASH_MAP ProcessMap;
+    HANDLE *Handles;
+    ULONG HandleCount;
+    ULONG *pids = NULL;
+    ULONG pids_len = 0;
+    ULONG count, passes, i;
+    const ULONG StartTime = GetTickCount();
 
     if (TerminateJob) {
 
@@ -344,35 +364,251 @@ NTSTATUS ProcessServer::KillAllHelper(const WCHAR *BoxName, ULONG SessionId, BOO
         // 
     }
 
-    
-    for (retries = 0; retries < 10; ) {
+    //
+    // the map holds an open handle for each process which was frozen
+    // but not yet terminated, or NULL for a process which was already
+    // handled or could not be opened
+    //
 
-        count = pids_len;
-        status = SbieApi_EnumProcessEx(BoxName, FALSE, SessionId, pids, &count);
-        if (status != STATUS_SUCCESS)
-            break;
-        if (count == 0)
-            break;
+    pool = Pool_Create();
+    if (! pool) {
+        if (ProcessCount)
+            *ProcessCount = 0;
+        if (ElapsedMs)
+            *ElapsedMs = GetTickCount() - StartTime;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-        if (count < pids_len)
-            retries++;
+    map_init(&ProcessMap, pool);
+    map_resize(&ProcessMap, 128);
 
-        if (retries) {
-            if (retries >= 10 - 1) {
-                status = STATUS_UNSUCCESSFUL;
-                break;
+    while (1) {
+
+        //
+        // freeze the box:  suspend each process which was not seen yet,
+        // so it can no longer start new processes.  repeat until a pass
+        // finds no new processes, i.e. none were started meanwhile
+        //
+
+        ULONG NewCount;
+
+        for (passes = 0; passes < KILL_ALL_PASSES; ++passes) {
+
+            count = 0;
+            status = SbieApi_EnumProcessEx(BoxName, FALSE, SessionId, NULL, &count);
+            if (status == STATUS_SUCCESS && count + 128 > pids_len) {
+
+                if (pids)
+                    HeapFree(GetProcessHeap(), 0, pids);
+                pids_len = count + 128;
+                pids = (ULONG *)HeapAlloc(GetProcessHeap(), 0, sizeof(ULONG) * pids_len);
+                if (! pids) {
+                    pids_len = 0;
+                    status = STATUS_INSUFFICIENT_RESOURCES;
+                }
             }
-            Sleep(100);
+            if (status == STATUS_SUCCESS) {
+                count = pids_len;
+                status = SbieApi_EnumProcessEx(BoxName, FALSE, SessionId, pids, &count);
+            }
+            if (status != STATUS_SUCCESS)
+                goto finish;
+
+            NewCount = 0;
+
+            for (i = 0; i < count; ++i) {
+
+                void *key = (void *)(ULONG_PTR)pids[i];
+
+                HANDLE *pProcess = (HANDLE *)map_get(&ProcessMap, key);
+                if (pProcess) {
+
+                    //
+                    // a process we could not open, or which survived its
+                    // termination, is handed to the driver once more
+                    //
+
+                    if (! *pProcess)
+                        KillProcess(pids[i]);
+                    continue;
+                }
+
+                HANDLE hProcess = KillAllFreeze(pids[i]);
+
+                if (! map_insert(&ProcessMap, key, &hProcess, sizeof(HANDLE))) {
+
+                    if (hProcess) {
+                        KillAllTerminate(hProcess, pids[i]);
+                        CloseHandle(hProcess);
+                    }
+                    continue;
+                }
+
+                ++NewCount;
+            }
+
+            if (! NewCount)
+                break;
+        }
+
+        //
+        // terminate the frozen processes.  TerminateProcess only starts
+        // the termination, so all processes go down in parallel, then we
+        // wait for them to exit, at most until the overall timeout
+        //
+
+        Handles = NULL;
+        HandleCount = 0;
+
+        if (ProcessMap.nnodes)
+            Handles = (HANDLE *)HeapAlloc(GetProcessHeap(), 0, sizeof(HANDLE) * ProcessMap.nnodes);
+
+        map_iter_t iter = map_iter();
+        while (map_next(&ProcessMap, &iter)) {
+
+            HANDLE *pProcess = (HANDLE *)iter.value;
+            if (! *pProcess)
+                continue;
+
+            KillAllTerminate(*pProcess, (ULONG)(ULONG_PTR)*(void **)iter.key);
+
+            if (Handles)
+                Handles[HandleCount++] = *pProcess;
+            else
+                CloseHandle(*pProcess);
+            *pProcess = NULL;
+        }
+
+        for (i = 0; i < HandleCount; i += MAXIMUM_WAIT_OBJECTS) {
+
+            ULONG WaitCount = HandleCount - i;
+            if (WaitCount > MAXIMUM_WAIT_OBJECTS)
+                WaitCount = MAXIMUM_WAIT_OBJECTS;
+
+            ULONG WaitTime = GetTickCount() - StartTime;
+            if (WaitTime >= KILL_ALL_TIMEOUT)
+                break;
+
+            if (WaitForMultipleObjects(WaitCount, &Handles[i], TRUE,
+                        KILL_ALL_TIMEOUT - WaitTime) == WAIT_TIMEOUT)
+                break;
         }
 
-        for (i = 0; i <= count; ++i)
-            KillProcess(pids[i]);
+        for (i = 0; i < HandleCount; ++i)
+            CloseHandle(Handles[i]);
+        if (Handles)
+            HeapFree(GetProcessHeap(), 0, Handles);
+
+        //
+        // the driver may still list a process for a moment after it
+        // has exited.  only when nothing was left to wait on, back off
+        // briefly before the next pass
+        //
+
+        count = 0;
+        status = SbieApi_EnumProcessEx(BoxName, FALSE, SessionId, NULL, &count);
+        if (status != STATUS_SUCCESS || count == 0)
+            break;
+
+        if (GetTickCount() - StartTime >= KILL_ALL_TIMEOUT) {
+            status = STATUS_UNSUCCESSFUL;
+            break;
+        }
+
+        if (! HandleCount)
+            Sleep(10);
     }
 
+finish:
+
+    //
+    // if we bailed out early, do not leave frozen processes behind
+    //
+
+    map_iter_t iter = map_iter();
+    while (map_next(&ProcessMap, &iter)) {
+
+        HANDLE *pProcess = (HANDLE *)iter.value;
+        if (*pProcess) {
+            KillAllTerminate(*pProcess, (ULONG)(ULONG_PTR)*(void **)iter.key);
+            CloseHandle(*pProcess);
+        }
+    }
+
+    if (ProcessCount)
+        *ProcessCount = ProcessMap.nnodes;
+    if (ElapsedMs)
+        *ElapsedMs = GetTickCount() - StartTime;
+
+    map_clear(&ProcessMap);
+    Pool_Delete(pool);
+
+    if (pids)
+        HeapFree(GetProcessHeap(), 0, pids);
+
     return status;
 }
 
 
+//---------------------------------------------------------------------------
+// KillAllFreeze
+//---------------------------------------------------------------------------
+
+
+HANDLE ProcessServer::KillAllFreeze(ULONG ProcessId)
+{
+    //
+    // open and suspend a process of the box being terminated.  if it
+    // cannot be opened, let the driver kill it right away.  as in
+    // KillProcess, the check for a sandboxed process is done while we
+    // hold the handle, so the PID cannot be reused meanwhile
+    //
+
+    HANDLE hProcess = OpenProcess(
+        PROCESS_TERMINATE | PROCESS_SUSPEND_RESUME
+            | PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE,
+        FALSE, ProcessId);
+
+    if (! hProcess) {
+        KillProcess(ProcessId);
+        return NULL;
+    }
+
+    if (! SbieApi_QueryProcessInfo((HANDLE)(ULONG_PTR)ProcessId, 0)) {
+        CloseHandle(hProcess);
+        return NULL;
+    }
+
+    NtSuspendProcess(hProcess);
+
+    return hProcess;
+}
+
+
+//---------------------------------------------------------------------------
+// KillAllTerminate
+//---------------------------------------------------------------------------
+
+
+void ProcessServer::KillAllTerminate(HANDLE hProcess, ULONG ProcessId)
+{
+    NTSTATUS status;
+    ULONG breakOnTermination;
+    BOOL ok = FALSE;
+
+    //
+    // same as KillProcess, a critical process is left to the driver
+    //
+
+    status = NtQueryInformationProcess(hProcess, ProcessBreakOnTermination, &breakOnTermination, sizeof(ULONG), NULL);
+    if (NT_SUCCESS(status) && !breakOnTermination)
+        ok = TerminateProcess(hProcess, DBG_TERMINATE_PROCESS);
+
+    if (!ok)
+        SbieApi_Call(API_KILL_PROCESS, 1, ProcessId);
+}
+
+
 //---------------------------------------------------------------------------
 // SetDeviceMap
 //---------------------------------------------------------------------------
@@ -51,7 +51,12 @@ protected:
 
     MSG_HEADER *KillAllHandler(MSG_HEADER *msg);
 
-    NTSTATUS KillAllHelper(const WCHAR *BoxName, ULONG SessionId, BOOLEAN TerminateJob = FALSE);
+    NTSTATUS KillAllHelper(const WCHAR *BoxName, ULONG SessionId, BOOLEAN TerminateJob = FALSE,
+                           ULONG *ProcessCount = NULL, ULONG *ElapsedMs = NULL);
+
+    HANDLE KillAllFreeze(ULONG ProcessId);
+
+    void KillAllTerminate(HANDLE hProcess, ULONG ProcessId);
 
     MSG_HEADER *SetDeviceMap(MSG_HEADER *msg);
 
@@ -53,7 +53,15 @@ struct tagPROCESS_KILL_ALL_REQ
     WCHAR boxname[34];
 };
 
+struct tagPROCESS_KILL_ALL_RPL
+{
+    MSG_HEADER h;                       // status is NTSTATUS
+    ULONG process_count;                // processes found in the box
+    ULONG elapsed_ms;                   // time until the box was empty
+};
+
 typedef struct tagPROCESS_KILL_ALL_REQ PROCESS_KILL_ALL_REQ;
+typedef struct tagPROCESS_KILL_ALL_RPL PROCESS_KILL_ALL_RPL;
 
 
 //---------------------------------------------------------------------------
@@ -52,10 +52,67 @@
 //---------------------------------------------------------------------------
 
 
+#ifndef FILE_PIPE_MESSAGE_MODE
+#define FILE_PIPE_MESSAGE_MODE      0x00000001
+#endif
+
+
+typedef struct _PROXY_PIPE_MODE {
+
+    ULONG ReadMode;
+    ULONG CompletionMode;
+
+} PROXY_PIPE_MODE;
+
+
+typedef struct _PROXY_PIPE_ASYNC {
+
+    //
+    // asynchronous mode:  one read at a time is kept outstanding on the
+    // pipe.  it completes through the completion port into Data, and the
+    // ReadHandler serves requests out of Data without blocking.  the
+    // structure lives until the outstanding read has completed, which may
+    // be after the PROXY_PIPE was closed, see CloseCallback
+    //
+
+    CRITICAL_SECTION CritSec;
+    HANDLE hPipe;                       // owned by the PROXY_PIPE
+    HANDLE hReadyEvent;                 // also duplicated into the client
+    BOOLEAN ShareEvent;
+    BOOLEAN MessageMode;
+    BOOLEAN ReadPending;
+    BOOLEAN Completed;
+    BOOLEAN Closed;
+    NTSTATUS ReadStatus;
+    ULONG DataPos;
+    ULONG DataLen;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER IssueTime;
+    LONG64 ReadWaitTicks;
+    UCHAR Data[NAMED_PIPE_MAX_TRANSFER];
+
+} PROXY_PIPE_ASYNC;
+
+
+typedef struct _PROXY_PIPE_STATS {
+
+    volatile LONG64 ReadCount;
+    volatile LONG64 ReadBytes;
+    volatile LONG64 ReadParked;
+    volatile LONG64 ReadWaitTicks;      // synchronous mode only
+    volatile LONG64 WriteCount;
+    volatile LONG64 WriteBytes;
+    volatile LONG64 WriteWaitTicks;
+
+} PROXY_PIPE_STATS;
+
+
 typedef struct _PROXY_PIPE {
 
     HANDLE hPipe;
     HANDLE hEvent;
+    PROXY_PIPE_ASYNC *Async;
+    PROXY_PIPE_STATS Stats;
 
 } PROXY_PIPE;
 
@@ -74,7 +131,30 @@ NamedPipeServer::NamedPipeServer(PipeServer *pipeServer)
         GetProcAddress(_Ntdll, "NtAlpcSendWaitReceivePort");
 
     m_ProxyHandle = new ProxyHandle(NULL, sizeof(PROXY_PIPE),
-                                    CloseCallback, NULL);
+                                    CloseCallback, this);
+
+    QueryPerformanceFrequency(&m_Frequency);
+
+    //
+    // a single thread services the completion port for the read ahead
+    // of all proxy pipes.  if it cannot be started, all pipes use the
+    // synchronous mode
+    //
+
+    m_hCompletionPort =
+        CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+
+    if (m_hCompletionPort) {
+
+        HANDLE hThread = CreateThread(NULL, 0,
+            (LPTHREAD_START_ROUTINE)CompletionThread, this, 0, NULL);
+        if (hThread)
+            CloseHandle(hThread);
+        else {
+            CloseHandle(m_hCompletionPort);
+            m_hCompletionPort = NULL;
+        }
+    }
 
     pipeServer->Register(MSGID_NAMED_PIPE, this, Handler);
 }
@@ -88,6 +168,31 @@ NamedPipeServer::NamedPipeServer(PipeServer *pipeServer)
 void NamedPipeServer::CloseCallback(void *context, void *data)
 {
     PROXY_PIPE *ProxyPipe = (PROXY_PIPE *)data;
+
+    if (ProxyPipe->Async) {
+
+        //
+        // if a read is still outstanding, cancel it and let
+        // CompleteRead free the structure when the read completes
+        //
+
+        PROXY_PIPE_ASYNC *async = ProxyPipe->Async;
+
+        EnterCriticalSection(&async->CritSec);
+
+        async->Closed = TRUE;
+        BOOLEAN ReadPending = async->ReadPending;
+        if (ReadPending)
+            CancelIoEx(async->hPipe, NULL);
+
+        LeaveCriticalSection(&async->CritSec);
+
+        if (! ReadPending)
+            DeleteAsync(async);
+
+        ProxyPipe->Async = NULL;
+    }
+
     if (ProxyPipe->hEvent)
         NtClose(ProxyPipe->hEvent);
     if (ProxyPipe->hPipe)
@@ -95,6 +200,204 @@ void NamedPipeServer::CloseCallback(void *context, void *data)
 }
 
 
+//---------------------------------------------------------------------------
+// CompletionThread
+//---------------------------------------------------------------------------
+
+
+ULONG NamedPipeServer::CompletionThread(void *_this)
+{
+    NamedPipeServer *pThis = (NamedPipeServer *)_this;
+
+    while (1) {
+
+        ULONG NumberOfBytes;
+        ULONG_PTR CompletionKey;
+        OVERLAPPED *Overlapped;
+
+        BOOL ok = GetQueuedCompletionStatus(pThis->m_hCompletionPort,
+                    &NumberOfBytes, &CompletionKey, &Overlapped, INFINITE);
+
+        //
+        // the read ahead passes its PROXY_PIPE_ASYNC as the APC context,
+        // which is what comes back here in place of an OVERLAPPED.  other
+        // i/o on an associated pipe (i.e. writes) has no APC context
+        //
+
+        if (Overlapped)
+            CompleteRead(Overlapped);
+        else if (! ok)
+            break;
+    }
+
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// CreateAsync
+//---------------------------------------------------------------------------
+
+
+void *NamedPipeServer::CreateAsync(HANDLE hPipe)
+{
+    PROXY_PIPE_ASYNC *async;
+    PROXY_PIPE_MODE PipeMode;
+    IO_STATUS_BLOCK IoStatusBlock;
+
+    if (! m_hCompletionPort)
+        return NULL;
+
+    async = (PROXY_PIPE_ASYNC *)HeapAlloc(
+                    GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(PROXY_PIPE_ASYNC));
+    if (! async)
+        return NULL;
+
+    async->hReadyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (! async->hReadyEvent) {
+        HeapFree(GetProcessHeap(), 0, async);
+        return NULL;
+    }
+
+    if (! CreateIoCompletionPort(hPipe, m_hCompletionPort, 0, 0)) {
+        CloseHandle(async->hReadyEvent);
+        HeapFree(GetProcessHeap(), 0, async);
+        return NULL;
+    }
+
+    InitializeCriticalSection(&async->CritSec);
+    async->hPipe = hPipe;
+
+    NTSTATUS status = NtQueryInformationFile(hPipe, &IoStatusBlock,
+                        &PipeMode, sizeof(PipeMode), FilePipeInformation);
+    if (NT_SUCCESS(status))
+        async->MessageMode = (PipeMode.ReadMode == FILE_PIPE_MESSAGE_MODE);
+
+    return async;
+}
+
+
+//---------------------------------------------------------------------------
+// ShareAsync
+//---------------------------------------------------------------------------
+
+
+void NamedPipeServer::ShareAsync(
+    void *_async, HANDLE idProcess, ULONG64 *ReadyEvent)
+{
+    PROXY_PIPE_ASYNC *async = (PROXY_PIPE_ASYNC *)_async;
+    HANDLE hProcess, hEvent;
+
+    //
+    // give the caller a handle to the ready event, so it can wait for
+    // parked reads on its own.  without it, the ReadHandler waits
+    //
+
+    *ReadyEvent = 0;
+
+    hProcess = OpenProcess(
+                    PROCESS_DUP_HANDLE, FALSE, (ULONG)(ULONG_PTR)idProcess);
+    if (! hProcess)
+        return;
+
+    if (DuplicateHandle(GetCurrentProcess(), async->hReadyEvent,
+                        hProcess, &hEvent, SYNCHRONIZE, FALSE, 0)) {
+
+        async->ShareEvent = TRUE;
+        *ReadyEvent = (ULONG64)(ULONG_PTR)hEvent;
+    }
+
+    CloseHandle(hProcess);
+}
+
+
+//---------------------------------------------------------------------------
+// DeleteAsync
+//---------------------------------------------------------------------------
+
+
+void NamedPipeServer::DeleteAsync(void *_async)
+{
+    PROXY_PIPE_ASYNC *async = (PROXY_PIPE_ASYNC *)_async;
+
+    DeleteCriticalSection(&async->CritSec);
+    CloseHandle(async->hReadyEvent);
+    HeapFree(GetProcessHeap(), 0, async);
+}
+
+
+//---------------------------------------------------------------------------
+// IssueRead
+//---------------------------------------------------------------------------
+
+
+void NamedPipeServer::IssueRead(void *_async)
+{
+    PROXY_PIPE_ASYNC *async = (PROXY_PIPE_ASYNC *)_async;
+    LARGE_INTEGER li;
+    li.QuadPart = 0;
+
+    //
+    // caller holds CritSec.  a read that fails right away does not
+    // post a completion, so its status is recorded here
+    //
+
+    QueryPerformanceCounter(&async->IssueTime);
+
+    NTSTATUS status = NtReadFile(
+        async->hPipe, NULL, NULL, async, &async->IoStatusBlock,
+        async->Data, sizeof(async->Data), &li, NULL);
+
+    if (NT_ERROR(status)) {
+
+        async->ReadStatus = status;
+        async->DataPos = 0;
+        async->DataLen = 0;
+        async->Completed = TRUE;
+
+    } else
+        async->ReadPending = TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// CompleteRead
+//---------------------------------------------------------------------------
+
+
+void NamedPipeServer::CompleteRead(void *_async)
+{
+    PROXY_PIPE_ASYNC *async = (PROXY_PIPE_ASYNC *)_async;
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+
+    EnterCriticalSection(&async->CritSec);
+
+    async->ReadPending = FALSE;
+
+    if (async->Closed) {
+
+        LeaveCriticalSection(&async->CritSec);
+        DeleteAsync(async);
+        return;
+    }
+
+    async->ReadWaitTicks += now.QuadPart - async->IssueTime.QuadPart;
+
+    async->ReadStatus = async->IoStatusBlock.Status;
+    async->DataPos = 0;
+    async->DataLen = (ULONG)async->IoStatusBlock.Information;
+    if (async->DataLen > sizeof(async->Data))
+        async->DataLen = 0;
+    async->Completed = TRUE;
+
+    SetEvent(async->hReadyEvent);
+
+    LeaveCriticalSection(&async->CritSec);
+}
+
+
 //---------------------------------------------------------------------------
 // Handler
 //---------------------------------------------------------------------------
@@ -186,8 +489,12 @@ MSG_HEADER *NamedPipeServer::OpenHandler(MSG_HEADER *msg, HANDLE idProcess)
         OBJECT_ATTRIBUTES objattrs;
         UNICODE_STRING objname;
         WCHAR pipename[160];
+        WCHAR boxname[BOXNAME_COUNT];
         IO_STATUS_BLOCK IoStatusBlock;
 
+        memzero(&ProxyPipe, sizeof(ProxyPipe));
+        rpl->ready_event = 0;
+
         if (req->server[0]) {
             wcscpy(pipename, L"\\device\\mup\\");
             wcscat(pipename, req->server);
@@ -226,11 +533,28 @@ MSG_HEADER *NamedPipeServer::OpenHandler(MSG_HEADER *msg, HANDLE idProcess)
                 rpl->h.status = STATUS_INSUFFICIENT_RESOURCES;
             } else {
 
+                //
+                // use the asynchronous mode unless the box asks for
+                // the synchronous mode, or it cannot be set up
+                //
+
+                if (0 == SbieApi_QueryProcess(
+                                idProcess, boxname, NULL, NULL, NULL)
+                        && SbieApi_QueryConfBool(
+                                boxname, L"AsyncPipeProxy", TRUE)) {
+
+                    ProxyPipe.Async =
+                        (PROXY_PIPE_ASYNC *)CreateAsync(ProxyPipe.hPipe);
+                }
+
+                PROXY_PIPE_ASYNC *async = ProxyPipe.Async;
+
                 rpl->handle = m_ProxyHandle->Create(idProcess, &ProxyPipe);
                 if (! rpl->handle) {
                     // CloseCallback was already invoked
                     rpl->h.status = STATUS_INSUFFICIENT_RESOURCES;
-                }
+                } else if (async)
+                    ShareAsync(async, idProcess, &rpl->ready_event);
             }
         }
 
@@ -253,17 +577,44 @@ MSG_HEADER *NamedPipeServer::CloseHandler(MSG_HEADER *msg, HANDLE idProcess)
     if (req->h.length < sizeof(NAMED_PIPE_CLOSE_REQ))
         return SHORT_REPLY(STATUS_INVALID_PARAMETER);
 
-    ULONG status = 0;
-
     PROXY_PIPE *ProxyPipe =
         (PROXY_PIPE *)m_ProxyHandle->Find(idProcess, req->handle);
+    if (! ProxyPipe)
+        return SHORT_REPLY(STATUS_INVALID_HANDLE);
 
-    if (ProxyPipe)
-        m_ProxyHandle->Close(ProxyPipe);
-    else
-        status = STATUS_INVALID_HANDLE;
+    const ULONG rpl_len = sizeof(NAMED_PIPE_CLOSE_RPL);
+    NAMED_PIPE_CLOSE_RPL *rpl = (NAMED_PIPE_CLOSE_RPL *)LONG_REPLY(rpl_len);
+
+    if (rpl) {
+
+        //
+        // return the statistics for this pipe, times in microseconds
+        //
+
+        PROXY_PIPE_STATS *Stats = &ProxyPipe->Stats;
+        LONG64 ReadWaitTicks = Stats->ReadWaitTicks;
 
-    return SHORT_REPLY(status);
+        if (ProxyPipe->Async) {
+            EnterCriticalSection(&ProxyPipe->Async->CritSec);
+            ReadWaitTicks += ProxyPipe->Async->ReadWaitTicks;
+            LeaveCriticalSection(&ProxyPipe->Async->CritSec);
+        }
+
+        rpl->stats.read_count = Stats->ReadCount;
+        rpl->stats.read_bytes = Stats->ReadBytes;
+        rpl->stats.read_parked = Stats->ReadParked;
+        rpl->stats.read_wait_us =
+            ReadWaitTicks * 1000000 / m_Frequency.QuadPart;
+        rpl->stats.write_count = Stats->WriteCount;
+        rpl->stats.write_bytes = Stats->WriteBytes;
+        rpl->stats.write_wait_us =
+            Stats->WriteWaitTicks * 1000000 / m_Frequency.QuadPart;
+
+        rpl->h.status = STATUS_SUCCESS;
+    }
+
+    m_ProxyHandle->Close(ProxyPipe);
+    return (MSG_HEADER *)rpl;
 }
 
 
@@ -299,6 +650,14 @@ MSG_HEADER *NamedPipeServer::SetHandler(MSG_HEADER *msg, HANDLE idProcess)
             ProxyPipe->hPipe, &IoStatusBlock,
             req->data, req->data_len, FilePipeInformation);
 
+        if (NT_SUCCESS(rpl->h.status) && ProxyPipe->Async
+                && req->data_len >= sizeof(PROXY_PIPE_MODE)) {
+
+            PROXY_PIPE_MODE *PipeMode = (PROXY_PIPE_MODE *)req->data;
+            ProxyPipe->Async->MessageMode =
+                (PipeMode->ReadMode == FILE_PIPE_MESSAGE_MODE);
+        }
+
         rpl->iosb.status = IoStatusBlock.Status;
         rpl->iosb.information = IoStatusBlock.Information;
     }
@@ -318,8 +677,8 @@ MSG_HEADER *NamedPipeServer::ReadHandler(MSG_HEADER *msg, HANDLE idProcess)
     NAMED_PIPE_READ_REQ *req = (NAMED_PIPE_READ_REQ *)msg;
     if (req->h.length < sizeof(NAMED_PIPE_READ_REQ))
         return SHORT_REPLY(STATUS_INVALID_PARAMETER);
-    if (req->read_len > PAGE_SIZE * 4)
-        return SHORT_REPLY(STATUS_BUFFER_OVERFLOW);
+    if (req->read_len > NAMED_PIPE_MAX_TRANSFER)
+        req->read_len = NAMED_PIPE_MAX_TRANSFER;
 
     PROXY_PIPE *ProxyPipe =
         (PROXY_PIPE *)m_ProxyHandle->Find(idProcess, req->handle);
@@ -331,17 +690,25 @@ MSG_HEADER *NamedPipeServer::ReadHandler(MSG_HEADER *msg, HANDLE idProcess)
         return SHORT_REPLY(STATUS_ACCESS_DENIED);
     }
 
+    if (ProxyPipe->Async) {
+        MSG_HEADER *rpl = AsyncReadHandler(ProxyPipe, req);
+        m_ProxyHandle->Release(ProxyPipe);
+        return rpl;
+    }
+
     const ULONG rpl_len = sizeof(NAMED_PIPE_READ_RPL) + req->read_len;
     NAMED_PIPE_READ_RPL *rpl = (NAMED_PIPE_READ_RPL *)LONG_REPLY(rpl_len);
 
     if (rpl) {
 
         IO_STATUS_BLOCK IoStatusBlock;
-        LARGE_INTEGER li;
+        LARGE_INTEGER li, t0, t1;
         li.QuadPart = 0;
 
         rpl->data_len = req->read_len;
 
+        QueryPerformanceCounter(&t0);
+
         rpl->h.status = NtReadFile(
             ProxyPipe->hPipe, ProxyPipe->hEvent, NULL, NULL, &IoStatusBlock,
             rpl->data, rpl->data_len, &li, NULL);
@@ -355,8 +722,18 @@ MSG_HEADER *NamedPipeServer::ReadHandler(MSG_HEADER *msg, HANDLE idProcess)
                 rpl->h.status = IoStatusBlock.Status;
         }
 
+        QueryPerformanceCounter(&t1);
+
         rpl->iosb.status = IoStatusBlock.Status;
         rpl->iosb.information = IoStatusBlock.Information;
+
+        InterlockedIncrement64(&ProxyPipe->Stats.ReadCount);
+        if (NT_SUCCESS(rpl->h.status)
+                || rpl->h.status == STATUS_BUFFER_OVERFLOW)
+            InterlockedExchangeAdd64(
+                &ProxyPipe->Stats.ReadBytes, IoStatusBlock.Information);
+        InterlockedExchangeAdd64(
+            &ProxyPipe->Stats.ReadWaitTicks, t1.QuadPart - t0.QuadPart);
     }
 
     m_ProxyHandle->Release(ProxyPipe);
@@ -364,6 +741,112 @@ MSG_HEADER *NamedPipeServer::ReadHandler(MSG_HEADER *msg, HANDLE idProcess)
 }
 
 
+//---------------------------------------------------------------------------
+// AsyncReadHandler
+//---------------------------------------------------------------------------
+
+
+MSG_HEADER *NamedPipeServer::AsyncReadHandler(
+    void *_ProxyPipe, NAMED_PIPE_READ_REQ *req)
+{
+    PROXY_PIPE *ProxyPipe = (PROXY_PIPE *)_ProxyPipe;
+    PROXY_PIPE_ASYNC *async = ProxyPipe->Async;
+
+    const ULONG rpl_len = sizeof(NAMED_PIPE_READ_RPL) + req->read_len;
+    NAMED_PIPE_READ_RPL *rpl = (NAMED_PIPE_READ_RPL *)LONG_REPLY(rpl_len);
+    if (! rpl)
+        return NULL;
+
+    //
+    // start the read ahead on first use, or after the previous
+    // data was consumed but no new read ahead could be started
+    //
+
+    EnterCriticalSection(&async->CritSec);
+
+    if ((! async->Completed) && (! async->ReadPending))
+        IssueRead(async);
+
+    //
+    // if no data is available yet, a caller which waits on its copy
+    // of the ready event is told to try again later.  otherwise we
+    // wait here, like the synchronous mode
+    //
+
+    const BOOLEAN Park =
+        async->ShareEvent && (req->flags & NAMED_PIPE_READ_PARK);
+
+    const ULONG WaitStart = GetTickCount();
+
+    while ((! async->Completed) && (! Park)) {
+
+        ULONG WaitTime = GetTickCount() - WaitStart;
+        if (WaitTime >= 10000)
+            break;
+
+        LeaveCriticalSection(&async->CritSec);
+        WaitForSingleObject(async->hReadyEvent, 10000 - WaitTime);
+        EnterCriticalSection(&async->CritSec);
+    }
+
+    if (async->Completed) {
+
+        //
+        // a partial read of a message leaves the rest of the message
+        // for the next read, and reports STATUS_BUFFER_OVERFLOW like
+        // a message mode pipe would
+        //
+
+        ULONG len = async->DataLen - async->DataPos;
+        if (len > req->read_len)
+            len = req->read_len;
+
+        memcpy(rpl->data, async->Data + async->DataPos, len);
+        async->DataPos += len;
+
+        if (async->DataPos < async->DataLen) {
+
+            rpl->h.status = async->MessageMode
+                          ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+
+        } else {
+
+            rpl->h.status = async->ReadStatus;
+            async->Completed = FALSE;
+
+            if (NT_SUCCESS(rpl->h.status)
+                    || rpl->h.status == STATUS_BUFFER_OVERFLOW)
+                IssueRead(async);
+        }
+
+        rpl->data_len = len;
+        rpl->iosb.status = rpl->h.status;
+        rpl->iosb.information = len;
+
+        InterlockedIncrement64(&ProxyPipe->Stats.ReadCount);
+        InterlockedExchangeAdd64(&ProxyPipe->Stats.ReadBytes, len);
+
+    } else {
+
+        if (Park) {
+
+            rpl->h.status = STATUS_PENDING;
+            InterlockedIncrement64(&ProxyPipe->Stats.ReadParked);
+
+        } else
+            rpl->h.status = STATUS_CANCELLED;
+
+        rpl->data_len = 0;
+        rpl->iosb.status = rpl->h.status;
+        rpl->iosb.information = 0;
+    }
+
+    LeaveCriticalSection(&async->CritSec);
+
+    return (MSG_HEADER *)rpl;
+}
+
+
 //---------------------------------------------------------------------------
 // WriteHandler
 //---------------------------------------------------------------------------
@@ -374,7 +857,7 @@ MSG_HEADER *NamedPipeServer::WriteHandler(MSG_HEADER *msg, HANDLE idProcess)
     NAMED_PIPE_WRITE_REQ *req = (NAMED_PIPE_WRITE_REQ *)msg;
     if (req->h.length < sizeof(NAMED_PIPE_WRITE_REQ))
         return SHORT_REPLY(STATUS_INVALID_PARAMETER);
-    if (req->data_len > PAGE_SIZE * 4)
+    if (req->data_len > NAMED_PIPE_MAX_TRANSFER)
         return SHORT_REPLY(STATUS_BUFFER_OVERFLOW);
     ULONG offset = FIELD_OFFSET(NAMED_PIPE_WRITE_REQ, data);
     if (offset + req->data_len > req->h.length)
@@ -391,9 +874,11 @@ MSG_HEADER *NamedPipeServer::WriteHandler(MSG_HEADER *msg, HANDLE idProcess)
     if (rpl) {
 
         IO_STATUS_BLOCK IoStatusBlock;
-        LARGE_INTEGER li;
+        LARGE_INTEGER li, t0, t1;
         li.QuadPart = 0;
 
+        QueryPerformanceCounter(&t0);
+
         if (RestrictToken()) {
 
             rpl->h.status = NtWriteFile(
@@ -415,8 +900,17 @@ MSG_HEADER *NamedPipeServer::WriteHandler(MSG_HEADER *msg, HANDLE idProcess)
                 rpl->h.status = IoStatusBlock.Status;
         }
 
+        QueryPerformanceCounter(&t1);
+
         rpl->iosb.status = IoStatusBlock.Status;
         rpl->iosb.information = IoStatusBlock.Information;
+
+        InterlockedIncrement64(&ProxyPipe->Stats.WriteCount);
+        if (NT_SUCCESS(rpl->h.status))
+            InterlockedExchangeAdd64(
+                &ProxyPipe->Stats.WriteBytes, IoStatusBlock.Information);
+        InterlockedExchangeAdd64(
+            &ProxyPipe->Stats.WriteWaitTicks, t1.QuadPart - t0.QuadPart);
     }
 
     m_ProxyHandle->Release(ProxyPipe);
@@ -536,8 +1030,8 @@ MSG_HEADER *NamedPipeServer::LpcConnectHandler(
     } else {
 
         PROXY_PIPE ProxyPipe;
+        memzero(&ProxyPipe, sizeof(ProxyPipe));
         ProxyPipe.hPipe = hPort;
-        ProxyPipe.hEvent = NULL;
 
         rpl->handle = m_ProxyHandle->Create(idProcess, &ProxyPipe);
         if (! rpl->handle)
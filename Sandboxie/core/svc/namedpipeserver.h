@@ -26,6 +26,7 @@
 
 #include "PipeServer.h"
 #include "ProxyHandle.h"
+#include "namedpipewire.h"
 
 
 class NamedPipeServer
@@ -41,6 +42,21 @@ protected:
 
     static void CloseCallback(void *context, void *data);
 
+    static ULONG CompletionThread(void *_this);
+
+    void *CreateAsync(HANDLE hPipe);
+
+    void ShareAsync(void *_async, HANDLE idProcess, ULONG64 *ReadyEvent);
+
+    static void DeleteAsync(void *_async);
+
+    static void IssueRead(void *_async);
+
+    static void CompleteRead(void *_async);
+
+    MSG_HEADER *AsyncReadHandler(
+        void *_ProxyPipe, NAMED_PIPE_READ_REQ *req);
+
     void NotifyHandler(HANDLE idProcess);
 
     MSG_HEADER *OpenHandler(MSG_HEADER *msg, HANDLE idProcess);
@@ -63,6 +79,10 @@ protected:
 
     ProxyHandle *m_ProxyHandle;
 
+    HANDLE m_hCompletionPort;
+
+    LARGE_INTEGER m_Frequency;
+
     void *m_pNtAlpcConnectPort;
     void *m_pNtAlpcSendWaitReceivePort;
     VOID *m_pNtAlpcImpersonateClientOfPort;
@@ -46,6 +46,24 @@ typedef struct tagNAMED_PIPE_IOSB {
 } NAMED_PIPE_IOSB;
 
 
+//---------------------------------------------------------------------------
+// Proxy Pipe Statistics
+//---------------------------------------------------------------------------
+
+
+typedef struct tagNAMED_PIPE_STATS {
+
+    ULONG64 read_count;
+    ULONG64 read_bytes;
+    ULONG64 read_parked;                // reads answered with STATUS_PENDING
+    ULONG64 read_wait_us;               // time spent waiting on the pipe
+    ULONG64 write_count;
+    ULONG64 write_bytes;
+    ULONG64 write_wait_us;
+
+} NAMED_PIPE_STATS;
+
+
 //---------------------------------------------------------------------------
 // Open Service
 //---------------------------------------------------------------------------
@@ -64,6 +82,7 @@ struct tagNAMED_PIPE_OPEN_RPL
     MSG_HEADER h;                       // status is NTSTATUS
     ULONG handle;
     NAMED_PIPE_IOSB iosb;
+    ULONG64 ready_event;                // see NAMED_PIPE_READ_PARK
 };
 
 typedef struct tagNAMED_PIPE_OPEN_REQ NAMED_PIPE_OPEN_REQ;
@@ -84,6 +103,7 @@ struct tagNAMED_PIPE_CLOSE_REQ
 struct tagNAMED_PIPE_CLOSE_RPL
 {
     MSG_HEADER h;                       // status is NTSTATUS
+    NAMED_PIPE_STATS stats;
 };
 
 typedef struct tagNAMED_PIPE_CLOSE_REQ NAMED_PIPE_CLOSE_REQ;
@@ -119,11 +139,23 @@ typedef struct tagNAMED_PIPE_SET_RPL NAMED_PIPE_SET_RPL;
 //---------------------------------------------------------------------------
 
 
+//
+// data is read ahead from the pipe into a window of at most
+// NAMED_PIPE_MAX_TRANSFER bytes.  when the caller sets NAMED_PIPE_READ_PARK
+// and no data is available yet, the reply is STATUS_PENDING, and the caller
+// should wait on the ready_event returned by the open service, then retry
+//
+
+#define NAMED_PIPE_MAX_TRANSFER         (64 * 1024)
+
+#define NAMED_PIPE_READ_PARK            0x0001
+
 struct tagNAMED_PIPE_READ_REQ
 {
     MSG_HEADER h;
     ULONG handle;
     ULONG read_len;
+    ULONG flags;
 };
 
 struct tagNAMED_PIPE_READ_RPL
@@ -36,6 +36,7 @@
 typedef struct _REQUEST_OBJ {
 
     LIST_ELEM list_elem;
+    struct _QUEUE_OBJ *queue_obj;
     ULONG  client_pid;
     ULONG  client_tid;
     HANDLE client_event;
@@ -51,9 +52,9 @@ typedef struct _REQUEST_OBJ {
 typedef struct _QUEUE_OBJ {
 
     LIST_ELEM list_elem;
-    FILETIME server_create_time;
     HANDLE server_pid;
     HANDLE server_event;
+    struct _QUEUE_WATCH *watch;
     LIST  requests;
     ULONG queue_name_len;
     WCHAR queue_name[1];
@@ -61,6 +62,42 @@ typedef struct _QUEUE_OBJ {
 } QUEUE_OBJ;
 
 
+typedef struct _QUEUE_WATCH {
+
+    //
+    // waits for the termination of the process which created the queue.
+    // the watch is freed only by ServerExitCallback, the queue may be
+    // deleted earlier, in which case DeleteQueueObj clears the queue field
+    //
+
+    QueueServer *server;
+    QUEUE_OBJ *queue;
+    HANDLE hProcess;
+    HANDLE hWait;
+
+} QUEUE_WATCH;
+
+
+//---------------------------------------------------------------------------
+// QueueServer_HashName
+//---------------------------------------------------------------------------
+
+
+static unsigned int QueueServer_HashName(const void *key, size_t size)
+{
+    //
+    // queue names are compared case insensitively (see str_map_match),
+    // so the hash has to ignore case as well
+    //
+
+    const WCHAR *name = *(const WCHAR **)key;
+    unsigned int hash = 5381;
+    for (; *name; ++name)
+        hash = ((hash << 5) + hash) ^ towlower(*name);
+    return hash;
+}
+
+
 //---------------------------------------------------------------------------
 // Constructor
 //---------------------------------------------------------------------------
@@ -75,6 +112,25 @@ QueueServer::QueueServer(PipeServer *pipeServer)
     InitializeCriticalSectionAndSpinCount(&m_lock, 1000);
     List_Init(&m_queues);
 
+    //
+    // queues are indexed by name, the key is a pointer to the name
+    // stored in the QUEUE_OBJ.  requests are indexed by request id.
+    // the map buckets come from m_pool, without it map_insert fails
+    // and CreateHandler and PutReqHandler report an error
+    //
+
+    m_pool = Pool_Create();
+    if (! m_pool)
+        LogEvent(MSG_9234, 0x9251, STATUS_INSUFFICIENT_RESOURCES);
+
+    map_init(&m_queue_map, m_pool);
+    m_queue_map.func_hash_key = &QueueServer_HashName;
+    m_queue_map.func_match_key = &str_map_match;
+    map_resize(&m_queue_map, 64);
+
+    map_init(&m_request_map, m_pool);
+    map_resize(&m_request_map, 128);
+
     m_RequestId = 0x00000001;
 
     pipeServer->Register(MSGID_QUEUE, this, Handler);
@@ -84,6 +140,9 @@ QueueServer::~QueueServer()
 {
 	// cleanup CS
 	DeleteCriticalSection(&m_lock);
+
+    if (m_pool)
+        Pool_Delete(m_pool);
 }
 
 
@@ -165,8 +224,8 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
     //
     //
 
-    status = OpenProcess(idProcess, &hProcess,
-                         PROCESS_DUP_HANDLE | PROCESS_QUERY_INFORMATION);
+    status = OpenProcess(idProcess, &hProcess, PROCESS_DUP_HANDLE
+                         | PROCESS_QUERY_INFORMATION | SYNCHRONIZE);
     if (! NT_SUCCESS(status))
         goto finish;
 
@@ -181,20 +240,31 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
 
     QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)FindQueueObj(QueueName);
     if (QueueObj) {
-        status = STATUS_OBJECT_NAME_COLLISION;
-        goto finish;
+
+        //
+        // a server which restarts right away may get here before
+        // ServerExitCallback has deleted the queue of its previous
+        // instance, so check the old server process on a collision
+        //
+
+        if (QueueObj->watch &&
+                WaitForSingleObject(QueueObj->watch->hProcess, 0)
+                                                        == WAIT_OBJECT_0) {
+
+            DeleteQueueObj(QueueObj);
+            QueueObj = NULL;
+
+        } else {
+
+            status = STATUS_OBJECT_NAME_COLLISION;
+            goto finish;
+        }
     }
 
     //
     //
     //
 
-    FILETIME time1, time2, time3, time4;
-    if (! GetProcessTimes(hProcess, &time1, &time2, &time3, &time4)) {
-        status = STATUS_INVALID_CID;
-        goto finish;
-    }
-
     status = DuplicateEvent(hProcess, req->event_handle, &hEvent);
     if (! NT_SUCCESS(status))
         goto finish;
@@ -207,18 +277,55 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
         goto finish;
     }
 
-    QueueObj->server_create_time.dwHighDateTime = time1.dwHighDateTime;
-    QueueObj->server_create_time.dwLowDateTime  = time1.dwLowDateTime;
+    QUEUE_WATCH *QueueWatch =
+        (QUEUE_WATCH *)HeapAlloc(m_heap, 0, sizeof(QUEUE_WATCH));
+    if (! QueueWatch) {
+        HeapFree(m_heap, 0, QueueObj);
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto finish;
+    }
 
     QueueObj->server_pid = idProcess;
     QueueObj->server_event = hEvent;
-    hEvent = NULL;
+    QueueObj->watch = QueueWatch;
 
     List_Init(&QueueObj->requests);
 
     wcscpy(QueueObj->queue_name, QueueName);
     QueueObj->queue_name_len = wcslen(QueueObj->queue_name);
 
+    if (! map_insert(&m_queue_map, QueueObj->queue_name, QueueObj, 0)) {
+        HeapFree(m_heap, 0, QueueWatch);
+        HeapFree(m_heap, 0, QueueObj);
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto finish;
+    }
+
+    //
+    // delete the queue when the server process terminates.  the
+    // callback cannot run before we leave m_lock, even if the process
+    // has already terminated
+    //
+
+    QueueWatch->server = this;
+    QueueWatch->queue = QueueObj;
+    QueueWatch->hProcess = hProcess;
+
+    if (! RegisterWaitForSingleObject(
+                            &QueueWatch->hWait, hProcess,
+                            ServerExitCallback, (void *)QueueWatch,
+                            INFINITE, WT_EXECUTEONLYONCE)) {
+
+        map_remove(&m_queue_map, QueueObj->queue_name);
+        HeapFree(m_heap, 0, QueueWatch);
+        HeapFree(m_heap, 0, QueueObj);
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto finish;
+    }
+
+    hProcess = NULL;
+    hEvent = NULL;
+
     List_Insert_After(&m_queues, NULL, QueueObj);
 
     status = STATUS_SUCCESS;
@@ -398,12 +505,8 @@ MSG_HEADER *QueueServer::PutRplHandler(MSG_HEADER *msg, HANDLE idProcess)
     //
     //
 
-    REQUEST_OBJ *RequestObj = (REQUEST_OBJ *)List_Head(&QueueObj->requests);
-    while (RequestObj) {
-        if (RequestObj->request_id == req->req_id)
-            break;
-        RequestObj = (REQUEST_OBJ *)List_Next(RequestObj);
-    }
+    REQUEST_OBJ *RequestObj =
+        (REQUEST_OBJ *)FindRequestObj(QueueObj, req->req_id);
 
     if (! RequestObj) {
         status = STATUS_END_OF_FILE;
@@ -524,6 +627,7 @@ MSG_HEADER *QueueServer::PutReqHandler(MSG_HEADER *msg, HANDLE idProcess)
     }
     memcpy(RequestData, req->data, req->data_len);
 
+    RequestObj->queue_obj = QueueObj;
     RequestObj->client_pid = (ULONG)(ULONG_PTR)idProcess;
     RequestObj->client_tid = PipeServer::GetCallerThreadId();
     RequestObj->client_event = hEvent;
@@ -543,8 +647,18 @@ MSG_HEADER *QueueServer::PutReqHandler(MSG_HEADER *msg, HANDLE idProcess)
     //
     //
 
-    rpl = (QUEUE_PUTREQ_RPL *)LONG_REPLY(sizeof(QUEUE_PUTREQ_RPL));
+    if (! map_insert(&m_request_map,
+                (void *)(ULONG_PTR)RequestObj->request_id, RequestObj, 0))
+        rpl = NULL;
+    else {
+        rpl = (QUEUE_PUTREQ_RPL *)LONG_REPLY(sizeof(QUEUE_PUTREQ_RPL));
+        if (! rpl)
+            map_remove(&m_request_map,
+                       (void *)(ULONG_PTR)RequestObj->request_id);
+    }
     if (! rpl) {
+        if (RequestObj->client_event)
+            CloseHandle(RequestObj->client_event);
         HeapFree(m_heap, 0, RequestData);
         HeapFree(m_heap, 0, RequestObj);
         status = STATUS_INSUFFICIENT_RESOURCES;
@@ -620,12 +734,8 @@ MSG_HEADER *QueueServer::GetRplHandler(MSG_HEADER *msg, HANDLE idProcess)
     //
     //
 
-    REQUEST_OBJ *RequestObj = (REQUEST_OBJ *)List_Head(&QueueObj->requests);
-    while (RequestObj) {
-        if (RequestObj->request_id == req->req_id)
-            break;
-        RequestObj = (REQUEST_OBJ *)List_Next(RequestObj);
-    }
+    REQUEST_OBJ *RequestObj =
+        (REQUEST_OBJ *)FindRequestObj(QueueObj, req->req_id);
 
     if (! RequestObj) {
         status = STATUS_END_OF_FILE;
@@ -825,47 +935,53 @@ WCHAR *QueueServer::MakeQueueName(
 
 void *QueueServer::FindQueueObj(const WCHAR *QueueName)
 {
-    ULONG QueueNameLen = wcslen(QueueName);
-    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)List_Head(&m_queues);
-    while (QueueObj) {
-        if (QueueObj->queue_name_len == QueueNameLen
-                && _wcsicmp(QueueObj->queue_name, QueueName) == 0)
-            break;
-        QueueObj = (QUEUE_OBJ *)List_Next(QueueObj);
-    }
+    //
+    // a queue is deleted when its server process terminates, see
+    // ServerExitCallback, which may run some time after the process
+    // has terminated.  CreateHandler checks the process on a collision
+    //
 
-    if (QueueObj) {
-        bool ServerProcessIsActive = false;
+    return map_get(&m_queue_map, QueueName);
+}
 
-        HANDLE hProcess = NULL;
-        ULONG status = OpenProcess(QueueObj->server_pid, &hProcess,
-                                   PROCESS_QUERY_INFORMATION);
-        if (status == 0) {
 
-            DWORD nExitCode = 0;
+//---------------------------------------------------------------------------
+// FindRequestObj
+//---------------------------------------------------------------------------
 
-            if (GetExitCodeProcess(hProcess, &nExitCode) && nExitCode == STILL_ACTIVE)
-            {
-                FILETIME time1, time2, time3, time4;
-                if (GetProcessTimes(hProcess, &time1, &time2, &time3, &time4)) {
-                    time2 = QueueObj->server_create_time;
-                    if (time1.dwHighDateTime == time2.dwHighDateTime &&
-                        time1.dwLowDateTime == time2.dwLowDateTime) {
 
-                        ServerProcessIsActive = true;
-                    }
-                }
-            }
-            CloseHandle(hProcess);
-        }
+void *QueueServer::FindRequestObj(void *_QueueObj, ULONG RequestId)
+{
+    REQUEST_OBJ *RequestObj = (REQUEST_OBJ *)
+                    map_get(&m_request_map, (void *)(ULONG_PTR)RequestId);
+    if (RequestObj && RequestObj->queue_obj != _QueueObj)
+        RequestObj = NULL;
+    return RequestObj;
+}
 
-        if (! ServerProcessIsActive) {
-            DeleteQueueObj(QueueObj);
-            QueueObj = NULL;
-        }
-    }
 
-    return QueueObj;
+//---------------------------------------------------------------------------
+// ServerExitCallback
+//---------------------------------------------------------------------------
+
+
+void QueueServer::ServerExitCallback(void *arg, BOOLEAN timeout)
+{
+    QUEUE_WATCH *QueueWatch = (QUEUE_WATCH *)arg;
+    QueueServer *pThis = QueueWatch->server;
+
+    EnterCriticalSection(&pThis->m_lock);
+
+    if (QueueWatch->queue)
+        pThis->DeleteQueueObj(QueueWatch->queue);
+
+    LeaveCriticalSection(&pThis->m_lock);
+
+    UnregisterWait(QueueWatch->hWait);
+
+    CloseHandle(QueueWatch->hProcess);
+
+    HeapFree(pThis->m_heap, 0, QueueWatch);
 }
 
 
@@ -936,6 +1052,10 @@ void QueueServer::DeleteQueueObj(void *_QueueObj)
     if (QueueObj->server_event)
         NtClose(QueueObj->server_event);
 
+    if (QueueObj->watch)
+        QueueObj->watch->queue = NULL;
+
+    map_remove(&m_queue_map, QueueObj->queue_name);
     List_Remove(&m_queues, QueueObj);
     HeapFree(m_heap, 0, QueueObj);
 }
@@ -955,6 +1075,7 @@ void QueueServer::DeleteRequestObj(LIST *RequestsList, void *_RequestObj)
         HeapFree(m_heap, 0, RequestObj->req_data_ptr);
     if (RequestObj->rpl_data_ptr)
         HeapFree(m_heap, 0, RequestObj->rpl_data_ptr);
+    map_remove(&m_request_map, (void *)(ULONG_PTR)RequestObj->request_id);
     List_Remove(RequestsList, RequestObj);
     HeapFree(m_heap, 0, RequestObj);
 }
@@ -41,6 +41,8 @@ protected:
 
     static void CloseCallback(void *context, void *data);
 
+    static void ServerExitCallback(void *arg, BOOLEAN timeout);
+
     MSG_HEADER *CreateHandler(MSG_HEADER *msg, HANDLE idProcess);
 
     MSG_HEADER *GetReqHandler(MSG_HEADER *msg, HANDLE idProcess);
@@ -65,6 +67,8 @@ protected:
 
     void *FindQueueObj(const WCHAR *QueueName);
 
+    void *FindRequestObj(void *_QueueObj, ULONG RequestId);
+
     void DeleteQueueObj(void *_QueueObj);
 
     void DeleteRequestObj(LIST *RequestsList, void *_RequestObj);
@@ -75,6 +79,9 @@ protected:
 
     CRITICAL_SECTION m_lock;
     LIST m_queues;
+    POOL *m_pool;
+    HASH_MAP m_queue_map;
+    HASH_MAP m_request_map;
 
     volatile LONG m_RequestId;
 };
@@ -0,0 +1,21 @@
+//---------------------------------------------------------------------------
+// IPv6 Address, stand-in for the Windows SDK header of the same name
+//---------------------------------------------------------------------------
+
+
+#ifndef _SBIE_TEST_IN6ADDR_H
+#define _SBIE_TEST_IN6ADDR_H
+
+
+typedef struct in6_addr {
+    union {
+        UCHAR Byte[16];
+        USHORT Word[8];
+    } u;
+} IN6_ADDR, *PIN6_ADDR;
+
+#define s6_addr     u.Byte
+#define s6_words    u.Word
+
+
+#endif // _SBIE_TEST_IN6ADDR_H
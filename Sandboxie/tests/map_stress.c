@@ -0,0 +1,816 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// Process Map Stress Test
+//
+// first runs random insert, take, get, iterate and erase sequences against
+// common/map.c and checks each step against a plain array.
+//
+// then models the process list of core/drv/process.c: Process_Map is a
+// common/map.c map keyed by process id, writer threads create and delete
+// processes under the exclusive list lock and rebuild the lock free lookup
+// table, reader threads look up random process ids, either in the table,
+// the way Process_Find does now, or in Process_Map under the shared lock,
+// the way it did before.  the table code below is a copy of the one in
+// process.c, with the per processor reader counters kept per reader
+// thread, Process_LookupTable_Free waits for the readers which are inside
+// a lookup in the same way.
+//
+// freed tables and PROCESS blocks are poisoned, and every PROCESS a reader
+// finds is checked while the reader is still inside the lookup, so a table
+// or block which is freed too early shows up as a failed check.  the
+// writers compare the table to Process_Map after every update.
+// building with -fsanitize=address catches use after free directly.
+//---------------------------------------------------------------------------
+
+
+#include "common/map.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_MAX_THREADS        64
+
+#define TEST_STORM_PIDS         4096        // pids created and deleted
+#define TEST_RESIDENT_PIDS      256         // pids which are never deleted
+#define TEST_RESIDENT_BASE      0x100000
+
+#define TEST_QUARANTINE         256         // freed blocks kept poisoned
+
+#define PROCESS_MAGIC_ALIVE     0x50524F43  // 'PROC'
+#define PROCESS_MAGIC_DEAD      0xDEADDEAD
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _PROCESS {
+
+    HANDLE pid;
+    ULONG magic;
+    ULONG64 create_count;
+
+} PROCESS;
+
+
+//
+// the lookup table, as in core/drv/process.c
+//
+
+typedef struct _PROCESS_LOOKUP_SLOT {
+
+    HANDLE pid;
+    PROCESS *proc;
+
+} PROCESS_LOOKUP_SLOT;
+
+typedef struct _PROCESS_LOOKUP_TABLE {
+
+    ULONG mask;
+    ULONG count;
+    PROCESS_LOOKUP_SLOT slots[1];
+
+} PROCESS_LOOKUP_TABLE;
+
+#define PROCESS_LOOKUP_HASH(pid)    ((ULONG)((ULONG_PTR)(pid) >> 2) * 2654435761U)
+
+
+//
+// stand-in for the ERESOURCE Process_ListLock, waiting writers hold back
+// new shared owners so a storm of lookups does not starve the writers
+//
+
+typedef struct _TEST_RESOURCE {
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ULONG shared;
+    ULONG exclusive;
+    ULONG waiting;
+
+} TEST_RESOURCE;
+
+
+//
+// per thread state, padded so the counters of different threads do not
+// share a cache line.  seq is odd while a reader is inside a lookup
+//
+
+typedef struct _TEST_THREAD {
+
+    pthread_t thread;
+    ULONG index;
+    ULONG64 seed;
+
+    volatile ULONG64 seq;
+
+    ULONG64 lookups;
+    ULONG64 hits;
+    ULONG64 updates;
+
+    PROCESS *quarantine[TEST_QUARANTINE];
+    ULONG quarantine_next;
+
+    UCHAR padding[64];
+
+} TEST_THREAD;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static HASH_MAP Process_Map;
+static TEST_RESOURCE Process_ListLock;
+
+static void *volatile Process_LookupTable = NULL;  // PROCESS_LOOKUP_TABLE
+
+static PROCESS Test_DeadProcess = { 0, PROCESS_MAGIC_DEAD, 0 };
+
+static TEST_THREAD Test_Readers[TEST_MAX_THREADS];
+static volatile ULONG Test_ReaderCount = 0;
+
+static TEST_THREAD Test_Writers[TEST_MAX_THREADS];
+
+static volatile BOOLEAN Test_Stop = FALSE;
+static BOOLEAN Test_UseTable = TRUE;
+static BOOLEAN Test_Verify = TRUE;
+
+static volatile LONG Test_CreateCount = 0;
+
+
+//---------------------------------------------------------------------------
+// Sequential Map Test
+//---------------------------------------------------------------------------
+
+
+#define TEST_SEQ_KEYS           1024
+
+
+static void Test_MapCheckAll(HASH_MAP *map, void **ref, ULONG ref_count)
+{
+    map_iter_t iter = map_iter();
+    ULONG count = 0;
+    ULONG i;
+
+    while (map_next(map, &iter)) {
+
+        ULONG key = (ULONG)(ULONG_PTR)*(void **)iter.key;
+        Test_Check(key && key < TEST_SEQ_KEYS, "bad key %u", key);
+        Test_Check(ref[key] == iter.value, "key %u has the wrong value", key);
+        ++count;
+    }
+
+    Test_Check(count == ref_count && (ULONG)map->nnodes == ref_count,
+        "map iterates %u nodes and counts %d, expected %u",
+        count, map->nnodes, ref_count);
+
+    for (i = 1; i < TEST_SEQ_KEYS; ++i) {
+        void *value = map_get(map, (void *)(ULONG_PTR)i);
+        Test_Check(value == ref[i], "map_get for key %u", i);
+    }
+}
+
+
+static void Test_MapSequential(ULONG op_count, ULONG64 seed)
+{
+    static void *ref[TEST_SEQ_KEYS];
+    HASH_MAP map;
+    WCHAR name[64];
+    HASH_MAP names;
+    ULONG ref_count = 0;
+    ULONG i;
+
+    memset(ref, 0, sizeof(ref));
+    map_init(&map, NULL);
+
+    for (i = 0; i < op_count; ++i) {
+
+        ULONG op = Test_Random(&seed) % 100;
+        ULONG key = 1 + Test_Random(&seed) % (TEST_SEQ_KEYS - 1);
+        void *value = (void *)(ULONG_PTR)(Test_Random(&seed) | 1);
+
+        if (op < 45) {
+
+            if (! ref[key]) {
+                Test_Check(map_insert(&map, (void *)(ULONG_PTR)key, value, 0),
+                    "map_insert failed");
+                ref[key] = value;
+                ++ref_count;
+            }
+
+        } else if (op < 80) {
+
+            void *taken = (void *)1;
+            BOOLEAN ok = map_take(&map, (void *)(ULONG_PTR)key, &taken, 0);
+            Test_Check(ok == (ref[key] != NULL) && taken == ref[key],
+                "map_take for key %u", key);
+            if (ok) {
+                ref[key] = NULL;
+                --ref_count;
+            }
+
+        } else if (op < 98) {
+
+            Test_Check(map_get(&map, (void *)(ULONG_PTR)key) == ref[key],
+                "map_get for key %u", key);
+
+        } else if (op < 99) {
+
+            //
+            // erase about a third of the nodes while iterating
+            //
+
+            map_iter_t iter = map_iter();
+            BOOLEAN more = map_next(&map, &iter);
+            while (more) {
+                ULONG k = (ULONG)(ULONG_PTR)*(void **)iter.key;
+                if (Test_Random(&seed) % 3 == 0) {
+                    ref[k] = NULL;
+                    --ref_count;
+                    more = map_erase(&map, &iter);
+                } else
+                    more = map_next(&map, &iter);
+            }
+
+            Test_MapCheckAll(&map, ref, ref_count);
+
+        } else {
+
+            Test_MapCheckAll(&map, ref, ref_count);
+
+            if (Test_Random(&seed) % 8 == 0) {
+                map_clear(&map);
+                memset(ref, 0, sizeof(ref));
+                ref_count = 0;
+            }
+        }
+    }
+
+    Test_MapCheckAll(&map, ref, ref_count);
+    map_clear(&map);
+
+    //
+    // keys stored by reference, as for the name maps in core/dll
+    //
+
+    map_init(&names, NULL);
+    names.func_key_size = &map_wcssize;
+
+    for (i = 0; i < TEST_SEQ_KEYS; ++i) {
+        swprintf(name, ARRAYSIZE(name), L"\\Device\\Process%u", i);
+        Test_Check(map_insert(&names, name, (void *)(ULONG_PTR)(i + 1), 0),
+            "map_insert failed");
+    }
+
+    for (i = 0; i < TEST_SEQ_KEYS; ++i) {
+        swprintf(name, ARRAYSIZE(name), L"\\Device\\Process%u", i);
+        Test_Check(map_get(&names, name) == (void *)(ULONG_PTR)(i + 1),
+            "map_get for %ls", name);
+        if (i % 2)
+            map_remove(&names, name);
+    }
+
+    Test_Check(names.nnodes == TEST_SEQ_KEYS / 2,
+        "%d names left", names.nnodes);
+    map_clear(&names);
+
+    printf("%u sequential map operations match the reference\n", op_count);
+}
+
+
+//---------------------------------------------------------------------------
+// List Lock
+//---------------------------------------------------------------------------
+
+
+static void Test_InitResource(TEST_RESOURCE *res)
+{
+    memset(res, 0, sizeof(TEST_RESOURCE));
+    pthread_mutex_init(&res->mutex, NULL);
+    pthread_cond_init(&res->cond, NULL);
+}
+
+
+static void Test_AcquireShared(TEST_RESOURCE *res)
+{
+    pthread_mutex_lock(&res->mutex);
+    while (res->exclusive || res->waiting)
+        pthread_cond_wait(&res->cond, &res->mutex);
+    ++res->shared;
+    pthread_mutex_unlock(&res->mutex);
+}
+
+
+static void Test_AcquireExclusive(TEST_RESOURCE *res)
+{
+    pthread_mutex_lock(&res->mutex);
+    ++res->waiting;
+    while (res->exclusive || res->shared)
+        pthread_cond_wait(&res->cond, &res->mutex);
+    --res->waiting;
+    res->exclusive = 1;
+    pthread_mutex_unlock(&res->mutex);
+}
+
+
+static void Test_Release(TEST_RESOURCE *res)
+{
+    pthread_mutex_lock(&res->mutex);
+    if (res->exclusive)
+        res->exclusive = 0;
+    else
+        --res->shared;
+    pthread_cond_broadcast(&res->cond);
+    pthread_mutex_unlock(&res->mutex);
+}
+
+
+//---------------------------------------------------------------------------
+// Lookup Table
+//---------------------------------------------------------------------------
+
+
+static void *Process_LookupTable_Update(void)
+{
+    PROCESS_LOOKUP_TABLE *table;
+    map_iter_t iter;
+    ULONG mask, size, i;
+
+    for (mask = 63; mask < (ULONG)Process_Map.nnodes * 2; mask = (mask << 1) | 1)
+        ;
+
+    size = FIELD_OFFSET(PROCESS_LOOKUP_TABLE, slots)
+         + sizeof(PROCESS_LOOKUP_SLOT) * (mask + 1);
+
+    table = malloc(size);
+    if (table) {
+
+        memset(table, 0, size);
+        table->mask = mask;
+
+        iter = map_iter();
+        while (map_next(&Process_Map, &iter)) {
+
+            HANDLE pid = *(HANDLE *)iter.key;   // keys are stored by value
+
+            i = PROCESS_LOOKUP_HASH(pid) & mask;
+            while (table->slots[i].pid)
+                i = (i + 1) & mask;
+
+            table->slots[i].pid = pid;
+            table->slots[i].proc = iter.value;
+            ++table->count;
+        }
+    }
+
+    return InterlockedExchangePointer(&Process_LookupTable, table);
+}
+
+
+static void Process_LookupTable_Free(void *old_table)
+{
+    PROCESS_LOOKUP_TABLE *table = old_table;
+    ULONG count, i;
+
+    if (! old_table)
+        return;
+
+    //
+    // wait until every reader which was inside a lookup when the table
+    // was replaced has left it
+    //
+
+    count = Test_ReaderCount;
+    for (i = 0; i < count; ++i) {
+
+        ULONG64 seq = __atomic_load_n(&Test_Readers[i].seq, __ATOMIC_SEQ_CST);
+        if (seq & 1) {
+            while (__atomic_load_n(&Test_Readers[i].seq, __ATOMIC_SEQ_CST) == seq)
+                YieldProcessor();
+        }
+    }
+
+    for (i = 0; i <= table->mask; ++i)
+        table->slots[i].proc = &Test_DeadProcess;
+
+    free(old_table);
+}
+
+
+static BOOLEAN Process_LookupTable_Find(
+    TEST_THREAD *reader, HANDLE ProcessId, PROCESS **out_proc)
+{
+    PROCESS_LOOKUP_TABLE *table;
+    PROCESS *proc = NULL;
+    BOOLEAN found = FALSE;
+    ULONG i;
+
+    __atomic_add_fetch(&reader->seq, 1, __ATOMIC_SEQ_CST);  // KeRaiseIrql
+
+    table = (PROCESS_LOOKUP_TABLE *)
+        __atomic_load_n(&Process_LookupTable, __ATOMIC_ACQUIRE);
+    if (table) {
+
+        i = PROCESS_LOOKUP_HASH(ProcessId) & table->mask;
+        while (table->slots[i].pid) {
+
+            if (table->slots[i].pid == ProcessId) {
+                proc = table->slots[i].proc;
+                break;
+            }
+
+            i = (i + 1) & table->mask;
+        }
+
+        found = TRUE;
+    }
+
+    //
+    // Process_Find hands the PROCESS to its caller after lowering the
+    // irql, from there on its lifetime is not protected by the table, so
+    // the test checks it while the table still protects it
+    //
+
+    if (proc) {
+        Test_Check(proc->magic == PROCESS_MAGIC_ALIVE,
+            "pid %p found a freed PROCESS", ProcessId);
+        Test_Check(proc->pid == ProcessId,
+            "pid %p found the PROCESS of pid %p", ProcessId, proc->pid);
+    }
+
+    __atomic_add_fetch(&reader->seq, 1, __ATOMIC_SEQ_CST);  // KeLowerIrql
+
+    *out_proc = proc;
+    return found;
+}
+
+
+static void Test_VerifyTable(void)
+{
+    PROCESS_LOOKUP_TABLE *table = Process_LookupTable;
+    map_iter_t iter = map_iter();
+    ULONG count = 0;
+
+    //
+    // caller holds the list lock exclusively
+    //
+
+    Test_Check(table, "no lookup table");
+    Test_Check(table->count == (ULONG)Process_Map.nnodes,
+        "table has %u processes, map has %d", table->count, Process_Map.nnodes);
+    Test_Check(table->count * 2 <= table->mask + 1,
+        "table is more than half full, %u of %u", table->count, table->mask + 1);
+
+    while (map_next(&Process_Map, &iter)) {
+
+        HANDLE pid = *(HANDLE *)iter.key;
+        ULONG i = PROCESS_LOOKUP_HASH(pid) & table->mask;
+        while (table->slots[i].pid && table->slots[i].pid != pid)
+            i = (i + 1) & table->mask;
+
+        Test_Check(table->slots[i].pid == pid && table->slots[i].proc == iter.value,
+            "pid %p is in the map but not in the table", pid);
+        ++count;
+    }
+
+    Test_Check(count == table->count, "map iterates %u processes", count);
+}
+
+
+//---------------------------------------------------------------------------
+// Processes
+//---------------------------------------------------------------------------
+
+
+static HANDLE Test_RandomPid(ULONG64 *seed, BOOLEAN readers)
+{
+    ULONG r = Test_Random(seed);
+
+    //
+    // readers also look for resident processes and for pids which
+    // never exist, writers only create and delete storm pids
+    //
+
+    if (readers && r % 8 == 0)
+        return (HANDLE)(ULONG_PTR)(TEST_RESIDENT_BASE + ((r >> 3) % TEST_RESIDENT_PIDS) * 4);
+    if (readers && r % 8 == 1)
+        return (HANDLE)(ULONG_PTR)(0x200000 + ((r >> 3) % 4096) * 4);
+    return (HANDLE)(ULONG_PTR)(4 + ((r >> 3) % TEST_STORM_PIDS) * 4);
+}
+
+
+static PROCESS *Test_AllocProcess(HANDLE pid)
+{
+    PROCESS *proc = malloc(sizeof(PROCESS));
+    Test_Check(proc, "out of memory");
+    proc->pid = pid;
+    proc->magic = PROCESS_MAGIC_ALIVE;
+    proc->create_count = InterlockedIncrement(&Test_CreateCount);
+    return proc;
+}
+
+
+static void Test_FreeProcess(TEST_THREAD *writer, PROCESS *proc)
+{
+    PROCESS **slot = &writer->quarantine[writer->quarantine_next];
+
+    //
+    // poison the block and keep it around for a while, so a reader which
+    // still uses it sees the poison rather than a reused block
+    //
+
+    proc->magic = PROCESS_MAGIC_DEAD;
+    proc->pid = NULL;
+
+    free(*slot);
+    *slot = proc;
+    writer->quarantine_next = (writer->quarantine_next + 1) % TEST_QUARANTINE;
+}
+
+
+static void Test_InitProcesses(void)
+{
+    ULONG i;
+
+    map_init(&Process_Map, NULL);
+    map_resize(&Process_Map, 128);
+    Test_InitResource(&Process_ListLock);
+
+    for (i = 0; i < TEST_RESIDENT_PIDS; ++i) {
+        HANDLE pid = (HANDLE)(ULONG_PTR)(TEST_RESIDENT_BASE + i * 4);
+        map_insert(&Process_Map, pid, Test_AllocProcess(pid), 0);
+    }
+
+    Process_LookupTable_Update();
+}
+
+
+static void Test_FreeProcesses(void)
+{
+    map_iter_t iter = map_iter();
+    ULONG i, j;
+
+    while (map_next(&Process_Map, &iter))
+        free(iter.value);
+    map_clear(&Process_Map);
+
+    free(InterlockedExchangePointer(&Process_LookupTable, NULL));
+
+    for (i = 0; i < TEST_MAX_THREADS; ++i) {
+        for (j = 0; j < TEST_QUARANTINE; ++j) {
+            free(Test_Writers[i].quarantine[j]);
+            Test_Writers[i].quarantine[j] = NULL;
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Threads
+//---------------------------------------------------------------------------
+
+
+static void *Test_Reader(void *param)
+{
+    TEST_THREAD *reader = param;
+
+    while (! Test_Stop) {
+
+        HANDLE pid = Test_RandomPid(&reader->seed, TRUE);
+        PROCESS *proc;
+
+        if (! Test_UseTable || ! Process_LookupTable_Find(reader, pid, &proc)) {
+
+            Test_AcquireShared(&Process_ListLock);
+
+            proc = map_get(&Process_Map, pid);
+            if (proc) {
+                Test_Check(proc->magic == PROCESS_MAGIC_ALIVE && proc->pid == pid,
+                    "pid %p found a bad PROCESS in the map", pid);
+            }
+
+            Test_Release(&Process_ListLock);
+        }
+
+        if ((ULONG_PTR)pid >= TEST_RESIDENT_BASE
+                && (ULONG_PTR)pid < TEST_RESIDENT_BASE + TEST_RESIDENT_PIDS * 4)
+            Test_Check(proc, "resident pid %p not found", pid);
+        else if ((ULONG_PTR)pid >= 0x200000)
+            Test_Check(! proc, "pid %p was never created", pid);
+
+        ++reader->lookups;
+        if (proc)
+            ++reader->hits;
+    }
+
+    return NULL;
+}
+
+
+static void *Test_Writer(void *param)
+{
+    TEST_THREAD *writer = param;
+
+    while (! Test_Stop) {
+
+        HANDLE pid = Test_RandomPid(&writer->seed, FALSE);
+        PROCESS *new_proc = Test_AllocProcess(pid);
+        PROCESS *proc = NULL;
+        void *old_table;
+
+        //
+        // create the process if it does not exist, otherwise delete it,
+        // as Process_NotifyProcess_Create and _Delete do
+        //
+
+        Test_AcquireExclusive(&Process_ListLock);
+
+        if (! map_take(&Process_Map, pid, &proc, 0)) {
+            map_insert(&Process_Map, pid, new_proc, 0);
+            new_proc = NULL;
+        }
+
+        old_table = Process_LookupTable_Update();
+
+        if (Test_Verify)
+            Test_VerifyTable();
+
+        Test_Release(&Process_ListLock);
+
+        Process_LookupTable_Free(old_table);
+
+        if (proc)
+            Test_FreeProcess(writer, proc);
+        if (new_proc)
+            free(new_proc);
+
+        ++writer->updates;
+    }
+
+    return NULL;
+}
+
+
+static void Test_Run(
+    ULONG readers, ULONG writers, ULONG duration_ms, ULONG64 seed,
+    ULONG64 *out_lookups, ULONG64 *out_hits, ULONG64 *out_updates)
+{
+    struct timespec ts;
+    ULONG i;
+
+    memset(Test_Readers, 0, sizeof(Test_Readers));
+    memset(Test_Writers, 0, sizeof(Test_Writers));
+    Test_Stop = FALSE;
+
+    Test_InitProcesses();
+
+    Test_ReaderCount = readers;
+    for (i = 0; i < readers; ++i) {
+        Test_Readers[i].index = i;
+        Test_Readers[i].seed = seed * 2654435761ULL + i + 1;
+        pthread_create(&Test_Readers[i].thread, NULL, Test_Reader, &Test_Readers[i]);
+    }
+
+    for (i = 0; i < writers; ++i) {
+        Test_Writers[i].index = i;
+        Test_Writers[i].seed = seed * 40503ULL + i + 0x1000;
+        pthread_create(&Test_Writers[i].thread, NULL, Test_Writer, &Test_Writers[i]);
+    }
+
+    ts.tv_sec = duration_ms / 1000;
+    ts.tv_nsec = (duration_ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+    Test_Stop = TRUE;
+
+    *out_lookups = *out_hits = *out_updates = 0;
+
+    for (i = 0; i < readers; ++i) {
+        pthread_join(Test_Readers[i].thread, NULL);
+        *out_lookups += Test_Readers[i].lookups;
+        *out_hits += Test_Readers[i].hits;
+    }
+
+    for (i = 0; i < writers; ++i) {
+        pthread_join(Test_Writers[i].thread, NULL);
+        *out_updates += Test_Writers[i].updates;
+    }
+
+    Test_FreeProcesses();
+}
+
+
+static void Test_Print(
+    const char *title, ULONG readers, ULONG writers, ULONG duration_ms,
+    ULONG64 lookups, ULONG64 hits, ULONG64 updates)
+{
+    printf("%-6s %2u readers %2u writers  %8.2f M lookups/s  %5.1f%% hits  "
+           "%8.0f creates and deletes/s\n",
+           title, readers, writers,
+           lookups / (duration_ms * 1000.0),
+           lookups ? 100.0 * hits / lookups : 0.0,
+           updates * 1000.0 / duration_ms);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    ULONG max_readers = 4;
+    ULONG writers = 2;
+    ULONG duration_ms = 1000;
+    ULONG op_count = 1000000;
+    ULONG64 seed = 1;
+    BOOLEAN bench = FALSE;
+    ULONG64 lookups, hits, updates;
+    ULONG i, readers;
+
+    for (i = 1; i < (ULONG)argc; ++i) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < (ULONG)argc)
+            max_readers = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < (ULONG)argc)
+            writers = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < (ULONG)argc)
+            duration_ms = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < (ULONG)argc)
+            op_count = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < (ULONG)argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-b") == 0)
+            bench = TRUE;
+        else {
+            printf("usage: %s [-r readers] [-w writers] [-d ms per run] "
+                   "[-n sequential operations] [-s seed] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (! seed)
+        seed = 1;
+    if (max_readers < 1 || max_readers > TEST_MAX_THREADS)
+        max_readers = 4;
+    if (writers > TEST_MAX_THREADS)
+        writers = TEST_MAX_THREADS;
+
+    Test_MapSequential(op_count, seed);
+
+    //
+    // the stress run checks the table after every update, the benchmark
+    // leaves that out and compares the lookups for growing reader counts
+    //
+
+    Test_Verify = TRUE;
+    Test_UseTable = TRUE;
+    Test_Run(max_readers, writers, duration_ms, seed, &lookups, &hits, &updates);
+    Test_Print("table", max_readers, writers, duration_ms, lookups, hits, updates);
+
+    Test_UseTable = FALSE;
+    Test_Run(max_readers, writers, duration_ms, seed, &lookups, &hits, &updates);
+    Test_Print("locked", max_readers, writers, duration_ms, lookups, hits, updates);
+
+    printf("stress test passed\n");
+
+    if (bench) {
+
+        Test_Verify = FALSE;
+
+        for (readers = 1; readers <= max_readers; readers *= 2) {
+
+            Test_UseTable = FALSE;
+            Test_Run(readers, writers, duration_ms, seed, &lookups, &hits, &updates);
+            Test_Print("locked", readers, writers, duration_ms, lookups, hits, updates);
+
+            Test_UseTable = TRUE;
+            Test_Run(readers, writers, duration_ms, seed, &lookups, &hits, &updates);
+            Test_Print("table", readers, writers, duration_ms, lookups, hits, updates);
+        }
+    }
+
+    return 0;
+}
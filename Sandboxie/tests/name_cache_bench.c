@@ -0,0 +1,735 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// File Name Cache Benchmark
+//
+// replays a trace of file opens through the name cache of core/dll/file_cache.c
+// the way File_GetName uses it, once with the cache and once without it.
+// the object manager and the file system are simulated, each symbolic link
+// probe and each directory query costs a configurable busy wait, which
+// stands in for the kernel round trip that the cache saves.
+//
+// a trace has one NT path per line, for example \??\C:\PROGRA~1\App\x.dll,
+// in a resource access log the text up to the first backslash is skipped.
+// lines beginning with ! are file system changes:
+//
+//   !rename <path>     this process renamed or deleted the entry of the
+//                      short name, the short name now refers to a new name
+//   !extern <path>     the same, but done by another process, the cache
+//                      may serve the old name until the entry expires
+//
+// every path resolves to the same name with and without the cache, which
+// is checked for each line, except for the expected staleness after a
+// change by another process
+//---------------------------------------------------------------------------
+
+
+#include "common/map.h"
+
+
+//---------------------------------------------------------------------------
+// SbieDll Environment
+//---------------------------------------------------------------------------
+
+
+#define TRUE_NAME_BUFFER        0
+#define COPY_NAME_BUFFER        1
+
+#define MONITOR_OTHER           0x0000
+#define MONITOR_TRACE           0x0000
+
+typedef struct _THREAD_DATA {
+
+    WCHAR *name_buffer[2];
+    ULONG name_buffer_len[2];
+
+} THREAD_DATA;
+
+typedef struct _FILE_DRIVE {
+
+    ULONG len;
+
+} FILE_DRIVE;
+
+typedef struct _FILE_BOTH_DIRECTORY_INFORMATION {
+
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+
+} FILE_BOTH_DIRECTORY_INFORMATION, *PFILE_BOTH_DIRECTORY_INFORMATION;
+
+ULONG Test_TickOffset = 0;
+
+static void *Dll_Pool = NULL;
+static const WCHAR *Dll_ImageName = L"bench";
+
+static BOOLEAN Bench_UseCache = TRUE;
+
+static CRITICAL_SECTION Bench_DrivesAndLinks_CritSec;
+static CRITICAL_SECTION *File_DrivesAndLinks_CritSec =
+                                                &Bench_DrivesAndLinks_CritSec;
+
+static const WCHAR *File_Mup = L"\\device\\mup\\";
+static const ULONG File_MupLen = 12;
+
+
+static void *Dll_AllocTemp(ULONG size)
+{
+    return malloc(size);
+}
+
+
+static void Dll_Free(void *ptr)
+{
+    free(ptr);
+}
+
+
+static WCHAR *Dll_GetTlsNameBuffer(THREAD_DATA *data, ULONG which, ULONG size)
+{
+    if (data->name_buffer_len[which] < size) {
+        data->name_buffer[which] = realloc(data->name_buffer[which], size);
+        data->name_buffer_len[which] = size;
+    }
+    return data->name_buffer[which];
+}
+
+
+static BOOLEAN SbieApi_QueryConfBool(
+    const WCHAR *section, const WCHAR *setting, BOOLEAN def)
+{
+    if (wcscmp(setting, L"UseFileNameCache") == 0)
+        return Bench_UseCache;
+    return def;
+}
+
+
+static void SbieApi_MonitorPutMsg(ULONG type, const WCHAR *msg)
+{
+    printf("%ls\n", msg);
+}
+
+
+static const FILE_DRIVE *File_GetDriveForPath(const WCHAR *path, ULONG len)
+{
+    static const FILE_DRIVE drive = { 0 };
+    static const WCHAR prefix[] = L"\\device\\harddiskvolume";
+    const ULONG prefix_len = (ULONG)wcslen(prefix);
+
+    //
+    // like the real function, the drives lock is held on return
+    //
+
+    if (len > prefix_len && _wcsnicmp(path, prefix, prefix_len) == 0) {
+        EnterCriticalSection(File_DrivesAndLinks_CritSec);
+        return &drive;
+    }
+    return NULL;
+}
+
+
+#include "core/dll/file_cache.c"
+
+
+//---------------------------------------------------------------------------
+// Simulated Object Manager and File System
+//---------------------------------------------------------------------------
+
+
+static ULONG Sim_ProbeNs = 1500;        // NtOpenSymbolicLinkObject
+static ULONG Sim_QueryNs = 15000;       // NtCreateFile + NtQueryDirectoryFile
+
+static ULONG64 Sim_Probes = 0;
+static ULONG64 Sim_Queries = 0;
+
+//
+// every short name resolves to its long name plus a version, the version
+// of a short name is incremented when its entry is renamed
+//
+
+static HASH_MAP Sim_Versions;           // lower case path -> ULONG
+
+
+static void Sim_Spin(ULONG ns)
+{
+    ULONG64 end = Test_GetNanoseconds() + ns;
+    while (Test_GetNanoseconds() < end)
+        ;
+}
+
+
+static WCHAR *Sim_TranslateSymlinks(const WCHAR *path, ULONG *link_len)
+{
+    ULONG len = (ULONG)wcslen(path);
+    ULONG i;
+    WCHAR *name;
+
+    //
+    // like File_GetName_TranslateSymlinks, probe successively shorter
+    // prefixes until one is a link, only \??\X: is a link here
+    //
+
+    *link_len = 0;
+
+    for (i = len; i > 0; --i) {
+
+        if (i < len && path[i] != L'\\')
+            continue;
+
+        ++Sim_Probes;
+        Sim_Spin(Sim_ProbeNs);
+
+        if (i == 6 && path[0] == L'\\' && path[1] == L'?' && path[2] == L'?'
+                && path[3] == L'\\' && path[5] == L':') {
+
+            *link_len = i;
+            break;
+        }
+    }
+
+    name = malloc((len + 32) * sizeof(WCHAR));
+    if (*link_len)
+        swprintf(name, len + 32, L"\\Device\\HarddiskVolume%d%ls",
+                 towupper(path[4]) - L'A' + 1, path + *link_len);
+    else
+        wcscpy(name, path);
+    return name;
+}
+
+
+static ULONG Sim_GetVersion(const WCHAR *path, ULONG len)
+{
+    WCHAR *key = File_NameCache_MakeKey(path, len);
+    ULONG *version = map_get(&Sim_Versions, key);
+    ULONG result = version ? *version : 0;
+    free(key);
+    return result;
+}
+
+
+static void Sim_Rename(const WCHAR *path)
+{
+    WCHAR *key = File_NameCache_MakeKey(path, (ULONG)wcslen(path));
+    ULONG *version = map_get(&Sim_Versions, key);
+    if (version)
+        ++*version;
+    else {
+        ULONG one = 1;
+        map_insert(&Sim_Versions, key, &one, sizeof(ULONG));
+    }
+    free(key);
+}
+
+
+static void Sim_QueryShortName(
+    const WCHAR *Path, ULONG index, ULONG backslash_index,
+    PFILE_BOTH_DIRECTORY_INFORMATION info)
+{
+    const WCHAR *short_name = Path + backslash_index + 1;
+    ULONG short_len = index - backslash_index - 1;
+    ULONG version = Sim_GetVersion(Path, index);
+    WCHAR *out = info->FileName;
+    ULONG tilde, i;
+
+    ++Sim_Queries;
+    Sim_Spin(Sim_QueryNs);
+
+    //
+    // PROGRA~1 becomes Progra Long 1, and Progra Long 1 v2 once renamed
+    //
+
+    for (tilde = 0; tilde < short_len && short_name[tilde] != L'~'; ++tilde)
+        ;
+    for (i = 0; i < tilde; ++i)
+        *out++ = i ? towlower(short_name[i]) : short_name[i];
+    wmemcpy(out, L" Long ", 6);
+    out += 6;
+    for (i = tilde + 1; i < short_len; ++i)
+        *out++ = short_name[i];
+    if (version)
+        out += swprintf(out, 32, L" v%u", version + 1);
+
+    info->FileNameLength = (ULONG)((out - info->FileName) * sizeof(WCHAR));
+}
+
+
+//---------------------------------------------------------------------------
+// Resolution as done by File_GetName
+//---------------------------------------------------------------------------
+
+
+static WCHAR *Bench_ExpandShortNames(THREAD_DATA *TlsData, WCHAR *Path)
+{
+    PFILE_BOTH_DIRECTORY_INFORMATION info;
+    const ULONG info_size = 1024;
+    ULONG index, backslash_index = 0;
+
+    //
+    // the scan for short name components follows
+    // File_GetName_ExpandShortNames in core/dll/file.c
+    //
+
+    info = malloc(info_size);
+
+    for (index = 0; Path[index] != 0; ) {
+
+        ULONG dot_count, len, generation = 0;
+        WCHAR *copy;
+
+        for (; Path[index] != L'\0' && Path[index] != L'~'; ++index)
+            if (Path[index] == L'\\')
+                backslash_index = index;
+
+        if (Path[index] == L'\0')
+            break;
+
+        if (index == backslash_index + 1)
+            dot_count = 99;
+        else
+            dot_count = 0;
+
+        for (; Path[index] != L'\0' && Path[index] != L'\\'; ++index)
+            if (Path[index] == L'.')
+                ++dot_count;
+
+        if (dot_count > 1 || (index - backslash_index - 1) > 12)
+            continue;
+
+        if (! File_NameCache_GetShortName(Path, index, info, info_size, &generation)) {
+            Sim_QueryShortName(Path, index, backslash_index, info);
+            File_NameCache_AddShortName(Path, index, info, generation);
+        }
+
+        len = (ULONG)((wcslen(Path) + 1) * sizeof(WCHAR) + info->FileNameLength);
+        copy = Dll_GetTlsNameBuffer(TlsData, COPY_NAME_BUFFER, len);
+
+        wmemcpy(copy, Path, backslash_index + 1);
+        len = (backslash_index + 1);
+        memcpy(copy + len, info->FileName, info->FileNameLength);
+        len += info->FileNameLength / sizeof(WCHAR);
+        wcscpy(copy + len, Path + index);
+
+        len = (ULONG)((wcslen(copy) + 1) * sizeof(WCHAR));
+        Path = Dll_GetTlsNameBuffer(TlsData, TRUE_NAME_BUFFER, len);
+        memcpy(Path, copy, len);
+
+        index = backslash_index + info->FileNameLength / sizeof(WCHAR) + 1;
+    }
+
+    free(info);
+    return Path;
+}
+
+
+static WCHAR *Bench_GetName(THREAD_DATA *TlsData, const WCHAR *path)
+{
+    ULONG len = (ULONG)wcslen(path);
+    WCHAR *name;
+
+    name = File_NameCache_GetLink(TlsData, path, len * sizeof(WCHAR));
+    if (! name) {
+
+        ULONG link_len;
+        WCHAR *translated = Sim_TranslateSymlinks(path, &link_len);
+        ULONG translated_len = (ULONG)wcslen(translated);
+
+        if (link_len)
+            File_NameCache_AddLink(path, link_len, translated, len - link_len);
+
+        name = Dll_GetTlsNameBuffer(
+                    TlsData, TRUE_NAME_BUFFER, (translated_len + 1) * sizeof(WCHAR));
+        wmemcpy(name, translated, translated_len + 1);
+        free(translated);
+    }
+
+    return Bench_ExpandShortNames(TlsData, name);
+}
+
+
+//---------------------------------------------------------------------------
+// Traces
+//---------------------------------------------------------------------------
+
+
+typedef struct _BENCH_LINE {
+
+    WCHAR *path;
+    char event;         // 0, 'r' for !rename, 'e' for !extern
+
+} BENCH_LINE;
+
+
+static BENCH_LINE *Bench_Lines = NULL;
+static ULONG Bench_LineCount = 0;
+
+
+static void Bench_AddLine(const char *text, char event)
+{
+    size_t len = strlen(text);
+    WCHAR *path = malloc((len + 1) * sizeof(WCHAR));
+
+    mbstowcs(path, text, len + 1);
+
+    Bench_Lines = realloc(Bench_Lines, (Bench_LineCount + 1) * sizeof(BENCH_LINE));
+    Bench_Lines[Bench_LineCount].path = path;
+    Bench_Lines[Bench_LineCount].event = event;
+    ++Bench_LineCount;
+}
+
+
+static BOOLEAN Bench_LoadTrace(const char *file_name)
+{
+    char line[4096];
+    FILE *file = fopen(file_name, "r");
+    if (! file)
+        return FALSE;
+
+    while (fgets(line, sizeof(line), file)) {
+
+        char *ptr = line + strcspn(line, "\r\n");
+        char event = 0;
+        *ptr = '\0';
+
+        if (strncmp(line, "!rename ", 8) == 0)
+            event = 'r';
+        else if (strncmp(line, "!extern ", 8) == 0)
+            event = 'e';
+        else if (line[0] == '!' || line[0] == '#')
+            continue;
+
+        ptr = strchr(line, '\\');
+        if (ptr)
+            Bench_AddLine(ptr, event);
+    }
+
+    fclose(file);
+    return TRUE;
+}
+
+
+static void Bench_GenerateTrace(ULONG count, ULONG64 seed)
+{
+    static const char *files[] = {
+        "kernel32.dll", "app.exe", "config.ini", "data.bin", "res.pak",
+        "locale\\en-US.pak", "lib\\core.dll", "lib\\gfx.dll",
+    };
+    char path[512];
+    ULONG i;
+
+    //
+    // an application which opens files in the program files folder and
+    // in the temp folder, most opens go to few of the installed programs
+    //
+
+    for (i = 0; i < count; ++i) {
+
+        ULONG r = Test_Random(&seed);
+        ULONG app = Test_Random(&seed) % (1 + (Test_Random(&seed) % 64));
+        const char *file = files[Test_Random(&seed) % 8];
+
+        if (r % 1000 == 0) {
+
+            snprintf(path, sizeof(path), "\\??\\C:\\PROGRA~1\\APP%02u~1", app);
+            Bench_AddLine(path, 'r');
+
+        } else if (r % 10 < 6) {
+
+            snprintf(path, sizeof(path),
+                     "\\??\\C:\\PROGRA~1\\APP%02u~1\\%s", app, file);
+            Bench_AddLine(path, 0);
+
+        } else if (r % 10 < 8) {
+
+            snprintf(path, sizeof(path),
+                     "\\??\\C:\\Users\\SANDBO~1\\AppData\\Local\\Temp\\~DF%04X.tmp",
+                     Test_Random(&seed) & 0xFFF);
+            Bench_AddLine(path, 0);
+
+        } else {
+
+            snprintf(path, sizeof(path),
+                     "\\??\\C:\\Windows\\System32\\%s", file);
+            Bench_AddLine(path, 0);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Replay
+//---------------------------------------------------------------------------
+
+
+typedef struct _BENCH_RESULT {
+
+    ULONG64 ns;
+    ULONG64 probes;
+    ULONG64 queries;
+    WCHAR **names;
+
+} BENCH_RESULT;
+
+
+static void Bench_Replay(BOOLEAN use_cache, BENCH_RESULT *result)
+{
+    THREAD_DATA TlsData;
+    ULONG64 start;
+    ULONG i;
+
+    memset(&TlsData, 0, sizeof(TlsData));
+
+    map_init(&Sim_Versions, NULL);
+    Sim_Versions.func_key_size = &map_wcssize;
+    Sim_Probes = Sim_Queries = 0;
+
+    File_FlushNameCache();
+    File_NameCacheEnabled = use_cache;
+    File_NameCacheLinkHits = File_NameCacheLinkMisses = 0;
+    File_NameCacheShortNameHits = File_NameCacheShortNameMisses = 0;
+
+    result->names = calloc(Bench_LineCount, sizeof(WCHAR *));
+
+    start = Test_GetNanoseconds();
+
+    for (i = 0; i < Bench_LineCount; ++i) {
+
+        const BENCH_LINE *line = &Bench_Lines[i];
+
+        if (line->event) {
+
+            //
+            // the directory of the renamed entry is resolved, the short
+            // name itself is kept, see Sim_QueryShortName
+            //
+
+            WCHAR *parent = wcsdup(line->path);
+            WCHAR *leaf = wcsrchr(parent, L'\\');
+            WCHAR *name;
+
+            *leaf = L'\0';
+            name = Bench_GetName(&TlsData, parent);
+            name = wcscat(wcscpy(malloc((wcslen(name) + wcslen(leaf + 1) + 2)
+                                        * sizeof(WCHAR)), name), L"\\");
+            Sim_Rename(wcscat(name, line->path + (leaf - parent) + 1));
+            free(name);
+            free(parent);
+            if (line->event == 'r')
+                File_NameCache_InvalidateShortNames();
+            continue;
+        }
+
+        result->names[i] = wcsdup(Bench_GetName(&TlsData, line->path));
+    }
+
+    result->ns = Test_GetNanoseconds() - start;
+    result->probes = Sim_Probes;
+    result->queries = Sim_Queries;
+
+    map_clear(&Sim_Versions);
+    free(TlsData.name_buffer[0]);
+    free(TlsData.name_buffer[1]);
+}
+
+
+static void Bench_Print(const char *title, const BENCH_RESULT *result, ULONG opens)
+{
+    printf("%-10s %10.3f ms %8.0f ns/open %10llu link probes %10llu dir queries\n",
+           title, result->ns / 1e6, opens ? (double)result->ns / opens : 0.0,
+           (unsigned long long)result->probes, (unsigned long long)result->queries);
+}
+
+
+//---------------------------------------------------------------------------
+// Self Test
+//---------------------------------------------------------------------------
+
+
+static void Bench_SelfTest(void)
+{
+    THREAD_DATA TlsData;
+    WCHAR *name, *expect;
+    ULONG64 queries;
+
+    memset(&TlsData, 0, sizeof(TlsData));
+
+    map_init(&Sim_Versions, NULL);
+    Sim_Versions.func_key_size = &map_wcssize;
+
+    File_FlushNameCache();
+    File_NameCacheEnabled = TRUE;
+    Sim_ProbeNs = Sim_QueryNs = 0;
+
+    //
+    // a repeated lookup is served from the cache
+    //
+
+    expect = wcsdup(Bench_GetName(&TlsData, L"\\??\\C:\\PROGRA~1\\APP~1\\x.dll"));
+    Test_Check(wcscmp(expect,
+        L"\\Device\\HarddiskVolume3\\Progra Long 1\\App Long 1\\x.dll") == 0,
+        "unexpected name %ls", expect);
+
+    queries = Sim_Queries;
+    name = Bench_GetName(&TlsData, L"\\??\\C:\\PROGRA~1\\APP~1\\x.dll");
+    Test_Check(wcscmp(name, expect) == 0, "cached name %ls", name);
+    Test_Check(Sim_Queries == queries, "lookup was not cached");
+
+    //
+    // a rename in this process drops the cached short names right away
+    //
+
+    Sim_Rename(L"\\Device\\HarddiskVolume3\\Progra Long 1\\APP~1");
+    File_NameCache_InvalidateShortNames();
+
+    name = Bench_GetName(&TlsData, L"\\??\\C:\\PROGRA~1\\APP~1\\x.dll");
+    Test_Check(wcscmp(name,
+        L"\\Device\\HarddiskVolume3\\Progra Long 1\\App Long 1 v2\\x.dll") == 0,
+        "stale name after rename %ls", name);
+
+    //
+    // a rename by another process is seen once the entry expired
+    //
+
+    Sim_Rename(L"\\Device\\HarddiskVolume3\\Progra Long 1\\APP~1");
+
+    name = Bench_GetName(&TlsData, L"\\??\\C:\\PROGRA~1\\APP~1\\x.dll");
+    Test_Check(wcscmp(name,
+        L"\\Device\\HarddiskVolume3\\Progra Long 1\\App Long 1 v2\\x.dll") == 0,
+        "entry expired too early %ls", name);
+
+    Test_TickOffset += FILE_NAME_CACHE_SHORT_NAME_TTL + 1;
+
+    name = Bench_GetName(&TlsData, L"\\??\\C:\\PROGRA~1\\APP~1\\x.dll");
+    Test_Check(wcscmp(name,
+        L"\\Device\\HarddiskVolume3\\Progra Long 1\\App Long 1 v3\\x.dll") == 0,
+        "expired entry was used %ls", name);
+
+    //
+    // a result which was looked up while the directory changed is not cached
+    //
+
+    {
+        FILE_BOTH_DIRECTORY_INFORMATION *info = malloc(1024);
+        const WCHAR *path = L"\\Device\\HarddiskVolume3\\PROGRA~2";
+        ULONG generation;
+
+        Test_Check(! File_NameCache_GetShortName(path, (ULONG)wcslen(path),
+                        info, 1024, &generation), "unexpected hit");
+        Sim_QueryShortName(path, (ULONG)wcslen(path), 23, info);
+        File_NameCache_InvalidateShortNames();
+        File_NameCache_AddShortName(path, (ULONG)wcslen(path), info, generation);
+        Test_Check(! File_NameCache_GetShortName(path, (ULONG)wcslen(path),
+                        info, 1024, &generation), "racing result was cached");
+        free(info);
+    }
+
+    map_clear(&Sim_Versions);
+    free(TlsData.name_buffer[0]);
+    free(TlsData.name_buffer[1]);
+    free(expect);
+
+    File_FlushNameCache();
+    Test_TickOffset = 0;
+
+    printf("self test passed\n");
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    BENCH_RESULT uncached, cached;
+    ULONG count = 100000;
+    ULONG opens = 0, stale = 0, i;
+    ULONG probe_ns = Sim_ProbeNs, query_ns = Sim_QueryNs;
+    const char *trace = NULL;
+
+    for (i = 1; i < (ULONG)argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < (ULONG)argc)
+            count = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < (ULONG)argc)
+            probe_ns = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < (ULONG)argc)
+            query_ns = strtoul(argv[++i], NULL, 10);
+        else if (argv[i][0] != '-')
+            trace = argv[i];
+        else {
+            printf("usage: %s [-n generated opens] [-p ns per link probe] "
+                   "[-q ns per directory query] [trace file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    InitializeCriticalSection(&Bench_DrivesAndLinks_CritSec);
+    File_InitNameCache();
+
+    Bench_SelfTest();
+
+    Sim_ProbeNs = probe_ns;
+    Sim_QueryNs = query_ns;
+
+    if (trace) {
+        if (! Bench_LoadTrace(trace)) {
+            fprintf(stderr, "could not read %s\n", trace);
+            return 1;
+        }
+    } else
+        Bench_GenerateTrace(count, 0x5EED);
+
+    Bench_Replay(FALSE, &uncached);
+    Bench_Replay(TRUE, &cached);
+
+    for (i = 0; i < Bench_LineCount; ++i) {
+
+        if (Bench_Lines[i].event)
+            continue;
+        ++opens;
+
+        if (wcscmp(uncached.names[i], cached.names[i]) != 0) {
+
+            //
+            // only a change by another process may be seen late
+            //
+
+            ULONG j;
+            for (j = 0; j < i && Bench_Lines[j].event != 'e'; ++j)
+                ;
+            Test_Check(j < i, "line %u: %ls resolved to %ls instead of %ls",
+                       i + 1, Bench_Lines[i].path, cached.names[i], uncached.names[i]);
+            ++stale;
+        }
+    }
+
+    printf("%u opens, %u changes\n", opens, Bench_LineCount - opens);
+    Bench_Print("uncached", &uncached, opens);
+    Bench_Print("cached", &cached, opens);
+    printf("link cache %d hits %d misses, short name cache %d hits %d misses, "
+           "%u stale results after changes by other processes\n",
+           File_NameCacheLinkHits, File_NameCacheLinkMisses,
+           File_NameCacheShortNameHits, File_NameCacheShortNameMisses, stale);
+    if (cached.ns)
+        printf("speedup %.2fx\n", (double)uncached.ns / cached.ns);
+
+    return 0;
+}
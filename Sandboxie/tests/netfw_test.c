@@ -0,0 +1,532 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// Network Firewall Rule Index Test
+//
+// builds random NetworkAccess rule lists with common/netfw.c, compiles them
+// with NetFw_BuildIndex and checks that NetFw_BlockTrafficIndex decides
+// every connection the same way as the linear NetFw_BlockTraffic.
+// the rules are drawn from a small address and port space so that they
+// overlap, get merged by NetFw_AddRule and shadow each other, and every
+// range boundary is probed at, below and above the boundary.
+// a list whose index would exceed NETFW_INDEX_MAX_ENTRIES must get none.
+//
+// the benchmark compares both lookups for rule lists of growing size
+//---------------------------------------------------------------------------
+
+
+#include "common/list.h"
+#include "common/my_wsa.h"
+
+#include "common/list.c"
+#include "common/pool.c"
+#include "common/rbtree.c"
+#include "common/str_util.c"
+#include "common/netfw.c"
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static const int Test_Protocols[] = {
+    IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP, 41 };
+
+
+typedef struct _TEST_QUERY {
+
+    IP_ADDRESS Ip;
+    USHORT Port;
+    int Protocol;
+
+} TEST_QUERY;
+
+
+typedef struct _TEST_RULES {
+
+    POOL *pool;
+    LIST list;
+    NETFW_INDEX *index;
+
+    ULONG query_count;
+    TEST_QUERY *queries;
+
+} TEST_RULES;
+
+
+//---------------------------------------------------------------------------
+// Random Rules
+//---------------------------------------------------------------------------
+
+
+//
+// ports are mostly taken from 0 to 2047, some from the top of the range,
+// addresses from 10.0.0.0/20, 192.168.0.0/24 and 2001:db8::/108, and now
+// and then the lowest and highest IPv6 address
+//
+
+static USHORT Test_RandomPort(ULONG64 *seed)
+{
+    if (Test_Random(seed) % 16 == 0)
+        return (USHORT)(0xFFFF - Test_Random(seed) % 8);
+    return (USHORT)(Test_Random(seed) % 2048);
+}
+
+
+static void Test_RandomIp(ULONG64 *seed, ULONG kind, WCHAR *str, ULONG size)
+{
+    ULONG r = Test_Random(seed);
+
+    if (kind == 0)
+        swprintf(str, size, L"10.0.%u.%u", (r >> 8) % 16, r & 0xFF);
+    else if (kind == 1)
+        swprintf(str, size, L"192.168.0.%u", r & 0xFF);
+    else if (kind == 2)
+        swprintf(str, size, L"2001:db8::%x:%x", (r >> 16) % 16, r & 0xFFFF);
+    else if (r & 1)
+        swprintf(str, size, L"::");
+    else
+        swprintf(str, size, L"ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff");
+}
+
+
+static void Test_RandomRule(ULONG64 *seed, WCHAR *str, ULONG size)
+{
+    ULONG count, i;
+    WCHAR *ptr = str;
+    WCHAR *end = str + size;
+
+    ptr += swprintf(ptr, end - ptr, L"%ls",
+                    (Test_Random(seed) % 3 == 0) ? L"Allow" : L"Block");
+
+    //
+    // ports and ranges, now and then a reversed range, which never
+    // matches but still hides the range below it
+    //
+
+    if (Test_Random(seed) % 3 != 0) {
+
+        ptr += swprintf(ptr, end - ptr, L";Port=");
+        count = 1 + Test_Random(seed) % 3;
+        for (i = 0; i < count; ++i) {
+
+            USHORT port1 = Test_RandomPort(seed);
+            ULONG type = Test_Random(seed) % 8;
+            if (i)
+                *ptr++ = L',';
+            if (type < 5)
+                ptr += swprintf(ptr, end - ptr, L"%u", port1);
+            else {
+                USHORT port2 = (type == 7)
+                    ? (USHORT)(port1 - Test_Random(seed) % 16)
+                    : (USHORT)(port1 + Test_Random(seed) % 256);
+                if (type != 7 && port2 < port1)
+                    port2 = 0xFFFF;
+                ptr += swprintf(ptr, end - ptr, L"%u-%u", port1, port2);
+            }
+        }
+    }
+
+    //
+    // addresses and ranges, both ends of a range of the same family
+    //
+
+    if (Test_Random(seed) % 3 != 0) {
+
+        ptr += swprintf(ptr, end - ptr, L";Address=");
+        count = 1 + Test_Random(seed) % 3;
+        for (i = 0; i < count; ++i) {
+
+            ULONG kind = Test_Random(seed) % 8;
+            kind = (kind < 3) ? 0 : (kind < 5) ? 1 : (kind < 7) ? 2 : 3;
+            if (i)
+                *ptr++ = L',';
+            Test_RandomIp(seed, kind, ptr, (ULONG)(end - ptr));
+            ptr += wcslen(ptr);
+            if (Test_Random(seed) % 2) {
+                *ptr++ = L'-';
+                Test_RandomIp(seed, kind, ptr, (ULONG)(end - ptr));
+                ptr += wcslen(ptr);
+            }
+        }
+    }
+
+    if (Test_Random(seed) % 2 == 0) {
+        static const WCHAR *protocols[] = { L"TCP", L"UDP", L"ICMP" };
+        ptr += swprintf(ptr, end - ptr, L";Protocol=%ls",
+                        protocols[Test_Random(seed) % 3]);
+    }
+}
+
+
+static void Test_BuildRules(TEST_RULES *rules, ULONG count, ULONG64 *seed)
+{
+    WCHAR str[512];
+    ULONG i;
+
+    rules->pool = Pool_Create();
+    Test_Check(rules->pool, "Pool_Create failed");
+    List_Init(&rules->list);
+
+    for (i = 0; i < count; ++i) {
+
+        NETFW_RULE *rule =
+            NetFw_AllocRule(rules->pool, Test_Random(seed) % 4);
+        Test_Check(rule, "NetFw_AllocRule failed");
+
+        Test_RandomRule(seed, str, ARRAYSIZE(str));
+        NetFw_ParseRule(rule, str);
+        NetFw_AddRule(&rules->list, rule);
+    }
+
+    rules->index = NetFw_BuildIndex(&rules->list, rules->pool);
+
+    rules->query_count = 0;
+    rules->queries = NULL;
+}
+
+
+static void Test_FreeRules(TEST_RULES *rules)
+{
+    NETFW_RULE *rule;
+
+    if (rules->index)
+        NetFw_FreeIndex(rules->index);
+
+    while ((rule = List_Head(&rules->list))) {
+        List_Remove(&rules->list, rule);
+        NetFw_FreeRule(rule);
+    }
+
+    Pool_Delete(rules->pool);
+    free(rules->queries);
+}
+
+
+//---------------------------------------------------------------------------
+// Queries
+//---------------------------------------------------------------------------
+
+
+static void Test_AddQuery(
+    TEST_RULES *rules, ULONG *size,
+    const IP_ADDRESS *ip, USHORT port, int protocol)
+{
+    TEST_QUERY *query;
+
+    if (rules->query_count == *size) {
+        *size = *size ? *size * 2 : 1024;
+        rules->queries = realloc(rules->queries, *size * sizeof(TEST_QUERY));
+        Test_Check(rules->queries, "out of memory");
+    }
+
+    query = &rules->queries[rules->query_count++];
+    query->Ip = *ip;
+    query->Port = port;
+    query->Protocol = protocol;
+}
+
+
+static void Test_RandomQueryIp(ULONG64 *seed, IP_ADDRESS *ip)
+{
+    WCHAR str[64];
+    ULONG kind = Test_Random(seed) % 8;
+    kind = (kind < 3) ? 0 : (kind < 5) ? 1 : (kind < 7) ? 2 : 3;
+    Test_RandomIp(seed, kind, str, ARRAYSIZE(str));
+    _inet_xton(str, (ULONG)wcslen(str), ip, NULL);
+}
+
+
+static void Test_BuildQueries(
+    TEST_RULES *rules, ULONG random_count, BOOLEAN boundaries, ULONG64 *seed)
+{
+    ULONG size = 0;
+    NETFW_RULE *rule;
+    IP_ADDRESS ip;
+    ULONG i;
+
+    //
+    // every port and address where a range begins or ends, and the values
+    // right next to it, combined with a random other half of the query
+    //
+
+    for (rule = List_Head(&rules->list); rule && boundaries;
+                                         rule = List_Next(rule)) {
+
+        rbnode_t *node;
+
+        for (node = rbtree_first(&rule->port_map); node != RBTREE_NULL;
+                                                   node = rbtree_next(node)) {
+
+            NETFW_PORTS *ports = (NETFW_PORTS *)node;
+            USHORT edges[2] = { ports->RangeBegin, ports->RangeEnd };
+
+            for (i = 0; i < 6; ++i) {
+                USHORT port = (USHORT)(edges[i / 3] + (i % 3) - 1);
+                Test_RandomQueryIp(seed, &ip);
+                Test_AddQuery(rules, &size, &ip, port,
+                    Test_Protocols[Test_Random(seed) % ARRAYSIZE(Test_Protocols)]);
+            }
+        }
+
+        for (node = rbtree_first(&rule->ip_map); node != RBTREE_NULL;
+                                                 node = rbtree_next(node)) {
+
+            NETFW_IPS *ips = (NETFW_IPS *)node;
+            const IP_ADDRESS *edges[2] = { &ips->RangeBegin, &ips->RangeEnd };
+
+            for (i = 0; i < 6; ++i) {
+                ip = *edges[i / 3];
+                if (i % 3 == 0)
+                    NetFw_IpPrev(&ip);
+                else if (i % 3 == 2)
+                    NetFw_IpNext(&ip);
+                Test_AddQuery(rules, &size, &ip, Test_RandomPort(seed),
+                    Test_Protocols[Test_Random(seed) % ARRAYSIZE(Test_Protocols)]);
+            }
+        }
+    }
+
+    for (i = 0; i < random_count; ++i) {
+
+        Test_RandomQueryIp(seed, &ip);
+        Test_AddQuery(rules, &size, &ip, Test_RandomPort(seed),
+            Test_Protocols[Test_Random(seed) % ARRAYSIZE(Test_Protocols)]);
+    }
+}
+
+
+static void Test_FormatQuery(const TEST_QUERY *query, char *str, ULONG size)
+{
+    const UCHAR *b = query->Ip.Data;
+    snprintf(str, size,
+        "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x"
+        " port %u protocol %d",
+        b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+        b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15],
+        query->Port, query->Protocol);
+}
+
+
+//---------------------------------------------------------------------------
+// Differential Test
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Compare(TEST_RULES *rules, ULONG64 seed, ULONG *blocked)
+{
+    ULONG i;
+
+    for (i = 0; i < rules->query_count; ++i) {
+
+        TEST_QUERY *query = &rules->queries[i];
+
+        BOOLEAN linear = NetFw_BlockTraffic(
+            &rules->list, &query->Ip, query->Port, query->Protocol);
+        BOOLEAN indexed = NetFw_BlockTrafficIndex(
+            rules->index, &query->Ip, query->Port, query->Protocol);
+
+        if (linear != indexed) {
+            char str[128];
+            Test_FormatQuery(query, str, sizeof(str));
+            Test_Check(linear == indexed,
+                "seed %llu, %u rules: %s is %s by the list but %s by the index",
+                (unsigned long long)seed, List_Count(&rules->list), str,
+                linear ? "blocked" : "allowed",
+                indexed ? "blocked" : "allowed");
+        }
+
+        if (linear)
+            ++*blocked;
+    }
+
+    return rules->query_count;
+}
+
+
+static void Test_Differential(
+    ULONG iterations, ULONG min_rules, ULONG max_rules, ULONG64 seed)
+{
+    ULONG64 queries = 0;
+    ULONG blocked = 0;
+    ULONG i;
+
+    for (i = 0; i < iterations; ++i) {
+
+        TEST_RULES rules;
+        ULONG64 set_seed = seed + i * 0x9E3779B97F4A7C15ULL;
+        ULONG64 state = set_seed;
+        ULONG count =
+            min_rules + Test_Random(&state) % (max_rules - min_rules + 1);
+
+        Test_BuildRules(&rules, count, &state);
+        Test_Check(rules.index,
+            "NetFw_BuildIndex failed for %u rules", List_Count(&rules.list));
+        Test_BuildQueries(&rules, 256, TRUE, &state);
+        queries += Test_Compare(&rules, set_seed, &blocked);
+        Test_FreeRules(&rules);
+    }
+
+    printf("%u rule lists of %u to %u rules, %llu queries, "
+           "%u blocked, index and list agree\n",
+           iterations, min_rules, max_rules, (unsigned long long)queries, blocked);
+}
+
+
+static void Test_SizeLimit(ULONG rule_count, ULONG64 seed)
+{
+    TEST_RULES rules;
+    ULONG64 state = seed;
+
+    //
+    // so many overlapping rules split the address space into so many
+    // intervals that the index would exceed its size limit
+    //
+
+    Test_BuildRules(&rules, rule_count, &state);
+    Test_Check(! rules.index,
+        "an index was built for %u overlapping rules", List_Count(&rules.list));
+
+    printf("%u rules (%u after merging) exceed the index size limit, "
+           "no index built\n", rule_count, List_Count(&rules.list));
+
+    Test_FreeRules(&rules);
+}
+
+
+//---------------------------------------------------------------------------
+// Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(ULONG rule_count, ULONG query_count, ULONG64 seed)
+{
+    TEST_RULES rules;
+    ULONG64 state = seed;
+    ULONG64 start, build_ns, linear_ns, index_ns;
+    ULONG blocked_linear = 0, blocked_index = 0;
+    ULONG i;
+
+    Test_BuildRules(&rules, rule_count, &state);
+    Test_BuildQueries(&rules, query_count, FALSE, &state);
+
+    start = Test_GetNanoseconds();
+    if (rules.index)
+        NetFw_FreeIndex(rules.index);
+    rules.index = NetFw_BuildIndex(&rules.list, rules.pool);
+    build_ns = Test_GetNanoseconds() - start;
+
+    start = Test_GetNanoseconds();
+    for (i = 0; i < rules.query_count; ++i) {
+        TEST_QUERY *query = &rules.queries[i];
+        blocked_linear += NetFw_BlockTraffic(
+            &rules.list, &query->Ip, query->Port, query->Protocol);
+    }
+    linear_ns = Test_GetNanoseconds() - start;
+
+    if (! rules.index) {
+        printf("%6u rules (%6u after merging)  over the index size limit  "
+               "list %9.0f ns/lookup\n",
+               rule_count, List_Count(&rules.list),
+               (double)linear_ns / rules.query_count);
+        Test_FreeRules(&rules);
+        return;
+    }
+
+    start = Test_GetNanoseconds();
+    for (i = 0; i < rules.query_count; ++i) {
+        TEST_QUERY *query = &rules.queries[i];
+        blocked_index += NetFw_BlockTrafficIndex(
+            rules.index, &query->Ip, query->Port, query->Protocol);
+    }
+    index_ns = Test_GetNanoseconds() - start;
+
+    Test_Check(blocked_linear == blocked_index,
+        "%u blocked by the list but %u by the index",
+        blocked_linear, blocked_index);
+
+    printf("%6u rules (%6u after merging)  build %9.3f ms  "
+           "list %9.0f ns/lookup  index %6.0f ns/lookup  speedup %7.1fx\n",
+           rule_count, List_Count(&rules.list), build_ns / 1e6,
+           (double)linear_ns / rules.query_count,
+           (double)index_ns / rules.query_count,
+           (double)linear_ns / index_ns);
+
+    Test_FreeRules(&rules);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    static const ULONG bench_sizes[] = { 10, 100, 1000, 5000, 20000 };
+    ULONG iterations = 500;
+    ULONG max_rules = 64;
+    ULONG large_rules = 1500;
+    ULONG limit_rules = 5000;
+    ULONG queries = 20000;
+    ULONG64 seed = 1;
+    BOOLEAN bench = FALSE;
+    ULONG i;
+
+    for (i = 1; i < (ULONG)argc; ++i) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < (ULONG)argc)
+            iterations = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < (ULONG)argc)
+            max_rules = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < (ULONG)argc)
+            large_rules = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < (ULONG)argc)
+            queries = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < (ULONG)argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-b") == 0)
+            bench = TRUE;
+        else {
+            printf("usage: %s [-i rule lists] [-r max rules per list] "
+                   "[-l rules in the large list] [-q benchmark queries] "
+                   "[-s seed] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (! seed)
+        seed = 1;
+
+    //
+    // many small lists, where merging and shadowing are most likely,
+    // then one large list, then one above the size limit, then the benchmark
+    //
+
+    Test_Differential(iterations, 0, max_rules, seed);
+    Test_Differential(1, large_rules, large_rules, seed ^ 0x5DEECE66DULL);
+    Test_SizeLimit(limit_rules, seed ^ 0x5DEECE66DULL);
+
+    if (bench) {
+        for (i = 0; i < ARRAYSIZE(bench_sizes); ++i)
+            Test_Benchmark(bench_sizes[i], queries, seed + i);
+    }
+
+    return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// Pool Stress Test and Benchmark
+//
+// threads allocate and free blocks of random sizes from one pool of
+// common/pool.c, the way hooked functions on many threads use Dll_Pool.
+// each thread keeps a set of live blocks, and replaces a random one with
+// each step.  a share of the replaced blocks is handed to another thread
+// and freed there, which exercises the depot and the freeing of cells
+// which were cached by another thread.
+//
+// every block is filled with a pattern when allocated and checked before
+// it is freed, so a block which is handed out twice or overlaps another
+// block shows up as a failed check.  in benchmark mode only the first and
+// last bytes are filled, to keep the fill from dominating the timing.
+//
+// this is built with POOL_TIMING, Pool_Delete prints the timing counters
+// and the percentiles of the Pool_Alloc and Pool_Free latencies
+//---------------------------------------------------------------------------
+
+
+#include "common/list.h"
+
+#include "common/list.c"
+#include "common/pool.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_MAX_THREADS        64
+
+#define TEST_INBOX_SIZE         1024
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _TEST_BLOCK {
+
+    UCHAR *ptr;
+    ULONG size;
+    UCHAR fill;
+
+} TEST_BLOCK;
+
+
+typedef struct _TEST_THREAD {
+
+    pthread_t thread;
+    ULONG index;
+    ULONG64 seed;
+
+    TEST_BLOCK *live;
+
+    pthread_mutex_t inbox_lock;
+    TEST_BLOCK inbox[TEST_INBOX_SIZE];
+    ULONG inbox_count;
+
+    ULONG64 allocs;
+    ULONG64 remote_frees;
+
+} TEST_THREAD;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static POOL *Test_Pool;
+static TEST_THREAD Test_Threads[TEST_MAX_THREADS];
+static ULONG Test_ThreadCount;
+
+static ULONG Test_OpCount = 200000;
+static ULONG Test_LiveCount = 256;
+static ULONG Test_RemotePercent = 25;
+static BOOLEAN Test_FullFill = TRUE;
+
+
+//---------------------------------------------------------------------------
+// Blocks
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_RandomSize(ULONG64 *seed)
+{
+    ULONG r = Test_Random(seed) % 1000;
+
+    //
+    // mostly small blocks, which the thread caches serve, some which
+    // take a longer run of cells, and a few large chunks
+    //
+
+    if (r < 700)
+        return 8 + Test_Random(seed) % 249;
+    if (r < 950)
+        return 257 + Test_Random(seed) % 768;
+    if (r < 995)
+        return 1025 + Test_Random(seed) % 15360;
+    return 50000 + Test_Random(seed) % 150000;
+}
+
+
+static void Test_Fill(TEST_BLOCK *block)
+{
+    if (Test_FullFill || block->size <= 32)
+        memset(block->ptr, block->fill, block->size);
+    else {
+        memset(block->ptr, block->fill, 16);
+        memset(block->ptr + block->size - 16, block->fill, 16);
+    }
+}
+
+
+static void Test_Verify(TEST_BLOCK *block)
+{
+    ULONG i, n = block->size;
+
+    for (i = 0; i < n; ++i) {
+
+        if (! Test_FullFill && i == 16 && n > 32)
+            i = n - 16;
+
+        Test_Check(block->ptr[i] == block->fill,
+            "block %p of %u bytes was overwritten at offset %u",
+            block->ptr, block->size, i);
+    }
+}
+
+
+static void Test_Alloc(TEST_THREAD *thread, TEST_BLOCK *block)
+{
+    block->size = Test_RandomSize(&thread->seed);
+    block->fill = (UCHAR)Test_Random(&thread->seed);
+    block->ptr = Pool_Alloc(Test_Pool, block->size);
+    Test_Check(block->ptr, "Pool_Alloc of %u bytes failed", block->size);
+    Test_Check(((ULONG_PTR)block->ptr & 7) == 0,
+        "block %p is not aligned", block->ptr);
+    Test_Fill(block);
+    ++thread->allocs;
+}
+
+
+static void Test_Free(TEST_BLOCK *block)
+{
+    Test_Verify(block);
+    memset(block->ptr, 0xDD, block->size <= 32 ? block->size : 16);
+    Pool_Free(block->ptr, block->size);
+    block->ptr = NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// Threads
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_SendBlock(TEST_THREAD *target, TEST_BLOCK *block)
+{
+    BOOLEAN sent = FALSE;
+
+    pthread_mutex_lock(&target->inbox_lock);
+    if (target->inbox_count < TEST_INBOX_SIZE) {
+        target->inbox[target->inbox_count++] = *block;
+        sent = TRUE;
+    }
+    pthread_mutex_unlock(&target->inbox_lock);
+
+    return sent;
+}
+
+
+static void Test_DrainInbox(TEST_THREAD *thread)
+{
+    TEST_BLOCK blocks[TEST_INBOX_SIZE];
+    ULONG count, i;
+
+    pthread_mutex_lock(&thread->inbox_lock);
+    count = thread->inbox_count;
+    memcpy(blocks, thread->inbox, count * sizeof(TEST_BLOCK));
+    thread->inbox_count = 0;
+    pthread_mutex_unlock(&thread->inbox_lock);
+
+    for (i = 0; i < count; ++i)
+        Test_Free(&blocks[i]);
+
+    thread->remote_frees += count;
+}
+
+
+static void *Test_Thread(void *param)
+{
+    TEST_THREAD *thread = param;
+    ULONG i;
+
+    for (i = 0; i < Test_LiveCount; ++i)
+        Test_Alloc(thread, &thread->live[i]);
+
+    for (i = 0; i < Test_OpCount; ++i) {
+
+        TEST_BLOCK *block =
+            &thread->live[Test_Random(&thread->seed) % Test_LiveCount];
+
+        if (Test_ThreadCount > 1
+                && Test_Random(&thread->seed) % 100 < Test_RemotePercent) {
+
+            ULONG other = (thread->index + 1
+                + Test_Random(&thread->seed) % (Test_ThreadCount - 1))
+                % Test_ThreadCount;
+            if (! Test_SendBlock(&Test_Threads[other], block))
+                Test_Free(block);
+
+        } else
+            Test_Free(block);
+
+        Test_Alloc(thread, block);
+
+        if ((i & 15) == 0)
+            Test_DrainInbox(thread);
+    }
+
+    for (i = 0; i < Test_LiveCount; ++i)
+        Test_Free(&thread->live[i]);
+
+    //
+    // blocks sent to this thread after its last drain are freed by the
+    // main thread.  the cache goes back to the pool on thread exit, the
+    // way Dll_FreeTlsData does it
+    //
+
+    Test_DrainInbox(thread);
+    Pool_FlushThreadCache(Test_Pool);
+
+    return NULL;
+}
+
+
+static double Test_Run(ULONG thread_count, BOOLEAN use_cache, ULONG64 seed)
+{
+    ULONG64 start, ns, allocs = 0, remote_frees = 0;
+    ULONG i;
+
+    Test_Pool = Pool_Create();
+    Test_Check(Test_Pool, "Pool_Create failed");
+    if (use_cache)
+        Test_Check(Pool_EnableThreadCache(Test_Pool), "no thread cache");
+
+    Test_ThreadCount = thread_count;
+    for (i = 0; i < thread_count; ++i) {
+        TEST_THREAD *thread = &Test_Threads[i];
+        thread->index = i;
+        thread->seed = seed * 2654435761ULL + i + 1;
+        thread->live = calloc(Test_LiveCount, sizeof(TEST_BLOCK));
+        Test_Check(thread->live, "out of memory");
+        thread->inbox_count = 0;
+        thread->allocs = thread->remote_frees = 0;
+        pthread_mutex_init(&thread->inbox_lock, NULL);
+    }
+
+    start = Test_GetNanoseconds();
+
+    for (i = 0; i < thread_count; ++i)
+        pthread_create(&Test_Threads[i].thread, NULL, Test_Thread, &Test_Threads[i]);
+    for (i = 0; i < thread_count; ++i)
+        pthread_join(Test_Threads[i].thread, NULL);
+
+    ns = Test_GetNanoseconds() - start;
+
+    for (i = 0; i < thread_count; ++i) {
+        TEST_THREAD *thread = &Test_Threads[i];
+        Test_DrainInbox(thread);
+        allocs += thread->allocs;
+        remote_frees += thread->remote_frees;
+        free(thread->live);
+        pthread_mutex_destroy(&thread->inbox_lock);
+    }
+
+    Pool_FlushThreadCache(Test_Pool);
+
+    printf("\n%2u threads, thread cache %-3s  %llu allocations, "
+           "%llu freed by another thread, %.2f M allocations/s\n",
+           thread_count, use_cache ? "on" : "off",
+           (unsigned long long)allocs, (unsigned long long)remote_frees,
+           allocs * 1000.0 / ns);
+
+    Pool_Delete(Test_Pool);
+    Test_Pool = NULL;
+
+    return allocs * 1000.0 / ns;
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    ULONG max_threads = 4;
+    ULONG64 seed = 1;
+    BOOLEAN bench = FALSE;
+    ULONG i, threads;
+
+    for (i = 1; i < (ULONG)argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < (ULONG)argc)
+            max_threads = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < (ULONG)argc)
+            Test_OpCount = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < (ULONG)argc)
+            Test_LiveCount = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < (ULONG)argc)
+            Test_RemotePercent = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < (ULONG)argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-b") == 0)
+            bench = TRUE;
+        else {
+            printf("usage: %s [-t max threads] [-n steps per thread] "
+                   "[-w live blocks per thread] [-r percent freed remotely] "
+                   "[-s seed] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (! seed)
+        seed = 1;
+    if (max_threads < 1 || max_threads > TEST_MAX_THREADS)
+        max_threads = 4;
+    if (Test_LiveCount < 1)
+        Test_LiveCount = 1;
+
+    //
+    // the stress test fills and checks every byte, the benchmark only
+    // the ends of each block, for growing numbers of threads
+    //
+
+    Test_FullFill = ! bench;
+
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+
+        double without = Test_Run(threads, FALSE, seed);
+        double with = Test_Run(threads, TRUE, seed);
+
+        printf("\n%2u threads: %.2f M allocations/s without thread cache, "
+               "%.2f with, %.2fx\n", threads, without, with, with / without);
+    }
+
+    if (! bench)
+        printf("\nstress test passed\n");
+
+    return 0;
+}
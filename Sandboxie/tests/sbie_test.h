@@ -0,0 +1,433 @@
+/*
+ * Copyright 2020-2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+//---------------------------------------------------------------------------
+// Test Harness Support
+//
+// the portable parts of Sandboxie/common and core/dll are built on Linux
+// with gcc or clang for the stress tests and benchmarks in this folder.
+// this header is force included (-include) before any Sandboxie source,
+// and supplies the few Windows types and functions that these sources use
+//---------------------------------------------------------------------------
+
+
+#ifndef _SBIE_TEST_H
+#define _SBIE_TEST_H
+
+
+//
+// only POSIX definitions are requested, the BSD extensions of glibc would
+// pull in declarations like fd_set and struct timeval that clash with the
+// Windows equivalents in common/my_wsa.h
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+
+typedef unsigned char       BOOLEAN, UCHAR, BYTE;
+typedef char                CHAR;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT, WORD;
+typedef int32_t             LONG, INT, NTSTATUS;
+typedef uint32_t            ULONG, DWORD, UINT;
+typedef int64_t             LONGLONG, LONG64;
+typedef uint64_t            ULONGLONG, ULONG64;
+typedef intptr_t            LONG_PTR;
+typedef uintptr_t           ULONG_PTR, UINT_PTR, SIZE_T;
+typedef wchar_t             WCHAR;
+typedef void                VOID;
+typedef void               *HANDLE;
+typedef long long           __int64;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef BOOLEAN            *PBOOLEAN;
+typedef ULONG              *PULONG;
+typedef WCHAR              *PWCHAR, *PWSTR;
+typedef const WCHAR        *PCWSTR;
+typedef void               *PVOID;
+
+#define TRUE    1
+#define FALSE   0
+
+#define _FX
+#define FAR
+#define __inline    static inline
+#define __declspec(x)               __declspec_##x
+#define __declspec_thread           __thread
+#define __declspec_noinline         __attribute__((noinline))
+#define __declspec_align(n)         __attribute__((aligned(n)))
+
+#if defined(__LP64__)
+#define _WIN64
+#endif
+
+#define MAXULONG                    0xFFFFFFFF
+
+#define ARRAYSIZE(a)                (sizeof(a) / sizeof((a)[0]))
+
+#define FIELD_OFFSET(type, field)   offsetof(type, field)
+
+#define STATUS_SUCCESS              ((NTSTATUS)0x00000000L)
+#define NT_SUCCESS(status)          ((NTSTATUS)(status) >= 0)
+
+
+//---------------------------------------------------------------------------
+// Strings
+//---------------------------------------------------------------------------
+
+
+#define _wcsicmp    wcscasecmp
+#define _wcsnicmp   wcsncasecmp
+#define _stricmp    strcasecmp
+#define _strnicmp   strncasecmp
+
+static inline WCHAR *_wcslwr(WCHAR *str)
+{
+    WCHAR *ptr;
+    for (ptr = str; *ptr; ++ptr)
+        *ptr = towlower(*ptr);
+    return str;
+}
+
+#define Sbie_snwprintf  swprintf
+
+#define _wtoi(str)      ((int)wcstol((str), NULL, 10))
+
+static inline int wcsncpy_s(
+    WCHAR *dst, size_t dst_size, const WCHAR *src, size_t count)
+{
+    count = wcsnlen(src, count);
+    if (count >= dst_size)
+        count = dst_size - 1;
+    wmemcpy(dst, src, count);
+    dst[count] = L'\0';
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Interlocked and Timing
+//---------------------------------------------------------------------------
+
+
+#define InterlockedIncrement(p)         __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)         __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v)    __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(p, v)  __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)       __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+
+static inline LONG InterlockedCompareExchange(
+    volatile LONG *p, LONG exchange, LONG comparand)
+{
+    __atomic_compare_exchange_n(p, &comparand, exchange, FALSE,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+static inline void *InterlockedCompareExchangePointer(
+    void *volatile *p, void *exchange, void *comparand)
+{
+    __atomic_compare_exchange_n(p, &comparand, exchange, FALSE,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+#define YieldProcessor()    sched_yield()
+
+static inline ULONGLONG Test_GetNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline BOOLEAN QueryPerformanceCounter(LARGE_INTEGER *counter)
+{
+    counter->QuadPart = (LONGLONG)Test_GetNanoseconds();
+    return TRUE;
+}
+
+static inline BOOLEAN QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000LL;
+    return TRUE;
+}
+
+//
+// the tick count can be moved forward by a test, to check expiration
+//
+
+extern ULONG Test_TickOffset;
+
+static inline ULONG GetTickCount(void)
+{
+    return (ULONG)(Test_GetNanoseconds() / 1000000ULL) + Test_TickOffset;
+}
+
+
+//---------------------------------------------------------------------------
+// Critical Sections
+//---------------------------------------------------------------------------
+
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+static inline BOOLEAN InitializeCriticalSectionAndSpinCount(
+    CRITICAL_SECTION *cs, ULONG spin)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return TRUE;
+}
+
+#define InitializeCriticalSection(cs)   InitializeCriticalSectionAndSpinCount((cs), 0)
+#define EnterCriticalSection(cs)        pthread_mutex_lock(cs)
+#define LeaveCriticalSection(cs)        pthread_mutex_unlock(cs)
+#define DeleteCriticalSection(cs)       pthread_mutex_destroy(cs)
+
+
+//---------------------------------------------------------------------------
+// Threads and Errors
+//---------------------------------------------------------------------------
+
+
+static inline ULONG GetCurrentThreadId(void)
+{
+    static __thread ULONG tid;
+    static volatile LONG next_tid;
+    if (! tid)
+        tid = (ULONG)InterlockedIncrement(&next_tid) * 4;
+    return tid;
+}
+
+static __thread ULONG Test_LastError;
+
+static inline ULONG GetLastError(void)
+{
+    return Test_LastError;
+}
+
+static inline void SetLastError(ULONG error)
+{
+    Test_LastError = error;
+}
+
+//
+// pool.c builds its abend message with the MSVC L#arg extension, which gcc
+// does not accept, so the message is dropped and only the abort remains
+//
+
+#define OutputDebugString(...)  ((void)0)
+#define __debugbreak()          abort()
+
+
+//---------------------------------------------------------------------------
+// Thread Local Storage
+//---------------------------------------------------------------------------
+
+
+#define TLS_OUT_OF_INDEXES      ((ULONG)0xFFFFFFFF)
+
+static inline ULONG TlsAlloc(void)
+{
+    pthread_key_t key;
+    if (pthread_key_create(&key, NULL) != 0)
+        return TLS_OUT_OF_INDEXES;
+    return (ULONG)key;
+}
+
+static inline BOOLEAN TlsFree(ULONG index)
+{
+    return pthread_key_delete((pthread_key_t)index) == 0;
+}
+
+static inline void *TlsGetValue(ULONG index)
+{
+    return pthread_getspecific((pthread_key_t)index);
+}
+
+static inline BOOLEAN TlsSetValue(ULONG index, void *value)
+{
+    return pthread_setspecific((pthread_key_t)index, value) == 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Interlocked Singly Linked Lists
+//---------------------------------------------------------------------------
+
+
+//
+// unlike the Windows SLIST these are protected by a spin lock, rather than
+// a compare-exchange of the list head, which is good enough to check the
+// callers for correctness but not to compare their raw speed with Windows
+//
+
+typedef struct _SLIST_ENTRY {
+    struct _SLIST_ENTRY *Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef struct _SLIST_HEADER {
+    PSLIST_ENTRY Next;
+    volatile LONG Lock;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+static inline void InitializeSListHead(PSLIST_HEADER head)
+{
+    head->Next = NULL;
+    head->Lock = 0;
+}
+
+static inline void Test_SListLock(PSLIST_HEADER head)
+{
+    while (__atomic_exchange_n(&head->Lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&head->Lock, __ATOMIC_RELAXED))
+            ;
+}
+
+static inline PSLIST_ENTRY InterlockedPushEntrySList(
+    PSLIST_HEADER head, PSLIST_ENTRY entry)
+{
+    PSLIST_ENTRY old;
+    Test_SListLock(head);
+    old = head->Next;
+    entry->Next = old;
+    head->Next = entry;
+    __atomic_store_n(&head->Lock, 0, __ATOMIC_RELEASE);
+    return old;
+}
+
+static inline PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER head)
+{
+    PSLIST_ENTRY entry;
+    Test_SListLock(head);
+    entry = head->Next;
+    if (entry)
+        head->Next = entry->Next;
+    __atomic_store_n(&head->Lock, 0, __ATOMIC_RELEASE);
+    return entry;
+}
+
+
+//---------------------------------------------------------------------------
+// Virtual Memory
+//---------------------------------------------------------------------------
+
+
+//
+// the user mode pool expects its 64K pages to be aligned to 64K, like
+// the allocation granularity of VirtualAlloc
+//
+
+#define MEM_COMMIT                  0x00001000
+#define MEM_RESERVE                 0x00002000
+#define MEM_RELEASE                 0x00008000
+#define MEM_TOP_DOWN                0x00100000
+#define PAGE_READWRITE              0x04
+#define PAGE_EXECUTE_READWRITE      0x40
+
+#define STATUS_ACCESS_VIOLATION             ((NTSTATUS)0xC0000005L)
+#define STATUS_NO_MEMORY                    ((NTSTATUS)0xC0000017L)
+#define EXCEPTION_NONCONTINUABLE_EXCEPTION  0xC0000025
+
+#define NtCurrentProcess()          ((HANDLE)(LONG_PTR)-1)
+
+static inline NTSTATUS NtAllocateVirtualMemory(
+    HANDLE process, void **base, ULONG_PTR zero_bits, SIZE_T *size,
+    ULONG type, ULONG protect)
+{
+    if (posix_memalign(base, 65536, *size) != 0) {
+        *base = NULL;
+        return STATUS_NO_MEMORY;
+    }
+    return STATUS_SUCCESS;
+}
+
+static inline BOOLEAN VirtualFree(void *ptr, SIZE_T size, ULONG type)
+{
+    free(ptr);
+    return TRUE;
+}
+
+#define RaiseException(code, flags, argc, argv) abort()
+#define ExitProcess(code)                       exit(code)
+
+
+//---------------------------------------------------------------------------
+// Test Helpers
+//---------------------------------------------------------------------------
+
+
+//
+// simple xorshift generator, each thread keeps its own state so the
+// tests are reproducible for a given seed
+//
+
+static inline ULONG Test_Random(ULONG64 *state)
+{
+    ULONG64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return (ULONG)(x >> 16);
+}
+
+#define Test_Check(cond, ...) do {                                      \
+    if (! (cond)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                __FILE__, __LINE__, #cond);                             \
+        fprintf(stderr, __VA_ARGS__);                                   \
+        fprintf(stderr, "\n");                                          \
+        exit(1);                                                        \
+    }                                                                   \
+} while (0)
+
+
+//---------------------------------------------------------------------------
+
+
+#endif // _SBIE_TEST_H
@@ -253,24 +253,20 @@ bool CArchive::Update(QMap<int, QIODevice*> *FileList, bool bDelete, const SComp
 			Switch -ms=on: Enable solid mode.	This is the default so you won't often need this.
 			Switch -ms=off: Disable solid mode.	This is useful when you need to update individual files. Will reduce compression ratios normally.
 		*/
-		const wchar_t *names[] =
-		{
-			L"x",
-			//L"mt",
-			L"s",
-			L"he"
-		};
-		const int kNumProps = sizeof(names) / sizeof(names[0]);
-		NWindows::NCOM::CPropVariant values[kNumProps] =
-		{
-			(UInt32)(Params ? Params->iLevel : 5),	// compression level = 9 - ultra
-			//(UInt32)8,							// set number of CPU threads
-			// 7z only
-			(Params ? Params->bSolid : false),		// solid mode OFF
-			(Params ? Params->b7z : false)		    // file name encryption
-		};
-
-		if(setProperties->SetProperties(names, values, Params->b7z ? kNumProps : (kNumProps - 2)) != S_OK)
+		const wchar_t *names[4];
+		NWindows::NCOM::CPropVariant values[4];
+		int count = 0;
+
+		names[count] = L"x";	values[count++] = (UInt32)(Params ? Params->iLevel : 5);	// compression level = 9 - ultra
+		if (Params && Params->iThreads > 0) {
+			names[count] = L"mt";	values[count++] = (UInt32)Params->iThreads;			// set number of CPU threads, LZMA2 splits the stream into blocks per thread
+		}
+		if (Params && Params->b7z) { // 7z only
+			names[count] = L"s";	values[count++] = Params->bSolid;						// solid mode
+			names[count] = L"he";	values[count++] = true;									// file name encryption
+		}
+
+		if(setProperties->SetProperties(names, values, count) != S_OK)
 		{
 			TRACE(L"ISetProperties failed");
 			Q_ASSERT(0);
@@ -21,6 +21,7 @@ struct SCompressParams
 	int iLevel = 0;
 	bool bSolid = false;
 	bool b7z = false;
+	int iThreads = 0;		// 0 leaves the choice to the codec
 };
 
 class MISCHELPERS_EXPORT CArchive
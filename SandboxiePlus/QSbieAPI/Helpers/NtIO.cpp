@@ -6,9 +6,17 @@ typedef long NTSTATUS;
 
 #include <windows.h>
 #include "..\..\..\Sandboxie\common\win32_ntddk.h"
+#include "..\..\..\Sandboxie\common\delta_file.h"
 
 #include "NtIO.h"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+
 bool NtIo_WaitForFolder(POBJECT_ATTRIBUTES objattrs, int seconds, bool (*cb)(const WCHAR* info, void* param), void* param)
 {
 	NTSTATUS status = STATUS_SUCCESS;
@@ -382,6 +390,364 @@ NTSTATUS NtIo_MergeFolder(POBJECT_ATTRIBUTES src_objattrs, POBJECT_ATTRIBUTES de
 	return status;
 }
 
+// parallel delete and merge
+
+struct SNtIoDirJob
+{
+	SNtIoDirJob(const std::wstring& src, const std::wstring& dest, ULONG attrs, SNtIoDirJob* parent)
+		: SrcPath(src), DestPath(dest), FileAttributes(attrs), Parent(parent), Pending(1) {}
+
+	std::wstring SrcPath;
+	std::wstring DestPath;			// merge only
+	ULONG FileAttributes;
+	SNtIoDirJob* Parent;
+	std::atomic<LONG> Pending;		// 1 for the job itself + 1 per unfinished sub folder job
+};
+
+class CNtIoDirPool
+{
+public:
+	CNtIoDirPool(int Threads, bool LowPriority, SNtIoStats* Stats, bool (*cb)(const WCHAR* info, void* param), void* param)
+	{
+		if (Threads <= 0)
+			Threads = std::min<int>(std::max<int>(std::thread::hardware_concurrency(), 1), 8);
+		m_QueueCount = Threads;
+		m_Queues.reset(new SQueue[m_QueueCount]);
+		m_LowPriority = LowPriority;
+		m_Stats = Stats;
+		m_cb = cb;
+		m_param = param;
+	}
+	virtual ~CNtIoDirPool() {}
+
+	NTSTATUS Run(SNtIoDirJob* Root)
+	{
+		Push(0, Root);
+
+		std::vector<std::thread> Workers;
+		for (size_t i = 1; i < m_QueueCount; i++)
+			Workers.push_back(std::thread(&CNtIoDirPool::Worker, this, i));
+		Worker(0);
+		for (size_t i = 0; i < Workers.size(); i++)
+			Workers[i].join();
+
+		return m_Status;
+	}
+
+protected:
+	struct SQueue
+	{
+		std::mutex Lock;
+		std::deque<SNtIoDirJob*> Jobs;
+	};
+
+	void Push(size_t Index, SNtIoDirJob* Job)
+	{
+		if (Job->Parent)
+			Job->Parent->Pending++;
+		m_Outstanding++;
+		{
+			std::unique_lock<std::mutex> Lock(m_Queues[Index].Lock);
+			m_Queues[Index].Jobs.push_back(Job);
+		}
+		m_Queued++;
+		Wake(false);
+	}
+
+	void Wake(bool All)
+	{
+		// taking the lock orders this against a worker which is about to wait, so the wakeup can't get lost
+		{ std::unique_lock<std::mutex> Lock(m_IdleLock); }
+		if (All)
+			m_IdleCond.notify_all();
+		else
+			m_IdleCond.notify_one();
+	}
+
+	SNtIoDirJob* Pop(size_t Index)
+	{
+		// own queue from the back, depth first, keeps the number of queued jobs low
+		{
+			std::unique_lock<std::mutex> Lock(m_Queues[Index].Lock);
+			if (!m_Queues[Index].Jobs.empty()) {
+				SNtIoDirJob* Job = m_Queues[Index].Jobs.back();
+				m_Queues[Index].Jobs.pop_back();
+				m_Queued--;
+				return Job;
+			}
+		}
+
+		// steal from the front of the other queues, the oldest jobs are the biggest sub trees
+		for (size_t i = 1; i < m_QueueCount; i++) {
+			SQueue& Queue = m_Queues[(Index + i) % m_QueueCount];
+			std::unique_lock<std::mutex> Lock(Queue.Lock);
+			if (!Queue.Jobs.empty()) {
+				SNtIoDirJob* Job = Queue.Jobs.front();
+				Queue.Jobs.pop_front();
+				m_Queued--;
+				return Job;
+			}
+		}
+		return NULL;
+	}
+
+	void Worker(size_t Index)
+	{
+		if (m_LowPriority)
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN); // lowers the i/o priority as well
+
+		while (m_Outstanding > 0)
+		{
+			SNtIoDirJob* Job = Pop(Index);
+			if (!Job) {
+				// idle workers sleep until a sub folder is queued, or the last job is done
+				std::unique_lock<std::mutex> Lock(m_IdleLock);
+				m_IdleCond.wait(Lock, [&] { return m_Queued > 0 || m_Outstanding == 0; });
+				continue;
+			}
+
+			if (NT_SUCCESS(m_Status)) {
+				if (m_cb && !m_cb(Job->SrcPath.c_str(), m_param))
+					SetStatus(STATUS_CANCELLED);
+				else
+					SetStatus(ProcessDir(Index, Job));
+			}
+
+			Release(Job);
+			if (--m_Outstanding == 0)
+				Wake(true);
+		}
+
+		if (m_LowPriority)
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+	}
+
+	void Release(SNtIoDirJob* Job)
+	{
+		// the last one to finish with a folder, removes it, and then releases its parent
+		while (Job && --Job->Pending == 0)
+		{
+			if (NT_SUCCESS(m_Status)) {
+				SetStatus(FinishDir(Job));
+				if (m_Stats)
+					InterlockedIncrement64(&m_Stats->Folders);
+			}
+
+			SNtIoDirJob* Parent = Job->Parent;
+			delete Job;
+			Job = Parent;
+		}
+	}
+
+	void SetStatus(NTSTATUS status)
+	{
+		if (!NT_SUCCESS(status))
+			InterlockedCompareExchange(&m_Status, status, STATUS_SUCCESS);
+	}
+
+	template <typename T>
+	NTSTATUS EnumDir(HANDLE Handle, T Func)
+	{
+		IO_STATUS_BLOCK Iosb;
+		std::vector<BYTE> Buffer(64 * 1024);
+
+		for (;;)
+		{
+			NTSTATUS status = NtQueryDirectoryFile(Handle, NULL, NULL, NULL, &Iosb, Buffer.data(), (ULONG)Buffer.size(), FileBothDirectoryInformation, FALSE, NULL, FALSE);
+			if (status == STATUS_NO_MORE_FILES)
+				return STATUS_SUCCESS;
+			if (!NT_SUCCESS(status))
+				return status;
+
+			for (PFILE_BOTH_DIRECTORY_INFORMATION Info = (PFILE_BOTH_DIRECTORY_INFORMATION)Buffer.data(); ; 
+			  Info = (PFILE_BOTH_DIRECTORY_INFORMATION)((BYTE*)Info + Info->NextEntryOffset))
+			{
+				std::wstring FileName(Info->FileName, Info->FileNameLength / sizeof(wchar_t));
+				if (FileName != L"." && FileName != L"..") {
+					status = Func(FileName, Info->FileAttributes);
+					if (!NT_SUCCESS(status))
+						return status;
+				}
+				if (Info->NextEntryOffset == 0)
+					break;
+			}
+
+			if (!NT_SUCCESS(m_Status))
+				return m_Status;
+		}
+	}
+
+	NTSTATUS OpenDir(const std::wstring& Path, HANDLE* Handle)
+	{
+		SNtObject ntObject(Path);
+		IO_STATUS_BLOCK Iosb;
+		return NtCreateFile(Handle, FILE_LIST_DIRECTORY | SYNCHRONIZE, &ntObject.attr, &Iosb, 0, FILE_ATTRIBUTE_DIRECTORY, 
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN, FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_REPARSE_POINT, 0, 0);
+	}
+
+	virtual NTSTATUS ProcessDir(size_t Index, SNtIoDirJob* Job) = 0;
+	virtual NTSTATUS FinishDir(SNtIoDirJob* Job) = 0;
+
+	std::unique_ptr<SQueue[]> m_Queues;
+	size_t m_QueueCount;
+	std::atomic<LONG> m_Outstanding = 0;
+	std::atomic<LONG> m_Queued = 0;
+	std::mutex m_IdleLock;
+	std::condition_variable m_IdleCond;
+	volatile LONG m_Status = STATUS_SUCCESS;
+
+	bool m_LowPriority;
+	SNtIoStats* m_Stats;
+	bool (*m_cb)(const WCHAR* info, void* param);
+	void* m_param;
+};
+
+class CNtIoDeletePool : public CNtIoDirPool
+{
+public:
+	CNtIoDeletePool(int Threads, bool LowPriority, SNtIoStats* Stats, bool (*cb)(const WCHAR* info, void* param), void* param)
+		: CNtIoDirPool(Threads, LowPriority, Stats, cb, param) {}
+
+protected:
+	virtual NTSTATUS ProcessDir(size_t Index, SNtIoDirJob* Job)
+	{
+		HANDLE Handle;
+		NTSTATUS status = OpenDir(Job->SrcPath, &Handle);
+		if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND)
+			return STATUS_SUCCESS;
+		if (!NT_SUCCESS(status))
+			return status;
+
+		status = EnumDir(Handle, [&](const std::wstring& FileName, ULONG FileAttributes) -> NTSTATUS {
+
+			// sub folders are handed to the pool, files and junctions are removed right away
+			if ((FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+				Push(Index, new SNtIoDirJob(Job->SrcPath + L"\\" + FileName, std::wstring(), FileAttributes, Job));
+				return STATUS_SUCCESS;
+			}
+
+			SNtObject ntFoundObject(FileName, Handle);
+			NTSTATUS status = NtIo_DeleteFile(FileAttributes, &ntFoundObject.attr, NULL, NULL);
+			if (NT_SUCCESS(status) && m_Stats)
+				InterlockedIncrement64(&m_Stats->Files);
+			return status;
+		});
+
+		NtClose(Handle);
+
+		return status;
+	}
+
+	virtual NTSTATUS FinishDir(SNtIoDirJob* Job)
+	{
+		SNtObject ntObject(Job->SrcPath);
+
+		if (Job->FileAttributes & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM))
+			NtIo_RemoveProblematicAttributes(&ntObject.attr);
+
+		NTSTATUS status = NtDeleteFile(&ntObject.attr);
+		if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND)
+			status = STATUS_SUCCESS;
+		return status;
+	}
+};
+
+NTSTATUS NtIo_DeleteFolderParallel(POBJECT_ATTRIBUTES objattrs, int Threads, bool LowPriority, SNtIoStats* Stats, bool (*cb)(const WCHAR* info, void* param), void* param)
+{
+	NtIo_RemoveProblematicAttributes(objattrs);
+
+	FILE_BASIC_INFORMATION info = { 0 };
+	NTSTATUS status = NtQueryAttributesFile(objattrs, &info);
+	if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND)
+		return STATUS_SUCCESS; // we wanted it gone and its not here, success
+	if (info.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+		return NtIo_DeleteFile(info.FileAttributes, objattrs, NULL, NULL);
+
+	std::wstring Path(objattrs->ObjectName->Buffer, objattrs->ObjectName->Length / sizeof(wchar_t));
+
+	CNtIoDeletePool Pool(Threads, LowPriority, Stats, cb, param);
+	return Pool.Run(new SNtIoDirJob(Path, std::wstring(), 0, NULL));
+}
+
+class CNtIoMergePool : public CNtIoDirPool
+{
+public:
+	CNtIoMergePool(int Threads, bool LowPriority, SNtIoStats* Stats, bool (*cb)(const WCHAR* info, void* param), void* param)
+		: CNtIoDirPool(Threads, LowPriority, Stats, cb, param) {}
+
+protected:
+	virtual NTSTATUS ProcessDir(size_t Index, SNtIoDirJob* Job)
+	{
+		HANDLE SrcHandle, DestHandle;
+		NTSTATUS status = OpenDir(Job->SrcPath, &SrcHandle);
+		if (!NT_SUCCESS(status))
+			return status;
+		status = OpenDir(Job->DestPath, &DestHandle);
+		if (!NT_SUCCESS(status)) {
+			NtClose(SrcHandle);
+			return status;
+		}
+
+		SNtObject ntDestFolder(Job->DestPath);
+
+		status = EnumDir(SrcHandle, [&](const std::wstring& FileName, ULONG FileAttributes) -> NTSTATUS {
+
+			SNtObject ntSrcObject(FileName, SrcHandle);
+			SNtObject ntDestObject(FileName, DestHandle);
+
+			BOOLEAN TargetExists = NtIo_FileExists(&ntDestObject.attr);
+
+			NTSTATUS status = STATUS_SUCCESS;
+			if (FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+				if (TargetExists)
+					status = NtIo_DeleteFile(ntDestObject, NULL, NULL);
+				if (NT_SUCCESS(status))
+					status = NtIo_RenameJunction(&ntSrcObject.attr, &ntDestFolder.attr, FileName.c_str());
+			}
+			else if (FileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				// only folders present on both sides need to be merged, the rest is moved as a whole
+				if (TargetExists) {
+					Push(Index, new SNtIoDirJob(Job->SrcPath + L"\\" + FileName, Job->DestPath + L"\\" + FileName, FileAttributes, Job));
+					return STATUS_SUCCESS;
+				}
+				status = NtIo_RenameFolder(&ntSrcObject.attr, &ntDestFolder.attr, FileName.c_str());
+			}
+			else
+			{
+				if (TargetExists)
+					status = NtIo_DeleteFile(ntDestObject, NULL, NULL);
+				if (NT_SUCCESS(status))
+					status = NtIo_RenameFile(&ntSrcObject.attr, &ntDestFolder.attr, FileName.c_str());
+			}
+
+			if (NT_SUCCESS(status) && m_Stats)
+				InterlockedIncrement64(&m_Stats->Files);
+			return status;
+		});
+
+		NtClose(SrcHandle);
+		NtClose(DestHandle);
+
+		return status;
+	}
+
+	virtual NTSTATUS FinishDir(SNtIoDirJob* Job)
+	{
+		SNtObject ntObject(Job->SrcPath);
+		return NtDeleteFile(&ntObject.attr);
+	}
+};
+
+NTSTATUS NtIo_MergeFolderParallel(POBJECT_ATTRIBUTES src_objattrs, POBJECT_ATTRIBUTES dest_objattrs, int Threads, bool LowPriority, SNtIoStats* Stats, bool (*cb)(const WCHAR* info, void* param), void* param)
+{
+	std::wstring SrcPath(src_objattrs->ObjectName->Buffer, src_objattrs->ObjectName->Length / sizeof(wchar_t));
+	std::wstring DestPath(dest_objattrs->ObjectName->Buffer, dest_objattrs->ObjectName->Length / sizeof(wchar_t));
+
+	CNtIoMergePool Pool(Threads, LowPriority, Stats, cb, param);
+	return Pool.Run(new SNtIoDirJob(SrcPath, DestPath, 0, NULL));
+}
+
 // copy
 
 std::wstring NtIo_ResolveObjectPath(const std::wstring& fullPath) 
@@ -679,6 +1045,139 @@ void NtIo_CopyMetadata(HANDLE srcHandle, HANDLE dstHandle,
     free(streamInfo);
 }
 
+NTSTATUS NtIo_MaterializeDeltaFile(POBJECT_ATTRIBUTES objattrs)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK IoStatusBlock;
+
+    //
+    // a delta file holds only the blocks modified in the box, the rest
+    // is read from the true file named in its header stream, see delta_file.h
+    //
+
+    SNtObject streamObj(std::wstring(objattrs->ObjectName->Buffer, objattrs->ObjectName->Length / sizeof(WCHAR)) + FILE_DELTA_STREAM_NAME, objattrs->RootDirectory);
+
+    HANDLE stream_handle = NULL;
+    status = NtCreateFile(&stream_handle, FILE_GENERIC_READ, &streamObj.attr, &IoStatusBlock, NULL,
+                          0, FILE_SHARE_VALID_FLAGS, FILE_OPEN,
+                          FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+    if (!NT_SUCCESS(status))
+        return STATUS_SUCCESS; // not a delta file
+
+    std::vector<BYTE> headerBuffer(FIELD_OFFSET(FILE_DELTA_HEADER, true_path) + (0x7FFF + 1) * sizeof(WCHAR));
+    FILE_DELTA_HEADER* header = (FILE_DELTA_HEADER*)headerBuffer.data();
+    status = NtReadFile(stream_handle, NULL, NULL, NULL, &IoStatusBlock, header, (ULONG)headerBuffer.size() - sizeof(WCHAR), NULL, NULL);
+    NtClose(stream_handle);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    if (IoStatusBlock.Information < FIELD_OFFSET(FILE_DELTA_HEADER, true_path) || header->magic != FILE_DELTA_MAGIC || header->version != FILE_DELTA_VERSION
+     || header->true_path_len == 0 || header->true_path_len > 0x7FFF
+     || FIELD_OFFSET(FILE_DELTA_HEADER, true_path) + header->true_path_len * sizeof(WCHAR) > IoStatusBlock.Information)
+        return STATUS_FILE_CORRUPT_ERROR;
+    header->true_path[header->true_path_len] = L'\0';
+
+    HANDLE true_handle = NULL;
+    SNtObject trueObj(header->true_path);
+    status = NtCreateFile(&true_handle, FILE_GENERIC_READ, &trueObj.attr, &IoStatusBlock, NULL,
+                          0, FILE_SHARE_VALID_FLAGS, FILE_OPEN,
+                          FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    //
+    // the true file must still be the file which was migrated, and must not
+    // have been modified since, otherwise its content can't be mixed into
+    // the copy file, the same check is done in SbieDll, see file_delta.c
+    //
+
+    FILE_BASIC_INFORMATION basicInfo;
+    FILE_INTERNAL_INFORMATION internalInfo;
+    status = NtQueryInformationFile(true_handle, &IoStatusBlock, &basicInfo, sizeof(basicInfo), FileBasicInformation);
+    if (NT_SUCCESS(status))
+        status = NtQueryInformationFile(true_handle, &IoStatusBlock, &internalInfo, sizeof(internalInfo), FileInternalInformation);
+    if (NT_SUCCESS(status) && ((ULONGLONG)basicInfo.LastWriteTime.QuadPart != header->true_write_time
+                            || (ULONGLONG)internalInfo.IndexNumber.QuadPart != header->true_file_id))
+        status = STATUS_FILE_INVALID;
+    if (!NT_SUCCESS(status)) {
+        NtClose(true_handle);
+        return status;
+    }
+
+    HANDLE handle = NULL;
+    status = NtCreateFile(&handle, FILE_GENERIC_READ | FILE_GENERIC_WRITE, objattrs, &IoStatusBlock, NULL,
+                          0, FILE_SHARE_READ, FILE_OPEN,
+                          FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+    if (!NT_SUCCESS(status)) {
+        NtClose(true_handle);
+        return status;
+    }
+
+    //
+    // copy every range below the original size which is not allocated in the box
+    //
+
+    std::vector<BYTE> buffer(1024 * 1024);
+    ULONGLONG pos = 0;
+    ULONGLONG end = header->true_size;
+
+    auto fillHole = [&](ULONGLONG start, ULONGLONG stop) -> NTSTATUS {
+        NTSTATUS status = STATUS_SUCCESS;
+        while (start < stop && NT_SUCCESS(status)) {
+            ULONG length = (ULONG)std::min<ULONGLONG>(stop - start, buffer.size());
+            LARGE_INTEGER offset;
+            offset.QuadPart = start;
+            status = NtReadFile(true_handle, NULL, NULL, NULL, &IoStatusBlock, buffer.data(), length, &offset, NULL);
+            ULONG got = NT_SUCCESS(status) ? (ULONG)IoStatusBlock.Information : 0;
+            if (status == STATUS_END_OF_FILE || (NT_SUCCESS(status) && got < length))
+                status = STATUS_FILE_INVALID; // the true file has shrunk since
+            if (!NT_SUCCESS(status))
+                break;
+            status = NtWriteFile(handle, NULL, NULL, NULL, &IoStatusBlock, buffer.data(), length, &offset, NULL);
+            start += length;
+        }
+        return status;
+    };
+
+    while (NT_SUCCESS(status) && pos < end) {
+
+        FILE_ALLOCATED_RANGE_BUFFER query;
+        query.FileOffset.QuadPart = pos;
+        query.Length.QuadPart = end - pos;
+        FILE_ALLOCATED_RANGE_BUFFER ranges[64];
+        status = NtFsControlFile(handle, NULL, NULL, NULL, &IoStatusBlock, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), ranges, sizeof(ranges));
+        bool more = (status == STATUS_BUFFER_OVERFLOW);
+        if (!NT_SUCCESS(status) && !more)
+            break;
+        status = STATUS_SUCCESS;
+
+        ULONG count = (ULONG)(IoStatusBlock.Information / sizeof(FILE_ALLOCATED_RANGE_BUFFER));
+        for (ULONG i = 0; i < count && NT_SUCCESS(status); i++) {
+            ULONGLONG start = std::max<ULONGLONG>(ranges[i].FileOffset.QuadPart, pos);
+            ULONGLONG stop = std::min<ULONGLONG>(ranges[i].FileOffset.QuadPart + ranges[i].Length.QuadPart, end);
+            if (start >= stop)
+                continue;
+            if (start > pos)
+                status = fillHole(pos, start);
+            pos = stop;
+        }
+
+        if (!more || count == 0) {
+            if (NT_SUCCESS(status) && pos < end)
+                status = fillHole(pos, end);
+            break;
+        }
+    }
+
+    NtClose(handle);
+    NtClose(true_handle);
+
+    if (NT_SUCCESS(status))
+        status = NtDeleteFile(&streamObj.attr);
+
+    return status;
+}
+
 NTSTATUS NtIo_CopyFile(
     POBJECT_ATTRIBUTES src_objattrs,
     POBJECT_ATTRIBUTES dest_objattrs,
@@ -691,6 +1190,15 @@ NTSTATUS NtIo_CopyFile(
     if (cb && !cb(src_objattrs->ObjectName->Buffer, param))
         return STATUS_CANCELLED;
 
+    const WCHAR* srcName = src_objattrs->ObjectName->Buffer;
+    const WCHAR* srcSlash = wcsrchr(srcName, L'\\');
+    const WCHAR* srcColon = wcschr(srcName, L':');
+    if (!(srcColon && (!srcSlash || srcColon > srcSlash))) {
+        status = NtIo_MaterializeDeltaFile(src_objattrs);
+        if (!NT_SUCCESS(status))
+            return status;
+    }
+
     HANDLE src_handle = NULL;
     status = NtCreateFile(&src_handle, GENERIC_READ | READ_CONTROL | SYNCHRONIZE, src_objattrs, &IoStatusBlock, NULL,
                           0, FILE_SHARE_READ, FILE_OPEN,
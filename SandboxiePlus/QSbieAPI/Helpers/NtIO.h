@@ -40,4 +40,16 @@ QSBIEAPI_EXPORT NTSTATUS NtIo_RenameJunction(POBJECT_ATTRIBUTES src_objattrs, PO
 
 QSBIEAPI_EXPORT NTSTATUS NtIo_MergeFolder(POBJECT_ATTRIBUTES src_objattrs, POBJECT_ATTRIBUTES dest_objattrs, bool (*cb)(const WCHAR* info, void* param) = NULL, void* param = NULL);
 
+struct SNtIoStats
+{
+	volatile LONG64 Files = 0;
+	volatile LONG64 Folders = 0;
+};
+
+// Threads <= 0 picks one per cpu core up to 8, cb may be invoked concurrently from all worker threads
+QSBIEAPI_EXPORT NTSTATUS NtIo_DeleteFolderParallel(POBJECT_ATTRIBUTES objattrs, int Threads = 0, bool LowPriority = true, SNtIoStats* Stats = NULL, bool (*cb)(const WCHAR* info, void* param) = NULL, void* param = NULL);
+QSBIEAPI_EXPORT NTSTATUS NtIo_MergeFolderParallel(POBJECT_ATTRIBUTES src_objattrs, POBJECT_ATTRIBUTES dest_objattrs, int Threads = 0, bool LowPriority = true, SNtIoStats* Stats = NULL, bool (*cb)(const WCHAR* info, void* param) = NULL, void* param = NULL);
+
+QSBIEAPI_EXPORT NTSTATUS NtIo_MaterializeDeltaFile(POBJECT_ATTRIBUTES objattrs);
+
 QSBIEAPI_EXPORT NTSTATUS NtIo_CopyFolder(POBJECT_ATTRIBUTES src_objattrs, POBJECT_ATTRIBUTES dest_objattrs, bool (*cb)(const WCHAR* info, void* param), void* param);
\ No newline at end of file
@@ -17,6 +17,7 @@
  */
 #include "stdafx.h"
 #include <QtConcurrent>
+#include <algorithm>
 #include "SandBox.h"
 #include "../SbieAPI.h"
 
@@ -27,6 +28,7 @@ typedef long NTSTATUS;
 #include <windows.h>
 #include "..\..\Sandboxie\common\win32_ntddk.h"
 #include "..\..\Sandboxie\core\drv\api_flags.h"
+#include "..\..\Sandboxie\common\snapshot_index.h"
 
 #include "..\..\Sandboxie\common\ini.cpp"
 
@@ -213,16 +215,48 @@ SB_PROGRESS CSandBox::CleanBox()
 	if (GetActiveProcessCount() > 0)
 		return SB_ERR(SB_DeleteNotEmpty);
 
-	return CleanBoxFolders(QStringList(m_FilePath));
+	return CleanBoxFolders(QStringList(m_FilePath), GetBool("UseBackgroundDelete", false, true));
 }
 
-SB_PROGRESS CSandBox::CleanBoxFolders(const QStringList& BoxFolders)
+SB_PROGRESS CSandBox::CleanBoxFolders(const QStringList& BoxFolders, bool bBackground)
 {
 	CSbieProgressPtr pProgress = CSbieProgressPtr(new CSbieProgress());
-	QtConcurrent::run(CSandBox::CleanBoxAsync, pProgress, BoxFolders);
+	QtConcurrent::run(CSandBox::CleanBoxAsync, pProgress, BoxFolders, bBackground);
 	return SB_PROGRESS(OP_ASYNC, pProgress);
 }
 
+struct SFolderProgress
+{
+	SFolderProgress(CSbieProgress* progress, const QString& format) 
+		: pProgress(progress), Format(format), StartTime(GetTickCount64()), LastUpdate(0) {}
+
+	CSbieProgress* pProgress;
+	QString Format;
+	SNtIoStats Stats;
+	quint64 StartTime;
+	volatile LONG64 LastUpdate;
+
+	quint64 GetRate() const
+	{
+		quint64 Elapsed = GetTickCount64() - StartTime;
+		return Elapsed ? (Stats.Files + Stats.Folders) * 1000 / Elapsed : 0;
+	}
+};
+
+bool CSandBox__FolderProgress(const WCHAR* info, void* param)
+{
+	SFolderProgress* pInfo = (SFolderProgress*)param;
+
+	// this gets called from all worker threads, only let one of them update the message every 250 ms
+	quint64 Now = GetTickCount64();
+	LONG64 LastUpdate = pInfo->LastUpdate;
+	if (Now - LastUpdate >= 250 && InterlockedCompareExchange64(&pInfo->LastUpdate, Now, LastUpdate) == LastUpdate) {
+		pInfo->pProgress->ShowMessage(pInfo->Format.arg(QString::fromWCharArray(info))
+			+ CSandBox::tr(" (%1 files, %2 folders, %3 items/s)").arg(pInfo->Stats.Files).arg(pInfo->Stats.Folders).arg(pInfo->GetRate()));
+	}
+	return !pInfo->pProgress->IsCanceled();
+}
+
 SB_STATUS CSandBox__DeleteFolder(const CSbieProgressPtr& pProgress, const QString& Folder)
 {
 	if (!QDir().exists(Folder))
@@ -241,36 +275,69 @@ SB_STATUS CSandBox__DeleteFolder(const CSbieProgressPtr& pProgress, const QStrin
 
 	pProgress->ShowMessage(CSandBox::tr("Deleting folder: %1").arg(Folder));
 
-	NTSTATUS status = NtIo_DeleteFolderRecursively(&ntObject.attr, [](const WCHAR* info, void* param) {
-		CSbieProgress* pProgress = (CSbieProgress*)param;
-		pProgress->ShowMessage(CSandBox::tr("Deleting folder: %1").arg(QString::fromWCharArray(info)));
-		return !pProgress->IsCanceled(); 
-	}, pProgress.data());
+	SFolderProgress Info(pProgress.data(), CSandBox::tr("Deleting folder: %1"));
+
+	NTSTATUS status = NtIo_DeleteFolderParallel(&ntObject.attr, 0, true, &Info.Stats, CSandBox__FolderProgress, &Info);
 
 	if (!NT_SUCCESS(status))
 		return SB_ERR(SB_DeleteError, QVariantList() << Folder, status);
+
+	pProgress->ShowMessage(CSandBox::tr("Deleted %1 files and %2 folders in %3 s (%4 items/s)")
+		.arg(Info.Stats.Files).arg(Info.Stats.Folders).arg((GetTickCount64() - Info.StartTime) / 1000.0, 0, 'f', 1).arg(Info.GetRate()));
 	return SB_OK;
 }
 
-void CSandBox::CleanBoxAsync(const CSbieProgressPtr& pProgress, const QStringList& BoxFolders)
+SB_STATUS CSandBox__DeleteFolderRetry(const CSbieProgressPtr& pProgress, const QString& Folder)
+{
+	SB_STATUS Status;
+	for (int i = 0; i < 10; i++) {
+		Status = CSandBox__DeleteFolder(pProgress, Folder);
+		if (!Status.IsError() || Status.GetStatus() == STATUS_CANCELLED)
+			break;
+			
+		QThread::sleep(1); // wait a second and retry
+	}
+	return Status;
+}
+
+void CSandBox__DeleteStaleFolders(const QString& Folder)
+{
+	// remove what was left over by background deletions which did not complete
+	QFileInfo Info(Folder);
+	QDir Dir(Info.absolutePath());
+	foreach(const QString& Name, Dir.entryList(QStringList() << (Info.fileName() + ".~del~*"), QDir::Dirs | QDir::Hidden | QDir::System)) {
+		CSbieProgressPtr pProgress = CSbieProgressPtr(new CSbieProgress());
+		CSandBox__DeleteFolderRetry(pProgress, Dir.absoluteFilePath(Name).replace("/", "\\"));
+	}
+}
+
+void CSandBox::CleanBoxAsync(const CSbieProgressPtr& pProgress, const QStringList& BoxFolders, bool bBackground)
 {
 	SB_STATUS Status;
 
 	foreach(const QString& Folder, BoxFolders)
 	{
-		for (int i = 0; i < 10; i++) {
-			Status = CSandBox__DeleteFolder(pProgress, Folder);
-			if (!Status.IsError() || Status.GetStatus() == STATUS_CANCELLED)
-				break;
-			
-			QThread::sleep(1); // wait a second and retry
+		if (bBackground && QDir().exists(Folder)) 
+		{
+			// move the content out of the way on the same volume, so the box can be used right away,
+			// the actual deletion is then done with low priority in the background
+			QString TrashFolder = Folder + ".~del~" + QString::number(GetTickCount64());
+			if (QDir().rename(Folder, TrashFolder))
+				continue;
+			// if the folder can't be renamed, something is still holding it, fall back to in place deletion
 		}
 
+		Status = CSandBox__DeleteFolderRetry(pProgress, Folder);
 		if (Status.IsError())
 			break;
 	}
 
 	pProgress->Finish(Status);
+
+	if (bBackground) {
+		foreach(const QString& Folder, BoxFolders)
+			CSandBox__DeleteStaleFolders(Folder);
+	}
 }
 
 SB_STATUS CSandBox__MoveFolder(const QString& SourcePath, const QString& ParentFolder, const QString& TargetName);
@@ -445,6 +512,87 @@ SB_STATUS CSandBox__MoveFolder(const QString& SourcePath, const QString& ParentF
 	return SB_OK;
 }
 
+bool CSandBox__IndexFolder(const std::wstring& Path, size_t RootLen, std::vector<ULONGLONG>& Hashes)
+{
+	WIN32_FIND_DATAW FindData;
+	HANDLE hFind = FindFirstFileExW((Path + L"\\*").c_str(), FindExInfoBasic, &FindData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+
+	bool bOk = true;
+	do {
+		if (wcscmp(FindData.cFileName, L".") == 0 || wcscmp(FindData.cFileName, L"..") == 0)
+			continue;
+
+		// lookups through a junction would resolve outside the snapshot, don't index such snapshots
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+			bOk = false;
+			break;
+		}
+
+		std::wstring FullPath = Path + L"\\" + FindData.cFileName;
+
+		ULONGLONG Hash;
+		if (SnapshotIndex_Hash(FullPath.c_str() + RootLen, (ULONG)(FullPath.length() - RootLen), &Hash))
+			Hashes.push_back(Hash);
+
+		if ((FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !CSandBox__IndexFolder(FullPath, RootLen, Hashes)) {
+			bOk = false;
+			break;
+		}
+	} while (FindNextFileW(hFind, &FindData));
+
+	FindClose(hFind);
+	return bOk;
+}
+
+void CSandBox__BuildSnapshotIndex(const QString& SnapshotFolder)
+{
+	//
+	// the index lets the driver dll skip this snapshot for all paths it does not contain,
+	// without it every file open probes every snapshot, see snapshot_index.h
+	//
+
+	QString IndexPath = SnapshotFolder + "\\" + QString::fromWCharArray(SNAPSHOT_INDEX_FILE_NAME);
+	QFile::remove(IndexPath);
+
+	std::wstring Root = L"\\\\?\\" + QString(SnapshotFolder).replace("/", "\\").toStdWString();
+
+	std::vector<ULONGLONG> Hashes;
+	foreach(const QString& BoxSubFolder, CSandBox__BoxSubFolders)
+	{
+		std::wstring SubFolder = Root + L"\\" + BoxSubFolder.toStdWString();
+		if (GetFileAttributesW(SubFolder.c_str()) == INVALID_FILE_ATTRIBUTES)
+			continue;
+
+		ULONGLONG Hash;
+		if (SnapshotIndex_Hash(SubFolder.c_str() + Root.length(), (ULONG)(SubFolder.length() - Root.length()), &Hash))
+			Hashes.push_back(Hash);
+
+		if (!CSandBox__IndexFolder(SubFolder, Root.length(), Hashes))
+			return; // no index, the snapshot will be probed on every lookup
+	}
+
+	std::sort(Hashes.begin(), Hashes.end());
+	Hashes.erase(std::unique(Hashes.begin(), Hashes.end()), Hashes.end());
+
+	SNAPSHOT_INDEX_HEADER Header;
+	Header.magic = SNAPSHOT_INDEX_MAGIC;
+	Header.version = SNAPSHOT_INDEX_VERSION;
+	Header.count = (ULONG)Hashes.size();
+	Header.reserved = 0;
+
+	QFile IndexFile(IndexPath);
+	if (!IndexFile.open(QFile::WriteOnly))
+		return;
+	bool bOk = IndexFile.write((char*)&Header, sizeof(Header)) == sizeof(Header);
+	if (bOk && !Hashes.empty())
+		bOk = IndexFile.write((char*)Hashes.data(), Hashes.size() * sizeof(ULONGLONG)) == (qint64)(Hashes.size() * sizeof(ULONGLONG));
+	IndexFile.close();
+	if (!bOk)
+		IndexFile.remove();
+}
+
 SB_PROGRESS CSandBox::TakeSnapshot(const QString& Name)
 {
 	QSettings ini(m_FilePath + "\\Snapshots.ini", QSettings::IniFormat);
@@ -493,6 +641,9 @@ SB_PROGRESS CSandBox::TakeSnapshot(const QString& Name)
 		if (Status.IsError())
 			return Status;
 	}
+
+	CSandBox__BuildSnapshotIndex(m_FilePath + "\\snapshot-" + ID);
+
 	return SB_OK;
 }
 
@@ -574,11 +725,9 @@ SB_STATUS CSandBox__MergeFolders(const CSbieProgressPtr& pProgress, const QStrin
 
 	pProgress->ShowMessage(CSandBox::tr("Merging folders: %1 >> %2").arg(SourceFolder).arg(TargetFolder));
 
-	NTSTATUS status = NtIo_MergeFolder(&ntSource.attr, &ntTarget.attr, [](const WCHAR* info, void* param) {
-		CSbieProgress* pProgress = (CSbieProgress*)param;
-		pProgress->ShowMessage(CSandBox::tr("Merging folder: %1").arg(QString::fromWCharArray(info)));
-		return !pProgress->IsCanceled(); 
-	}, pProgress.data());
+	SFolderProgress Info(pProgress.data(), CSandBox::tr("Merging folder: %1"));
+
+	NTSTATUS status = NtIo_MergeFolderParallel(&ntSource.attr, &ntTarget.attr, 0, true, &Info.Stats, CSandBox__FolderProgress, &Info);
 
 	if (!NT_SUCCESS(status))
 		return SB_ERR(SB_SnapMergeFail, QVariantList() << TargetFolder << SourceFolder, status);
@@ -590,6 +739,7 @@ SB_STATUS CSandBox__CleanupSnapshot(const QString& Folder)
 	// remove files which may be in the snapshot
 	foreach(const SBoxDataFile& BoxDataFile, CSandBox__BoxDataFiles) 
 		QFile::remove(Folder + "\\" + BoxDataFile.Name);
+	QFile::remove(Folder + "\\" + QString::fromWCharArray(SNAPSHOT_INDEX_FILE_NAME));
 
 	// delete snapshot folder, at this stage it should be empty
 	// when its not empty delete will fail
@@ -637,6 +787,9 @@ void CSandBox::MergeSnapshotAsync(const CSbieProgressPtr& pProgress, const QStri
 
 	SB_STATUS Status = SB_OK;
 
+	// the target snapshot is about to change, its index would hide the merged files
+	QFile::remove(TargetFolder + "\\" + QString::fromWCharArray(SNAPSHOT_INDEX_FILE_NAME));
+
 	// apply source FilePaths.dat on the targetfolder
 	if (QFile::exists(SourceFolder + "\\FilePaths.dat")) 
 	{
@@ -760,6 +913,9 @@ void CSandBox::MergeSnapshotAsync(const CSbieProgressPtr& pProgress, const QStri
 			// rename target snapshot to source snapshot
 			if (!Status.IsError())
 				Status = CSandBox__MoveFolder(TargetFolder, BoxPath, "snapshot-" + SourceID);
+
+			if (!Status.IsError())
+				CSandBox__BuildSnapshotIndex(BoxPath + "\\snapshot-" + SourceID);
 		}
 	}
 
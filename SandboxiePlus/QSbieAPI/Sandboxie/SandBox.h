@@ -101,8 +101,8 @@ protected:
 	friend class CBoxedProcess;
 	friend class CSbieAPI;
 
-	SB_PROGRESS						CleanBoxFolders(const QStringList& BoxFolders);
-	static void						CleanBoxAsync(const CSbieProgressPtr& pProgress, const QStringList& BoxFolders);
+	SB_PROGRESS						CleanBoxFolders(const QStringList& BoxFolders, bool bBackground = false);
+	static void						CleanBoxAsync(const CSbieProgressPtr& pProgress, const QStringList& BoxFolders, bool bBackground);
 
 	static void						DeleteSnapshotAsync(const CSbieProgressPtr& pProgress, const QString& BoxPath, const QString& ID);
 	static void						MergeSnapshotAsync(const CSbieProgressPtr& pProgress, const QString& BoxPath, const QString& TargetID, const QString& SourceID, const QPair<const QString, class CSbieAPI*>& params);
@@ -259,6 +259,16 @@ QList<CSbieIni::SbieIniValue> CSbieIni::GetIniSection(qint32* pStatus, bool with
 	if (!withTemplates)
 		uFlags |= CONF_GET_NO_TEMPLS;
 
+	// fetch the whole section in one driver call, fall back to enumerating setting by setting with older drivers
+	QList<CSbieIni::SbieIniValue> Settings = m_pAPI->SbieIniGetSection(m_Name, uFlags, &status);
+	if (status != STATUS_NOT_SUPPORTED) {
+		if (status == STATUS_RESOURCE_NAME_NOT_FOUND)
+			status = STATUS_SUCCESS;
+		if (pStatus) *pStatus = status;
+		return Settings;
+	}
+	status = STATUS_SUCCESS;
+
 	QSet<QString> Names;
 
 	if (withGlobals)
@@ -290,7 +300,6 @@ QList<CSbieIni::SbieIniValue> CSbieIni::GetIniSection(qint32* pStatus, bool with
 		Names.insert(Name);
 	}
 
-	QList<CSbieIni::SbieIniValue> Settings;
 	foreach(const QString& Name, Names)
 	{
 		for (int Index = 0; ; Index++)
@@ -19,6 +19,7 @@
 #include "SbieTemplates.h"
 #include "../SbieAPI.h"
 #include "../SbieUtils.h"
+#include <QtConcurrent>
 
 #include <ntstatus.h>
 #define WIN32_NO_STATUS
@@ -41,26 +42,35 @@ CSbieTemplates::CSbieTemplates(CSbieAPI* pAPI, QObject* paretn)
 
 void CSbieTemplates::RunCheck()
 {
-	CollectObjects();
-	CollectClasses();
-	CollectServices();
-	CollectProducts();
+	// the collectors are independent of each other, run them side by side
+	QList<QFuture<void>> Collectors;
+	Collectors.append(QtConcurrent::run([this]() { CollectObjects(); }));
+	Collectors.append(QtConcurrent::run([this]() { CollectClasses(); }));
+	Collectors.append(QtConcurrent::run([this]() { CollectServices(); }));
+	Collectors.append(QtConcurrent::run([this]() { CollectProducts(); }));
 
 	CollectTemplates();
 
+	foreach(QFuture<void> Collector, Collectors)
+		Collector.waitForFinished();
+
 	QStringList Used = m_pAPI->GetGlobalSettings()->GetTextList("Template", false);
 	QStringList Rejected = m_pAPI->GetGlobalSettings()->GetTextList("TemplateReject", false);
 
-	for(QMap<QString, int>::iterator I = m_Templates.begin(); I != m_Templates.end(); ++I)
+	// from here on the collected data is only read, so the templates can be checked in parallel
+	QStringList Names = m_Templates.keys();
+	QList<bool> Required = QtConcurrent::blockingMapped<QList<bool>>(Names, [this](const QString& Name) { return CheckTemplate(Name); });
+
+	for (int i = 0; i < Names.count(); i++)
 	{
 		int Value = eNone;
-		if (Used.contains(I.key(), Qt::CaseInsensitive))
+		if (Used.contains(Names[i], Qt::CaseInsensitive))
 			Value |= eEnabled;
-		if (CheckTemplate(I.key()))
+		if (Required[i])
 			Value |= eRequired;
-		if (Rejected.contains(I.key() , Qt::CaseInsensitive))
+		if (Rejected.contains(Names[i], Qt::CaseInsensitive))
 			Value |= eDisabled;
-		I.value() = Value;
+		m_Templates[Names[i]] = Value;
 	}
 }
 
@@ -68,19 +78,15 @@ void CSbieTemplates::CollectTemplates()
 {
 	m_Templates.clear();
 
-	QStringList Templates;
-	Templates.append(GetTemplateNames("EmailReader"));
-	Templates.append(GetTemplateNames("Print"));
-	Templates.append(GetTemplateNames("Security"));
-	Templates.append(GetTemplateNames("Desktop"));
-	Templates.append(GetTemplateNames("Download"));
-	Templates.append(GetTemplateNames("Misc"));
-	Templates.append(GetTemplateNames("WebBrowser"));
-	Templates.append(GetTemplateNames("MediaPlayer"));
-	Templates.append(GetTemplateNames("TorrentClient"));
-
-	foreach(const QString& Template, Templates)
-		m_Templates.insert(Template, 0);
+	static const QStringList Classes = QStringList() << "EmailReader" << "Print" << "Security" << "Desktop" 
+		<< "Download" << "Misc" << "WebBrowser" << "MediaPlayer" << "TorrentClient";
+
+	QMap<QString, QString> Templates = GetTemplateClasses();
+	for (QMap<QString, QString>::iterator I = Templates.begin(); I != Templates.end(); ++I)
+	{
+		if (Classes.contains(I.value(), Qt::CaseInsensitive))
+			m_Templates.insert(I.key(), 0);
+	}
 }
 
 void CSbieTemplates::SetCheckResult(const QStringList& Result)
@@ -119,6 +125,41 @@ void CSbieTemplates::Reset()
 	m_Classes.clear();
 	m_Services.clear();
 	m_Products.clear();
+
+	m_ObjectIndex = SNameIndex();
+	m_ClassIndex = SNameIndex();
+	m_ServiceIndex = SNameIndex();
+	m_ProductIndex = SNameIndex();
+}
+
+void CSbieTemplates::BuildIndex(const QStringList& List, SNameIndex& Index)
+{
+	Index.Exact = QSet<QString>(List.begin(), List.end());
+	Index.Sorted = Index.Exact.values();
+	Index.Sorted.sort();
+}
+
+bool CSbieTemplates::CheckIndex(const QString& value, const SNameIndex& Index)
+{
+	QString Value = value.toLower();
+
+	// without wildcards we only need a lookup
+	int pos = 0;
+	for (; pos < Value.length(); pos++) {
+		if (Value[pos] == '*' || Value[pos] == '?')
+			break;
+	}
+	if (pos == Value.length())
+		return Index.Exact.contains(Value);
+
+	// otherwise only entries starting with the literal prefix can match
+	QString Prefix = Value.left(pos);
+	for (auto I = std::lower_bound(Index.Sorted.begin(), Index.Sorted.end(), Prefix); I != Index.Sorted.end() && I->startsWith(Prefix); ++I)
+	{
+		if (CSbieUtils::WildCompare(Value, *I))
+			return true;
+	}
+	return false;
 }
 
 QStringList CSbieTemplates::GetObjects() 
@@ -226,6 +267,8 @@ void CSbieTemplates::CollectObjects()
 	}
 
 	free(info);
+
+	BuildIndex(m_Objects, m_ObjectIndex);
 }
 
 void CSbieTemplates::CollectClasses()
@@ -246,6 +289,8 @@ void CSbieTemplates::CollectClasses()
 
 		return TRUE;
 	}, (LPARAM)this);
+
+	BuildIndex(m_Classes, m_ClassIndex);
 }
 
 void CSbieTemplates::CollectServices()
@@ -281,6 +326,8 @@ void CSbieTemplates::CollectServices()
 	free(info);
 
 	CloseServiceHandle(hManager);
+
+	BuildIndex(m_Services, m_ServiceIndex);
 }
 
 void CSbieTemplates::CollectProducts()
@@ -329,6 +376,8 @@ void CSbieTemplates::CollectProducts()
 #endif _WIN64
 		}
 	}
+
+	BuildIndex(m_Products, m_ProductIndex);
 }
 
 QStringList CSbieTemplates::GetTemplateNames(const QString& forClass)
@@ -359,6 +408,25 @@ QStringList CSbieTemplates::GetTemplateNames(const QString& forClass)
 	return list;
 }
 
+QMap<QString, QString> CSbieTemplates::GetTemplateClasses()
+{
+	QMap<QString, QString> Templates;
+
+	for(int index = 0;; index++)
+	{
+		QString section = m_pAPI->SbieIniGet(QString(), QString(), index);
+		if (section.isEmpty())
+			break;
+
+		if (section.left(9).compare("Template_", Qt::CaseInsensitive) != 0)
+			continue;
+
+		Templates.insert(section.mid(9), m_pAPI->SbieIniGet(section, "Tmpl.Class", CONF_GET_NO_GLOBAL));
+	}
+
+	return Templates;
+}
+
 bool CSbieTemplates::CheckTemplate(const QString& Name)
 {
 	QSharedPointer<CSbieIni> pTemplate = QSharedPointer<CSbieIni>(new CSbieIni("Template_" + Name, m_pAPI));
@@ -465,46 +533,22 @@ bool CSbieTemplates::CheckFile(const QString& Value)
 
 bool CSbieTemplates::CheckClasses(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Classes.begin(); I != m_Classes.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return CheckIndex(value, m_ClassIndex);
 }
 
 bool CSbieTemplates::CheckServices(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Services.begin(); I != m_Services.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return CheckIndex(value, m_ServiceIndex);
 }
 
 bool CSbieTemplates::CheckProducts(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Products.begin(); I != m_Products.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return CheckIndex(value, m_ProductIndex);
 }
 
 bool CSbieTemplates::CheckObjects(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Objects.begin(); I != m_Objects.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return CheckIndex(value, m_ObjectIndex);
 }
 
 void CSbieTemplates::InitExpandPaths(bool WithUser)
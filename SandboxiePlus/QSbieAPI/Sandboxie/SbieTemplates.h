@@ -1,5 +1,6 @@
 #pragma once
 #include <QObject>
+#include <QSet>
 
 #include "../qsbieapi_global.h"
 
@@ -50,16 +51,31 @@ protected:
 	void CollectTemplates();
 
 	QStringList GetTemplateNames(const QString& forClass);
+	QMap<QString, QString> GetTemplateClasses();
 
 	bool CheckTemplate(const QString& Name);
 
 	void InitExpandPaths(bool WithUser);
 
+	struct SNameIndex
+	{
+		QSet<QString> Exact;
+		QStringList Sorted;
+	};
+
+	static void BuildIndex(const QStringList& List, SNameIndex& Index);
+	static bool CheckIndex(const QString& Value, const SNameIndex& Index);
+
 	QStringList m_Objects;
 	QStringList m_Classes;
 	QStringList m_Services;
 	QStringList m_Products;
 
+	SNameIndex m_ObjectIndex;
+	SNameIndex m_ClassIndex;
+	SNameIndex m_ServiceIndex;
+	SNameIndex m_ProductIndex;
+
 	QMap<QString, int> m_Templates;
 
 	QMap<QString, QString> m_Expands;
@@ -64,6 +64,12 @@ struct SSbieAPI
 		lastMessageNum = 0;
 		//lastRecordNum = 0;
 		traceBuffer = NULL;
+
+		processEventsSupported = true;
+		processEventsSynced = false;
+		processEventsAllSessions = false;
+		lastProcessEventNum = 0;
+		lastProcessInfoUpdate = 0;
 		traceBufferLen = 0;
 
 		SbieMsgDll = NULL;
@@ -101,6 +107,12 @@ struct SSbieAPI
 	UCHAR* traceBuffer;
 	ULONG traceBufferLen;
 
+	bool processEventsSupported;
+	bool processEventsSynced;
+	bool processEventsAllSessions;
+	ULONG64 lastProcessEventNum;
+	quint64 lastProcessInfoUpdate;
+
 	HMODULE SbieMsgDll;
 
 	mutable volatile LONG   SvcLock;
@@ -140,6 +152,9 @@ CSbieAPI::CSbieAPI(QObject* parent) : QThread(parent)
 	m_bReloadPending = false;
 	m_bBoxesDirty = false;
 
+	m_TraceMemoryLimit = 0;
+	m_pTraceStore = CTraceStorePtr(new CTraceStore());
+
 	connect(&m_IniWatcher, SIGNAL(fileChanged(const QString&)), this, SLOT(OnIniChanged(const QString&)));
 	connect(this, SIGNAL(ProcessBoxed(quint32, const QString&, const QString&, quint32, const QString&)), this, SLOT(OnProcessBoxed(quint32, const QString&, const QString&, quint32, const QString&)));
 }
@@ -295,6 +310,9 @@ SB_STATUS CSbieAPI::Connect(bool takeOver, bool withQueue)
 	m->lastMessageNum = 0;
 	//m->lastRecordNum = 0;
 
+	m->processEventsSupported = true;
+	m->processEventsSynced = false;
+
 	// Note: this lib is not using all functions, hence it can be compatible with multiple driver ABI revisions
 	//QStringList CompatVersions = QStringList () << "5.55.0";
 	//QString CurVersion = GetVersion();
@@ -366,6 +384,8 @@ SB_STATUS CSbieAPI::Disconnect()
 	m_BoxedProxesses.clear();
 	m_bBoxesDirty = true;
 
+	m->processEventsSynced = false;
+
 	emit StatusChanged();
 	return SB_OK;
 }
@@ -1346,6 +1366,68 @@ QString CSbieAPI::SbieIniGet(const QString& Section, const QString& Setting, qui
 	return QString::fromWCharArray(out_buffer);
 }
 
+QList<CSbieIni::SbieIniValue> CSbieAPI::SbieIniGetSection(const QString& Section, quint32 Flags, qint32* ErrCode)
+{
+	QList<CSbieIni::SbieIniValue> Settings;
+
+	std::wstring section = Section.toStdWString();
+
+	quint32 Index = Flags | CONF_GET_SECTION;
+
+	ULONG BufferSize = 0x10000;
+	QByteArray Buffer;
+
+	NTSTATUS status;
+	for (;;)
+	{
+		Buffer.resize(BufferSize);
+		*(ULONG*)Buffer.data() = 0xFFFFFFFF;
+		ULONG BufferLen = BufferSize;
+
+		__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+
+		memset(parms, 0, sizeof(parms));
+		parms[0] = API_QUERY_CONF;
+		parms[1] = (ULONG64)section.c_str();
+		parms[3] = (ULONG64)&Index;
+		parms[6] = (ULONG64)Buffer.data();
+		parms[7] = (ULONG64)&BufferLen;
+
+		status = m->IoControl(parms);
+		if (status == STATUS_BUFFER_TOO_SMALL && BufferLen > BufferSize) {
+			BufferSize = BufferLen;
+			continue;
+		}
+
+		// an older driver without section export treats this as a setting name enumeration, it writes the name 
+		// through the NULL output buffer and fails with STATUS_ACCESS_VIOLATION, or for an empty section reports 
+		// STATUS_RESOURCE_NAME_NOT_FOUND which is also what a current driver returns, any other failure or a buffer 
+		// left untouched means the caller has to fall back to the setting by setting walk
+		if (NT_SUCCESS(status) ? *(ULONG*)Buffer.data() == 0xFFFFFFFF : status != STATUS_RESOURCE_NAME_NOT_FOUND)
+			status = STATUS_NOT_SUPPORTED;
+		break;
+	}
+
+	if (ErrCode)
+		*ErrCode = status;
+	if (!NT_SUCCESS(status))
+		return Settings;
+
+	for (const char* ptr = Buffer.constData(); ; )
+	{
+		const CONF_RECORD* rec = (const CONF_RECORD*)ptr;
+		if (rec->length == 0)
+			break;
+		Settings.append(CSbieIni::SbieIniValue{ 
+			QString::fromWCharArray(rec->data, rec->name_len), 
+			rec->flags, 
+			QString::fromWCharArray(rec->data + rec->name_len + 1, rec->value_len) });
+		ptr += rec->length;
+	}
+
+	return Settings;
+}
+
 QString CSbieAPI::SbieIniGet2(const QString& Section, const QString& Setting, quint32 Index, bool bWithGlobal, bool bNoExpand, bool withTemplates)
 {
 	int flags = (bWithGlobal ? 0 : CONF_GET_NO_GLOBAL);
@@ -1448,67 +1530,67 @@ SB_STATUS CSbieAPI__GetProcessPIDs(SSbieAPI* m, const QString& BoxName, bool bAl
 	return SB_OK;
 }
 
-SB_STATUS CSbieAPI::UpdateProcesses(int iKeep, bool bAllSessions)
+SB_STATUS CSbieAPI__GetProcessEvents(SSbieAPI* m, bool bAllSessions, API_PROCESS_EVENT* events, ULONG* count)
 {
-	ULONG count = 0;
-	SB_STATUS Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, NULL, &count); // query count
-	if (Status.IsError()) 
-		return Status;
+	__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+	API_GET_PROCESS_EVENTS_ARGS* args = (API_GET_PROCESS_EVENTS_ARGS*)parms;
 
-	count += 128; // add some extra space
-	ULONG* boxed_pids = new ULONG[count]; 
+	memset(parms, 0, sizeof(parms));
+	args->func_code = API_GET_PROCESS_EVENTS;
+	args->seq_num.val = &m->lastProcessEventNum;
+	args->session_id.val = bAllSessions ? -1 : m->sessionId;
+	args->events.val = events;
+	args->count.val = count;
 
-	Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, boxed_pids, &count); // query pids
-	if (Status.IsError()) {
-		delete[] boxed_pids;
-		return Status;
-	}
+	NTSTATUS status = m->IoControl(parms);
+	if (!NT_SUCCESS(status))
+		return SB_ERR(status);
+	return SB_OK;
+}
 
-	QMap<quint32, CBoxedProcessPtr>	OldProcessList;
-	foreach(const CSandBoxPtr& pBox, m_SandBoxes)
-		OldProcessList.insert(pBox->m_ProcessList);
+SB_STATUS CSbieAPI::UpdateProcesses(int iKeep, bool bAllSessions)
+{
+	quint64 uNow = ::GetTickCount64();
 
-	for (int i=0; i < count; i++)
-	{
-		quint32 ProcessId = (quint32)boxed_pids[i];
+	//
+	// apply the process start/exit events queued by the driver since the last update,
+	// a full enumeration is only needed initially, when the session filter changes
+	// or when the driver dropped events because we did not keep up
+	//
 
-		CBoxedProcessPtr pProcess = OldProcessList.take(ProcessId);
-		if (!pProcess)
-		{
-			pProcess = CBoxedProcessPtr(NewBoxedProcess(ProcessId, NULL));
-			UpdateProcessInfo(pProcess);
-			
-			CSandBoxPtr pBox = GetBoxByName(pProcess->GetBoxName());
-			if (pBox.isNull())
-				continue;
+	bool bFullScan = true;
+	if (m->processEventsSynced && m->processEventsAllSessions == bAllSessions)
+		bFullScan = !UpdateProcessEvents(bAllSessions);
 
-			if (pBox->m_ActiveProcessCount == 0) {
-				pBox->m_ActiveProcessCount = 1;
-				pBox->OpenBox();
-				m_bBoxesDirty = true;
-				emit BoxOpened(pBox);
-			}
+	if (bFullScan) 
+	{
+		SB_STATUS Status = UpdateAllProcesses(bAllSessions);
+		if (Status.IsError())
+			return Status;
+	}
+
+	//
+	// per process details are refreshed on a slower cadence
+	//
 
-			pProcess->m_pBox = pBox.data();
-			pBox->m_ProcessList.insert(ProcessId, pProcess);
-			m_BoxedProxesses.insert(ProcessId, pProcess);
-			pBox->m_ActiveProcessDirty = true;
+	if (bFullScan || uNow - m->lastProcessInfoUpdate >= 2000)
+	{
+		m->lastProcessInfoUpdate = uNow;
 
-			pProcess->InitProcessInfo();
+		foreach(const CBoxedProcessPtr& pProcess, m_BoxedProxesses) {
+			if (!pProcess->IsTerminated())
+				pProcess->UpdateProcessInfo();
 		}
-
-		pProcess->UpdateProcessInfo();
 	}
 
-	foreach(const CBoxedProcessPtr& pProcess, OldProcessList) 
+	if (iKeep != -1)
 	{
-		if (!pProcess->IsTerminated()) {
-			pProcess->SetTerminated();
-			pProcess->m_pBox->m_ActiveProcessDirty = true;
-		}
-		else if (iKeep != -1 && pProcess->IsTerminated(iKeep)) {
-			pProcess->m_pBox->m_ProcessList.remove(pProcess->m_ProcessId);
-			m_BoxedProxesses.remove(pProcess->m_ProcessId);
+		foreach(const CBoxedProcessPtr& pProcess, m_BoxedProxesses) 
+		{
+			if (pProcess->IsTerminated() && pProcess->IsTerminated(iKeep)) {
+				pProcess->m_pBox->m_ProcessList.remove(pProcess->m_ProcessId);
+				m_BoxedProxesses.remove(pProcess->m_ProcessId);
+			}
 		}
 	}
 
@@ -1532,10 +1614,129 @@ SB_STATUS CSbieAPI::UpdateProcesses(int iKeep, bool bAllSessions)
 		}
 	}
 
+	return SB_OK;
+}
+
+SB_STATUS CSbieAPI::UpdateAllProcesses(bool bAllSessions)
+{
+	//
+	// remember where the event queue stands before enumerating,
+	// processes started in the meantime are reported again and ignored as duplicates
+	//
+
+	m->processEventsSynced = false;
+	if (m->processEventsSupported) {
+		ULONG count = 0;
+		if (CSbieAPI__GetProcessEvents(m, bAllSessions, NULL, &count))
+			m->processEventsSynced = true;
+		else // the driver does not support process events, fall back to polling
+			m->processEventsSupported = false;
+	}
+	m->processEventsAllSessions = bAllSessions;
+
+	ULONG count = 0;
+	SB_STATUS Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, NULL, &count); // query count
+	if (Status.IsError()) 
+		return Status;
+
+	count += 128; // add some extra space
+	ULONG* boxed_pids = new ULONG[count]; 
+
+	Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, boxed_pids, &count); // query pids
+	if (Status.IsError()) {
+		delete[] boxed_pids;
+		return Status;
+	}
+
+	QMap<quint32, CBoxedProcessPtr>	OldProcessList = m_BoxedProxesses;
+
+	for (int i=0; i < count; i++)
+	{
+		quint32 ProcessId = (quint32)boxed_pids[i];
+
+		if (!OldProcessList.take(ProcessId))
+			AddBoxedProcess(ProcessId);
+	}
+
+	foreach(const CBoxedProcessPtr& pProcess, OldProcessList) 
+	{
+		if (!pProcess->IsTerminated()) {
+			pProcess->SetTerminated();
+			pProcess->m_pBox->m_ActiveProcessDirty = true;
+		}
+	}
+
 	delete[] boxed_pids;
 	return SB_OK;
 }
 
+bool CSbieAPI::UpdateProcessEvents(bool bAllSessions)
+{
+	API_PROCESS_EVENT Events[128];
+	for (;;)
+	{
+		ULONG count = ARRAYSIZE(Events);
+		if (!CSbieAPI__GetProcessEvents(m, bAllSessions, Events, &count))
+			return false; // events were lost
+
+		for (ULONG i = 0; i < count; i++)
+		{
+			quint32 ProcessId = Events[i].process_id;
+			CBoxedProcessPtr pProcess = m_BoxedProxesses.value(ProcessId);
+
+			if (Events[i].type == API_PROCESS_EVENT_START)
+			{
+				if (pProcess && pProcess->IsTerminated()) { // pid got reused
+					pProcess->m_pBox->m_ProcessList.remove(ProcessId);
+					m_BoxedProxesses.remove(ProcessId);
+					pProcess.clear();
+				}
+
+				if (!pProcess)
+					AddBoxedProcess(ProcessId);
+			}
+			else if (Events[i].type == API_PROCESS_EVENT_EXIT)
+			{
+				if (pProcess && !pProcess->IsTerminated()) {
+					pProcess->SetTerminated();
+					pProcess->m_pBox->m_ActiveProcessDirty = true;
+				}
+			}
+		}
+
+		if (count < ARRAYSIZE(Events))
+			break;
+	}
+	return true;
+}
+
+CBoxedProcessPtr CSbieAPI::AddBoxedProcess(quint32 ProcessId)
+{
+	CBoxedProcessPtr pProcess = CBoxedProcessPtr(NewBoxedProcess(ProcessId, NULL));
+	UpdateProcessInfo(pProcess);
+			
+	CSandBoxPtr pBox = GetBoxByName(pProcess->GetBoxName());
+	if (pBox.isNull())
+		return CBoxedProcessPtr();
+
+	if (pBox->m_ActiveProcessCount == 0) {
+		pBox->m_ActiveProcessCount = 1;
+		pBox->OpenBox();
+		m_bBoxesDirty = true;
+		emit BoxOpened(pBox);
+	}
+
+	pProcess->m_pBox = pBox.data();
+	pBox->m_ProcessList.insert(ProcessId, pProcess);
+	m_BoxedProxesses.insert(ProcessId, pProcess);
+	pBox->m_ActiveProcessDirty = true;
+
+	pProcess->InitProcessInfo();
+	pProcess->UpdateProcessInfo();
+
+	return pProcess;
+}
+
 bool CSbieAPI::HasProcesses(const QString& BoxName)
 {
 	ULONG count;
@@ -1702,6 +1903,56 @@ quint64 CSbieAPI::QueryProcessInfo(quint32 ProcessId, quint32 InfoClass)
 	return ResultValue;
 }
 
+SB_STATUS CSbieAPI::GetSyscallProfile(quint32 ProcessId, QList<SSyscallProfile>& Profile, double* pBucketUs, bool bReset)
+{
+	__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+	API_QUERY_SYSCALL_PROFILE_ARGS *args = (API_QUERY_SYSCALL_PROFILE_ARGS *)parms;
+
+	QByteArray Buffer;
+	ULONG ResultLen = sizeof(API_SYSCALL_PROFILE_HEADER) + 64 * sizeof(API_SYSCALL_PROFILE_ENTRY);
+
+	NTSTATUS status;
+	do {
+		Buffer.resize(ResultLen + 16 * sizeof(API_SYSCALL_PROFILE_ENTRY)); // add some extra space
+
+		memset(parms, 0, sizeof(parms));
+		args->func_code             = API_QUERY_SYSCALL_PROFILE;
+		args->process_id.val64      = (ULONG64)(ULONG_PTR)ProcessId;
+		args->flags.val             = bReset ? API_SYSCALL_PROFILE_RESET : 0;
+		args->buffer.val            = Buffer.data();
+		args->buffer_len.val        = Buffer.size();
+		args->result_len.val        = &ResultLen;
+
+		status = m->IoControl(parms);
+	} while (status == STATUS_BUFFER_TOO_SMALL);
+
+	if (!NT_SUCCESS(status))
+		return SB_ERR(status);
+
+	API_SYSCALL_PROFILE_HEADER* pHeader = (API_SYSCALL_PROFILE_HEADER*)Buffer.data();
+	API_SYSCALL_PROFILE_ENTRY* pEntries = (API_SYSCALL_PROFILE_ENTRY*)(pHeader + 1);
+
+	double TickUs = pHeader->frequency ? 1000000.0 / pHeader->frequency : 0;
+	if (pBucketUs)
+		*pBucketUs = TickUs * (1ULL << pHeader->unit_shift);
+
+	Profile.clear();
+	for (ULONG i = 0; i < pHeader->count; i++)
+	{
+		API_SYSCALL_PROFILE_ENTRY* pEntry = &pEntries[i];
+
+		SSyscallProfile Entry;
+		Entry.Name = QString::fromLatin1((char*)pEntry->name);
+		Entry.Count = pEntry->count;
+		Entry.TotalUs = pEntry->ticks * TickUs;
+		Entry.Histogram.resize(API_SYSCALL_PROFILE_BUCKETS);
+		for (int j = 0; j < API_SYSCALL_PROFILE_BUCKETS; j++)
+			Entry.Histogram[j] = pEntry->hist[j];
+		Profile.append(Entry);
+	}
+	return SB_OK;
+}
+
 SB_STATUS CSbieAPI::TerminateAll(const QString& BoxName)
 {
 	PROCESS_KILL_ALL_REQ req;
@@ -1717,6 +1968,11 @@ SB_STATUS CSbieAPI::TerminateAll(const QString& BoxName)
 		return Status;
 	if(rpl->status != 0) 
 		Status = SB_ERR(rpl->status);
+	if (rpl->length >= sizeof(PROCESS_KILL_ALL_RPL)) {
+		PROCESS_KILL_ALL_RPL* pRpl = (PROCESS_KILL_ALL_RPL*)rpl.Value();
+		if (pRpl->process_count)
+			emit BoxTerminated(BoxName, pRpl->process_count, pRpl->elapsed_ms);
+	}
 	return Status;
 }
 
@@ -3111,7 +3367,7 @@ bool CSbieAPI::GetMonitor()
 #endif
 }
 
-const QVector<CTraceEntryPtr>& CSbieAPI::GetTrace()
+CTraceStorePtr CSbieAPI::GetTrace()
 { 
 	QMutexLocker Lock(&m_TraceMutex);
 
@@ -3119,13 +3375,6 @@ const QVector<CTraceEntryPtr>& CSbieAPI::GetTrace()
 	{
 		CTraceEntryPtr& pEntry = m_TraceCache[i];
 
-#ifdef USE_MERGE_TRACE
-		if (!m_TraceList.isEmpty() && m_TraceList.last()->Equals(pEntry)) {
-			m_TraceList.last()->Merge(pEntry);
-			continue;
-		}
-#endif
-
 		if (CBoxedProcessPtr proc = m_BoxedProxesses.value(pEntry->GetProcessId())) {
 			pEntry->SetProcessName(proc->GetProcessName());
 			pEntry->SetBoxPtr(proc->GetBoxPtr());
@@ -3134,11 +3383,27 @@ const QVector<CTraceEntryPtr>& CSbieAPI::GetTrace()
 				proc->ResolveSymbols(Stack);
 		}
 
-		m_TraceList.append(pEntry);
+		m_pTraceStore->Append(pEntry);
 	}
 	m_TraceCache.clear();
 
-	return m_TraceList; 
+	return m_pTraceStore; 
+}
+
+void CSbieAPI::ClearTrace()
+{
+	CTraceStorePtr pTraceStore = CTraceStorePtr(new CTraceStore(m_TraceMemoryLimit));
+
+	QMutexLocker Lock(&m_TraceMutex);
+	m_TraceCache.clear();
+	m_pTraceStore = pTraceStore;
+}
+
+void CSbieAPI::SetTraceMemoryLimit(quint64 MemoryLimit)
+{
+	QMutexLocker Lock(&m_TraceMutex);
+	m_TraceMemoryLimit = MemoryLimit;
+	m_pTraceStore->SetMemoryLimit(MemoryLimit);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
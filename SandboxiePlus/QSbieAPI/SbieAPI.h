@@ -89,6 +89,7 @@ public:
 	virtual QString			SbieIniGet(const QString& Section, const QString& Setting, quint32 Index = 0, qint32* ErrCode = NULL, quint32* pType = NULL);
 	virtual QString			SbieIniGet2(const QString& Section, const QString& Setting, quint32 Index = 0, bool bWithGlobal = false, bool bNoExpand = true, bool withTemplates = false);
 	virtual QString			SbieIniGetEx(const QString& Section, const QString& Setting);
+	virtual QList<CSbieIni::SbieIniValue> SbieIniGetSection(const QString& Section, quint32 Flags, qint32* ErrCode = NULL);
 	virtual SB_STATUS		SbieIniSet(const QString& Section, const QString& Setting, const QString& Value, CSbieIni::ESetMode Mode = CSbieIni::eIniUpdate, bool bRefresh = true);
 	virtual SB_STATUS		SbieIniSetDrv(const QString& Section, const QString& Setting, const QString& Value, CSbieIni::ESetMode Mode = CSbieIni::eIniUpdate);
 	virtual bool			IsBox(const QString& BoxName, bool& bIsEnabled);
@@ -139,13 +140,24 @@ public:
 	virtual SB_STATUS		EnableMonitor(bool Enable);
 	virtual bool			IsMonitoring();
 
-	virtual const QVector<CTraceEntryPtr>& GetTrace();
-	virtual int				GetTraceCount() const { return m_TraceList.count(); }
-	virtual void			ClearTrace() { m_TraceList.clear(); QMutexLocker Lock(&m_TraceMutex); m_TraceCache.clear(); }
+	virtual CTraceStorePtr	GetTrace();
+	virtual int				GetTraceCount() const { QMutexLocker Lock(&m_TraceMutex); return m_pTraceStore->Count(); }
+	virtual void			ClearTrace();
+	virtual void			SetTraceMemoryLimit(quint64 MemoryLimit);
 
 	// Other
 	virtual quint64			QueryProcessInfo(quint32 ProcessId, quint32 InfoClass = 0);
 
+	struct SSyscallProfile
+	{
+		QString				Name;
+		quint32				Count;
+		double				TotalUs;
+		QVector<quint32>	Histogram; // bucket i counts calls below BucketUs * 2^i, the last one all above
+	};
+
+	virtual SB_STATUS		GetSyscallProfile(quint32 ProcessId, QList<SSyscallProfile>& Profile, double* pBucketUs = NULL, bool bReset = false);
+
 	virtual QString			GetSbieMsgStr(quint32 code, quint32 Lang = 1033);
 
 	enum EStartFlags
@@ -191,6 +203,7 @@ signals:
 	void					LogSbieMessage(quint32 MsgCode, const QStringList& MsgData, quint32 ProcessId);
 	void					ProcessBoxed(quint32 ProcessId, const QString& Path, const QString& Box, quint32 ParentId, const QString& CmdLine);
 	void					FileToRecover(const QString& BoxName, const QString& FilePath, const QString& BoxPath, quint32 ProcessId);
+	void					BoxTerminated(const QString& BoxName, quint32 ProcessCount, quint32 ElapsedMs);
 
 	void					BoxAdded(const CSandBoxPtr& pBox);
 	void					BoxOpened(const CSandBoxPtr& pBox);
@@ -233,6 +246,9 @@ protected:
 	virtual SB_STATUS		RunSandboxed(const QString& BoxName, const QString& Command, QString WrkDir = QString(), quint32 Flags = 0);
 
 	virtual SB_STATUS		UpdateBoxPaths(CSandBox* pSandBox);
+	virtual SB_STATUS		UpdateAllProcesses(bool bAllSessions);
+	virtual bool			UpdateProcessEvents(bool bAllSessions);
+	virtual CBoxedProcessPtr AddBoxedProcess(quint32 ProcessId);
 	virtual SB_STATUS		UpdateProcessInfo(const CBoxedProcessPtr& pProcess);
 
 	virtual SB_STATUS		GetProcessInfo(quint32 ProcessId, quint32* pParentId = NULL, quint32* pInfo = NULL, bool* pSuspended = NULL, QString* pImagePath = NULL, QString* pCommandLine = NULL, QString* pWorkingDir = NULL);
@@ -249,7 +265,8 @@ protected:
 
 	mutable QMutex			m_TraceMutex;
 	QVector<CTraceEntryPtr>	m_TraceCache;
-	QVector<CTraceEntryPtr>	m_TraceList;
+	CTraceStorePtr			m_pTraceStore;
+	quint64					m_TraceMemoryLimit;
 
 	mutable QReadWriteLock	m_DriveLettersMutex;
 	struct SDrive
@@ -18,6 +18,11 @@
 #include "stdafx.h"
 #include <QDebug>
 #include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QDir>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
 #include "SbieTrace.h"
 
 #include <ntstatus.h>
@@ -152,14 +157,19 @@ QString CTraceEntry::GetTypeStr(quint32 Type)
 
 QString CTraceEntry::GetTypeStr() const
 {
-	QString Type = GetTypeStr(m_Type.Type);
+	return GetTypeStr(m_Type.Flags, m_SubType);
+}
+
+QString CTraceEntry::GetTypeStr(quint32 Flags, const QString& SubType)
+{
+	QString Type = GetTypeStr(Flags & 0xFF);
 	if(Type.isEmpty())
-		Type = "Unknown: " + QString::number(m_Type.Type);
+		Type = "Unknown: " + QString::number(Flags & 0xFF);
 
-	if(!m_SubType.isEmpty())
-		Type.append(" / " + m_SubType);
+	if(!SubType.isEmpty())
+		Type.append(" / " + SubType);
 
-	if (m_Type.User)
+	if (Flags & MONITOR_USER)
 		Type.append(" (U)"); // user mode (sbiedll.dll)
 	//else if (m_Type.Agent)
 	//	Type.append(" (S)"); // system mode (sbiesvc.exe)
@@ -169,32 +179,39 @@ QString CTraceEntry::GetTypeStr() const
 	return Type;
 }
 
-bool CTraceEntry::IsOpen() const 
+bool CTraceEntry::IsOpen(quint32 Flags)
 {
-	return (m_Type.Flags & MONITOR_DISPOSITION_MASK) == MONITOR_OPEN;
+	return (Flags & MONITOR_DISPOSITION_MASK) == MONITOR_OPEN;
 }
 
-bool CTraceEntry::IsClosed() const
+bool CTraceEntry::IsClosed(quint32 Flags)
 {
-	return (m_Type.Flags & MONITOR_DISPOSITION_MASK) == MONITOR_DENY;
+	return (Flags & MONITOR_DISPOSITION_MASK) == MONITOR_DENY;
 }
 
-bool CTraceEntry::IsTrace() const
+bool CTraceEntry::IsTrace(quint32 Flags)
 {
-	return m_Type.Trace;
+	return (Flags & MONITOR_TRACE) != 0;
 }
 
-QString CTraceEntry::GetStautsStr() const
+QString CTraceEntry::GetStautsStr(quint32 Flags)
 {
 	QString Status;
-	if (IsOpen())
+	if (IsOpen(Flags))
 		Status.append("Open ");
-	if (IsClosed())
+	if (IsClosed(Flags))
 		Status.append("Closed ");
 
-	if (IsTrace())
+	if (IsTrace(Flags))
 		Status.append("Trace ");
 
+	return Status;
+}
+
+QString CTraceEntry::GetStautsStr() const
+{
+	QString Status = GetStautsStr(m_Type.Flags);
+
 #ifdef USE_MERGE_TRACE
 	if (m_Counter > 1)
 		Status.append(QString("(%1) ").arg(m_Counter));
@@ -203,6 +220,551 @@ QString CTraceEntry::GetStautsStr() const
 	return Status;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStore
+//
+
+CTraceStore::CTraceStore(quint64 MemoryLimit)
+{
+	// each store gets its own range of uid's so that a cleared log can be told apart from the old one
+	static std::atomic<quint64> NextBaseUID = 0;
+	m_BaseUID = NextBaseUID.fetch_add(1ull << 40);
+	m_Count = 0;
+
+	m_Strings.append(QString()); // id 0 is always the empty string
+	m_Boxes.append(NULL);
+	m_BoxRows.append(QVector<int>());
+	m_ProcessThreadsVersion = 0;
+	m_bIndexed = true;
+	m_IndexBytes = 0;
+	m_OtherBytes = 0;
+
+	m_FirstResidentChunk = 0;
+	m_ArenaPos = 0;
+	m_FirstResident = 0;
+	m_MemoryLimit = MemoryLimit;
+	m_pSpillFile = NULL;
+}
+
+CTraceStore::~CTraceStore()
+{
+	foreach(const SChunkRef& Chunk, m_Chunks)
+		free(Chunk.pData);
+	foreach(const SArena& Arena, m_Arenas)
+		free(Arena.pData);
+	delete m_pSpillFile;
+}
+
+void CTraceStore::Append(const CTraceEntryPtr& pEntry)
+{
+	QWriteLocker Lock(&m_Lock);
+
+	int Index = m_Count % eChunkRows;
+	if (Index == 0) {
+		SChunkRef NewChunk;
+		NewChunk.pData = (SChunk*)malloc(sizeof(SChunk));
+		if (!NewChunk.pData)
+			return;
+		m_Chunks.append(NewChunk);
+	}
+	SChunk* pChunk = m_Chunks.last().pData; // the chunk being filled is never spilled
+
+	pChunk->TimeStamp[Index] = pEntry->GetTimeStamp();
+	pChunk->ProcessId[Index] = pEntry->GetProcessId();
+	pChunk->ThreadId[Index] = pEntry->GetThreadId();
+	pChunk->Type[Index] = pEntry->GetTypeFlags();
+	pChunk->Name[Index] = Intern(pEntry->GetName());
+	pChunk->SubType[Index] = Intern(pEntry->GetSubType());
+	pChunk->ProcessName[Index] = Intern(pEntry->GetProcessName());
+	pChunk->Message[Index] = StoreMessage(pEntry->GetMessage());
+
+	int Box = m_Boxes.indexOf(pEntry->GetBoxPtr());
+	if (Box == -1) {
+		Box = m_Boxes.count();
+		m_Boxes.append(pEntry->GetBoxPtr());
+		m_BoxRows.append(QVector<int>());
+	}
+	pChunk->Box[Index] = (quint16)Box;
+
+	QVector<quint64> Stack = pEntry->GetStack();
+	if (!Stack.isEmpty()) {
+		m_Stacks.insert(m_Count, Stack);
+		m_OtherBytes += Stack.count() * sizeof(quint64);
+	}
+
+	// update the secondary indexes
+	if (m_bIndexed)
+	{
+		int Word = m_Count / 64;
+		quint64 Bit = 1ull << (m_Count % 64);
+
+		QVector<quint64>& TypeBits = m_TypeBits[pEntry->GetType()];
+		if (TypeBits.count() <= Word) {
+			m_IndexBytes += (Word + 1 - TypeBits.count()) * sizeof(quint64);
+			TypeBits.resize(Word + 1);
+		}
+		TypeBits[Word] |= Bit;
+
+		QVector<quint64>& StatusBits = m_StatusBits[GetStatus(pEntry->GetTypeFlags())];
+		if (StatusBits.count() <= Word) {
+			m_IndexBytes += (Word + 1 - StatusBits.count()) * sizeof(quint64);
+			StatusBits.resize(Word + 1);
+		}
+		StatusBits[Word] |= Bit;
+
+		m_ProcessRows[pEntry->GetProcessId()].append(m_Count);
+		m_ThreadRows[pEntry->GetThreadId()].append(m_Count);
+		m_BoxRows[Box].append(m_Count);
+		m_IndexBytes += 3 * sizeof(int);
+	}
+
+	QSet<quint32>& Threads = m_ProcessThreads[pEntry->GetProcessId()];
+	if (!Threads.contains(pEntry->GetThreadId())) {
+		Threads.insert(pEntry->GetThreadId());
+		m_ProcessThreadsVersion++;
+	}
+
+	m_Count++;
+
+	if (m_MemoryLimit != 0 && GetMemoryUsageImpl() > m_MemoryLimit)
+		EnforceMemoryLimit();
+}
+
+quint32 CTraceStore::Intern(const QString& String)
+{
+	if (String.isEmpty())
+		return 0;
+	quint32& Id = m_StringMap[String];
+	if (Id == 0) {
+		Id = m_Strings.count();
+		m_Strings.append(String);
+		m_OtherBytes += String.length() * sizeof(QChar) + 64; // the string is shared with the map key
+		if (m_bIndexed)
+			IndexString(Id, String);
+	}
+	return Id;
+}
+
+static quint64 CTraceStore__Trigram(const QChar* pStr)
+{
+	return ((quint64)pStr[0].toLower().unicode() << 32) | ((quint64)pStr[1].toLower().unicode() << 16) | pStr[2].toLower().unicode();
+}
+
+void CTraceStore::IndexString(quint32 Id, const QString& String)
+{
+	// ids are handed out in ascending order, so the posting lists stay sorted
+	QSet<quint64> Trigrams;
+	for (int i = 0; i + 3 <= String.length(); i++)
+		Trigrams.insert(CTraceStore__Trigram(String.constData() + i));
+	foreach(quint64 Trigram, Trigrams)
+		m_Trigrams[Trigram].append(Id);
+	m_IndexBytes += Trigrams.count() * sizeof(quint32);
+}
+
+QBitArray CTraceStore::FindStrings(const QString& Text) const
+{
+	QReadLocker Lock(&m_Lock);
+
+	QBitArray Result(m_Strings.count());
+	if (Text.isEmpty())
+		return Result;
+
+	if (Text.length() < 3 || !m_bIndexed) { // to short for the index or no index, test all distinct strings
+		for (int i = 1; i < m_Strings.count(); i++) {
+			if (m_Strings[i].contains(Text, Qt::CaseInsensitive))
+				Result.setBit(i);
+		}
+		return Result;
+	}
+
+	// intersect the posting lists starting with the shortest one
+	QList<const QVector<quint32>*> Lists;
+	for (int i = 0; i + 3 <= Text.length(); i++) {
+		auto F = m_Trigrams.find(CTraceStore__Trigram(Text.constData() + i));
+		if (F == m_Trigrams.end())
+			return Result;
+		Lists.append(&F.value());
+	}
+	std::sort(Lists.begin(), Lists.end(), [](const QVector<quint32>* l, const QVector<quint32>* r) { return l->count() < r->count(); });
+
+	QVector<quint32> Candidates = *Lists.first();
+	for (int i = 1; i < Lists.count() && !Candidates.isEmpty(); i++) {
+		QVector<quint32> Next;
+		std::set_intersection(Candidates.begin(), Candidates.end(), Lists[i]->begin(), Lists[i]->end(), std::back_inserter(Next));
+		Candidates = Next;
+	}
+
+	// the trigrams only tell where the text may be, confirm each candidate
+	foreach(quint32 Id, Candidates) {
+		if (m_Strings[Id].contains(Text, Qt::CaseInsensitive))
+			Result.setBit(Id);
+	}
+	return Result;
+}
+
+bool CTraceStore::MatchRow(int Row, const QBitArray& Strings, const QString& Text) const
+{
+	QReadLocker Lock(&m_Lock);
+	if (Row < 0 || Row >= m_Count)
+		return false;
+
+	int Index = Row % eChunkRows;
+	quint32 Name = 0;
+	quint32 ProcessName = 0;
+	ReadChunk(Row / eChunkRows, offsetof(SChunk, Name) + Index * sizeof(quint32), &Name, sizeof(quint32));
+	ReadChunk(Row / eChunkRows, offsetof(SChunk, ProcessName) + Index * sizeof(quint32), &ProcessName, sizeof(quint32));
+	if ((Name < (quint32)Strings.size() && Strings.testBit(Name)) || (ProcessName < (quint32)Strings.size() && Strings.testBit(ProcessName)))
+		return true;
+
+	return GetMessageImpl(Row).contains(Text, Qt::CaseInsensitive);
+}
+
+CTraceStore::EStatus CTraceStore::GetStatus(quint32 Flags)
+{
+	if (CTraceEntry::IsOpen(Flags))
+		return eStatusOpen;
+	if (CTraceEntry::IsClosed(Flags))
+		return eStatusClosed;
+	if (CTraceEntry::IsTrace(Flags))
+		return eStatusTrace;
+	return eStatusOther;
+}
+
+template<typename T, typename F>
+void CTraceStore::ScanColumn(size_t Offset, F Fn) const
+{
+	// resident chunks are scanned in place, spilled ones are read back one column at a time
+	QVector<T> Buffer(eChunkRows);
+	for (int Chunk = 0; Chunk * eChunkRows < m_Count; Chunk++)
+	{
+		int Rows = qMin<int>(eChunkRows, m_Count - Chunk * eChunkRows);
+		const T* pColumn;
+		if (m_Chunks[Chunk].pData)
+			pColumn = (const T*)((const char*)m_Chunks[Chunk].pData + Offset);
+		else if (ReadChunk(Chunk, Offset, Buffer.data(), Rows * sizeof(T)))
+			pColumn = Buffer.constData();
+		else
+			continue;
+		for (int Index = 0; Index < Rows; Index++)
+			Fn(Chunk * eChunkRows + Index, pColumn[Index]);
+	}
+}
+
+QVector<quint64> CTraceStore::GetTypeBits(quint8 Type) const
+{
+	QReadLocker Lock(&m_Lock);
+	if (m_bIndexed)
+		return m_TypeBits.value(Type);
+
+	QVector<quint64> Bits((m_Count + 63) / 64);
+	ScanColumn<quint32>(offsetof(SChunk, Type), [&](int Row, quint32 Flags) {
+		if ((Flags & 0xFF) == Type)
+			Bits[Row / 64] |= 1ull << (Row % 64);
+	});
+	return Bits;
+}
+
+QVector<quint64> CTraceStore::GetStatusBits(EStatus Status) const
+{
+	QReadLocker Lock(&m_Lock);
+	if (m_bIndexed)
+		return m_StatusBits[Status];
+
+	QVector<quint64> Bits((m_Count + 63) / 64);
+	ScanColumn<quint32>(offsetof(SChunk, Type), [&](int Row, quint32 Flags) {
+		if (GetStatus(Flags) == Status)
+			Bits[Row / 64] |= 1ull << (Row % 64);
+	});
+	return Bits;
+}
+
+QVector<int> CTraceStore::GetProcessRows(quint32 ProcessId) const
+{
+	QReadLocker Lock(&m_Lock);
+	if (m_bIndexed)
+		return m_ProcessRows.value(ProcessId);
+
+	QVector<int> Rows;
+	ScanColumn<quint32>(offsetof(SChunk, ProcessId), [&](int Row, quint32 Value) {
+		if (Value == ProcessId)
+			Rows.append(Row);
+	});
+	return Rows;
+}
+
+QVector<int> CTraceStore::GetThreadRows(quint32 ThreadId) const
+{
+	QReadLocker Lock(&m_Lock);
+	if (m_bIndexed)
+		return m_ThreadRows.value(ThreadId);
+
+	QVector<int> Rows;
+	ScanColumn<quint32>(offsetof(SChunk, ThreadId), [&](int Row, quint32 Value) {
+		if (Value == ThreadId)
+			Rows.append(Row);
+	});
+	return Rows;
+}
+
+QVector<int> CTraceStore::GetBoxRows(void* pBox) const
+{
+	QReadLocker Lock(&m_Lock);
+	int Box = m_Boxes.indexOf(pBox);
+	if (Box == -1)
+		return QVector<int>();
+	if (m_bIndexed)
+		return m_BoxRows[Box];
+
+	QVector<int> Rows;
+	ScanColumn<quint16>(offsetof(SChunk, Box), [&](int Row, quint16 Value) {
+		if (Value == Box)
+			Rows.append(Row);
+	});
+	return Rows;
+}
+
+QHash<quint32, QSet<quint32>> CTraceStore::GetProcessThreads() const
+{
+	QReadLocker Lock(&m_Lock);
+	return m_ProcessThreads;
+}
+
+int CTraceStore::GetProcessThreadsVersion() const
+{
+	QReadLocker Lock(&m_Lock);
+	return m_ProcessThreadsVersion;
+}
+
+quint64 CTraceStore::StoreMessage(const QString& Message)
+{
+	quint64 Length = qMin<quint64>(Message.length(), eArenaChars);
+	if (Length == 0)
+		return 0;
+
+	// a message never spans two arenas
+	if ((m_ArenaPos % eArenaChars) + Length > eArenaChars)
+		m_ArenaPos = (m_ArenaPos / eArenaChars + 1) * eArenaChars;
+
+	int Arena = m_ArenaPos / eArenaChars;
+	if (Arena >= m_Arenas.count()) {
+		SArena NewArena;
+		NewArena.pData = (QChar*)malloc(eArenaChars * sizeof(QChar));
+		if (!NewArena.pData)
+			return 0;
+		m_Arenas.append(NewArena);
+	}
+
+	memcpy(m_Arenas[Arena].pData + (m_ArenaPos % eArenaChars), Message.constData(), Length * sizeof(QChar));
+
+	quint64 Pos = (m_ArenaPos << 24) | Length;
+	m_ArenaPos += Length;
+	return Pos;
+}
+
+bool CTraceStore::ReadChunk(int Chunk, size_t Offset, void* pData, size_t Size) const
+{
+	const SChunkRef& Ref = m_Chunks[Chunk];
+	if (Ref.pData) {
+		memcpy(pData, (const char*)Ref.pData + Offset, Size);
+		return true;
+	}
+
+	QMutexLocker SpillLock(&m_SpillMutex);
+	return m_pSpillFile->seek(Ref.SpillPos + Offset) && m_pSpillFile->read((char*)pData, Size) == (qint64)Size;
+}
+
+quint64 CTraceStore::GetMemoryUsageImpl() const
+{
+	return (quint64)(m_Chunks.count() - m_FirstResidentChunk) * sizeof(SChunk) 
+		+ (quint64)(m_Arenas.count() - m_FirstResident) * eArenaChars * sizeof(QChar)
+		+ m_IndexBytes + m_OtherBytes;
+}
+
+qint64 CTraceStore::SpillData(const void* pData, qint64 Size)
+{
+	QMutexLocker Lock(&m_SpillMutex);
+
+	if (!m_pSpillFile) {
+		m_pSpillFile = new QTemporaryFile(QDir::tempPath() + "/SbieTrace_XXXXXX.tmp");
+		if (!m_pSpillFile->open()) {
+			delete m_pSpillFile;
+			m_pSpillFile = NULL;
+			return -1;
+		}
+	}
+
+	qint64 Pos = m_pSpillFile->size();
+	if (!m_pSpillFile->seek(Pos) || m_pSpillFile->write((const char*)pData, Size) != Size)
+		return -1;
+	return Pos;
+}
+
+void CTraceStore::EnforceMemoryLimit()
+{
+	if (m_MemoryLimit == 0)
+		return;
+
+	//
+	// the message arenas go first as they are the largest and least often read, then the 
+	// column chunks, the arena and chunk being filled always stay in memory, if that is 
+	// still not enough the secondary indexes are dropped
+	//
+
+	while (GetMemoryUsageImpl() > m_MemoryLimit)
+	{
+		if (m_FirstResident < m_Arenas.count() - 1)
+		{
+			SArena& Arena = m_Arenas[m_FirstResident];
+			qint64 Pos = SpillData(Arena.pData, eArenaChars * sizeof(QChar));
+			if (Pos == -1) {
+				m_MemoryLimit = 0; // can't spill, keep everything in memory
+				return;
+			}
+			Arena.SpillPos = Pos;
+			free(Arena.pData);
+			Arena.pData = NULL;
+			m_FirstResident++;
+		}
+		else if (m_FirstResidentChunk < m_Chunks.count() - 1)
+		{
+			SChunkRef& Chunk = m_Chunks[m_FirstResidentChunk];
+			qint64 Pos = SpillData(Chunk.pData, sizeof(SChunk));
+			if (Pos == -1) {
+				m_MemoryLimit = 0;
+				return;
+			}
+			Chunk.SpillPos = Pos;
+			free(Chunk.pData);
+			Chunk.pData = NULL;
+			m_FirstResidentChunk++;
+		}
+		else if (m_bIndexed)
+			DropIndexes();
+		else
+			break; // only the strings, stacks and the current chunk and arena are left
+	}
+}
+
+void CTraceStore::DropIndexes()
+{
+	qDebug() << "Trace log indexes exceed the memory limit, dropping them";
+
+	m_bIndexed = false;
+	m_TypeBits.clear();
+	for (int i = 0; i < eStatusCount; i++)
+		m_StatusBits[i].clear();
+	m_ProcessRows.clear();
+	m_ThreadRows.clear();
+	for (int i = 0; i < m_BoxRows.count(); i++)
+		m_BoxRows[i].clear();
+	m_Trigrams.clear();
+	m_IndexBytes = 0;
+}
+
+void CTraceStore::SetMemoryLimit(quint64 MemoryLimit)
+{
+	QWriteLocker Lock(&m_Lock);
+	m_MemoryLimit = MemoryLimit;
+	EnforceMemoryLimit();
+}
+
+quint64 CTraceStore::GetMemoryUsage() const
+{
+	QReadLocker Lock(&m_Lock);
+	return GetMemoryUsageImpl();
+}
+
+int CTraceStore::Count() const
+{
+	QReadLocker Lock(&m_Lock);
+	return m_Count;
+}
+
+int CTraceStore::FindRow(quint64 UID) const
+{
+	if (UID < m_BaseUID || UID - m_BaseUID >= (quint64)Count())
+		return -1;
+	return (int)(UID - m_BaseUID);
+}
+
+#define TRACE_STORE_GET(Column, Default) \
+	QReadLocker Lock(&m_Lock); \
+	if (Row < 0 || Row >= m_Count) \
+		return Default; \
+	std::remove_reference<decltype(SChunk::Column[0])>::type Value; \
+	if (!ReadChunk(Row / eChunkRows, offsetof(SChunk, Column) + (Row % eChunkRows) * sizeof(Value), &Value, sizeof(Value))) \
+		return Default;
+
+quint64 CTraceStore::GetTimeStamp(int Row) const		{ TRACE_STORE_GET(TimeStamp, 0) return Value; }
+quint32 CTraceStore::GetProcessId(int Row) const		{ TRACE_STORE_GET(ProcessId, 0) return Value; }
+quint32 CTraceStore::GetThreadId(int Row) const			{ TRACE_STORE_GET(ThreadId, 0) return Value; }
+quint32 CTraceStore::GetTypeFlags(int Row) const		{ TRACE_STORE_GET(Type, 0) return Value; }
+
+QString CTraceStore::GetName(int Row) const				{ TRACE_STORE_GET(Name, QString()) return m_Strings[Value]; }
+QString CTraceStore::GetSubType(int Row) const			{ TRACE_STORE_GET(SubType, QString()) return m_Strings[Value]; }
+QString CTraceStore::GetProcessName(int Row) const		{ TRACE_STORE_GET(ProcessName, QString()) return m_Strings[Value]; }
+void* CTraceStore::GetBoxPtr(int Row) const				{ TRACE_STORE_GET(Box, NULL) return m_Boxes[Value]; }
+
+#undef TRACE_STORE_GET
+
+QString CTraceStore::GetMessage(int Row) const
+{
+	QReadLocker Lock(&m_Lock);
+	return GetMessageImpl(Row);
+}
+
+QString CTraceStore::GetMessageImpl(int Row) const
+{
+	if (Row < 0 || Row >= m_Count)
+		return QString();
+
+	quint64 Pos;
+	if (!ReadChunk(Row / eChunkRows, offsetof(SChunk, Message) + (Row % eChunkRows) * sizeof(quint64), &Pos, sizeof(quint64)))
+		return QString();
+	int Length = Pos & 0xFFFFFF;
+	if (Length == 0)
+		return QString();
+	Pos >>= 24;
+
+	const SArena& Arena = m_Arenas[Pos / eArenaChars];
+	if (Arena.pData)
+		return QString(Arena.pData + (Pos % eArenaChars), Length);
+
+	QMutexLocker SpillLock(&m_SpillMutex);
+	QString Message(Length, Qt::Uninitialized);
+	if (!m_pSpillFile->seek(Arena.SpillPos + (Pos % eArenaChars) * sizeof(QChar)) 
+	  || m_pSpillFile->read((char*)Message.data(), Length * sizeof(QChar)) != Length * sizeof(QChar))
+		return QString();
+	return Message;
+}
+
+QVector<quint64> CTraceStore::GetStack(int Row) const
+{
+	QReadLocker Lock(&m_Lock);
+	return m_Stacks.value(Row);
+}
+
+CTraceEntryPtr CTraceStore::GetEntry(int Row) const
+{
+	if (Row < 0 || Row >= Count())
+		return CTraceEntryPtr();
+
+	// the stored values are already post processed, so don't run them through the regular constructor again
+	CTraceEntry* pEntry = new CTraceEntry();
+	pEntry->m_TimeStamp = GetTimeStamp(Row);
+	pEntry->m_ProcessId = GetProcessId(Row);
+	pEntry->m_ThreadId = GetThreadId(Row);
+	pEntry->m_Type.Flags = GetTypeFlags(Row);
+	pEntry->m_Name = GetName(Row);
+	pEntry->m_Message = GetMessage(Row);
+	pEntry->m_SubType = GetSubType(Row);
+	pEntry->m_ProcessName = GetProcessName(Row);
+	pEntry->m_Stack = GetStack(Row);
+	pEntry->m_BoxPtr = GetBoxPtr(Row);
+	pEntry->m_uid = GetUID(Row);
+	return CTraceEntryPtr(pEntry);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // 
 //
@@ -18,6 +18,10 @@
 #pragma once
 
 #include <QThread>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QBitArray>
 
 #include "qsbieapi_global.h"
 
@@ -37,9 +41,13 @@ public:
 	virtual quint64		GetTimeStamp() const { return m_TimeStamp; }
 
 	virtual quint8		GetType() const { return m_Type.Type; }
+	virtual quint32		GetTypeFlags() const { return m_Type.Flags; }
+	virtual QString		GetSubType() const { return m_SubType; }
 	static QList<quint32>AllTypes();
 	static QString		GetTypeStr(quint32 Type);
+	static QString		GetTypeStr(quint32 Flags, const QString& SubType);
 	virtual QString		GetTypeStr() const;
+	static QString		GetStautsStr(quint32 Flags);
 	virtual QString		GetStautsStr() const;
 
 	virtual void		SetProcessName(const QString& name) { m_ProcessName = name; }
@@ -62,13 +70,24 @@ public:
 	}
 #endif
 
-	virtual bool		IsOpen() const;
-	virtual bool		IsClosed() const;
-	virtual bool		IsTrace() const;
+	static bool			IsOpen(quint32 Flags);
+	static bool			IsClosed(quint32 Flags);
+	static bool			IsTrace(quint32 Flags);
+	virtual bool		IsOpen() const { return IsOpen(m_Type.Flags); }
+	virtual bool		IsClosed() const { return IsClosed(m_Type.Flags); }
+	virtual bool		IsTrace() const { return IsTrace(m_Type.Flags); }
 
 	quint64				GetUID() const { return m_uid; }
 
 protected:
+	friend class CTraceStore;
+
+	CTraceEntry() {
+#ifdef USE_MERGE_TRACE
+		m_Counter = 1;
+#endif
+	}
+
 	QString m_Name;
 	QString m_Message;
 	QString m_SubType;
@@ -109,3 +128,159 @@ protected:
 };
 
 typedef QSharedDataPointer<CTraceEntry> CTraceEntryPtr;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStore
+//
+// Append only, column wise storage of the trace log, the entries are not kept 
+// as objects, the fixed size values are stored in per chunk columns, names,
+// sub types and process names are interned, and messages are copied into
+// large character arenas.  Above the memory limit the message arenas and then
+// the column chunks are spilled to a temporary file and read back on demand,
+// if that is not enough the secondary indexes are dropped and their getters
+// fall back to scanning the columns.
+//
+// Rows are only ever appended, the store is replaced as a whole on clear,
+// so readers on other threads can keep using the old instance.
+//
+
+class QTemporaryFile;
+
+class QSBIEAPI_EXPORT CTraceStore
+{
+public:
+	CTraceStore(quint64 MemoryLimit = 0);
+	~CTraceStore();
+
+	void				Append(const CTraceEntryPtr& pEntry);
+
+	int					Count() const;
+	quint64				GetUID(int Row) const		{ return m_BaseUID + Row; }
+	int					FindRow(quint64 UID) const;
+
+	quint64				GetTimeStamp(int Row) const;
+	quint32				GetProcessId(int Row) const;
+	quint32				GetThreadId(int Row) const;
+	quint32				GetTypeFlags(int Row) const;
+	quint8				GetType(int Row) const		{ return GetTypeFlags(Row) & 0xFF; }
+	QString				GetName(int Row) const;
+	QString				GetMessage(int Row) const;
+	QString				GetSubType(int Row) const;
+	QString				GetProcessName(int Row) const;
+	void*				GetBoxPtr(int Row) const;
+	QVector<quint64>	GetStack(int Row) const;
+
+	QString				GetTypeStr(int Row) const	{ return CTraceEntry::GetTypeStr(GetTypeFlags(Row), GetSubType(Row)); }
+	QString				GetStautsStr(int Row) const	{ return CTraceEntry::GetStautsStr(GetTypeFlags(Row)); }
+	bool				IsOpen(int Row) const		{ return CTraceEntry::IsOpen(GetTypeFlags(Row)); }
+	bool				IsClosed(int Row) const		{ return CTraceEntry::IsClosed(GetTypeFlags(Row)); }
+	bool				IsTrace(int Row) const		{ return CTraceEntry::IsTrace(GetTypeFlags(Row)); }
+
+	// materializes a row as a stand alone entry
+	CTraceEntryPtr		GetEntry(int Row) const;
+
+	// secondary indexes, updated on append, bitsets hold one bit per row, row lists are ascending,
+	// once dropped to hold the memory limit the same results are computed from the columns
+	enum EStatus
+	{
+		eStatusOpen = 0,
+		eStatusClosed,
+		eStatusTrace,
+		eStatusOther,
+		eStatusCount
+	};
+	static EStatus		GetStatus(quint32 Flags);
+
+	QVector<quint64>	GetTypeBits(quint8 Type) const;
+	QVector<quint64>	GetStatusBits(EStatus Status) const;
+	QVector<int>		GetProcessRows(quint32 ProcessId) const;
+	QVector<int>		GetThreadRows(quint32 ThreadId) const;
+	QVector<int>		GetBoxRows(void* pBox) const;
+	QHash<quint32, QSet<quint32>> GetProcessThreads() const;
+	int					GetProcessThreadsVersion() const;
+
+	// trigram index over the interned strings, returns one bit per string id containing Text
+	QBitArray			FindStrings(const QString& Text) const;
+	// tests name and process name against the FindStrings result and the message against Text
+	bool				MatchRow(int Row, const QBitArray& Strings, const QString& Text) const;
+
+	void				SetMemoryLimit(quint64 MemoryLimit);
+	quint64				GetMemoryUsage() const;
+
+protected:
+	enum 
+	{
+		eChunkRows = 0x4000,
+		eArenaChars = 0x100000,
+	};
+
+	struct SChunk
+	{
+		quint64			TimeStamp[eChunkRows];
+		quint64			Message[eChunkRows];	// arena position << 24 | length
+		quint32			ProcessId[eChunkRows];
+		quint32			ThreadId[eChunkRows];
+		quint32			Type[eChunkRows];
+		quint32			Name[eChunkRows];		// interned
+		quint32			SubType[eChunkRows];	// interned
+		quint32			ProcessName[eChunkRows];// interned
+		quint16			Box[eChunkRows];
+	};
+
+	struct SChunkRef
+	{
+		SChunk*			pData = NULL;
+		qint64			SpillPos = -1;
+	};
+
+	struct SArena
+	{
+		QChar*			pData = NULL;
+		qint64			SpillPos = -1;
+	};
+
+	quint32				Intern(const QString& String);
+	void				IndexString(quint32 Id, const QString& String);
+	QString				GetMessageImpl(int Row) const;
+	quint64				StoreMessage(const QString& Message);
+	bool				ReadChunk(int Chunk, size_t Offset, void* pData, size_t Size) const;
+	template<typename T, typename F>
+	void				ScanColumn(size_t Offset, F Fn) const;
+	quint64				GetMemoryUsageImpl() const;
+	qint64				SpillData(const void* pData, qint64 Size);
+	void				EnforceMemoryLimit();
+	void				DropIndexes();
+
+	mutable QReadWriteLock	m_Lock;
+	quint64				m_BaseUID;
+	int					m_Count;
+	QVector<SChunkRef>	m_Chunks;
+	int					m_FirstResidentChunk;
+
+	QHash<QString, quint32>	m_StringMap;
+	QVector<QString>	m_Strings;
+	QVector<void*>		m_Boxes;
+	QHash<int, QVector<quint64>> m_Stacks;
+
+	QHash<quint8, QVector<quint64>> m_TypeBits;
+	QVector<quint64>	m_StatusBits[eStatusCount];
+	QHash<quint32, QVector<int>> m_ProcessRows;
+	QHash<quint32, QVector<int>> m_ThreadRows;
+	QVector<QVector<int>> m_BoxRows;
+	QHash<quint32, QSet<quint32>> m_ProcessThreads;
+	int					m_ProcessThreadsVersion;
+	QHash<quint64, QVector<quint32>> m_Trigrams;
+	bool				m_bIndexed;
+	quint64				m_IndexBytes;	// estimated size of the droppable indexes above
+	quint64				m_OtherBytes;	// estimated size of the strings and stacks
+
+	QVector<SArena>		m_Arenas;
+	quint64				m_ArenaPos;
+	int					m_FirstResident;
+	quint64				m_MemoryLimit;
+	mutable QMutex		m_SpillMutex;
+	QTemporaryFile*		m_pSpillFile;
+};
+
+typedef QSharedPointer<CTraceStore> CTraceStorePtr;
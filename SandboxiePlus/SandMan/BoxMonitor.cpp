@@ -1,13 +1,19 @@
 #include "stdafx.h"
 #include "BoxMonitor.h"
 #include "../MiscHelpers/Common/Common.h"
+#include "../MiscHelpers/Common/Settings.h"
+#include <QtConcurrent>
+#include <QCryptographicHash>
 
-CBoxMonitor::CBoxMonitor() 
-{ 
+#define BOX_INDEX_MAGIC		0x58495342 // BSIX
+#define BOX_INDEX_VERSION	1
+
+CBoxMonitor::CBoxMonitor()
+{
 	m_bTerminate = false;
 }
 
-CBoxMonitor::~CBoxMonitor() 
+CBoxMonitor::~CBoxMonitor()
 {
 	Stop();
 }
@@ -19,34 +25,291 @@ void CBoxMonitor::Notify(const std::wstring& strDirectory)
 	m_Mutex.unlock();
 }
 
-quint64 CBoxMonitor::CounDirSize(const QString& Directory, SBox* Box) 
+void CBoxMonitor::NotifyChange(const std::wstring& strDirectory, DWORD dwAction, const std::wstring& strFileName)
+{
+	QString Path = QString::fromStdWString(strFileName).toLower();
+	int Pos = Path.lastIndexOf("\\");
+	QString Parent = Pos == -1 ? QString("") : Path.left(Pos);
+
+	QMutexLocker Lock(&m_Mutex);
+	SBox& Box = m_Boxes[QString::fromStdWString(strDirectory)];
+
+	// the aggregate of the parent directory needs to be updated in any case
+	Box.DirtyDirs.insert(Parent);
+
+	// the entry itself may be a directory which came or went with all its content
+	if (dwAction != FILE_ACTION_MODIFIED)
+		Box.DirtyTrees.insert(Path);
+}
+
+void CBoxMonitor::NotifyOverflow(const std::wstring& strDirectory)
+{
+	m_Mutex.lock();
+	m_Boxes[QString::fromStdWString(strDirectory)].Overflow = true;
+	m_Mutex.unlock();
+}
+
+bool CBoxMonitor::ScanDir(const QString& Path, quint64& Size, QStringList* pSubDirs)
+{
+	//
+	// list the files directly in the given directory, the sizes come with the directory
+	// listing so we don't need to open any files, reparse points are not followed
+	//
+
+	WIN32_FIND_DATAW FindData;
+	HANDLE hFind = FindFirstFileExW((Path + "\\*").toStdWString().c_str(), FindExInfoBasic, &FindData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return false;
+
+	Size = 0;
+	do {
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if (wcscmp(FindData.cFileName, L".") == 0 || wcscmp(FindData.cFileName, L"..") == 0)
+				continue;
+			if (pSubDirs && (FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+				pSubDirs->append(QString::fromWCharArray(FindData.cFileName).toLower());
+		}
+		else
+			Size += ((quint64)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow;
+	} while (FindNextFileW(hFind, &FindData));
+
+	FindClose(hFind);
+	return true;
+}
+
+void CBoxMonitor::ScanTree(const QString& Root, const QString& Dir, QHash<QString, quint64>& DirSizes, SBox* Box)
+{
+	QStringList Dirs;
+	Dirs.append(Dir);
+	while (!Dirs.isEmpty())
+	{
+		if (m_bTerminate || IsRemoved(Box))
+			break;
+
+		QString CurDir = Dirs.takeLast();
+		QStringList SubDirs;
+		quint64 Size;
+		if (!ScanDir(CurDir.isEmpty() ? Root : Root + "\\" + CurDir, Size, &SubDirs))
+			continue;
+
+		DirSizes.insert(CurDir, Size);
+		foreach(const QString& SubDir, SubDirs)
+			Dirs.append(CurDir.isEmpty() ? SubDir : CurDir + "\\" + SubDir);
+	}
+}
+
+bool CBoxMonitor::IsRemoved(SBox* Box)
 {
+	QMutexLocker Lock(&m_Mutex);
+	return Box->Removed;
+}
+
+void CBoxMonitor::ScanIndex(const QString& Root, SBox* Box)
+{
+	//
+	// walk the first levels breadth first until we have enough folders
+	// to keep all pool threads busy, and then scan these subtrees in parallel
+	//
+
+	QHash<QString, quint64> DirSizes;
+
+	int MinCount = 4 * QThread::idealThreadCount();
+	QStringList Dirs;
+	Dirs.append("");
+	for (int Level = 0; Level < 3 && !Dirs.isEmpty() && Dirs.count() < MinCount; Level++)
+	{
+		QStringList NextDirs;
+		foreach(const QString& Dir, Dirs)
+		{
+			QStringList SubDirs;
+			quint64 Size;
+			if (!ScanDir(Dir.isEmpty() ? Root : Root + "\\" + Dir, Size, &SubDirs))
+				continue;
+
+			DirSizes.insert(Dir, Size);
+			foreach(const QString& SubDir, SubDirs)
+				NextDirs.append(Dir.isEmpty() ? SubDir : Dir + "\\" + SubDir);
+		}
+		Dirs = NextDirs;
+	}
+
+	std::function<QHash<QString, quint64>(const QString&)> ScanSubTree = [this, Root, Box](const QString& Dir) {
+		// a verification sweep should not compete with the user for the disk
+		SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+		QHash<QString, quint64> DirSizes;
+		ScanTree(Root, Dir, DirSizes, Box);
+		SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+		return DirSizes;
+	};
+
+	QList<QHash<QString, quint64>> Results = QtConcurrent::blockingMapped<QList<QHash<QString, quint64>>>(Dirs, ScanSubTree);
+	foreach(const auto& Result, Results)
+		DirSizes.insert(Result);
+
+	if (m_bTerminate || IsRemoved(Box))
+		return;
+
 	quint64 TotalSize = 0;
-	if (m_bTerminate || Box->pBox.isNull())
-		return TotalSize;
+	foreach(quint64 Size, DirSizes)
+		TotalSize += Size;
+
+	Box->DirSizes = DirSizes;
+	Box->TotalSize = TotalSize;
+	Box->IndexValid = true;
+	Box->IndexDirty = true;
+}
+
+QString CBoxMonitor::NormalizeKey(const QString& Root, const QString& Key)
+{
+	//
+	// notifications may report short names, the index uses the long ones
+	//
+
+	if (!Key.contains("~"))
+		return Key;
+
+	std::wstring Path = (Root + "\\" + Key).toStdWString();
+	wchar_t Buffer[MAX_PATH];
+	DWORD Length = GetLongPathNameW(Path.c_str(), Buffer, MAX_PATH);
+	if (Length == 0 || Length >= MAX_PATH)
+		return Key;
+
+	QString LongPath = QString::fromWCharArray(Buffer, Length);
+	if (!LongPath.startsWith(Root + "\\", Qt::CaseInsensitive))
+		return Key;
+	return LongPath.mid(Root.length() + 1).toLower();
+}
 
-	QDir Dir(Directory);
-	foreach(const QFileInfo & Info, Dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot))
+bool CBoxMonitor::UpdateIndex(const QString& Root, SBox* Box, const QSet<QString>& DirtyDirs, const QSet<QString>& DirtyTrees)
+{
+	quint64 OldSize = Box->TotalSize;
+
+	//
+	// first handle entries which came or went, if they were a known directory
+	// we drop the old content, if they are a directory now we index the new content
+	//
+
+	foreach(const QString& Entry, DirtyTrees)
 	{
-		if (Info.isDir())
-			TotalSize += CounDirSize(Info.filePath(), Box);
-		else if (Info.isShortcut())
+		QString Dir = NormalizeKey(Root, Entry);
+
+		if (Box->DirSizes.contains(Dir))
 		{
-			QFile File(Info.filePath());
-			if (File.open(QFile::ReadOnly))
-				TotalSize += File.size();
-			File.close();
+			QString Prefix = Dir + "\\";
+			for (auto I = Box->DirSizes.begin(); I != Box->DirSizes.end();) {
+				if (I.key() == Dir || I.key().startsWith(Prefix)) {
+					Box->TotalSize -= I.value();
+					I = Box->DirSizes.erase(I);
+				} else
+					++I;
+			}
+		}
+
+		DWORD Attributes = GetFileAttributesW((Root + "\\" + Dir).toStdWString().c_str());
+		if (Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY) && (Attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+		{
+			QHash<QString, quint64> DirSizes;
+			ScanTree(Root, Dir, DirSizes, Box);
+			for (auto I = DirSizes.begin(); I != DirSizes.end(); ++I) {
+				Box->TotalSize += I.value();
+				Box->DirSizes.insert(I.key(), I.value());
+			}
+		}
+	}
+
+	//
+	// then refresh the aggregates of the directories with changed files
+	//
+
+	foreach(const QString& Entry, DirtyDirs)
+	{
+		QString Dir = NormalizeKey(Root, Entry);
+
+		quint64 Size;
+		bool bExists = ScanDir(Dir.isEmpty() ? Root : Root + "\\" + Dir, Size, NULL);
+
+		auto I = Box->DirSizes.find(Dir);
+		if (I != Box->DirSizes.end()) {
+			Box->TotalSize -= I.value();
+			if (bExists) {
+				Box->TotalSize += Size;
+				I.value() = Size;
+			} else
+				Box->DirSizes.erase(I);
+		}
+		else if (bExists) {
+			Box->TotalSize += Size;
+			Box->DirSizes.insert(Dir, Size);
 		}
-		else
-			TotalSize += QFile(Info.filePath()).size();
 	}
 
-	return TotalSize;
+	Box->IndexDirty = true;
+	return Box->TotalSize != OldSize;
+}
+
+QString CBoxMonitor::GetIndexPath(const QString& Root) const
+{
+	QByteArray Hash = QCryptographicHash::hash(Root.toLower().toUtf8(), QCryptographicHash::Md5).toHex();
+	return m_IndexDir + "/" + QString::fromLatin1(Hash) + ".dat";
+}
+
+bool CBoxMonitor::LoadIndex(const QString& Root, SBox* Box)
+{
+	if (m_IndexDir.isEmpty())
+		return false;
+
+	QFile File(GetIndexPath(Root));
+	if (!File.open(QFile::ReadOnly))
+		return false;
+
+	QDataStream Stream(&File);
+	quint32 Magic, Version;
+	QString IndexRoot;
+	Stream >> Magic >> Version;
+	if (Magic != BOX_INDEX_MAGIC || Version != BOX_INDEX_VERSION)
+		return false;
+	Stream >> IndexRoot;
+	if (IndexRoot.compare(Root, Qt::CaseInsensitive) != 0)
+		return false;
+
+	QHash<QString, quint64> DirSizes;
+	Stream >> DirSizes;
+	if (Stream.status() != QDataStream::Ok)
+		return false;
+
+	quint64 TotalSize = 0;
+	foreach(quint64 Size, DirSizes)
+		TotalSize += Size;
+
+	Box->DirSizes = DirSizes;
+	Box->TotalSize = TotalSize;
+	Box->IndexValid = true;
+	Box->IndexDirty = false;
+	return true;
+}
+
+void CBoxMonitor::SaveIndex(const QString& Root, SBox* Box)
+{
+	Box->IndexDirty = false;
+	Box->LastSave = GetCurTick();
+
+	if (m_IndexDir.isEmpty() || !QDir().mkpath(m_IndexDir))
+		return;
+
+	QFile File(GetIndexPath(Root));
+	if (!File.open(QFile::WriteOnly | QFile::Truncate))
+		return;
+
+	QDataStream Stream(&File);
+	Stream << (quint32)BOX_INDEX_MAGIC << (quint32)BOX_INDEX_VERSION;
+	Stream << Root;
+	Stream << Box->DirSizes;
 }
 
 void CBoxMonitor::run()
 {
-	while (!m_bTerminate) 
+	while (!m_bTerminate)
 	{
 		Sleep(100);
 
@@ -60,40 +323,116 @@ void CBoxMonitor::run()
 
 			m_Mutex.lock();
 			SBox* Box = &m_Boxes[Key];
+			bool bDropIndex = Box->DropIndex;
+			Box->DropIndex = false;
 			m_Mutex.unlock();
 
+			if (bDropIndex) {
+				// the box is about to be modified or deleted, the index is no longer valid
+				QFile::remove(GetIndexPath(Key));
+				Box->DirSizes.clear();
+				Box->TotalSize = 0;
+				Box->IndexValid = false;
+				Box->IndexLoaded = true;
+				Box->IndexDirty = false;
+				Box->NeedsVerify = false;
+
+				m_Mutex.lock();
+				bool bRemoved = Box->Removed;
+				if (bRemoved)
+					m_Boxes.remove(Key);
+				m_Mutex.unlock();
+				if (bRemoved)
+					continue;
+			}
+
 			quint64 MinScanInterval = Box->ScanDuration * 100;
 			if (MinScanInterval < 30 * 1000)
 				MinScanInterval = 30 * 1000;
 			if (MinScanInterval > 30 * 60 * 1000)
 				MinScanInterval = 30 * 60 * 1000;
 
-			if ((Box->Changed && (!Box->IsWatched || Box->LastScan == 0 || (CurTick - Box->LastScan) > MinScanInterval)) || Box->ForceUpdate) {
+			quint64 VerifyInterval = MinScanInterval;
+			if (VerifyInterval < 30 * 60 * 1000)
+				VerifyInterval = 30 * 60 * 1000;
+
+			//
+			// a persisted index lets us skip the initial scan, but as the box may have been used
+			// while we were not watching, it gets verified in the background shortly after
+			//
+
+			if (!Box->IndexValid && !Box->IndexLoaded && Box->IsWatched && !Box->ForceUpdate) {
+				Box->IndexLoaded = true;
+				if (LoadIndex(Key, Box)) {
+					Box->NeedsVerify = true;
+					Box->VerifyAt = CurTick + 60 * 1000;
+					QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection, Q_ARG(QString, Key));
+				}
+			}
+
+			bool bFullScan = Box->ForceUpdate
+				|| (Box->Changed && !Box->IndexValid && (!Box->IsWatched || Box->LastScan == 0 || (CurTick - Box->LastScan) > MinScanInterval))
+				|| (Box->Overflow && (CurTick - Box->LastScan) > MinScanInterval)
+				|| (Box->IndexValid && Box->NeedsVerify && CurTick >= Box->VerifyAt);
+
+			if (bFullScan) {
 
 				qDebug() << "Rescanning:" << Key << "(" + QDateTime::currentDateTime().toString() + ")";
 
+				// changes which arrive during the scan are applied afterwards
+				m_Mutex.lock();
+				Box->DirtyDirs.clear();
+				Box->DirtyTrees.clear();
+				Box->Changed = false;
+				Box->Overflow = false;
+				Box->ForceUpdate = false;
+				m_Mutex.unlock();
+
 				quint64 ScanStart = GetCurTick();
 
 				Box->ScanDuration = -1;
 
-				Box->TotalSize = CounDirSize(Key, Box);
+				ScanIndex(Key, Box);
 
 				Box->ScanDuration = GetCurTick() - ScanStart;
 				Box->LastScan = GetCurTick();
+				Box->LastUpdate = Box->LastScan;
+				Box->NeedsVerify = false;
+
+				SaveIndex(Key, Box);
 
 				QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection,
 					//Q_RETURN_ARG(int, retVal),
 					Q_ARG(QString, Key)
 				);
+			}
+			else if (Box->Changed && Box->IndexValid && (CurTick - Box->LastUpdate) > 1000) {
+
+				QSet<QString> DirtyDirs;
+				QSet<QString> DirtyTrees;
 
+				m_Mutex.lock();
+				DirtyDirs.swap(Box->DirtyDirs);
+				DirtyTrees.swap(Box->DirtyTrees);
 				Box->Changed = false;
-				Box->ForceUpdate = false;
+				m_Mutex.unlock();
+
+				Box->LastUpdate = CurTick;
+
+				if (!Box->NeedsVerify) {
+					Box->NeedsVerify = true;
+					Box->VerifyAt = CurTick + VerifyInterval;
+				}
+
+				if (UpdateIndex(Key, Box, DirtyDirs, DirtyTrees)) {
+					QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection,
+						Q_ARG(QString, Key)
+					);
+				}
 			}
 
-			m_Mutex.lock();
-			if (Box->pBox.isNull())
-				m_Boxes.remove(Key);
-			m_Mutex.unlock();
+			if (Box->IndexDirty && (!Box->IsWatched || (CurTick - Box->LastSave) > 5 * 60 * 1000))
+				SaveIndex(Key, Box);
 		}
 	}
 }
@@ -103,32 +442,44 @@ void CBoxMonitor::UpdateBox(const QString& Path)
 	// Note: this private function runs in the main thread
 
 	m_Mutex.lock();
-	SBox Box = m_Boxes.value(Path);
+	auto I = m_Boxes.find(Path);
+	if (I == m_Boxes.end()) {
+		m_Mutex.unlock();
+		return;
+	}
+	QPointer<CSandBoxPlus> pBox = I->pBox;
+	quint64 TotalSize = I->TotalSize;
 	m_Mutex.unlock();
 
-	if (Box.pBox)
-		Box.pBox->SetSize(Box.TotalSize);
+	if (pBox)
+		pBox->SetSize(TotalSize);
 }
 
 void CBoxMonitor::WatchBox(CSandBoxPlus* pBox)
 {
 	QMutexLocker Lock(&m_Mutex);
+	if (m_IndexDir.isEmpty())
+		m_IndexDir = theConf->GetConfigDir() + "/BoxIndex";
 	if (!isRunning()) start();
 
 	SBox& Box = m_Boxes[pBox->GetFileRoot()];
 	Box.pBox = pBox;
+	Box.Removed = false;
 
 	Box.IsWatched = true;
-	AddDirectory(pBox->GetFileRoot().toStdWString().c_str(), true, FILE_NOTIFY_CHANGE_SIZE);
+	AddDirectory(pBox->GetFileRoot().toStdWString().c_str(), true, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE);
 }
 
 void CBoxMonitor::ScanBox(CSandBoxPlus* pBox)
 {
 	QMutexLocker Lock(&m_Mutex);
+	if (m_IndexDir.isEmpty())
+		m_IndexDir = theConf->GetConfigDir() + "/BoxIndex";
 	if (!isRunning()) start();
 
 	SBox& Box = m_Boxes[pBox->GetFileRoot()];
 	Box.pBox = pBox;
+	Box.Removed = false;
 
 	Box.ForceUpdate = true;
 }
@@ -158,19 +509,22 @@ void CBoxMonitor::RemoveBox(CSandBoxPlus* pBox)
 
 	if(I->IsWatched)
 		DetachDirectory(pBox->GetFileRoot().toStdWString().c_str());
+	I->IsWatched = false;
 	I->pBox.clear();
+	I->Removed = true;
+	I->DropIndex = true;
 }
 
 bool CBoxMonitor::IsScanPending(const CSandBoxPlus* pBox)
 {
 	QMutexLocker Lock(&m_Mutex);
-	if (!isRunning()) false;
+	if (!isRunning()) return false;
 
 	auto I = m_Boxes.find(pBox->GetFileRoot());
 	if (I == m_Boxes.end())
 		return false;
 
-	return (I->Changed && !I->IsWatched) || I->ForceUpdate || I->ScanDuration == -1;
+	return (I->Changed && !I->IsWatched && !I->IndexValid) || I->ForceUpdate || I->ScanDuration == -1;
 }
 
 void CBoxMonitor::Stop()
@@ -187,9 +541,14 @@ void CBoxMonitor::Stop()
 	QMutexLocker Lock(&m_Mutex);
 
 	while (!m_Boxes.isEmpty()) {
-		SBox Box = m_Boxes.take(m_Boxes.firstKey());
-		if(Box.IsWatched && Box.pBox)
-			DetachDirectory(Box.pBox->GetFileRoot().toStdWString().c_str());
+		QString Key = m_Boxes.firstKey();
+		SBox Box = m_Boxes.take(Key);
+		if(Box.IsWatched)
+			DetachDirectory(Key.toStdWString().c_str());
+		if (Box.DropIndex)
+			QFile::remove(GetIndexPath(Key));
+		else if (Box.IndexDirty && Box.IndexValid)
+			SaveIndex(Key, &Box);
 	}
 
 	m_bTerminate = false;
@@ -11,6 +11,8 @@ public:
 	~CBoxMonitor();
 
 	virtual void Notify(const std::wstring& strDirectory);
+	virtual void NotifyChange(const std::wstring& strDirectory, DWORD dwAction, const std::wstring& strFileName);
+	virtual void NotifyOverflow(const std::wstring& strDirectory);
 
 	virtual void run();
 
@@ -37,9 +39,19 @@ protected:
 			LastScan = 0;
 			ScanDuration = 0;
 			TotalSize = 0;
+			IndexValid = false;
+			IndexLoaded = false;
+			IndexDirty = false;
+			Overflow = false;
+			NeedsVerify = false;
+			VerifyAt = 0;
+			LastUpdate = 0;
+			LastSave = 0;
+			Removed = false;
+			DropIndex = false;
 		}
 
-		QPointer<CSandBoxPlus> pBox;
+		QPointer<CSandBoxPlus> pBox; // only to be used in the main thread
 		bool ForceUpdate;
 		bool Changed;
 		bool IsWatched;
@@ -47,11 +59,41 @@ protected:
 		quint64 ScanDuration;
 
 		quint64 TotalSize;
+
+		// the size index, relative directory path -> size of the files directly inside,
+		// it is only accessed by the monitor thread and kept up to date from the change notifications
+		QHash<QString, quint64> DirSizes;
+		bool IndexValid;
+		bool IndexLoaded;
+		bool IndexDirty;
+		bool Overflow;
+		bool NeedsVerify;
+		quint64 VerifyAt;
+		quint64 LastUpdate;
+		quint64 LastSave;
+
+		// set by RemoveBox when the box is about to be modified or deleted, guarded by m_Mutex
+		bool Removed;
+		bool DropIndex;
+
+		// pending changes, guarded by m_Mutex
+		QSet<QString> DirtyDirs;	// parent directories of changed entries
+		QSet<QString> DirtyTrees;	// added, removed or renamed entries, which may be directories
 	};
 
-	quint64 CounDirSize(const QString& Dir, SBox* Box);
+	static bool ScanDir(const QString& Path, quint64& Size, QStringList* pSubDirs);
+	void ScanTree(const QString& Root, const QString& Dir, QHash<QString, quint64>& DirSizes, SBox* Box);
+	void ScanIndex(const QString& Root, SBox* Box);
+	bool UpdateIndex(const QString& Root, SBox* Box, const QSet<QString>& DirtyDirs, const QSet<QString>& DirtyTrees);
+	static QString NormalizeKey(const QString& Root, const QString& Key);
+	bool IsRemoved(SBox* Box);
+
+	QString GetIndexPath(const QString& Root) const;
+	bool LoadIndex(const QString& Root, SBox* Box);
+	void SaveIndex(const QString& Root, SBox* Box);
 
 	QMutex m_Mutex;
 	QMap<QString, SBox> m_Boxes;
+	QString m_IndexDir;
 	bool m_bTerminate;
 };
\ No newline at end of file
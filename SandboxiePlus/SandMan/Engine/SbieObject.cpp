@@ -159,10 +159,10 @@ QVariantList CSbieObject::ReadTrace(const QVariantMap& Options)
 
 	QVariantList List;
 
-	const QVector<CTraceEntryPtr> &ResourceLog = theAPI->GetTrace();
-	for (int i = Start; i < ResourceLog.count() && (!Count || Count > ResourceLog.count()); i++)
+	CTraceStorePtr pResourceLog = theAPI->GetTrace();
+	for (int i = Start; i < pResourceLog->Count() && (!Count || Count > pResourceLog->Count()); i++)
 	{
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
+		CTraceEntryPtr pEntry = pResourceLog->GetEntry(i);
 
 		if (pCurrentBox != NULL && pCurrentBox != pEntry->GetBoxPtr())
 			continue;
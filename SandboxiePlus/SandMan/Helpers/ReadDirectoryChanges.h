@@ -121,6 +121,17 @@ public:
 
 	virtual void Notify( const std::wstring& strDirectory ) {}
 
+	/// <summary>
+	/// Called for every entry of a notification, before Notify.
+	/// The file name is relative to the monitored directory.
+	/// </summary>
+	virtual void NotifyChange( const std::wstring& strDirectory, DWORD dwAction, const std::wstring& strFileName ) {}
+
+	/// <summary>
+	/// Called when the notification buffer overflowed and changes were lost.
+	/// </summary>
+	virtual void NotifyOverflow( const std::wstring& strDirectory ) {}
+
 	/// <summary>
 	/// Return a handle for the Win32 Wait... functions that will be
 	/// signaled when there is a queue entry.
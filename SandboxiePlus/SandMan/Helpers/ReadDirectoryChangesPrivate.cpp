@@ -124,9 +124,16 @@ VOID CALLBACK CReadChangesRequest::NotificationCompletion(
 		return;
 	}
 
-	// This might mean overflow? Not sure.
+	// A successful completion without data means the buffer overflowed,
+	// the read needs to be reissued and the caller must rescan.
 	if(!dwNumberOfBytesTransfered)
+	{
+		pBlock->BeginRead();
+
+		pBlock->m_pServer->m_pBase->NotifyOverflow(pBlock->GetDirectory());
+		pBlock->m_pServer->m_pBase->Notify(pBlock->GetDirectory());
 		return;
+	}
 
 	// Can't use sizeof(FILE_NOTIFY_INFORMATION) because
 	// the structure is padded to 16 bytes.
@@ -139,7 +146,7 @@ VOID CALLBACK CReadChangesRequest::NotificationCompletion(
 	// again once the completion routine is called.
 	pBlock->BeginRead();
 
-	//pBlock->ProcessNotification();
+	pBlock->ProcessNotification();
 
 	pBlock->m_pServer->m_pBase->Notify(pBlock->GetDirectory());
 }
@@ -153,11 +160,6 @@ void CReadChangesRequest::ProcessNotification()
 		FILE_NOTIFY_INFORMATION& fni = (FILE_NOTIFY_INFORMATION&)*pBase;
 
 		std::wstring wstrFilename(fni.FileName, fni.FileNameLength/sizeof(wchar_t));
-		// Handle a trailing backslash, such as for a root directory.
-		if (m_wstrDirectory.back() != L'\\')
-			wstrFilename = m_wstrDirectory + L"\\" + wstrFilename;
-		else
-			wstrFilename = m_wstrDirectory + wstrFilename;
 
 		// If it could be a short filename, expand it.
 		LPCWSTR wszFilename = PathFindFileNameW(wstrFilename.c_str());
@@ -165,14 +167,21 @@ void CReadChangesRequest::ProcessNotification()
 		// The maximum length of an 8.3 filename is twelve, including the dot.
 		if (len <= 12 && wcschr(wszFilename, L'~'))
 		{
+			std::wstring wstrFullname;
+			// Handle a trailing backslash, such as for a root directory.
+			if (m_wstrDirectory.back() != L'\\')
+				wstrFullname = m_wstrDirectory + L"\\" + wstrFilename;
+			else
+				wstrFullname = m_wstrDirectory + wstrFilename;
+
 			// Convert to the long filename form. Unfortunately, this
 			// does not work for deletions, so it's an imperfect fix.
 			wchar_t wbuf[MAX_PATH];
-			if (::GetLongPathNameW(wstrFilename.c_str(), wbuf, _countof(wbuf)) > 0)
-				wstrFilename = wbuf;
+			if (::GetLongPathNameW(wstrFullname.c_str(), wbuf, _countof(wbuf)) > 0 && _wcsnicmp(wbuf, wstrFullname.c_str(), wstrFullname.length() - len) == 0)
+				wstrFilename = wstrFilename.substr(0, wstrFilename.length() - len) + (wbuf + wstrFullname.length() - len);
 		}
 
-		//m_pServer->m_pBase->Push(fni.Action, wstrFilename);
+		m_pServer->m_pBase->NotifyChange(m_wstrDirectory, fni.Action, wstrFilename);
 
 		if (!fni.NextEntryOffset)
 			break;
@@ -27,15 +27,11 @@ public:
 	QString		GetTypeStr() const { return CTraceEntry::GetTypeStr(m_Type); }
 	int			GetCount() const { return m_Counter; }
 
-	void		Merge(const CTraceEntryPtr& pEntry) {
-#ifdef USE_MERGE_TRACE
-		m_Counter += pEntry->GetCount(); 
-#else
+	void		Merge(quint32 TypeFlags) {
 		m_Counter++;
-#endif
-		if (!m_bOpen && pEntry->IsOpen())
+		if (!m_bOpen && CTraceEntry::IsOpen(TypeFlags))
 			m_bOpen = true;
-		if (!m_bClosed && pEntry->IsClosed())
+		if (!m_bClosed && CTraceEntry::IsClosed(TypeFlags))
 			m_bClosed = true;
 	}
 
@@ -12,174 +12,208 @@ CTraceModel::CTraceModel(QObject* parent)
 	:QAbstractItemModelEx(parent)
 {
 	m_bTree = false;
-
-	m_Root = MkNode(0);
-
-	m_LastCount = 0;
 }
 
 CTraceModel::~CTraceModel()
 {
-	FreeNode(m_Root);
-	m_Root = NULL;
 }
 
-QList<QModelIndex> CTraceModel::Sync(const QVector<CTraceEntryPtr>& EntryList)
+QList<QModelIndex> CTraceModel::Sync(const CTraceStorePtr& pStore, const QVector<int>& RowList)
 {
 	QList<QModelIndex> NewBranches;
 
 	// Note: since this is a log and we ever always only add entries we save cpu time by always skipping the already know portion of the list
 
 	int i = 0;
-	if (EntryList.count() >= m_LastCount && m_LastCount > 0)
+	if (m_pStore == pStore && RowList.count() >= m_Rows.count() && !m_Rows.isEmpty())
 	{
-		i = m_LastCount - 1;
-		if (m_LastID == EntryList.at(i)->GetUID())
+		i = m_Rows.count() - 1;
+		if (m_LastID == pStore->GetUID(RowList.at(i)))
 			i++;
 		else
 			i = 0;
 	}
 
-	emit layoutAboutToBeChanged();
-
-	for (; i < EntryList.count(); i++)
+	if (i == 0 && (!m_Rows.isEmpty() || m_pStore != pStore))
 	{
-		const CTraceEntryPtr& pEntry = EntryList.at(i);
+		// the row list was not just extended, this is the only case that needs a full relayout
+		beginResetModel();
+		m_Rows.clear();
+		m_Groups.clear();
+		m_Processes.clear();
+		m_ProcessMap.clear();
+		m_ThreadMap.clear();
+		m_pStore = pStore;
+		AppendRows(RowList, 0, false, &NewBranches);
+		endResetModel();
+	}
+	else if (i < RowList.count())
+		AppendRows(RowList, i, true, &NewBranches);
 
-		quint64 ID = pEntry->GetUID();
+	if(!m_Rows.isEmpty())
+		m_LastID = pStore->GetUID(m_Rows.last());
+	else
+		m_LastID.clear();
 
-		STreeNode* pNode = MkNode(ID);
-		pNode->pEntry = pEntry;
-		if (m_bTree)
-		{
-			quint64 Path = PROCESS_MARK | pEntry->GetProcessId();
-			Path |= quint64(THREAD_MARK | pEntry->GetThreadId()) << 32;
+	return NewBranches;
+}
 
-			pNode->Parent = FindParentNode(m_Root, Path, 0, &NewBranches);
-		}
-		else
-			pNode->Parent = m_Root;
+void CTraceModel::AppendRows(const QVector<int>& RowList, int From, bool bNotify, QList<QModelIndex>* pNewBranches)
+{
+	int Count = RowList.count() - From;
+	if (Count <= 0)
+		return;
 
-		//pNode->Row = pNode->Parent->Children.size();
-		pNode->Parent->Children.append(pNode);
+	if (!m_bTree)
+	{
+		if (bNotify) beginInsertRows(QModelIndex(), m_Rows.count(), m_Rows.count() + Count - 1);
+		m_Rows.append(RowList.mid(From));
+		if (bNotify) endInsertRows();
+		return;
 	}
 
-	emit layoutChanged();
+	m_Rows.append(RowList.mid(From));
 
-	m_LastCount = EntryList.count();
-	if(m_LastCount)
-		m_LastID = EntryList.last()->GetUID();
+	// group the new rows by thread first so that each branch gets only one insert notification
+	QMap<int, QVector<int>> NewRows;
+	int LastGroup = -1;
+	QVector<int>* pLastRows = NULL;
+	for (int i = From; i < RowList.count(); i++)
+	{
+		int Row = RowList.at(i);
+		int Group = GetGroup(Row, bNotify, pNewBranches);
+		if (Group != LastGroup) {
+			LastGroup = Group;
+			pLastRows = &NewRows[Group];
+		}
+		pLastRows->append(Row);
+	}
 
-	return NewBranches;
+	for (auto I = NewRows.begin(); I != NewRows.end(); ++I)
+	{
+		QVector<int>& Rows = m_Groups[I.key()].Rows;
+		if (bNotify) beginInsertRows(GroupIndex(I.key()), Rows.count(), Rows.count() + I.value().count() - 1);
+		Rows.append(I.value());
+		if (bNotify) endInsertRows();
+	}
 }
 
-//__inline uint qHash(const CTraceModel::STracePath& var)
-//{
-//    unsigned int hash = 5381;
-//    for (quint32* ptr = var.path; ptr < var.path + var.count; ptr++)
-//        hash = ((hash << 15) + hash) ^ *ptr;
-//    return hash;
-//}
-//
-//bool operator == (const CTraceModel::STracePath& l, const CTraceModel::STracePath& r)
-//{
-//	if (l.count != r.count)
-//		return false;
-//	return memcmp(l.path, r.path, l.count) == 0;
-//}
-
-CTraceModel::STreeNode* CTraceModel::FindParentNode(STreeNode* pParent, quint64 Path, int PathsIndex, QList<QModelIndex>* pNewBranches)
+int CTraceModel::GetGroup(int Row, bool bNotify, QList<QModelIndex>* pNewBranches)
 {
-	if (2 <= PathsIndex)
-		return pParent;
-	
-	quint64 CurPath = PathsIndex == 0 ? Path & 0x00000000FFFFFFFF : Path;
-	STreeNode* &pNode = m_Branches[CurPath];
-	if(!pNode)
-	{
-		pNode = MkNode(PathsIndex == 0 ? Path & 0x00000000FFFFFFFF : (Path >> 32));
-		pNode->Parent = pParent;
-		pNewBranches->append(createIndex(pParent->Children.size(), FIRST_COLUMN, pNode));
+	quint32 ProcessId = m_pStore->GetProcessId(Row);
+	quint32 ThreadId = m_pStore->GetThreadId(Row);
 
-		//pNode->Row = pParent->Children.size();
-		pParent->Children.append(pNode);
+	int& ThreadGroup = m_ThreadMap[quint64(ProcessId) << 32 | ThreadId];
+	if (ThreadGroup != 0)
+		return ThreadGroup - 1;
+
+	int ProcessGroup = m_ProcessMap.value(ProcessId, -1);
+	if (ProcessGroup == -1)
+	{
+		ProcessGroup = m_Groups.count();
+		SGroup Process;
+		Process.Id = PROCESS_MARK | ProcessId;
+		Process.Pos = m_Processes.count();
+		Process.FirstRow = Row;
+		if (bNotify) beginInsertRows(QModelIndex(), Process.Pos, Process.Pos);
+		m_Groups.append(Process);
+		m_Processes.append(ProcessGroup);
+		m_ProcessMap.insert(ProcessId, ProcessGroup);
+		if (bNotify) endInsertRows();
+		pNewBranches->append(GroupIndex(ProcessGroup));
 	}
-	return FindParentNode(pNode, Path, PathsIndex + 1, pNewBranches);
+
+	int Group = m_Groups.count();
+	SGroup Thread;
+	Thread.Id = THREAD_MARK | ThreadId;
+	Thread.Parent = ProcessGroup;
+	Thread.Pos = m_Groups[ProcessGroup].Children.count();
+	Thread.FirstRow = Row;
+	if (bNotify) beginInsertRows(GroupIndex(ProcessGroup), Thread.Pos, Thread.Pos);
+	m_Groups.append(Thread);
+	m_Groups[ProcessGroup].Children.append(Group);
+	if (bNotify) endInsertRows();
+	pNewBranches->append(GroupIndex(Group));
+
+	ThreadGroup = Group + 1; // the reference is still valid, m_ThreadMap was not modified since
+	return Group;
+}
+
+QModelIndex CTraceModel::GroupIndex(int Group) const
+{
+	return createIndex(m_Groups[Group].Pos, FIRST_COLUMN, MkId(Group, false));
+}
+
+int CTraceModel::GetStoreRow(const QModelIndex& index) const
+{
+	if (!index.isValid() || !IdIsLeaf(index.internalId()))
+		return -1;
+
+	int Group = IdGroup(index.internalId());
+	if (Group == -1)
+		return m_Rows.value(index.row(), -1);
+	return m_Groups[Group].Rows.value(index.row(), -1);
 }
 
 void CTraceModel::Clear(bool bMem)
 {
-	m_LastCount = 0;
 	m_LastID.clear();
 
 	beginResetModel();
 
-	m_Branches.clear();
-	FreeNode(m_Root);
-
-	if (bMem)
-		m_NodeAllocator.dispose();
-
-	m_Root = MkNode(0);
+	if (bMem) {
+		m_Rows = QVector<int>();
+		m_Groups = QVector<SGroup>();
+		m_Processes = QVector<int>();
+		m_ProcessMap = QHash<quint32, int>();
+		m_ThreadMap = QHash<quint64, int>();
+	}
+	else {
+		m_Rows.clear();
+		m_Groups.clear();
+		m_Processes.clear();
+		m_ProcessMap.clear();
+		m_ThreadMap.clear();
+	}
+	m_pStore.clear();
 
 	endResetModel();
 }
 
-PoolAllocator<sizeof(CTraceModel::STreeNode)> CTraceModel::m_NodeAllocator;
-
-CTraceModel::STreeNode*	CTraceModel::MkNode(quint64 Id) 
-{ 
-	STreeNode* pNode = (STreeNode*)m_NodeAllocator.allocate(sizeof(STreeNode));
-	new (pNode) STreeNode(Id);
-	return pNode;
-	//return new STreeNode(Id);
-}
-
-void CTraceModel::FreeNode(STreeNode* pNode) 
-{ 
-	foreach(STreeNode* pSubNode, pNode->Children)
-		FreeNode(pSubNode);
-	pNode->~STreeNode();
-	m_NodeAllocator.free(pNode);
-	//delete pNode; 
-}
-
-bool CTraceModel::TestHighLight(STreeNode* pNode) const
+bool CTraceModel::TestHighLight(int Row) const
 {
 	if (m_HighLightExp.isEmpty())
 		return false;
 	for (int i = 0; i < eCount; i++) {
-		if (NodeData(pNode, Qt::DisplayRole, i).toString().contains(m_HighLightExp, Qt::CaseInsensitive))
+		if (RowData(Row, Qt::DisplayRole, i).toString().contains(m_HighLightExp, Qt::CaseInsensitive))
 			return true;
 	}
 	return false;
 }
 
-QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
+QVariant CTraceModel::GroupData(int Group, int role, int section) const
 {
-	const CTraceEntryPtr& pEntry = pNode->pEntry;
-	if(!pEntry.constData())
-	{
-		if (section != FIRST_COLUMN || (role != Qt::DisplayRole && role != Qt::EditRole))
-			return QVariant();
-
-		quint32 id = pNode->ID;
-		if (id & PROCESS_MARK) {
-			CTraceEntryPtr pProcEntry; // pick first log entry of first thread to query the process name
-			if (!pNode->Children.isEmpty()) {
-				STreeNode* pSubNode = pNode->Children.first();
-				if (!pSubNode->Children.isEmpty())
-					pProcEntry = pSubNode->Children.first()->pEntry;
-			}
-			if (pProcEntry && !pProcEntry->GetProcessName().isEmpty())
-				return tr("%1 (%2)").arg(pProcEntry->GetProcessName()).arg(pProcEntry->GetProcessId());
-			return tr("Process %1").arg(id & 0x0FFFFFFF);
-		}
-		else if (id & THREAD_MARK)
-			return tr("Thread %1").arg(id & 0x0FFFFFFF);
-		else
-			return QString::number(id, 16).rightJustified(8, '0');
+	if (section != FIRST_COLUMN || (role != Qt::DisplayRole && role != Qt::EditRole))
+		return QVariant();
+
+	const SGroup& Node = m_Groups[Group];
+	quint32 id = Node.Id;
+	if (id & PROCESS_MARK) {
+		QString ProcessName = m_pStore ? m_pStore->GetProcessName(Node.FirstRow) : QString();
+		if (!ProcessName.isEmpty())
+			return tr("%1 (%2)").arg(ProcessName).arg(m_pStore->GetProcessId(Node.FirstRow));
+		return tr("Process %1").arg(id & 0x0FFFFFFF);
 	}
+	else if (id & THREAD_MARK)
+		return tr("Thread %1").arg(id & 0x0FFFFFFF);
+	else
+		return QString::number(id, 16).rightJustified(8, '0');
+}
+
+QVariant CTraceModel::RowData(int Row, int role, int section) const
+{
+	if (Row == -1 || !m_pStore)
+		return QVariant();
 	
 	switch(role)
 	{
@@ -192,20 +226,21 @@ QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
 			//case eTimeStamp:		return pEntry->GetUID();
 			case eProcess:		{
 									if(!m_bTree) {
-										QString Name = pEntry->GetProcessName();
+										QString Name = m_pStore->GetProcessName(Row);
 										return QString("%1 (%2, %3) - %4").arg(Name.isEmpty() ? tr("Unknown") : Name)
-											.arg(pEntry->GetProcessId()).arg(pEntry->GetThreadId())
-											.arg(QDateTime::fromMSecsSinceEpoch(pEntry->GetTimeStamp()).toString("hh:mm:ss.zzz"));
+											.arg(m_pStore->GetProcessId(Row)).arg(m_pStore->GetThreadId(Row))
+											.arg(QDateTime::fromMSecsSinceEpoch(m_pStore->GetTimeStamp(Row)).toString("hh:mm:ss.zzz"));
 									} else 
-										return QDateTime::fromMSecsSinceEpoch(pEntry->GetTimeStamp()).toString("hh:mm:ss.zzz");
+										return QDateTime::fromMSecsSinceEpoch(m_pStore->GetTimeStamp(Row)).toString("hh:mm:ss.zzz");
 								}
-			case eType:				return pEntry->GetTypeStr();
-			case eStatus:			return pEntry->GetStautsStr();
+			case eType:				return m_pStore->GetTypeStr(Row);
+			case eStatus:			return m_pStore->GetStautsStr(Row);
 			case eValue:		{			
-									QString sValue = pEntry->GetName();
-									if (!sValue.isEmpty() && !pEntry->GetMessage().isEmpty())
+									QString sValue = m_pStore->GetName(Row);
+									QString sMessage = m_pStore->GetMessage(Row);
+									if (!sValue.isEmpty() && !sMessage.isEmpty())
 										sValue += " ";
-									sValue += pEntry->GetMessage();
+									sValue += sMessage;
 									return sValue;
 								}
 			}
@@ -213,13 +248,13 @@ QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
 		case Qt::BackgroundRole:
 		{
 			if(!CTreeItemModel::GetDarkMode())
-				return TestHighLight(pNode) ? QColor(Qt::yellow) : QVariant();
+				return TestHighLight(Row) ? QColor(Qt::yellow) : QVariant();
 			break;
 		}
 		case Qt::ForegroundRole:
 		{
 			if(CTreeItemModel::GetDarkMode())
-				return TestHighLight(pNode) ? QColor(Qt::yellow) : QVariant();
+				return TestHighLight(Row) ? QColor(Qt::yellow) : QVariant();
 			break;
 		}
 	}
@@ -229,13 +264,10 @@ QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
 
 CTraceEntryPtr CTraceModel::GetEntry(const QModelIndex& index) const
 {
-	if (!index.isValid())
+	int Row = GetStoreRow(index);
+	if (Row == -1 || !m_pStore)
 		return CTraceEntryPtr();
-
-	STreeNode* pNode = static_cast<STreeNode*>(index.internalPointer());
-	ASSERT(pNode);
-
-	return pNode->pEntry;
+	return m_pStore->GetEntry(Row);
 }
 
 QVariant CTraceModel::data(const QModelIndex &index, int role) const
@@ -248,9 +280,13 @@ QVariant CTraceModel::GetItemID(const QModelIndex& index) const
 	if (!index.isValid())
 		return QVariant();
 
-	STreeNode* pNode = static_cast<STreeNode*>(index.internalPointer());
+	if (!IdIsLeaf(index.internalId()))
+		return (quint64)m_Groups[IdGroup(index.internalId())].Id;
 
-	return pNode->ID;
+	int Row = GetStoreRow(index);
+	if (Row == -1 || !m_pStore)
+		return QVariant();
+	return m_pStore->GetUID(Row);
 }
 
 QVariant CTraceModel::Data(const QModelIndex &index, int role, int section) const
@@ -258,10 +294,9 @@ QVariant CTraceModel::Data(const QModelIndex &index, int role, int section) cons
 	if (!index.isValid())
 		return QVariant();
 
-	STreeNode* pNode = static_cast<STreeNode*>(index.internalPointer());
-	ASSERT(pNode);
-
-	return NodeData(pNode, role, section);
+	if (!IdIsLeaf(index.internalId()))
+		return GroupData(IdGroup(index.internalId()), role, section);
+	return RowData(GetStoreRow(index), role, section);
 }
 
 Qt::ItemFlags CTraceModel::flags(const QModelIndex &index) const
@@ -278,15 +313,17 @@ QModelIndex CTraceModel::index(int row, int column, const QModelIndex &parent) c
     if (!hasIndex(row, column, parent))
         return QModelIndex();
 
-    STreeNode* pParent;
-    if (!parent.isValid())
-        pParent = m_Root;
-    else
-        pParent = static_cast<STreeNode*>(parent.internalPointer());
+	if (!parent.isValid()) {
+		if (!m_bTree)
+			return createIndex(row, column, MkId(-1, true));
+		return createIndex(row, column, MkId(m_Processes[row], false));
+	}
 
-	if(STreeNode* pNode = pParent->Children.count() > row ? pParent->Children[row] : NULL)
-        return createIndex(row, column, pNode);
-    return QModelIndex();
+	int Group = IdGroup(parent.internalId());
+	const SGroup& Node = m_Groups[Group];
+	if (Node.Parent == -1)
+		return createIndex(row, column, MkId(Node.Children[row], false));
+	return createIndex(row, column, MkId(Group, true));
 }
 
 QModelIndex CTraceModel::parent(const QModelIndex &index) const
@@ -294,16 +331,12 @@ QModelIndex CTraceModel::parent(const QModelIndex &index) const
     if (!index.isValid())
         return QModelIndex();
 
-    STreeNode* pNode = static_cast<STreeNode*>(index.internalPointer());
-	ASSERT(pNode->Parent);
-	STreeNode* pParent = pNode->Parent;
-    if (pParent == m_Root)
-        return QModelIndex();
-
-	int row = 0;
-	if(pParent->Parent)
-		row = pParent->Parent->Children.indexOf(pParent);
-    return createIndex(row, 0, pParent);
+	int Group = IdGroup(index.internalId());
+	if (!IdIsLeaf(index.internalId()))
+		Group = m_Groups[Group].Parent;
+	if (Group == -1)
+		return QModelIndex();
+	return GroupIndex(Group);
 }
 
 int CTraceModel::rowCount(const QModelIndex &parent) const
@@ -311,12 +344,16 @@ int CTraceModel::rowCount(const QModelIndex &parent) const
     if (parent.column() > 0)
         return 0;
 
-	STreeNode* pNode;
     if (!parent.isValid())
-        pNode = m_Root;
-    else
-        pNode = static_cast<STreeNode*>(parent.internalPointer());
-	return pNode->Children.count();
+        return m_bTree ? m_Processes.count() : m_Rows.count();
+
+	if (IdIsLeaf(parent.internalId()))
+		return 0;
+
+	const SGroup& Node = m_Groups[IdGroup(parent.internalId())];
+	if (Node.Parent == -1)
+		return Node.Children.count();
+	return Node.Rows.count();
 }
 
 int CTraceModel::columnCount(const QModelIndex& parent) const
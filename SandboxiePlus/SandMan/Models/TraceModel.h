@@ -2,7 +2,6 @@
 #include <qwidget.h>
 #include "../../QSbieAPI/SbieAPI.h"
 #include "../../MiscHelpers/Common/TreeItemModel.h"
-#include "../../MiscHelpers/Common/PoolAllocator.h"
 
 class CTraceModel : public QAbstractItemModelEx
 {
@@ -17,7 +16,8 @@ public:
 	
 	void			SetHighLight(const QString& Exp) { m_HighLightExp = Exp; }
 
-	QList<QModelIndex>	Sync(const QVector<CTraceEntryPtr>& EntryList);
+	// appends the rows not yet known to the model, a changed row list resets the model
+	QList<QModelIndex>	Sync(const CTraceStorePtr& pStore, const QVector<int>& RowList);
 
 	CTraceEntryPtr	GetEntry(const QModelIndex& index) const;
 	QVariant		GetItemID(const QModelIndex& index) const;
@@ -46,61 +46,45 @@ public:
 
 protected:
 
-	//struct STracePath {
-	//	STracePath() { Q_ASSERT(0); }
-	//	STracePath(quint32* p, int c) : path(p), count(c), owner(false) {}
-	//	STracePath(const STracePath& other) 
-	//	{
-	//		count = other.count;
-	//		path = new quint32[count];
-	//		memcpy(path, other.path, count * sizeof(quint32));
-	//		owner = true;
-	//	}
-	//	~STracePath() {
-	//		if (owner) 
-	//			delete[] path;
-	//	}
-	//	STracePath& operator = (const STracePath& other) { Q_ASSERT(0); return *this; }
-	//	quint32*		path;
-	//	int				count;
-	//	bool			owner;
-	//};
 	//
-	//friend uint qHash(const STracePath& var);
-	//friend bool operator == (const STracePath& l, const STracePath& r);
+	// the model does not allocate anything per trace entry, leaf rows are positions in m_Rows,
+	// in tree mode the pid and tid branches are groups holding the row ranges they cover
+	// a model index encodes its parent group: internalId = ((Group + 1) << 1) | IsLeaf
+	// with Group == -1 being the root, for branches Group is the index of the branch itself
+	//
 
-	struct STreeNode
+	struct SGroup
 	{
-		STreeNode(quint64 Id) { ID = Id; }
-		//virtual ~STreeNode(){}
+		quint32				Id = 0;			// PROCESS_MARK | pid or THREAD_MARK | tid
+		int					Parent = -1;	// process group of a thread group, -1 for process groups
+		int					Pos = 0;		// position under the parent
+		int					FirstRow = -1;	// first store row, used to look up the process name
+		QVector<int>		Children;		// thread groups of a process group
+		QVector<int>		Rows;			// store rows of a thread group
+	};
 
-		quint64				ID;
+	static quintptr			MkId(int Group, bool bLeaf) { return (quintptr(Group + 1) << 1) | (bLeaf ? 1 : 0); }
+	static int				IdGroup(quintptr Id)		{ return int(Id >> 1) - 1; }
+	static bool				IdIsLeaf(quintptr Id)		{ return (Id & 1) != 0; }
 
-		STreeNode*			Parent = NULL;
-		//int					Row = 0;
-		QVector<STreeNode*>	Children;
-
-		CTraceEntryPtr		pEntry;
-	};
+	int						GetStoreRow(const QModelIndex& index) const;
+	QModelIndex				GroupIndex(int Group) const;
+	int						GetGroup(int Row, bool bNotify, QList<QModelIndex>* pNewBranches);
+	void					AppendRows(const QVector<int>& RowList, int From, bool bNotify, QList<QModelIndex>* pNewBranches);
 
+	QVariant				RowData(int Row, int role, int section) const;
+	QVariant				GroupData(int Group, int role, int section) const;
+	bool					TestHighLight(int Row) const;
 
 	bool					m_bTree;
+	CTraceStorePtr			m_pStore;
 	QVariant				m_LastID;
-	int						m_LastCount;
-
-	virtual QVariant		NodeData(STreeNode* pNode, int role, int section) const;
 
-	virtual STreeNode*		MkNode(quint64 Id);
-	virtual void			FreeNode(STreeNode* pNode);
-
-	STreeNode*				FindParentNode(STreeNode* pParent, quint64 Path, int PathsIndex, QList<QModelIndex>* pNewBranches);
-
-	STreeNode*				m_Root;
-	QHash<quint64, STreeNode*> m_Branches;
+	QVector<int>			m_Rows;			// store rows in display order
+	QVector<SGroup>			m_Groups;
+	QVector<int>			m_Processes;	// process groups in order of appearance
+	QHash<quint32, int>		m_ProcessMap;	// pid -> process group
+	QHash<quint64, int>		m_ThreadMap;	// pid << 32 | tid -> thread group
 
 	QString					m_HighLightExp;
-
-	bool					TestHighLight(STreeNode* pNode) const;
-
-	static PoolAllocator<sizeof(STreeNode)> m_NodeAllocator;
 };
@@ -18,6 +18,7 @@
 #include "../MiscHelpers/Common/TreeItemModel.h"
 #include "../MiscHelpers/Common/ListItemModel.h"
 #include "Views/TraceView.h"
+#include "Views/SyscallProfileView.h"
 #include "Windows/SelectBoxWindow.h"
 #include "../UGlobalHotkey/uglobalhotkeys.h"
 #include "Wizards/SetupWizard.h"
@@ -281,6 +282,7 @@ CSandMan::CSandMan(QWidget *parent)
 	connect(theAPI, SIGNAL(NotAuthorized(bool, bool&)), this, SLOT(OnNotAuthorized(bool, bool&)), Qt::DirectConnection);
 	connect(theAPI, SIGNAL(QueuedRequest(quint32, quint32, quint32, const QVariantMap&)), this, SLOT(OnQueuedRequest(quint32, quint32, quint32, const QVariantMap&)), Qt::QueuedConnection);
 	connect(theAPI, SIGNAL(FileToRecover(const QString&, const QString&, const QString&, quint32)), this, SLOT(OnFileToRecover(const QString&, const QString&, const QString&, quint32)), Qt::QueuedConnection);
+	connect(theAPI, SIGNAL(BoxTerminated(const QString&, quint32, quint32)), this, SLOT(OnBoxTerminated(const QString&, quint32, quint32)), Qt::QueuedConnection);
 	connect(theAPI, SIGNAL(ConfigReloaded()), this, SLOT(OnIniReloaded()));
 
     connect(qApp, &QGuiApplication::commitDataRequest, this, &CSandMan::commitData);
@@ -1211,6 +1213,7 @@ void CSandMan::CreateView(int iViewMode)
 
 		m_pMessageLog = NULL;
 		m_pTraceView = NULL;
+		m_pSyscallProfile = NULL;
 		m_pRecoveryLog = NULL;
 
 		return;
@@ -1274,6 +1277,11 @@ void CSandMan::CreateView(int iViewMode)
 
 		m_pLogTabs->addTab(m_pTraceView, tr("Trace Log"));
 
+		// Syscall Profile
+		m_pSyscallProfile = new CSyscallProfileView(this);
+
+		m_pLogTabs->addTab(m_pSyscallProfile, tr("Syscall Profile"));
+
 
 		// Recovery Log
 		m_pRecoveryLog = new CPanelWidgetEx();
@@ -1302,6 +1310,7 @@ void CSandMan::CreateView(int iViewMode)
 
 		m_pMessageLog = NULL;
 		m_pTraceView = NULL;
+		m_pSyscallProfile = NULL;
 		m_pRecoveryLog = NULL;
 	}
 }
@@ -3265,6 +3274,11 @@ SB_STATUS CSandMan::ReloadCert(QWidget* pWidget)
 	return Status;
 }
 
+void CSandMan::OnBoxTerminated(const QString& BoxName, quint32 ProcessCount, quint32 ElapsedMs)
+{
+	AddLogMessage(tr("Terminated %1 process(es) in sandbox %2 in %3 ms").arg(ProcessCount).arg(BoxName).arg(ElapsedMs));
+}
+
 void CSandMan::OnQueuedRequest(quint32 ClientPid, quint32 ClientTid, quint32 RequestId, const QVariantMap& Data)
 {
 	if (Data["id"].toInt() == 0)
@@ -3992,6 +4006,8 @@ void CSandMan::OnMonitoring()
 {
 	if (m_pTraceView)
 	{
+		// message text above this limit is moved to a temporary file
+		theAPI->SetTraceMemoryLimit((quint64)theConf->GetInt("Options/TraceMemoryLimit", 256) * 1024 * 1024);
 		theAPI->EnableMonitor(m_pEnableMonitoring->isChecked());
 
 		if(m_pEnableMonitoring->isChecked() && !m_pToolBar->isVisible())
@@ -4145,7 +4161,9 @@ QString CSandMan::FormatError(const SB_STATUS& Error)
 	case SBX_7zOpenFailed:	Message = tr("Failed to open the 7z archive"); break;
 	case SBX_7zExtractFailed: Message = tr("Failed to unpack the box archive"); break;
 	case SBX_NotBoxArchive:	Message = tr("The selected 7z file is NOT a box archive"); break;
+	case SBX_BaseArchiveMissing: Message = tr("The base archive '%1' of this incremental box archive could not be found, it must be located in the same folder"); break;
 	case SBX_FailedCopyDir: Message = tr("Failed to copy directory '%1' to '%2'"); break;
+	case SBX_DeltaFileInvalid: Message = tr("The box file '%1' holds only the changes to a file outside the box, which has been modified or removed since, the box can not be exported"); break;
 
 	default:				return tr("Unknown Error Status: 0x%1").arg((quint32)Error.GetStatus(), 8, 16, QChar('0'));
 	}
@@ -194,6 +194,7 @@ public slots:
 	void				OnQueuedRequest(quint32 ClientPid, quint32 ClientTid, quint32 RequestId, const QVariantMap& Data);
 	void				OnFileToRecover(const QString& BoxName, const QString& FilePath, const QString& BoxPath, quint32 ProcessId);
 	void				OnFileRecovered(const QString& BoxName, const QString& FilePath, const QString& BoxPath);
+	void				OnBoxTerminated(const QString& BoxName, quint32 ProcessCount, quint32 ElapsedMs);
 
 	bool				OpenRecovery(const CSandBoxPtr& pBox, bool& DeleteSnapshots, bool bCloseEmpty = false);
 	class CRecoveryWindow* ShowRecovery(const CSandBoxPtr& pBox);
@@ -359,6 +360,7 @@ private:
 	QTabWidget*			m_pLogTabs;
 	CPanelWidgetEx*		m_pMessageLog;
 	CTraceView*			m_pTraceView;
+	class CSyscallProfileView* m_pSyscallProfile;
 	CPanelWidgetEx*		m_pRecoveryLog;
 	class CRecoveryLogWnd* m_pRecoveryLogWnd;
 
@@ -18,6 +18,7 @@ HEADERS += ./stdafx.h \
     ./Views/FileView.h \
     ./Views/TraceView.h \
     ./Views/StackView.h \
+    ./Views/SyscallProfileView.h \
     ./Helpers/FindTool.h \
     ./Helpers/FullScreen.h \
     ./Helpers/WinAdmin.h \
@@ -73,6 +74,7 @@ SOURCES += ./main.cpp \
     ./Views/FileView.cpp \
     ./Views/TraceView.cpp \
     ./Views/StackView.cpp \
+    ./Views/SyscallProfileView.cpp \
     ./Helpers/FindTool.cpp \
     ./Helpers/FullScreen.cpp \
     ./Helpers/WinAdmin.cpp \
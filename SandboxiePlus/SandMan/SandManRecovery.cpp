@@ -247,7 +247,8 @@ void CSandMan::RecoverFilesAsync(QPair<const CSbieProgressPtr&,QWidget*> pParam,
 				QFile::remove(RecoveryPath);
 		}
 
-		if (!QFile::rename(BoxPath, RecoveryPath))
+		// a delta file must receive its full contents before it can leave the box
+		if (!CSandBoxPlus::MaterializeDeltaFile(BoxPath) || !QFile::rename(BoxPath, RecoveryPath))
 			Unrecovered.append(BoxPath);
 		else {
 			QMetaObject::invokeMethod(theGUI, "OnFileRecovered", Qt::BlockingQueuedConnection, // show this question using the GUI thread
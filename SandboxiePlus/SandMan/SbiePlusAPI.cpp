@@ -213,6 +213,100 @@ protected:
 	CArchive* m_pArchive;
 };
 
+struct SBoxExportEntry
+{
+	QString Path;		// relative to the box root, as stored in the archive
+	quint64 Size;
+	quint64 MTime;
+	quint32 Attrib;
+};
+
+#define BOX_MANIFEST_NAME	"BoxManifest.txt"
+#define BOX_MANIFEST_MAGIC	"#SandboxieBoxManifest 1"
+
+void CSandBoxPlus__ScanBox(const QString& RootPath, const QString& SubPath, QList<SBoxExportEntry>& Entries, QStringList& Invalid, const CSbieProgressPtr& pProgress)
+{
+	// collect name, size, time and attributes in one pass over each folder, 
+	// the file content itself is only opened when the compressor asks for it
+	WIN32_FIND_DATAW FindData;
+	HANDLE hFind = FindFirstFileExW(QString(RootPath + "\\" + SubPath + "*").replace("/", "\\").toStdWString().c_str(), 
+		FindExInfoBasic, &FindData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		QString Name = QString::fromWCharArray(FindData.cFileName);
+		if (Name == "." || Name == "..")
+			continue;
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			if ((FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+				CSandBoxPlus__ScanBox(RootPath, SubPath + Name + "/", Entries, Invalid, pProgress);
+			continue;
+		}
+		if (SubPath.isEmpty() && Name == BOX_MANIFEST_NAME)
+			continue;
+
+		// a delta file holds only the blocks modified in the box, it is sparse and its holes read as zeros, 
+		// so it gets its full content before it is archived, this updates its write time as well
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) {
+			QString FilePath = QString(RootPath + "\\" + SubPath + Name).replace("/", "\\");
+			WIN32_FILE_ATTRIBUTE_DATA AttrData;
+			if (!CSandBoxPlus::MaterializeDeltaFile(FilePath)) {
+				Invalid.append(SubPath + Name);
+				continue;
+			}
+			if (GetFileAttributesExW(FilePath.toStdWString().c_str(), GetFileExInfoStandard, &AttrData)) {
+				FindData.dwFileAttributes = AttrData.dwFileAttributes;
+				FindData.ftLastWriteTime = AttrData.ftLastWriteTime;
+				FindData.nFileSizeHigh = AttrData.nFileSizeHigh;
+				FindData.nFileSizeLow = AttrData.nFileSizeLow;
+			}
+		}
+
+		SBoxExportEntry Entry;
+		Entry.Path = SubPath + Name;
+		Entry.Size = ((quint64)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow;
+		Entry.MTime = ((quint64)FindData.ftLastWriteTime.dwHighDateTime << 32) | FindData.ftLastWriteTime.dwLowDateTime;
+		Entry.Attrib = FindData.dwFileAttributes;
+		Entries.append(Entry);
+	} while (!pProgress->IsCanceled() && FindNextFileW(hFind, &FindData));
+	FindClose(hFind);
+}
+
+bool CSandBoxPlus__LoadManifest(const QString& FilePath, QHash<QString, QPair<quint64, quint64>>& Manifest, QString* pBase = NULL)
+{
+	QFile File(FilePath);
+	if (!File.open(QFile::ReadOnly))
+		return false;
+	QStringList Lines = QString::fromUtf8(File.readAll()).split("\n", Qt::SkipEmptyParts);
+	if (Lines.isEmpty() || Lines.takeFirst() != BOX_MANIFEST_MAGIC)
+		return false;
+	foreach(const QString& Line, Lines) {
+		if (Line.startsWith("Base=")) {
+			if (pBase) *pBase = Line.mid(5);
+			continue;
+		}
+		QStringList Fields = Line.split("\t");
+		if (Fields.count() != 3)
+			continue;
+		Manifest.insert(Fields[2].toLower(), qMakePair(Fields[0].toULongLong(), Fields[1].toULongLong()));
+	}
+	return true;
+}
+
+bool CSandBoxPlus__SaveManifest(const QString& FilePath, const QList<SBoxExportEntry>& Entries, const QString& Base)
+{
+	QFile File(FilePath);
+	if (!File.open(QFile::WriteOnly))
+		return false;
+	QStringList Lines;
+	Lines.append(BOX_MANIFEST_MAGIC);
+	if (!Base.isEmpty())
+		Lines.append("Base=" + Base);
+	foreach(const SBoxExportEntry& Entry, Entries)
+		Lines.append(QString("%1\t%2\t%3").arg(Entry.Size).arg(Entry.MTime).arg(Entry.Path));
+	return File.write((Lines.join("\n") + "\n").toUtf8()) != -1;
+}
+
 void CSandBoxPlus::ExportBoxAsync(const CSbieProgressPtr& pProgress, const QString& ExportPath, const QString& RootPath, const QString& Section, const QVariantMap& vParams)
 {
 	//CArchive Archive(ExportPath + ".tmp");
@@ -235,26 +329,58 @@ void CSandBoxPlus::ExportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 		File.close();
 	}
 
-	QStringList FileList = ListDir(RootPath + "\\");
-	foreach(const QString& File, FileList)
+	pProgress->ShowMessage(tr("Scanning box content..."));
+
+	QList<SBoxExportEntry> Entries;
+	QStringList Invalid;
+	CSandBoxPlus__ScanBox(RootPath, "", Entries, Invalid, pProgress);
+
+	if (!Invalid.isEmpty()) {
+		File.remove();
+		pProgress->Finish(SB_ERR((ESbieMsgCodes)SBX_DeltaFileInvalid, QVariantList() << Invalid.first()));
+		return;
+	}
+
+	//
+	// for an incremental export only the files which differ from the manifest of the base archive are packed,
+	// the full manifest is stored in every archive, so that an import can remove files which are gone since
+	//
+
+	QString Base;
+	QHash<QString, QPair<quint64, quint64>> BaseManifest;
+	if (!vParams["base"].toString().isEmpty()) {
+		if (CSandBoxPlus__LoadManifest(vParams["base"].toString() + ".manifest", BaseManifest))
+			Base = Split2(QString(vParams["base"].toString()).replace("\\", "/"), "/", true).second;
+		else
+			pProgress->ShowMessage(tr("No manifest found for %1, doing a full export").arg(vParams["base"].toString()));
+	}
+
+	foreach(const SBoxExportEntry& Entry, Entries)
 	{
-		StrPair RootName = Split2(File, "\\", true);
-		if(RootName.second.isEmpty())
-		{
-			RootName.second = RootName.first;
-			RootName.first = "";
+		if (!Base.isEmpty()) {
+			auto F = BaseManifest.find(Entry.Path.toLower());
+			if (F != BaseManifest.end() && F->first == Entry.Size && F->second == Entry.MTime)
+				continue; // unchanged
 		}
-		int ArcIndex = Archive.AddFile(RootName.second);
+
+		int ArcIndex = Archive.AddFile(Entry.Path);
 		if(ArcIndex != -1)
 		{
-			QString FileName = (RootName.first.isEmpty() ?  RootPath + "\\" : RootName.first) + RootName.second;
-			Files.insert(ArcIndex, new QFileX(FileName, pProgress, &Archive));
-			Attributes.insert(ArcIndex, GetFileAttributesW(QString(FileName).replace("/", "\\").toStdWString().c_str()));
+			Files.insert(ArcIndex, new QFileX(RootPath + "\\" + Entry.Path, pProgress, &Archive));
+			Attributes.insert(ArcIndex, Entry.Attrib);
+			Archive.FileProperty(ArcIndex, "MTime", Entry.MTime);
 		}
 		//else
 			// this file is already present in the archive, this should not happen !!!
 	}
 
+	QString ManifestPath = RootPath + "\\" + BOX_MANIFEST_NAME;
+	if (CSandBoxPlus__SaveManifest(ManifestPath, Entries, Base)) {
+		int ArcIndex = Archive.AddFile(BOX_MANIFEST_NAME);
+		if (ArcIndex != -1)
+			Files.insert(ArcIndex, new QFileX(ManifestPath, pProgress, &Archive));
+	}
+
 	if (vParams.contains("password"))
 		Archive.SetPassword(vParams["password"].toString());
 
@@ -264,6 +390,7 @@ void CSandBoxPlus::ExportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 	Params.iLevel = vParams["level"].toInt();
 	Params.bSolid = vParams["solid"].toBool();
 	Params.b7z = Info.ArchiveExt != "zip";
+	Params.iThreads = vParams["threads"].toInt();
 
 	SB_STATUS Status = SB_OK;
 	if (!Archive.Update(&Files, true, &Params, &Attributes))
@@ -274,12 +401,18 @@ void CSandBoxPlus::ExportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 	//else
 	//	QFile::remove(ExportPath + ".tmp");
 
+	// keep the manifest next to the archive, so the next incremental export does not need to open the archive
+	QFile::remove(ExportPath + ".manifest");
+	if (!Status.IsError() && !pProgress->IsCanceled())
+		QFile::copy(ManifestPath, ExportPath + ".manifest");
+
+	QFile::remove(ManifestPath);
 	File.remove();
 
 	pProgress->Finish(Status);
 }
 
-SB_PROGRESS CSandBoxPlus::ExportBox(const QString& FileName, const QString& Password, int Level, bool Solid)
+SB_PROGRESS CSandBoxPlus::ExportBox(const QString& FileName, const QString& Password, int Level, bool Solid, int Threads, const QString& BaseArchive)
 {
 	if (!CArchive::IsInit())
 		return SB_ERR((ESbieMsgCodes)SBX_7zNotReady);
@@ -297,6 +430,9 @@ SB_PROGRESS CSandBoxPlus::ExportBox(const QString& FileName, const QString& Pass
 		vParams["password"] = Password;
 	vParams["level"] = Level;
 	vParams["solid"] = Solid;
+	vParams["threads"] = Threads;
+	if (!BaseArchive.isEmpty())
+		vParams["base"] = BaseArchive;
 
 	CSbieProgressPtr pProgress = CSbieProgressPtr(new CSbieProgress());
 	QtConcurrent::run(CSandBoxPlus::ExportBoxAsync, pProgress, FileName, m_FilePath, Section, vParams);
@@ -305,38 +441,83 @@ SB_PROGRESS CSandBoxPlus::ExportBox(const QString& FileName, const QString& Pass
 
 void CSandBoxPlus::ImportBoxAsync(const CSbieProgressPtr& pProgress, const QString& ImportPath, const QString& RootPath, const QString& BoxName, const QString& Password)
 {
-	CArchive Archive(ImportPath);
+	//
+	// an incremental archive only holds the files which changed since its base archive, 
+	// the chain of base archives must be located next to it, each base is unpacked after the archive which refers to it, 
+	// skipping the files which were already unpacked and those which are not listed in the manifest of the newest archive
+	//
 
-	if (!Password.isEmpty())
-		Archive.SetPassword(Password);
+	SB_STATUS Status = SB_OK;
+	QString ArchivePath = ImportPath;
+	QStringList Visited;
+	QSet<QString> Extracted;
+	QHash<QString, QPair<quint64, quint64>> Manifest;
 
-	if (Archive.Open() != ERR_7Z_OK) {
-		pProgress->Finish(SB_ERR((ESbieMsgCodes)SBX_7zOpenFailed));
-		return;
-	}
+	while (!pProgress->IsCanceled())
+	{
+		bool bBase = !Visited.isEmpty();
+		Visited.append(ArchivePath);
 
-	bool IsBoxArchive = false;
+		CArchive Archive(ArchivePath);
 
-	QMap<int, QIODevice*> Files;
+		if (!Password.isEmpty())
+			Archive.SetPassword(Password);
 
-	for (int i = 0; i < Archive.FileCount(); i++) {
-		int ArcIndex = Archive.FindByIndex(i);
-		if(Archive.FileProperty(ArcIndex, "IsDir").toBool())
-			continue;
-		QString File = Archive.FileProperty(ArcIndex, "Path").toString();
-		if (File == "BoxConfig.ini")
-			IsBoxArchive = true;
-		Files.insert(ArcIndex, new QFileX(CArchive::PrepareExtraction(File, RootPath + "\\"), pProgress, &Archive));
-	}
+		if (Archive.Open() != ERR_7Z_OK) {
+			Status = SB_ERR((ESbieMsgCodes)SBX_7zOpenFailed);
+			break;
+		}
 
-	if(!IsBoxArchive) {
-		pProgress->Finish(SB_ERR((ESbieMsgCodes)SBX_NotBoxArchive));
-		return;
+		bool IsBoxArchive = false;
+
+		QMap<int, QIODevice*> Files;
+
+		for (int i = 0; i < Archive.FileCount(); i++) {
+			int ArcIndex = Archive.FindByIndex(i);
+			if(Archive.FileProperty(ArcIndex, "IsDir").toBool())
+				continue;
+			QString File = Archive.FileProperty(ArcIndex, "Path").toString();
+			if (File == "BoxConfig.ini")
+				IsBoxArchive = true;
+			if (bBase && File != BOX_MANIFEST_NAME) {
+				QString Key = QString(File).replace("\\", "/").toLower();
+				if (Extracted.contains(Key) || !Manifest.contains(Key))
+					continue;
+			}
+			Extracted.insert(QString(File).replace("\\", "/").toLower());
+			Files.insert(ArcIndex, new QFileX(CArchive::PrepareExtraction(File, RootPath + "\\"), pProgress, &Archive));
+		}
+
+		if(!IsBoxArchive) {
+			Status = SB_ERR((ESbieMsgCodes)SBX_NotBoxArchive);
+			break;
+		}
+
+		if (!Archive.Extract(&Files)) {
+			Status = SB_ERR((ESbieMsgCodes)SBX_7zExtractFailed);
+			break;
+		}
+
+		// archives made by older versions have no manifest, they are never incremental
+		QString Base;
+		QHash<QString, QPair<quint64, quint64>> CurManifest;
+		if (!CSandBoxPlus__LoadManifest(RootPath + "\\" + BOX_MANIFEST_NAME, CurManifest, &Base))
+			break;
+		if (!bBase)
+			Manifest = CurManifest;
+		if (Base.isEmpty())
+			break;
+
+		ArchivePath = QFileInfo(ArchivePath).absoluteDir().filePath(Base);
+		if (!QFile::exists(ArchivePath) || Visited.contains(ArchivePath, Qt::CaseInsensitive)) {
+			Status = SB_ERR((ESbieMsgCodes)SBX_BaseArchiveMissing, QVariantList() << Base);
+			break;
+		}
+
+		pProgress->ShowMessage(tr("Unpacking base archive %1...").arg(Base));
 	}
 
-	SB_STATUS Status = SB_OK;
-	if (!Archive.Extract(&Files))
-		Status = SB_ERR((ESbieMsgCodes)SBX_7zExtractFailed);
+	QFile::remove(RootPath + "\\" + BOX_MANIFEST_NAME);
 
 	if (!Status.IsError() && !pProgress->IsCanceled())
 	{
@@ -387,6 +568,12 @@ void CSandBoxPlus::CopyBoxAsync(const CSbieProgressPtr& pProgress, const QString
 	pProgress->Finish(Status);
 }
 
+bool CSandBoxPlus::MaterializeDeltaFile(const QString& BoxPath)
+{
+	SNtObject ntObject(L"\\??\\" + BoxPath.toStdWString());
+	return NT_SUCCESS(NtIo_MaterializeDeltaFile(&ntObject.attr));
+}
+
 SB_PROGRESS CSandBoxPlus::CopyBox(const QString& DestDir)
 {
 	if (theAPI->HasProcesses(m_Name))
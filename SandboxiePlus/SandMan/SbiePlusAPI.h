@@ -12,7 +12,9 @@ enum ESbieExMsgCodes
 	SBX_7zOpenFailed,
 	SBX_7zExtractFailed,
 	SBX_FailedCopyDir,
-	SBX_NotBoxArchive
+	SBX_NotBoxArchive,
+	SBX_BaseArchiveMissing,
+	SBX_DeltaFileInvalid
 };
 
 class CSbiePlusAPI : public CSbieAPI
@@ -75,11 +77,13 @@ public:
 
 	virtual QString			GetDisplayName() const;
 
-	SB_PROGRESS				ExportBox(const QString& FileName, const QString& Password = "", int Level = 5, bool Solid = false);
+	SB_PROGRESS				ExportBox(const QString& FileName, const QString& Password = "", int Level = 5, bool Solid = false, int Threads = 0, const QString& BaseArchive = "");
 	SB_PROGRESS				ImportBox(const QString& FileName, const QString& Password);
 
 	SB_PROGRESS				CopyBox(const QString& DestDir);
 
+	static bool				MaterializeDeltaFile(const QString& BoxPath);
+
 	virtual void			UpdateDetails();
 
 	virtual void			ScanStartMenu();
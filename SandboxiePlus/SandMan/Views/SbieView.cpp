@@ -1605,7 +1605,14 @@ void CSbieView::OnSandBoxAction(QAction* Action, const QList<CSandBoxPtr>& SandB
 		if (Path.isEmpty())
 			return;
 
-		SB_PROGRESS Status = pBoxEx->ExportBox(Path, Password, optWnd.GetLevel(), optWnd.MakeSolid());
+		QString BasePath;
+		if (optWnd.IsIncremental()) {
+			BasePath = QFileDialog::getOpenFileName(this, tr("Select previous export"), "", tr("Archive Files (*.7z *.zip)"));
+			if (BasePath.isEmpty())
+				return;
+		}
+
+		SB_PROGRESS Status = pBoxEx->ExportBox(Path, Password, optWnd.GetLevel(), optWnd.MakeSolid(), optWnd.GetThreads(), BasePath);
 		if (Status.GetStatus() == OP_ASYNC)
 			theGUI->AddAsyncOp(Status.GetValue(), false, tr("Exporting: %1").arg(Path));
 		else
@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include "..\SandMan.h"
+#include "SyscallProfileView.h"
+#include "..\..\MiscHelpers\Common\Common.h"
+
+CSyscallProfileView::CSyscallProfileView(QWidget *parent)
+	: CPanelView(parent)
+{
+	m_ProcessId = 0;
+
+	m_pMainLayout = new QVBoxLayout();
+	m_pMainLayout->setContentsMargins(0, 0, 0, 0);
+	this->setLayout(m_pMainLayout);
+
+	m_pToolBar = new QToolBar();
+	m_pReset = m_pToolBar->addAction(CSandMan::GetIcon("Erase"), tr("Reset counters"), this, SLOT(OnReset()));
+	m_pToolBar->addSeparator();
+	m_pProcessLabel = new QLabel();
+	m_pToolBar->addWidget(m_pProcessLabel);
+	m_pMainLayout->addWidget(m_pToolBar);
+
+	// Profile List
+	m_pProfileList = new QTreeWidgetEx();
+	m_pProfileList->setItemDelegate(new CTreeItemDelegate());
+	m_pProfileList->setHeaderLabels(tr("Syscall|Calls|Total (ms)|Average (\xC2\xB5s)|Median (\xC2\xB5s)|99th Percentile (\xC2\xB5s)|Latency Histogram").split("|"));
+	m_pProfileList->setMinimumHeight(50);
+
+	m_pProfileList->setSelectionMode(QAbstractItemView::ExtendedSelection);
+	m_pProfileList->setSortingEnabled(true);
+	m_pProfileList->sortByColumn(eTotal, Qt::DescendingOrder);
+
+	m_pProfileList->setContextMenuPolicy(Qt::CustomContextMenu);
+	connect(m_pProfileList, SIGNAL(customContextMenuRequested( const QPoint& )), this, SLOT(OnMenu(const QPoint &)));
+
+	m_pMainLayout->addWidget(CFinder::AddFinder(m_pProfileList, this, true, &m_pFinder));
+	//
+
+	AddPanelItemsToMenu();
+
+	m_pProfileList->header()->restoreState(theConf->GetBlob("MainWindow/SyscallProfile_Columns"));
+
+	m_uTimerID = startTimer(1000);
+}
+
+CSyscallProfileView::~CSyscallProfileView()
+{
+	killTimer(m_uTimerID);
+
+	theConf->SetBlob("MainWindow/SyscallProfile_Columns", m_pProfileList->header()->saveState());
+}
+
+void CSyscallProfileView::timerEvent(QTimerEvent* pEvent)
+{
+	if (pEvent->timerId() != m_uTimerID)
+		return;
+
+	if (isVisible())
+		Refresh();
+}
+
+void CSyscallProfileView::Refresh()
+{
+	QList<CBoxedProcessPtr> Processes = theGUI->GetBoxView()->GetSelectedProcesses();
+	CBoxedProcessPtr pProcess = Processes.isEmpty() ? CBoxedProcessPtr() : Processes.first();
+	quint32 ProcessId = pProcess ? pProcess->GetProcessId() : 0;
+
+	if (ProcessId != m_ProcessId) {
+		m_ProcessId = ProcessId;
+		m_pProfileList->clear();
+	}
+
+	if (!pProcess) {
+		m_pProcessLabel->setText(tr("Select a sandboxed process to view its syscall profile."));
+		return;
+	}
+
+	QList<CSbieAPI::SSyscallProfile> Profile;
+	double BucketUs = 0;
+	SB_STATUS Status = theAPI->GetSyscallProfile(ProcessId, Profile, &BucketUs);
+	if (Status.IsError()) {
+		m_pProfileList->clear();
+		if (Status.GetStatus() == STATUS_NOT_SUPPORTED)
+			m_pProcessLabel->setText(tr("%1 (%2): syscall profiling is not enabled, set SyscallProfile=y in the box options and restart the process.").arg(pProcess->GetProcessName()).arg(ProcessId));
+		else
+			m_pProcessLabel->setText(tr("%1 (%2): failed to query the syscall profile, status 0x%3").arg(pProcess->GetProcessName()).arg(ProcessId).arg((quint32)Status.GetStatus(), 8, 16, QChar('0')));
+		return;
+	}
+
+	quint64 TotalCalls = 0;
+	double TotalUs = 0;
+
+	QMap<QString, QTreeWidgetItem*> OldItems;
+	for (int i = 0; i < m_pProfileList->topLevelItemCount(); i++) {
+		QTreeWidgetItem* pItem = m_pProfileList->topLevelItem(i);
+		OldItems.insert(pItem->text(eSyscall), pItem);
+	}
+
+	m_pProfileList->setSortingEnabled(false);
+
+	foreach(const CSbieAPI::SSyscallProfile& Entry, Profile)
+	{
+		TotalCalls += Entry.Count;
+		TotalUs += Entry.TotalUs;
+
+		QTreeWidgetItem* pItem = OldItems.take(Entry.Name);
+		if (!pItem) {
+			pItem = new QTreeWidgetItem();
+			pItem->setText(eSyscall, Entry.Name);
+			m_pProfileList->addTopLevelItem(pItem);
+		}
+
+		// numeric display data so that the columns sort by value
+		pItem->setData(eCalls, Qt::DisplayRole, Entry.Count);
+		pItem->setData(eTotal, Qt::DisplayRole, qRound64(Entry.TotalUs / 10) / 100.0);
+		pItem->setData(eAverage, Qt::DisplayRole, Entry.Count ? qRound64(Entry.TotalUs * 10 / Entry.Count) / 10.0 : 0.0);
+		pItem->setData(eMedian, Qt::DisplayRole, GetPercentile(Entry, 0.50, BucketUs));
+		pItem->setData(eP99, Qt::DisplayRole, GetPercentile(Entry, 0.99, BucketUs));
+		pItem->setText(eHistogram, FormatHistogram(Entry));
+	}
+
+	foreach(QTreeWidgetItem* pItem, OldItems) // counters were reset
+		delete pItem;
+
+	m_pProfileList->setSortingEnabled(true);
+
+	m_pProcessLabel->setText(tr("%1 (%2): %3 calls, %4 ms total, latency buckets start at %5 \xC2\xB5s")
+		.arg(pProcess->GetProcessName()).arg(ProcessId).arg(TotalCalls).arg(qRound64(TotalUs / 1000)).arg(BucketUs, 0, 'f', 2));
+
+	CPanelWidgetEx::ApplyFilter(m_pProfileList, m_pFinder->isVisible() ? &m_pFinder->GetSearchExp() : NULL);
+}
+
+void CSyscallProfileView::OnReset()
+{
+	if (!m_ProcessId)
+		return;
+
+	QList<CSbieAPI::SSyscallProfile> Profile;
+	theAPI->GetSyscallProfile(m_ProcessId, Profile, NULL, true);
+
+	m_pProfileList->clear();
+	Refresh();
+}
+
+double CSyscallProfileView::GetPercentile(const CSbieAPI::SSyscallProfile& Entry, double Fraction, double BucketUs)
+{
+	//
+	// the histogram only knows the upper bound of each bucket,
+	// so this returns the bound of the bucket the percentile falls into
+	//
+
+	quint64 Target = qCeil(Entry.Count * Fraction);
+	quint64 Sum = 0;
+	for (int i = 0; i < Entry.Histogram.count(); i++) {
+		Sum += Entry.Histogram[i];
+		if (Sum >= Target)
+			return qRound64(BucketUs * (1ULL << i) * 10) / 10.0;
+	}
+	return qRound64(BucketUs * (1ULL << Entry.Histogram.count()) * 10) / 10.0;
+}
+
+QString CSyscallProfileView::FormatHistogram(const CSbieAPI::SSyscallProfile& Entry)
+{
+	static const QString Bars = QString::fromUtf8("\xE2\x96\x81\xE2\x96\x82\xE2\x96\x83\xE2\x96\x84\xE2\x96\x85\xE2\x96\x86\xE2\x96\x87\xE2\x96\x88");
+
+	quint32 Max = 0;
+	foreach(quint32 Value, Entry.Histogram)
+		Max = qMax(Max, Value);
+
+	QString Histogram;
+	foreach(quint32 Value, Entry.Histogram) {
+		if (Value == 0)
+			Histogram += ' ';
+		else
+			Histogram += Bars.at((int)((quint64)(Value - 1) * Bars.length() / Max));
+	}
+	return Histogram;
+}
+
+void CSyscallProfileView::SetFilter(const QRegularExpression& Exp, int iOptions, int Col)
+{
+	CPanelWidgetEx::ApplyFilter(m_pProfileList, &m_pFinder->GetSearchExp());
+}
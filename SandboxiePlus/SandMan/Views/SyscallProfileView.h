@@ -0,0 +1,58 @@
+#pragma once
+
+#include "../../MiscHelpers/Common/PanelView.h"
+#include "../../MiscHelpers/Common/TreeviewEx.h"
+#include "../../QSbieAPI/SbieAPI.h"
+
+
+class CFinder;
+
+class CSyscallProfileView : public CPanelView
+{
+	Q_OBJECT
+public:
+	CSyscallProfileView(QWidget *parent = 0);
+	virtual ~CSyscallProfileView();
+
+public slots:
+	void					Clear()			{ m_pProfileList->clear(); }
+	void					Refresh();
+	void					OnReset();
+
+	void					SetFilter(const QRegularExpression& Exp, int iOptions = 0, int Col = -1); // -1 = any
+
+protected:
+	virtual QTreeView*			GetView()	{ return m_pProfileList; }
+	virtual QAbstractItemModel* GetModel()	{ return m_pProfileList->model(); }
+
+	void					timerEvent(QTimerEvent* pEvent);
+
+	static double			GetPercentile(const CSbieAPI::SSyscallProfile& Entry, double Fraction, double BucketUs);
+	static QString			FormatHistogram(const CSbieAPI::SSyscallProfile& Entry);
+
+private:
+	enum EProfileColumns
+	{
+		eSyscall = 0,
+		eCalls,
+		eTotal,
+		eAverage,
+		eMedian,
+		eP99,
+		eHistogram,
+		eCount
+	};
+
+	QVBoxLayout*			m_pMainLayout;
+
+	QToolBar*				m_pToolBar;
+	QLabel*					m_pProcessLabel;
+	QAction*				m_pReset;
+
+	QTreeWidgetEx*			m_pProfileList;
+
+	CFinder*				m_pFinder;
+
+	int						m_uTimerID;
+	quint32					m_ProcessId;
+};
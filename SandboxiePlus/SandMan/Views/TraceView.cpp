@@ -240,6 +240,7 @@ CTraceView::CTraceView(bool bStandAlone, QWidget* parent) : QWidget(parent)
 
 	m_LastID = 0;
 	m_LastCount = 0;
+	m_PidMapVersion = -1;
 	m_bUpdatePending = false;
 
 	m_FilterTid = 0;
@@ -403,6 +404,7 @@ void CTraceView::Refresh()
 		m_LastID = 0;
 		m_LastCount = 0;
 		m_PidMap.clear();
+		m_PidMapVersion = -1;
 
 		quint64 start = GetCurCycle();
 		m_pTrace->m_pTraceModel->Clear();
@@ -412,15 +414,16 @@ void CTraceView::Refresh()
 		m_FullRefresh = false;
 	}
 
-	const QVector<CTraceEntryPtr> &ResourceLog = theAPI->GetTrace();
+	CTraceStorePtr pResourceLog = theAPI->GetTrace();
+	int Count = pResourceLog->Count();
 
 	bool bUpdateFilters = false;
 
 	int i = 0;
-	if (ResourceLog.count() >= m_LastCount && m_LastCount > 0)
+	if (Count >= m_LastCount && m_LastCount > 0)
 	{
 		i = m_LastCount - 1;
-		if (m_LastID == ResourceLog.at(i)->GetUID())
+		if (m_LastID == pResourceLog->GetUID(i))
 			i++;
 		else
 			i = 0;
@@ -428,91 +431,62 @@ void CTraceView::Refresh()
 
 	if (i == 0) {
 		m_PidMap.clear();
+		m_PidMapVersion = -1;
 		m_TraceList.clear();
 		m_MonitorMap.clear();
 	}
 
-	if (m_LastCount == ResourceLog.count())
+	if (m_LastCount == Count)
 		return;
 
-	//bool bHasFilter = !m_pTrace->m_FilterExp.pattern().isEmpty();
-	bool bHasFilter = !m_pTrace->m_FilterExp.isEmpty();
-
-	quint64 start = GetCurCycle();
-	for (; i < ResourceLog.count(); i++)
+	// the process and thread lists for the filter boxes are taken from the store index
+	int PidMapVersion = pResourceLog->GetProcessThreadsVersion();
+	if (m_PidMapVersion != PidMapVersion)
 	{
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
-
-		SProgInfo& Info = m_PidMap[pEntry->GetProcessId()];
-		if (Info.Name.isEmpty()) {
-			Info.Name = pEntry->GetProcessName();
-			bUpdateFilters = true;
-		}
-		if (!Info.Threads.contains(pEntry->GetThreadId())) {
-			Info.Threads.insert(pEntry->GetThreadId());
-			bUpdateFilters = true;
+		m_PidMapVersion = PidMapVersion;
+		QHash<quint32, QSet<quint32>> ProcessThreads = pResourceLog->GetProcessThreads();
+		for (auto I = ProcessThreads.begin(); I != ProcessThreads.end(); ++I) {
+			SProgInfo& Info = m_PidMap[I.key()];
+			if (Info.Name.isEmpty()) {
+				QVector<int> Rows = pResourceLog->GetProcessRows(I.key());
+				if (!Rows.isEmpty())
+					Info.Name = pResourceLog->GetProcessName(Rows.first());
+			}
+			Info.Threads = I.value();
 		}
+		bUpdateFilters = true;
+	}
 
-		if (m_pCurrentBox != NULL && m_pCurrentBox != pEntry->GetBoxPtr())
-			continue;
-
-		quint32 pid = pEntry->GetProcessId();
-		if (!((m_ShowPids.isEmpty() || m_ShowPids.contains(pid)) && !m_HidePids.contains(pid)))
-			continue;
-
-		if (m_FilterTid != 0 && m_FilterTid != pEntry->GetThreadId())
-			continue;
-
-		if (!m_FilterTypes.isEmpty() && !m_FilterTypes.contains(pEntry->GetType()))
-			continue;
-
-		if (bMonitorMode)
+	quint64 start = GetCurCycle();
+	QVector<int> Rows = FilterRows(pResourceLog, i, Count, !bMonitorMode);
+	if (bMonitorMode)
+	{
+		foreach(int Row, Rows)
 		{
-			QString Name = pEntry->GetName();
+			quint32 TypeFlags = pResourceLog->GetTypeFlags(Row);
+
+			QString Name = pResourceLog->GetName(Row);
 			if (Name.isEmpty())
-				Name = pEntry->GetMessage();
+				Name = pResourceLog->GetMessage(Row);
 			CMonitorEntryPtr& pItem = m_MonitorMap[Name.toLower()];
 			if (pItem.data() == NULL) {
 				//if (Name.left(9).compare("\\REGISTRY", Qt::CaseInsensitive) == 0) {
 				//	int pos = Name.indexOf("\\", 10);
 				//	Name = Name.left(pos).toUpper() + Name.mid(pos);
 				//}
-				pItem = CMonitorEntryPtr(new CMonitorEntry(Name, pEntry->GetType()));
+				pItem = CMonitorEntryPtr(new CMonitorEntry(Name, TypeFlags & 0xFF));
 			}
 
-			pItem->Merge(pEntry);
-		}
-		else
-		{
-			if (bHasFilter && !m_pTrace->m_bHighLight) {
-				if (!pEntry->GetName().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive)
-					&& !pEntry->GetMessage().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive)
-					//&& !pEntry->GetTypeStr().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive) // don't filter on non static strings !!!
-					//&& !pEntry->GetStautsStr().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive) // don't filter on non static strings !!!
-					&& !pEntry->GetProcessName().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive))
-						continue;
-			}
-	
-			if (m_FilterStatus != 0) {
-				if (pEntry->IsOpen()) {
-					if (m_FilterStatus != 1) continue;
-				} else if (pEntry->IsClosed()) {
-					if (m_FilterStatus != 2) continue;
-				} else if (pEntry->IsTrace()) {
-					if (m_FilterStatus != 3) continue;
-				} else {
-					if (m_FilterStatus != 4) continue;
-				}
-			}
-
-			m_TraceList.append(pEntry);
+			pItem->Merge(TypeFlags);
 		}
 	}
+	else
+		m_TraceList += Rows;
 	qDebug() << "Filtering took" << (GetCurCycle() - start) / 1000000.0 << "s";
 
-	m_LastCount = ResourceLog.count();
+	m_LastCount = Count;
 	if(m_LastCount)
-		m_LastID = ResourceLog.last()->GetUID();
+		m_LastID = pResourceLog->GetUID(Count - 1);
 
 	if (bUpdateFilters && !m_bUpdatePending)
 	{
@@ -542,8 +516,12 @@ void CTraceView::Refresh()
 		else
 			m_pTrace->m_pTraceModel->SetHighLight(QString());
 
+		// follow the tail only while the view is scrolled to the end, so the user can look at older entries
+		QScrollBar* pScrollBar = m_pTrace->m_pTreeList->verticalScrollBar();
+		bool bAtTail = pScrollBar->value() == pScrollBar->maximum();
+
 		quint64 start = GetCurCycle();
-		QList<QModelIndex> NewBranches = m_pTrace->m_pTraceModel->Sync(m_TraceList);
+		QList<QModelIndex> NewBranches = m_pTrace->m_pTraceModel->Sync(pResourceLog, m_TraceList);
 		qDebug() << "Sync took" << (GetCurCycle() - start) / 1000000.0 << "s";
 
 		if (m_pTrace->m_pTraceModel->IsTree())
@@ -556,11 +534,133 @@ void CTraceView::Refresh()
 			});
 		}
 
-		if(m_pTrace->m_pAutoScroll->isChecked())
+		if(m_pTrace->m_pAutoScroll->isChecked() && bAtTail)
 			m_pTrace->m_pTreeList->scrollToBottom();
 	}
 }
 
+QVector<int> CTraceView::FilterRows(const CTraceStorePtr& pResourceLog, int From, int To, bool bTraceFilters) const
+{
+	QVector<int> Rows;
+	if (From >= To)
+		return Rows;
+
+	//
+	// the cheap filters are answered from the secondary indexes of the trace store, 
+	// they are combined into a mask with one bit per row in the range From to To
+	//
+
+	int Base = From / 64;
+	int Words = (To + 63) / 64 - Base;
+	QVector<quint64> Mask(Words, ~0ull);
+	Mask[0] &= ~0ull << (From % 64);
+	if (To % 64)
+		Mask[Words - 1] &= (1ull << (To % 64)) - 1;
+
+	auto AndGlobalBits = [&](const QVector<quint64>& Bits) {
+		for (int w = 0; w < Words; w++)
+			Mask[w] &= Base + w < Bits.count() ? Bits[Base + w] : 0;
+	};
+
+	auto RowsToBits = [&](const QVector<int>& RowList, QVector<quint64>& Bits) {
+		for (auto I = std::lower_bound(RowList.begin(), RowList.end(), From); I != RowList.end() && *I < To; ++I)
+			Bits[*I / 64 - Base] |= 1ull << (*I % 64);
+	};
+
+	auto AndBits = [&](const QVector<quint64>& Bits) {
+		for (int w = 0; w < Words; w++)
+			Mask[w] &= Bits[w];
+	};
+
+	if (!m_FilterTypes.isEmpty()) {
+		QVector<quint64> Bits(Words, 0);
+		foreach(quint32 Type, m_FilterTypes) {
+			QVector<quint64> TypeBits = pResourceLog->GetTypeBits(Type);
+			for (int w = 0; w < Words && Base + w < TypeBits.count(); w++)
+				Bits[w] |= TypeBits[Base + w];
+		}
+		AndBits(Bits);
+	}
+
+	if (bTraceFilters && m_FilterStatus != 0)
+		AndGlobalBits(pResourceLog->GetStatusBits((CTraceStore::EStatus)(m_FilterStatus - 1)));
+
+	if (m_pCurrentBox != NULL) {
+		QVector<quint64> Bits(Words, 0);
+		RowsToBits(pResourceLog->GetBoxRows(m_pCurrentBox), Bits);
+		AndBits(Bits);
+	}
+
+	if (!m_ShowPids.isEmpty()) {
+		QVector<quint64> Bits(Words, 0);
+		foreach(quint32 pid, m_ShowPids)
+			RowsToBits(pResourceLog->GetProcessRows(pid), Bits);
+		AndBits(Bits);
+	}
+
+	if (!m_HidePids.isEmpty()) {
+		QVector<quint64> Bits(Words, 0);
+		foreach(quint32 pid, m_HidePids)
+			RowsToBits(pResourceLog->GetProcessRows(pid), Bits);
+		for (int w = 0; w < Words; w++)
+			Mask[w] &= ~Bits[w];
+	}
+
+	if (m_FilterTid != 0) {
+		QVector<quint64> Bits(Words, 0);
+		RowsToBits(pResourceLog->GetThreadRows(m_FilterTid), Bits);
+		AndBits(Bits);
+	}
+
+	for (int w = 0; w < Words; w++) {
+		for (quint64 Word = Mask[w]; Word; Word &= Word - 1) {
+			Rows.append((Base + w) * 64 + qCountTrailingZeroBits(Word));
+		}
+	}
+
+	//
+	// the text filter, names and process names are matched once per distinct string using 
+	// the trigram index of the store, messages are unique and need to be checked row by row
+	//
+
+	//bool bHasFilter = !m_pTrace->m_FilterExp.pattern().isEmpty();
+	bool bHasFilter = !m_pTrace->m_FilterExp.isEmpty();
+	if (!bTraceFilters || !bHasFilter || m_pTrace->m_bHighLight)
+		return Rows;
+
+	QString Text = m_pTrace->m_FilterExp;
+	QBitArray Strings = pResourceLog->FindStrings(Text);
+
+	struct SBlock
+	{
+		int Begin;
+		int End;
+		QVector<int> Rows;
+	};
+
+	const int BlockSize = 0x4000;
+	QVector<SBlock> Blocks;
+	for (int Begin = 0; Begin < Rows.count(); Begin += BlockSize)
+		Blocks.append(SBlock{ Begin, qMin(Begin + BlockSize, Rows.count()) });
+
+	auto MatchBlock = [&](SBlock& Block) {
+		for (int j = Block.Begin; j < Block.End; j++) {
+			if (pResourceLog->MatchRow(Rows[j], Strings, Text))
+				Block.Rows.append(Rows[j]);
+		}
+	};
+
+	if (Blocks.count() > 1)
+		QtConcurrent::blockingMap(Blocks, MatchBlock); // large rescans are evaluated on all cores
+	else if (!Blocks.isEmpty())
+		MatchBlock(Blocks[0]);
+
+	QVector<int> Matches;
+	foreach(const SBlock& Block, Blocks)
+		Matches += Block.Rows;
+	return Matches;
+}
+
 void CTraceView::Clear()
 {
 	m_pTracePid->clear();
@@ -751,42 +851,44 @@ void CTraceView::SaveToFile()
 	File.close();
 }
 
-void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTraceEntryPtr> ResourceLog, QIODevice* pFile)
+void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, CTraceStorePtr pResourceLog, QIODevice* pFile)
 {
 	pProgress->ShowMessage(tr("Saving TraceLog..."));
 
 	QByteArray Unknown = "Unknown";
 
+	// the store is append only, entries added while saving are not included
+	int Count = pResourceLog->Count();
+
 	quint64 LastTimeStamp = 0;
 	QByteArray LastTimeStampStr;
-	for (int i = 0; i < ResourceLog.count() && !pProgress->IsCanceled(); i++)
+	for (int i = 0; i < Count && !pProgress->IsCanceled(); i++)
 	{
 		if (i % 10000 == 0)
-			pProgress->SetProgress(100 * i / ResourceLog.count());
-
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
+			pProgress->SetProgress(100 * (qint64)i / Count);
 
-		if (LastTimeStamp != pEntry->GetTimeStamp()) {
-			LastTimeStamp = pEntry->GetTimeStamp();
-			LastTimeStampStr = QDateTime::fromMSecsSinceEpoch(pEntry->GetTimeStamp()).toString("dd.MM.yyyy hh:mm:ss.zzz").toUtf8();
+		quint64 TimeStamp = pResourceLog->GetTimeStamp(i);
+		if (LastTimeStamp != TimeStamp) {
+			LastTimeStamp = TimeStamp;
+			LastTimeStampStr = QDateTime::fromMSecsSinceEpoch(TimeStamp).toString("dd.MM.yyyy hh:mm:ss.zzz").toUtf8();
 		}
 
 		pFile->write(LastTimeStampStr);
 		pFile->write("\t");
-		QString Name = pEntry->GetProcessName();
+		QString Name = pResourceLog->GetProcessName(i);
 		pFile->write(Name.isEmpty() ? Unknown : Name.toUtf8());
 		pFile->write("\t");
-		pFile->write(QByteArray::number(pEntry->GetProcessId()));
+		pFile->write(QByteArray::number(pResourceLog->GetProcessId(i)));
 		pFile->write("\t");
-		pFile->write(QByteArray::number(pEntry->GetThreadId()));
+		pFile->write(QByteArray::number(pResourceLog->GetThreadId(i)));
 		pFile->write("\t");
-		pFile->write(pEntry->GetTypeStr().toUtf8());
+		pFile->write(pResourceLog->GetTypeStr(i).toUtf8());
 		pFile->write("\t");
-		pFile->write(pEntry->GetStautsStr().toUtf8());
+		pFile->write(pResourceLog->GetStautsStr(i).toUtf8());
 		pFile->write("\t");
-		pFile->write(pEntry->GetName().toUtf8());
+		pFile->write(pResourceLog->GetName(i).toUtf8());
 		pFile->write("\t");
-		pFile->write(pEntry->GetMessage().toUtf8());
+		pFile->write(pResourceLog->GetMessage(i).toUtf8());
 		pFile->write("\n");
 	}
 
@@ -796,9 +898,9 @@ void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTra
 bool CTraceView::SaveToFile(QIODevice* pFile)
 {
 	pFile->write("Timestamp\tProcess\tPID\tTID\tType\tStatus\tName\tMessage\n"); // don't translate log
-	QVector<CTraceEntryPtr> ResourceLog = theAPI->GetTrace();
+	CTraceStorePtr pResourceLog = theAPI->GetTrace();
 	CSbieProgressPtr pProgress = CSbieProgressPtr(new CSbieProgress());
-	QtConcurrent::run(CTraceView::SaveToFileAsync, pProgress, ResourceLog, pFile);
+	QtConcurrent::run(CTraceView::SaveToFileAsync, pProgress, pResourceLog, pFile);
 	theGUI->AddAsyncOp(pProgress, true);
 	return !pProgress->IsCanceled();
 }
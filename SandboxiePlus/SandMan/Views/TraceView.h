@@ -96,7 +96,9 @@ protected:
 	void				timerEvent(QTimerEvent* pEvent);
 	int					m_uTimerID;
 
-	static void			SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTraceEntryPtr> ResourceLog, QIODevice* pFile);
+	static void			SaveToFileAsync(const CSbieProgressPtr& pProgress, CTraceStorePtr pResourceLog, QIODevice* pFile);
+
+	QVector<int>		FilterRows(const CTraceStorePtr& pResourceLog, int From, int To, bool bTraceFilters) const;
 
 	struct SProgInfo
 	{
@@ -105,11 +107,12 @@ protected:
 	};
 
 	QMap<quint32, SProgInfo>m_PidMap;
+	int						m_PidMapVersion;
 	bool					m_FullRefresh;
 	quint64					m_LastID;
 	int						m_LastCount;
 	bool					m_bUpdatePending;
-	QVector<CTraceEntryPtr> m_TraceList;
+	QVector<int>			m_TraceList;		// rows in the trace store
 	QMap<QString, CMonitorEntryPtr> m_MonitorMap;
 
 	QSet<quint32>		m_ShowPids;
@@ -34,6 +34,7 @@ CCompressDialog::CCompressDialog(QWidget *parent)
 	ui.cmbCompression->addItem(tr("Maximum"), 7);
 	ui.cmbCompression->addItem(tr("Ultra"), 9);
 	ui.cmbCompression->setCurrentIndex(ui.cmbCompression->findData(theConf->GetInt("Options/ExportCompression", 3)));
+	ui.spinThreads->setValue(theConf->GetInt("Options/ExportThreads", 0));
 
 	connect(ui.buttonBox, SIGNAL(accepted()), SLOT(accept()));
 	connect(ui.buttonBox, SIGNAL(rejected()), SLOT(reject()));
@@ -76,4 +77,14 @@ void CCompressDialog::SetMustEncrypt()
 bool CCompressDialog::UseEncryption()
 {
 	return ui.chkEncrypt->isChecked();
+}
+
+int CCompressDialog::GetThreads()
+{
+	return ui.spinThreads->value();
+}
+
+bool CCompressDialog::IsIncremental()
+{
+	return ui.chkIncremental->isChecked();
 }
\ No newline at end of file
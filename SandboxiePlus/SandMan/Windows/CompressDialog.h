@@ -15,6 +15,8 @@ public:
 	QString GetFormat();
 	int GetLevel();
 	bool MakeSolid();
+	int GetThreads();
+	bool IsIncremental();
 
 	void SetMustEncrypt();
 	bool UseEncryption();
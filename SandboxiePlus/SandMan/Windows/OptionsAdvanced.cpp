@@ -103,6 +103,7 @@ void COptionsWindow::CreateAdvanced()
 	connect(ui.chkHookTrace, SIGNAL(clicked(bool)), this, SLOT(OnAdvancedChanged()));
 	connect(ui.chkDbgTrace, SIGNAL(clicked(bool)), this, SLOT(OnAdvancedChanged()));
 	connect(ui.chkErrTrace, SIGNAL(clicked(bool)), this, SLOT(OnAdvancedChanged()));
+	connect(ui.chkSyscallProfile, SIGNAL(clicked(bool)), this, SLOT(OnAdvancedChanged()));
 
 	connect(ui.treeTriggers, SIGNAL(itemChanged(QTreeWidgetItem *, int)), this, SLOT(OnTriggerChanged()));
 	connect(ui.btnAddAutoRun, SIGNAL(clicked(bool)), this, SLOT(OnAddAutoRun()));
@@ -295,6 +296,7 @@ void COptionsWindow::LoadAdvanced()
 	ui.chkHookTrace->setChecked(m_pBox->GetBool("HookTrace", false));
 	ui.chkDbgTrace->setChecked(m_pBox->GetBool("DebugTrace", false));
 	ui.chkErrTrace->setChecked(m_pBox->GetBool("ErrorTrace", false));
+	ui.chkSyscallProfile->setChecked(m_pBox->GetBool("SyscallProfile", false));
 
 	// triggers
 	ui.treeTriggers->clear();
@@ -560,6 +562,7 @@ void COptionsWindow::SaveAdvanced()
 	WriteAdvancedCheck(ui.chkHookTrace, "HookTrace", "y");
 	WriteAdvancedCheck(ui.chkDbgTrace, "DebugTrace", "y");
 	WriteAdvancedCheck(ui.chkErrTrace, "ErrorTrace", "y");
+	WriteAdvancedCheck(ui.chkSyscallProfile, "SyscallProfile", "y");
 
 	// triggers
 	QStringList StartProgram;